@@ -0,0 +1,9 @@
+// Configuration Generated
+// Sun Oct 18 06:00:44 UTC 2026
+
+#define LEARNER_LINUX
+#define LEARNER_X86_64
+#define LEARNER_CORES 1
+#define LEARNER_PAGE_SIZE 4096
+#define LEARNER_WORD_SIZE 8
+#define LEARNER_EPOLL
@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "algorithms/als.h"
+#include "structures/dense_matrix.h"
+#include "structures/sparse_vector.h"
+#include "structures/column_index.h"
+#include "structures/vector_block.h"
+#include "structures/vector_kernels.h"
+
+// users and items are divided between threads in ranges of this many
+#define ALS_GRANULARITY   64
+
+// per thread squared error sums, padded to a cache line so threads
+// don't write to the same line
+typedef struct {
+  double    squares;
+  u_int64_t ratings;
+  char      padding[48];
+} als_counters;
+
+typedef struct {
+  Matrix          *ratings;
+  als_parameters  *parameters;
+  als_result      *result;
+  u_int32_t       threads;
+  u_int32_t       factors;
+  u_int32_t       stride;
+  
+  // per thread scratch: a factors x factors gram matrix, then a row
+  // for the right hand side of the normal equations
+  float           *scratch;
+  als_counters    *counters;
+} als_context;
+
+
+// ------------------------------------------
+// solving
+// ------------------------------------------
+#define als_scratch(context, thread) ((context)->scratch + ((u_int64_t) (thread) * ((context)->factors + 1) * (context)->stride))
+#define als_factors(matrix, row) ((matrix)->values + ((u_int64_t) (row) * (matrix)->stride))
+
+// splitmix64 of the seed and n, so factors can be seeded in parallel
+static u_int64_t als_random(u_int64_t seed, u_int64_t n) {
+  u_int64_t x = seed + ((n + 1) * 0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static void als_start(als_context *context, float *gram) {
+  memset(gram, 0, (u_int64_t) (context->factors + 1) * context->stride * sizeof(float));
+}
+
+// gram += f f' (the lower triangle only) and rhs += rating * f
+static void als_add(als_context *context, float *gram, float *factors, float rating) {
+  u_int32_t k = context->factors;
+  for(u_int32_t a = 0; a < k; a++)
+    if(factors[a] != 0.0)
+      vector_kernels.axpy(factors[a], factors, gram + ((u_int64_t) a * context->stride), a + 1);
+  vector_kernels.axpy(rating, factors, gram + ((u_int64_t) k * context->stride), k);
+}
+
+// solves (gram + lambda * n * I) x = rhs by cholesky decomposition in
+// place, writing x to result. lambda > 0 makes the system positive
+// definite; a rounding failure leaves the factors at 0.
+static void als_solve(als_context *context, float *gram, u_int64_t n, float *result) {
+  u_int32_t k = context->factors, stride = context->stride;
+  float *rhs = gram + ((u_int64_t) k * stride);
+  float penalty = context->parameters->lambda * n;
+  memset(result, 0, stride * sizeof(float));
+  
+  for(u_int32_t j = 0; j < k; j++) {
+    float *row_j = gram + ((u_int64_t) j * stride);
+    float diagonal = row_j[j] + penalty - vector_kernels.sum_of_squares(row_j, j);
+    if(diagonal <= 0.0) return;
+    row_j[j] = sqrtf(diagonal);
+    for(u_int32_t i = j + 1; i < k; i++) {
+      float *row_i = gram + ((u_int64_t) i * stride);
+      row_i[j] = (row_i[j] - vector_kernels.dot_product(row_i, row_j, j)) / row_j[j];
+    }
+  }
+  
+  // l y = rhs, then l' x = y
+  for(u_int32_t i = 0; i < k; i++) {
+    float *row_i = gram + ((u_int64_t) i * stride);
+    rhs[i] = (rhs[i] - vector_kernels.dot_product(row_i, rhs, i)) / row_i[i];
+  }
+  for(u_int32_t i = k; i-- > 0;) {
+    float sum = rhs[i];
+    for(u_int32_t j = i + 1; j < k; j++)
+      sum -= gram[((u_int64_t) j * stride) + i] * result[j];
+    result[i] = sum / gram[((u_int64_t) i * stride) + i];
+  }
+}
+
+static void als_solve_users(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  als_context *context = (als_context *) param;
+  Matrix *users = context->result->users, *items = context->result->items;
+  float *gram = als_scratch(context, thread);
+  SparseVector *row;
+  
+  for(u_int64_t u = start; u < end; u++) {
+    if(matrix_get_row(context->ratings, u, &row) != NO_ERROR || row->header.count == 0) {
+      memset(als_factors(users, u), 0, users->stride * sizeof(float));
+      continue;
+    }
+    als_start(context, gram);
+    for(u_int64_t i = 0; i < row->header.count; i++)
+      als_add(context, gram, als_factors(items, sparse_vector_index_at(row, i)), sparse_vector_value_at(row, i));
+    als_solve(context, gram, row->header.count, als_factors(users, u));
+  }
+}
+
+static void als_solve_items(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  als_context *context = (als_context *) param;
+  Matrix *users = context->result->users, *items = context->result->items;
+  float *gram = als_scratch(context, thread);
+  column_postings *column;
+  
+  for(u_int64_t j = start; j < end; j++) {
+    if(matrix_get_column(context->ratings, j, &column) != NO_ERROR || column->count == 0) {
+      memset(als_factors(items, j), 0, items->stride * sizeof(float));
+      continue;
+    }
+    als_start(context, gram);
+    for(u_int32_t p = 0; p < column->count; p++)
+      als_add(context, gram, als_factors(users, column->postings[p].row), column->postings[p].weight);
+    als_solve(context, gram, column->count, als_factors(items, j));
+  }
+}
+
+// items start at small random values; users are solved from them
+static void als_seed_items(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  als_context *context = (als_context *) param;
+  Matrix *items = context->result->items;
+  for(u_int64_t j = start; j < end; j++) {
+    float *factors = als_factors(items, j);
+    for(u_int32_t a = 0; a < context->factors; a++) {
+      u_int64_t random = als_random(context->parameters->seed, (j * context->factors) + a);
+      factors[a] = ((random >> 40) * (1.0 / 16777216.0)) / sqrtf(context->factors);
+    }
+  }
+}
+
+static void als_errors(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  als_context *context = (als_context *) param;
+  Matrix *users = context->result->users, *items = context->result->items;
+  SparseVector *row;
+  
+  for(u_int64_t u = start; u < end; u++) {
+    if(matrix_get_row(context->ratings, u, &row) != NO_ERROR) continue;
+    float *user = als_factors(users, u);
+    for(u_int64_t i = 0; i < row->header.count; i++) {
+      float predicted = vector_kernels.dot_product(user, als_factors(items, sparse_vector_index_at(row, i)), context->factors);
+      float error = sparse_vector_value_at(row, i) - predicted;
+      context->counters[thread].squares += error * error;
+    }
+    context->counters[thread].ratings += row->header.count;
+  }
+}
+
+static learner_error als_rmse(als_context *context, double *rmse) {
+  double squares = 0.0;
+  u_int64_t ratings = 0;
+  memset(context->counters, 0, context->threads * sizeof(als_counters));
+  learner_error error = learner_parallel_for(context->ratings->rows, context->threads, ALS_GRANULARITY, als_errors, context);
+  for(u_int32_t t = 0; t < context->threads; t++) {
+    squares += context->counters[t].squares;
+    ratings += context->counters[t].ratings;
+  }
+  *rmse = ratings ? sqrt(squares / ratings) : 0.0;
+  return error;
+}
+
+static learner_error als_iterate(als_context *context) {
+  als_parameters *parameters = context->parameters;
+  als_result *result = context->result;
+  u_int32_t iterations = parameters->iterations ? parameters->iterations : ALS_DEFAULT_ITERATIONS;
+  double previous = INFINITY;
+  learner_error error;
+  
+  error = learner_parallel_for(result->items->rows, context->threads, ALS_GRANULARITY, als_seed_items, context);
+  while(!error && result->iterations < iterations) {
+    if((error = learner_parallel_for(result->users->rows, context->threads, ALS_GRANULARITY, als_solve_users, context))) break;
+    if((error = learner_parallel_for(result->items->rows, context->threads, ALS_GRANULARITY, als_solve_items, context))) break;
+    if((error = als_rmse(context, &result->rmse))) break;
+    result->iterations++;
+    learner_log_with_format(DEBUG, "als iteration %u: rmse %f", result->iterations, result->rmse);
+    if(previous - result->rmse < parameters->tolerance) break;
+    previous = result->rmse;
+  }
+  return error;
+}
+
+
+// ------------------------------------------
+// public
+// ------------------------------------------
+learner_error matrix_als(Matrix *ratings, als_parameters *parameters, als_result **result) {
+  if(!ratings) return MISSING_MATRIX;
+  if(ratings->values) return INVALID_MATRIX_STORAGE;
+  if(!parameters || parameters->factors == 0 || parameters->lambda <= 0.0) return INVALID_PARAMETERS;
+  
+  // items are every column up to the largest index of any row
+  u_int64_t items = 0;
+  SparseVector *row;
+  for(u_int64_t r = 0; r < ratings->rows; r++)
+    if(matrix_get_row(ratings, r, &row) == NO_ERROR && row->header.count && row->header.max_index + 1 > items)
+      items = row->header.max_index + 1;
+  if(items == 0) return INVALID_PARAMETERS;
+  
+  als_context context;
+  memset(&context, 0, sizeof(als_context));
+  context.ratings    = ratings;
+  context.parameters = parameters;
+  context.threads    = learner_default_threads(parameters->threads);
+  context.factors    = parameters->factors;
+  context.stride     = vector_block_stride(parameters->factors);
+  learner_error error = matrix_index_columns(ratings, context.threads);
+  if(error) return error;
+  
+  *result = (als_result *) calloc(1, sizeof(als_result));
+  if(!*result) return MEMORY_ERROR;
+  context.result   = *result;
+  context.counters = (als_counters *) calloc(context.threads, sizeof(als_counters));
+  if(!context.counters)
+    error = MEMORY_ERROR;
+  if(!error)
+    error = vector_block_new(context.factors, (u_int64_t) context.threads * (context.factors + 1), &context.scratch);
+  if(!error)
+    error = matrix_new_dense(ratings->rows, context.factors, &(*result)->users);
+  if(!error)
+    error = matrix_new_dense(items, context.factors, &(*result)->items);
+  if(!error)
+    error = als_iterate(&context);
+  
+  if(error) {
+    als_result_free(*result);
+    *result = NULL;
+  }
+  vector_block_free(context.scratch);
+  free(context.counters);
+  return error;
+}
+
+learner_error als_result_free(als_result *result) {
+  if(!result) return MISSING_VALUES;
+  if(result->users)
+    matrix_free(result->users);
+  if(result->items)
+    matrix_free(result->items);
+  free(result);
+  return NO_ERROR;
+}
+
+learner_error als_predict(als_result *result, u_int64_t user, u_int64_t item, float *rating) {
+  if(!result) return MISSING_VALUES;
+  if(user >= result->users->rows || item >= result->items->rows) return INDEX_OUT_OF_RANGE;
+  *rating = vector_kernels.dot_product(als_factors(result->users, user), als_factors(result->items, item), result->users->columns);
+  return NO_ERROR;
+}
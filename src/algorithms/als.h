@@ -0,0 +1,64 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+
+#ifndef __learner_als__
+#define __learner_als__
+
+// alternating least squares factorisation of a sparse ratings matrix
+// (users as rows, items as columns) in to dense user and item factor
+// matrices, so that a rating is approximated by the dot product of
+// its user's and item's factors. only the ratings set are fitted;
+// missing values are unknown, not 0.
+//
+// each iteration solves every user's factors with the item factors
+// fixed, then every item's with the user factors fixed. each is an
+// independent regularised least squares problem, so users (and then
+// items) are solved in parallel, each thread building the normal
+// equations in its own scratch gram matrix. users read their ratings
+// by row and items theirs by column, through the column index.
+#define ALS_DEFAULT_ITERATIONS  10
+
+typedef struct {
+  u_int32_t factors;
+  
+  // 0 for ALS_DEFAULT_ITERATIONS
+  u_int32_t iterations;
+  
+  // factors of a user or item with n ratings are penalised by
+  // lambda * n * |factors|^2 (weighted lambda regularisation)
+  float     lambda;
+  
+  // iterations stop early once the rmse improves by less than this
+  float     tolerance;
+  u_int64_t seed;
+  
+  // 0 for LEARNER_CORES
+  u_int32_t threads;
+} als_parameters;
+
+typedef struct {
+  // dense matrices (see dense_matrix.h) with a row of factors per
+  // user (row of ratings) and item (one more than the largest column
+  // index). rows are aligned and padded, so they can be used with the
+  // dense vector and vector block functions directly. users without
+  // ratings and items never rated have factors of 0.
+  Matrix    *users;
+  Matrix    *items;
+  
+  // root mean squared error over every rating
+  double    rmse;
+  u_int32_t iterations;
+} als_result;
+
+// factorises a sparse ratings matrix, indexing its columns first if
+// they aren't already (the index is kept). dense matrices are an
+// INVALID_MATRIX_STORAGE error; factors must be at least 1 and lambda
+// above 0, so every problem solved has a single solution.
+learner_error matrix_als(Matrix *ratings, als_parameters *parameters, als_result **result);
+learner_error als_result_free(als_result *result);
+
+// the predicted rating of item by user
+learner_error als_predict(als_result *result, u_int64_t user, u_int64_t item, float *rating);
+
+#endif
@@ -0,0 +1,722 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "algorithms/hnsw.h"
+#include "structures/dense_matrix.h"
+#include "structures/vector_block.h"
+#include "structures/vector_kernels.h"
+
+#define hnsw_vector(index, id)      ((index)->vectors + ((u_int64_t) (id) * (index)->stride))
+#define hnsw_lock(index, id)        (&(index)->locks[(id) % HNSW_LOCK_STRIPES])
+#define hnsw_max_links(index, level) ((level) ? (index)->parameters.m : 2 * (index)->parameters.m)
+
+static inline u_int32_t *hnsw_links(hnsw_index *index, u_int32_t id, int level) {
+  if(level == 0)
+    return index->links + ((u_int64_t) id * (1 + (2 * index->parameters.m)));
+  return index->upper_links[id] + ((level - 1) * (1 + index->parameters.m));
+}
+
+// smaller is closer for every metric. rows are padded with zeros, so
+// the kernels can run over the whole (16 value aligned) stride.
+static inline float hnsw_distance(hnsw_index *index, float *a, float *b) {
+  if(index->parameters.metric == EUCLIDEAN_DISTANCE)
+    return vector_kernels.squared_distance(a, b, index->stride);
+  return -vector_kernels.dot_product(a, b, index->stride);
+}
+
+// splitmix64 finaliser, seeding each node's level from its id
+static inline u_int64_t hnsw_mix(u_int64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// levels are exponentially distributed so each level has about 1/m
+// of the nodes of the level below
+static int hnsw_random_level(hnsw_index *index, u_int64_t id) {
+  double uniform = ((hnsw_mix(index->parameters.seed ^ hnsw_mix(id)) >> 11) + 1) * (1.0 / 9007199254740992.0);
+  int level = (int) (-log(uniform) / log((double) index->parameters.m));
+  return (level > HNSW_MAX_LEVEL) ? HNSW_MAX_LEVEL : level;
+}
+
+
+// ------------------------------------------
+// heaps
+// ------------------------------------------
+// candidates are kept closest first while searching, results furthest
+// first so the worst result can be replaced
+typedef struct {
+  float     distance;
+  u_int32_t id;
+} hnsw_candidate;
+
+typedef struct {
+  hnsw_candidate  *items;
+  u_int32_t       count;
+  u_int32_t       capacity;
+} hnsw_heap;
+
+#define hnsw_above(furthest, a, b) ((furthest) ? ((a) > (b)) : ((a) < (b)))
+
+static learner_error hnsw_heap_push(hnsw_heap *heap, int furthest, float distance, u_int32_t id) {
+  if(heap->count == heap->capacity) {
+    u_int32_t capacity = heap->capacity ? heap->capacity * 2 : 64;
+    hnsw_candidate *items = (hnsw_candidate *) realloc(heap->items, capacity * sizeof(hnsw_candidate));
+    if(!items) return MEMORY_ERROR;
+    heap->items = items;
+    heap->capacity = capacity;
+  }
+  
+  u_int32_t i = heap->count++, parent;
+  while(i > 0) {
+    parent = (i - 1) / 2;
+    if(!hnsw_above(furthest, distance, heap->items[parent].distance)) break;
+    heap->items[i] = heap->items[parent];
+    i = parent;
+  }
+  heap->items[i].distance = distance;
+  heap->items[i].id = id;
+  return NO_ERROR;
+}
+
+static hnsw_candidate hnsw_heap_pop(hnsw_heap *heap, int furthest) {
+  hnsw_candidate top = heap->items[0], last = heap->items[--heap->count];
+  u_int32_t i = 0, child;
+  while((child = (2 * i) + 1) < heap->count) {
+    if(child + 1 < heap->count && hnsw_above(furthest, heap->items[child + 1].distance, heap->items[child].distance))
+      child++;
+    if(!hnsw_above(furthest, heap->items[child].distance, last.distance)) break;
+    heap->items[i] = heap->items[child];
+    i = child;
+  }
+  heap->items[i] = last;
+  return top;
+}
+
+static int hnsw_compare_candidates(const void *a, const void *b) {
+  const hnsw_candidate *x = (const hnsw_candidate *) a, *y = (const hnsw_candidate *) b;
+  if(x->distance != y->distance) return (x->distance < y->distance) ? -1 : 1;
+  return (x->id < y->id) ? -1 : (x->id > y->id);
+}
+
+
+// ------------------------------------------
+// searching
+// ------------------------------------------
+// scratch space for one thread's inserts or searches
+typedef struct {
+  column_accumulator  *visited;
+  column_accumulator  *owned;
+  hnsw_heap           candidates;
+  hnsw_heap           results;
+  u_int32_t           *neighbours;
+  hnsw_candidate      *pruned;
+} hnsw_state;
+
+static learner_error hnsw_state_new(hnsw_index *index, column_accumulator *accumulator, hnsw_state *state) {
+  learner_error error;
+  memset(state, 0, sizeof(hnsw_state));
+  if(!accumulator) {
+    if((error = column_accumulator_new(&state->owned)))
+      return error;
+    accumulator = state->owned;
+  }
+  state->visited = accumulator;
+  state->neighbours = (u_int32_t *) malloc(2 * index->parameters.m * sizeof(u_int32_t));
+  state->pruned = (hnsw_candidate *) malloc(((2 * index->parameters.m) + 1) * sizeof(hnsw_candidate));
+  if(!state->neighbours || !state->pruned) return MEMORY_ERROR;
+  return NO_ERROR;
+}
+
+static void hnsw_state_free(hnsw_state *state) {
+  if(state->owned)
+    column_accumulator_free(state->owned);
+  free(state->candidates.items);
+  free(state->results.items);
+  free(state->neighbours);
+  free(state->pruned);
+}
+
+// mapped indexes are read only, so their links are read unlocked
+static u_int32_t hnsw_copy_links(hnsw_index *index, u_int32_t id, int level, u_int32_t *copy) {
+  if(index->file) {
+    u_int32_t *links = hnsw_links(index, id, level);
+    memcpy(copy, links + 1, links[0] * sizeof(u_int32_t));
+    return links[0];
+  }
+  
+  pthread_mutex_t *lock = hnsw_lock(index, id);
+  pthread_mutex_lock(lock);
+  u_int32_t *links = hnsw_links(index, id, level), count = links[0];
+  memcpy(copy, links + 1, count * sizeof(u_int32_t));
+  pthread_mutex_unlock(lock);
+  return count;
+}
+
+// upper levels are only used to find a starting point for the level
+// below, so a greedy walk to the closest node is enough
+static u_int32_t hnsw_greedy(hnsw_index *index, hnsw_state *state, float *query, u_int32_t entry, float *distance, int level) {
+  int changed = 1;
+  while(changed) {
+    changed = 0;
+    u_int32_t count = hnsw_copy_links(index, entry, level, state->neighbours);
+    for(u_int32_t i = 0; i < count; i++) {
+      float candidate = hnsw_distance(index, query, hnsw_vector(index, state->neighbours[i]));
+      if(candidate < *distance) {
+        *distance = candidate;
+        entry = state->neighbours[i];
+        changed = 1;
+      }
+    }
+  }
+  return entry;
+}
+
+// best first search of level from entry, keeping the ef closest nodes
+// found in state->results. stops once the closest unexpanded node is
+// further than every result.
+static learner_error hnsw_search_level(hnsw_index *index, hnsw_state *state, float *query, u_int32_t entry, float distance, u_int32_t ef, int level) {
+  column_accumulator *visited = state->visited;
+  hnsw_heap *candidates = &state->candidates, *results = &state->results;
+  learner_error error = column_accumulator_start_visits(visited, index->capacity);
+  if(error) return error;
+  u_int32_t stamp = visited->stamp, *stamps = visited->stamps, *neighbours = state->neighbours;
+  candidates->count = results->count = 0;
+  
+  stamps[entry] = stamp;
+  visited->count++;
+  if((error = hnsw_heap_push(candidates, 0, distance, entry)) || (error = hnsw_heap_push(results, 1, distance, entry)))
+    return error;
+  
+  while(candidates->count) {
+    hnsw_candidate closest = hnsw_heap_pop(candidates, 0);
+    if(closest.distance > results->items[0].distance) break;
+    u_int32_t count = hnsw_copy_links(index, closest.id, level, neighbours);
+    for(u_int32_t i = 0; i < count; i++)
+      __builtin_prefetch(hnsw_vector(index, neighbours[i]));
+    
+    for(u_int32_t i = 0; i < count; i++) {
+      u_int32_t id = neighbours[i];
+      if(stamps[id] == stamp) continue;
+      stamps[id] = stamp;
+      visited->count++;
+      
+      float candidate = hnsw_distance(index, query, hnsw_vector(index, id));
+      if(results->count < ef || candidate < results->items[0].distance) {
+        if((error = hnsw_heap_push(candidates, 0, candidate, id)) || (error = hnsw_heap_push(results, 1, candidate, id)))
+          return error;
+        if(results->count > ef)
+          hnsw_heap_pop(results, 1);
+      }
+    }
+  }
+  
+  qsort(results->items, results->count, sizeof(hnsw_candidate), hnsw_compare_candidates);
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// linking
+// ------------------------------------------
+// keeps candidates (sorted closest first to the node they'll link
+// from) that are closer to that node than to any candidate already
+// kept, up to maximum. selected may be candidates.
+static u_int32_t hnsw_select(hnsw_index *index, hnsw_candidate *candidates, u_int32_t count, u_int32_t maximum, hnsw_candidate *selected) {
+  u_int32_t chosen = 0;
+  for(u_int32_t i = 0; i < count && chosen < maximum; i++) {
+    hnsw_candidate candidate = candidates[i];
+    float *vector = hnsw_vector(index, candidate.id);
+    int keep = 1;
+    for(u_int32_t j = 0; j < chosen && keep; j++)
+      keep = hnsw_distance(index, vector, hnsw_vector(index, selected[j].id)) >= candidate.distance;
+    if(keep)
+      selected[chosen++] = candidate;
+  }
+  return chosen;
+}
+
+// adds id to node's links, reselecting node's neighbours when full
+static void hnsw_link_back(hnsw_index *index, hnsw_state *state, u_int32_t node, u_int32_t id, int level) {
+  u_int32_t maximum = hnsw_max_links(index, level);
+  float *vector = hnsw_vector(index, node);
+  hnsw_candidate *pruned = state->pruned;
+  pthread_mutex_t *lock = hnsw_lock(index, node);
+  pthread_mutex_lock(lock);
+  u_int32_t *links = hnsw_links(index, node, level), count = links[0];
+  
+  if(count < maximum) {
+    links[1 + count] = id;
+    links[0] = count + 1;
+  } else {
+    for(u_int32_t i = 0; i < count; i++) {
+      pruned[i].id = links[1 + i];
+      pruned[i].distance = hnsw_distance(index, vector, hnsw_vector(index, links[1 + i]));
+    }
+    pruned[count].id = id;
+    pruned[count].distance = hnsw_distance(index, vector, hnsw_vector(index, id));
+    qsort(pruned, count + 1, sizeof(hnsw_candidate), hnsw_compare_candidates);
+    
+    count = hnsw_select(index, pruned, count + 1, maximum, pruned);
+    for(u_int32_t i = 0; i < count; i++)
+      links[1 + i] = pruned[i].id;
+    links[0] = count;
+  }
+  pthread_mutex_unlock(lock);
+}
+
+// links id to the neighbours selected from the last level search, and
+// each of them back to id
+static void hnsw_connect(hnsw_index *index, hnsw_state *state, u_int32_t id, int level) {
+  hnsw_heap *results = &state->results;
+  u_int32_t count = hnsw_select(index, results->items, results->count, index->parameters.m, state->pruned);
+  pthread_mutex_t *lock = hnsw_lock(index, id);
+  
+  pthread_mutex_lock(lock);
+  u_int32_t *links = hnsw_links(index, id, level);
+  for(u_int32_t i = 0; i < count; i++)
+    links[1 + i] = state->pruned[i].id;
+  links[0] = count;
+  pthread_mutex_unlock(lock);
+  
+  // hnsw_link_back reuses pruned, so the neighbours are read back
+  // from the links just written
+  u_int32_t copied = hnsw_copy_links(index, id, level, state->neighbours);
+  for(u_int32_t i = 0; i < copied; i++)
+    hnsw_link_back(index, state, state->neighbours[i], id, level);
+}
+
+
+// ------------------------------------------
+// index
+// ------------------------------------------
+static learner_error hnsw_allocate_locks(hnsw_index *index) {
+  if(pthread_mutex_init(&index->entry_lock, NULL))
+    return MEMORY_ERROR;
+  if(index->file) return NO_ERROR;
+  index->locks = (pthread_mutex_t *) malloc(HNSW_LOCK_STRIPES * sizeof(pthread_mutex_t));
+  if(!index->locks) return MEMORY_ERROR;
+  for(int i = 0; i < HNSW_LOCK_STRIPES; i++)
+    pthread_mutex_init(&index->locks[i], NULL);
+  return NO_ERROR;
+}
+
+learner_error hnsw_new(u_int32_t dimensions, u_int64_t capacity, hnsw_parameters *parameters, hnsw_index **index) {
+  if(!parameters) return MISSING_VALUES;
+  if(dimensions == 0) return INVALID_LENGTH;
+  if(capacity == 0 || capacity > UINT32_MAX || parameters->m == 1)
+    return INVALID_PARAMETERS;
+  learner_error error;
+  
+  *index = (hnsw_index *) calloc(1, sizeof(hnsw_index));
+  if(!*index) return MEMORY_ERROR;
+  hnsw_index *created = *index;
+  created->parameters = *parameters;
+  if(created->parameters.m == 0)
+    created->parameters.m = HNSW_DEFAULT_M;
+  if(created->parameters.ef_construction == 0)
+    created->parameters.ef_construction = HNSW_DEFAULT_EF_CONSTRUCTION;
+  created->dimensions = dimensions;
+  created->stride = vector_block_stride(dimensions);
+  created->capacity = capacity;
+  created->max_level = -1;
+  
+  if((error = hnsw_allocate_locks(created)) || (error = vector_block_new(dimensions, capacity, &created->vectors))) {
+    hnsw_free(created);
+    *index = NULL;
+    return error;
+  }
+  created->levels = (u_int8_t *) calloc(capacity, sizeof(u_int8_t));
+  created->links = (u_int32_t *) calloc(capacity * (1 + (2 * created->parameters.m)), sizeof(u_int32_t));
+  created->upper_links = (u_int32_t **) calloc(capacity, sizeof(u_int32_t *));
+  if(!created->levels || !created->links || !created->upper_links) {
+    hnsw_free(created);
+    *index = NULL;
+    return MEMORY_ERROR;
+  }
+  return NO_ERROR;
+}
+
+
+learner_error hnsw_free(hnsw_index *index) {
+  if(!index) return MISSING_VALUES;
+  if(index->file) {
+    paged_file_close(index->file);
+  } else {
+    if(index->upper_links)
+      for(u_int64_t id = 0; id < index->count; id++)
+        free(index->upper_links[id]);
+    if(index->vectors)
+      vector_block_free(index->vectors);
+    free(index->levels);
+    free(index->links);
+  }
+  
+  if(index->locks) {
+    for(int i = 0; i < HNSW_LOCK_STRIPES; i++)
+      pthread_mutex_destroy(&index->locks[i]);
+    free(index->locks);
+  }
+  pthread_mutex_destroy(&index->entry_lock);
+  free(index->upper_links);
+  free(index);
+  return NO_ERROR;
+}
+
+
+// ids are handed out in blocks, so concurrent inserts never share one
+static learner_error hnsw_reserve(hnsw_index *index, u_int64_t count, u_int64_t *first) {
+  u_int64_t start;
+  do {
+    start = index->count;
+    if(start + count > index->capacity) return INDEX_OUT_OF_RANGE;
+  } while(!__sync_bool_compare_and_swap(&index->count, start, start + count));
+  *first = start;
+  return NO_ERROR;
+}
+
+static learner_error hnsw_insert_node(hnsw_index *index, hnsw_state *state, Vector *vector, u_int32_t id) {
+  float *values = hnsw_vector(index, id), distance;
+  int level = hnsw_random_level(index, id);
+  learner_error error = NO_ERROR;
+  
+  vector_block_set(index->vectors, id, vector);
+  if(index->parameters.metric == COSINE_SIMILARITY) {
+    float magnitude = sqrtf(vector_kernels.sum_of_squares(values, index->stride));
+    for(u_int32_t i = 0; magnitude > 0.0 && i < index->dimensions; i++)
+      values[i] /= magnitude;
+  }
+  if(level > 0 && !(index->upper_links[id] = (u_int32_t *) calloc(level * (1 + index->parameters.m), sizeof(u_int32_t))))
+    return MEMORY_ERROR;
+  index->levels[id] = level;
+  
+  // nodes reaching a new top level hold the entry lock until they're
+  // linked in, then become the entry point (unless linking failed)
+  pthread_mutex_lock(&index->entry_lock);
+  u_int32_t entry = index->entry;
+  int32_t max_level = index->max_level;
+  if(max_level < 0) {
+    index->entry = id;
+    index->max_level = level;
+    pthread_mutex_unlock(&index->entry_lock);
+    return NO_ERROR;
+  }
+  if(level <= max_level)
+    pthread_mutex_unlock(&index->entry_lock);
+  
+  distance = hnsw_distance(index, values, hnsw_vector(index, entry));
+  for(int l = max_level; l > level; l--)
+    entry = hnsw_greedy(index, state, values, entry, &distance, l);
+  for(int l = (level < max_level) ? level : max_level; l >= 0 && !error; l--) {
+    if((error = hnsw_search_level(index, state, values, entry, distance, index->parameters.ef_construction, l)))
+      break;
+    entry = state->results.items[0].id;
+    distance = state->results.items[0].distance;
+    hnsw_connect(index, state, id, l);
+  }
+  
+  if(level > max_level) {
+    if(!error) {
+      index->entry = id;
+      index->max_level = level;
+    }
+    pthread_mutex_unlock(&index->entry_lock);
+  }
+  return error;
+}
+
+
+learner_error hnsw_insert(hnsw_index *index, column_accumulator *accumulator, Vector *vector, u_int64_t *id) {
+  if(!index || !accumulator) return MISSING_VALUES;
+  if(!vector) return MISSING_VECTOR;
+  if(vector->header.length != index->dimensions) return VECTORS_NOT_OF_EQUAL_LENGTH;
+  hnsw_state state;
+  learner_error error = hnsw_reserve(index, 1, id);
+  if(error) return error;
+  
+  if(!(error = hnsw_state_new(index, accumulator, &state)))
+    error = hnsw_insert_node(index, &state, vector, *id);
+  hnsw_state_free(&state);
+  return error;
+}
+
+
+typedef struct {
+  hnsw_index    *index;
+  Matrix        *matrix;
+  hnsw_state    *states;
+  learner_error *errors;
+  u_int64_t     first;
+} hnsw_insert_context;
+
+static void hnsw_insert_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  hnsw_insert_context *context = (hnsw_insert_context *) param;
+  Vector row;
+  for(u_int64_t r = start; r < end && !context->errors[thread]; r++) {
+    matrix_dense_row(context->matrix, r, &row);
+    context->errors[thread] = hnsw_insert_node(context->index, &context->states[thread], &row, context->first + r);
+  }
+}
+
+learner_error hnsw_insert_matrix(hnsw_index *index, Matrix *matrix, u_int32_t threads, u_int64_t *first) {
+  if(!index) return MISSING_VALUES;
+  if(!matrix) return MISSING_MATRIX;
+  if(!matrix->values) return INVALID_MATRIX_STORAGE;
+  if(matrix->columns != index->dimensions) return INCOMPATIBLE_DIMENSIONS;
+  learner_error error = hnsw_reserve(index, matrix->rows, first);
+  if(error || matrix->rows == 0) return error;
+  
+  threads = learner_default_threads(threads);
+  hnsw_insert_context context = {index, matrix, NULL, NULL, *first};
+  context.states = (hnsw_state *) calloc(threads, sizeof(hnsw_state));
+  context.errors = (learner_error *) calloc(threads, sizeof(learner_error));
+  if(!context.states || !context.errors) {
+    free(context.states);
+    free(context.errors);
+    return MEMORY_ERROR;
+  }
+  
+  u_int32_t ready = 0;
+  for(; ready < threads && !error; ready++)
+    error = hnsw_state_new(index, NULL, &context.states[ready]);
+  if(!error)
+    error = learner_parallel_for(matrix->rows, threads, 64, hnsw_insert_rows, &context);
+  for(u_int32_t i = 0; i < threads && !error; i++)
+    error = context.errors[i];
+  
+  for(u_int32_t i = 0; i < ready; i++)
+    hnsw_state_free(&context.states[i]);
+  free(context.states);
+  free(context.errors);
+  return error;
+}
+
+
+learner_error hnsw_search(hnsw_index *index, column_accumulator *accumulator, Vector *query, u_int32_t k, u_int32_t ef, knn_result *results, u_int32_t *found) {
+  if(!index || !accumulator || !results) return MISSING_VALUES;
+  if(!query) return MISSING_VECTOR;
+  if(query->header.length != index->dimensions) return VECTORS_NOT_OF_EQUAL_LENGTH;
+  learner_error error;
+  hnsw_state state;
+  float *values;
+  *found = 0;
+  
+  pthread_mutex_lock(&index->entry_lock);
+  u_int32_t entry = index->entry;
+  int32_t max_level = index->max_level;
+  pthread_mutex_unlock(&index->entry_lock);
+  if(max_level < 0 || k == 0) return NO_ERROR;
+  if(ef < k) ef = k;
+  
+  // the query is copied in to an aligned, padded row
+  if((error = vector_block_new(index->dimensions, 1, &values)))
+    return error;
+  vector_block_set(values, 0, query);
+  if(index->parameters.metric == COSINE_SIMILARITY) {
+    float magnitude = sqrtf(vector_kernels.sum_of_squares(values, index->stride));
+    for(u_int32_t i = 0; magnitude > 0.0 && i < index->dimensions; i++)
+      values[i] /= magnitude;
+  }
+  
+  if(!(error = hnsw_state_new(index, accumulator, &state))) {
+    float distance = hnsw_distance(index, values, hnsw_vector(index, entry));
+    for(int l = max_level; l > 0; l--)
+      entry = hnsw_greedy(index, &state, values, entry, &distance, l);
+    error = hnsw_search_level(index, &state, values, entry, distance, ef, 0);
+  }
+  
+  if(!error) {
+    *found = (state.results.count < k) ? state.results.count : k;
+    for(u_int32_t i = 0; i < *found; i++) {
+      float distance = state.results.items[i].distance;
+      results[i].row = state.results.items[i].id;
+      if(index->parameters.metric == EUCLIDEAN_DISTANCE)
+        results[i].score = (distance > 0.0) ? sqrtf(distance) : 0.0;
+      else
+        results[i].score = -distance;
+    }
+  }
+  
+  hnsw_state_free(&state);
+  vector_block_free(values);
+  return error;
+}
+
+
+// ------------------------------------------
+// persistence
+// ------------------------------------------
+static pf_error hnsw_write_section(paged_file *file, void *data, u_int64_t bytes, u_int64_t *page) {
+  *page = 0;
+  if(bytes == 0) return PF_NO_ERROR;
+  return paged_file_write_new(file, page, data, bytes);
+}
+
+// upper links are packed in node order, after a table of each node's
+// offset in to them
+learner_error hnsw_save(hnsw_index *index, char *path) {
+  if(!index) return MISSING_VALUES;
+  if(!path) return NAME_MISSING;
+  u_int64_t count = index->count, packed_count = 0, header_page = 0;
+  u_int32_t upper = 1 + index->parameters.m;
+  hnsw_file_header header;
+  paged_file *file;
+  pf_error error = PF_NO_ERROR;
+  
+  memset(&header, 0, sizeof(hnsw_file_header));
+  pthread_mutex_lock(&index->entry_lock);
+  header.entry = index->entry;
+  header.max_level = index->max_level;
+  pthread_mutex_unlock(&index->entry_lock);
+  header.count = count;
+  header.seed = index->parameters.seed;
+  header.dimensions = index->dimensions;
+  header.stride = index->stride;
+  header.m = index->parameters.m;
+  header.ef_construction = index->parameters.ef_construction;
+  header.metric = index->parameters.metric;
+  
+  u_int64_t *offsets = (u_int64_t *) malloc((count + 1) * sizeof(u_int64_t));
+  if(!offsets) return MEMORY_ERROR;
+  for(u_int64_t id = 0; id < count; id++) {
+    offsets[id] = packed_count;
+    packed_count += index->levels[id] * upper;
+  }
+  u_int32_t *packed = (u_int32_t *) malloc((packed_count + 1) * sizeof(u_int32_t));
+  if(!packed) {
+    free(offsets);
+    return MEMORY_ERROR;
+  }
+  for(u_int64_t id = 0; id < count; id++)
+    if(index->levels[id])
+      memcpy(packed + offsets[id], index->upper_links[id], index->levels[id] * upper * sizeof(u_int32_t));
+  
+  unlink(path);
+  if(paged_file_open(path, HNSW_PAGE_SIZE, &file) != PF_NO_ERROR) {
+    free(offsets);
+    free(packed);
+    return FILE_IO_ERROR;
+  }
+  
+  if(!error) error = hnsw_write_section(file, index->vectors, count * index->stride * sizeof(float), &header.vectors);
+  if(!error) error = hnsw_write_section(file, index->levels, count, &header.levels);
+  if(!error) error = hnsw_write_section(file, index->links, count * (1 + (2 * index->parameters.m)) * sizeof(u_int32_t), &header.links);
+  if(!error) error = hnsw_write_section(file, offsets, count * sizeof(u_int64_t), &header.upper_offsets);
+  if(!error) error = hnsw_write_section(file, packed, packed_count * sizeof(u_int32_t), &header.upper_links);
+  if(!error) error = paged_file_write_new(file, &header_page, &header, sizeof(hnsw_file_header));
+  paged_file_set_attribute(file, HNSW_ATTRIBUTE_MAGIC, HNSW_FILE_MAGIC);
+  paged_file_set_attribute(file, HNSW_ATTRIBUTE_HEADER, header_page);
+  if(paged_file_close(file) != PF_NO_ERROR)
+    error = PF_IO_ERROR;
+  
+  free(offsets);
+  free(packed);
+  return error ? FILE_IO_ERROR : NO_ERROR;
+}
+
+
+// sections are runs of pages used in place. pages and lengths come
+// from the file, so sections reaching past its end are a corrupt file.
+static learner_error hnsw_map_section(paged_file *file, u_int64_t page, u_int64_t count, u_int64_t size, void **data) {
+  *data = NULL;
+  if(count == 0) return NO_ERROR;
+  if(page == 0) return PARSE_ERROR;
+  pf_error error = paged_file_map(file, page, data);
+  if(error == PF_INDEX_OUT_OF_RANGE) return PARSE_ERROR;
+  if(error) return FILE_IO_ERROR;
+  u_int64_t start = (char *) *data - (char *) file->map;
+  return (count > (file->map_length - start) / size) ? PARSE_ERROR : NO_ERROR;
+}
+
+// searches follow links without checking them, so every link list
+// must be within its level's limit and point at a node in the index
+static learner_error hnsw_check_links(hnsw_index *index) {
+  for(u_int64_t id = 0; id < index->count; id++) {
+    if(index->levels[id] > index->max_level) return PARSE_ERROR;
+    for(int level = 0; level <= index->levels[id]; level++) {
+      u_int32_t *links = hnsw_links(index, id, level);
+      if(links[0] > hnsw_max_links(index, level)) return PARSE_ERROR;
+      for(u_int32_t i = 1; i <= links[0]; i++)
+        if(links[i] >= index->count) return PARSE_ERROR;
+    }
+  }
+  return NO_ERROR;
+}
+
+learner_error hnsw_load(char *path, hnsw_index **index) {
+  if(!path) return NAME_MISSING;
+  if(access(path, F_OK) != 0) return FILE_NOT_FOUND;
+  hnsw_file_header header, *stored;
+  learner_error error = NO_ERROR;
+  u_int64_t *offsets;
+  paged_file *file;
+  
+  if(paged_file_open(path, 0, &file) != PF_NO_ERROR)
+    return FILE_IO_ERROR;
+  if(paged_file_get_attribute(file, HNSW_ATTRIBUTE_MAGIC) != HNSW_FILE_MAGIC ||
+     paged_file_read(file, paged_file_get_attribute(file, HNSW_ATTRIBUTE_HEADER), (void **) &stored, sizeof(hnsw_file_header)) != PF_NO_ERROR) {
+    paged_file_close(file);
+    return PARSE_ERROR;
+  }
+  header = *stored;
+  free(stored);
+  if(header.m < 2 || header.stride != vector_block_stride(header.dimensions) || header.max_level > HNSW_MAX_LEVEL ||
+     header.count > UINT32_MAX || (header.count && (header.entry >= header.count || header.max_level < 0))) {
+    paged_file_close(file);
+    return PARSE_ERROR;
+  }
+  
+  // the index is full, so nothing can be inserted in to the mapping
+  *index = (hnsw_index *) calloc(1, sizeof(hnsw_index));
+  if(!*index) {
+    paged_file_close(file);
+    return MEMORY_ERROR;
+  }
+  hnsw_index *loaded = *index;
+  u_int64_t upper = 1 + header.m, packed_count = 0;
+  loaded->file = file;
+  loaded->parameters.m = header.m;
+  loaded->parameters.ef_construction = header.ef_construction;
+  loaded->parameters.metric = header.metric;
+  loaded->parameters.seed = header.seed;
+  loaded->dimensions = header.dimensions;
+  loaded->stride = header.stride;
+  loaded->capacity = loaded->count = header.count;
+  loaded->entry = header.entry;
+  loaded->max_level = header.max_level;
+  
+  if(!error) error = hnsw_allocate_locks(loaded);
+  if(!error) error = hnsw_map_section(file, header.vectors, header.count, header.stride * sizeof(float), (void **) &loaded->vectors);
+  if(!error) error = hnsw_map_section(file, header.levels, header.count, sizeof(u_int8_t), (void **) &loaded->levels);
+  if(!error) error = hnsw_map_section(file, header.links, header.count, (1 + (2 * (u_int64_t) header.m)) * sizeof(u_int32_t), (void **) &loaded->links);
+  if(!error) error = hnsw_map_section(file, header.upper_offsets, header.count, sizeof(u_int64_t), (void **) &offsets);
+  if(!error && !(loaded->upper_links = (u_int32_t **) calloc(header.count ? header.count : 1, sizeof(u_int32_t *))))
+    error = MEMORY_ERROR;
+  
+  // upper links are packed in node order, so each node's offset must
+  // be where the levels before it end
+  for(u_int64_t id = 0; id < header.count && !error; id++) {
+    if(loaded->levels[id] && offsets[id] != packed_count)
+      error = PARSE_ERROR;
+    packed_count += loaded->levels[id] * upper;
+  }
+  u_int32_t *packed;
+  if(!error) error = hnsw_map_section(file, header.upper_links, packed_count, sizeof(u_int32_t), (void **) &packed);
+  for(u_int64_t id = 0; id < header.count && !error; id++)
+    if(loaded->levels[id])
+      loaded->upper_links[id] = packed + offsets[id];
+  if(!error && header.count && loaded->levels[header.entry] != header.max_level)
+    error = PARSE_ERROR;
+  if(!error)
+    error = hnsw_check_links(loaded);
+  
+  if(error) {
+    hnsw_free(loaded);
+    *index = NULL;
+  }
+  return error;
+}
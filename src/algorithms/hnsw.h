@@ -0,0 +1,123 @@
+#include <sys/types.h>
+#include <pthread.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/vector.h"
+#include "structures/metric.h"
+#include "structures/column_index.h"
+#include "datastore/paged_file.h"
+#include "algorithms/knn.h"
+
+#ifndef __learner_hnsw__
+#define __learner_hnsw__
+
+// hierarchical navigable small world graph over dense vectors, for
+// approximate nearest neighbour search. every vector is a node on
+// level 0; each level above holds an exponentially shrinking sample
+// of the nodes. searches descend greedily from the single node on
+// the top level, then widen to the ef closest nodes on level 0.
+//
+// nodes have up to m neighbours per level (2m on level 0), chosen so
+// no neighbour is closer to another chosen neighbour than to the
+// node, which keeps links spread across clusters.
+#define HNSW_DEFAULT_M                16
+#define HNSW_DEFAULT_EF_CONSTRUCTION  200
+#define HNSW_MAX_LEVEL                15
+
+// nodes are locked while their neighbours are read or changed, with
+// node n guarded by locks[n % HNSW_LOCK_STRIPES]
+#define HNSW_LOCK_STRIPES             1024
+
+// indexes are saved to paged files of this page size, with vectors
+// starting on a 64 byte boundary so they can be used mapped
+#define HNSW_PAGE_SIZE                65536
+#define HNSW_FILE_MAGIC               0x686e7377
+
+// saved indexes hold this record on the page given by the paged
+// file's HNSW_ATTRIBUTE_HEADER attribute. sections are the page they
+// start on, or 0 when empty.
+#define HNSW_ATTRIBUTE_MAGIC          0
+#define HNSW_ATTRIBUTE_HEADER         1
+
+#pragma pack(push)
+#pragma pack(1)
+typedef struct {
+  u_int64_t count;
+  u_int64_t seed;
+  u_int32_t dimensions;
+  u_int32_t stride;
+  u_int32_t m;
+  u_int32_t ef_construction;
+  u_int32_t metric;
+  u_int32_t entry;
+  int32_t   max_level;
+  u_int64_t vectors;
+  u_int64_t levels;
+  u_int64_t links;
+  u_int64_t upper_offsets;
+  u_int64_t upper_links;
+} hnsw_file_header;
+#pragma pack(pop)
+
+typedef struct {
+  u_int32_t       m;
+  u_int32_t       ef_construction;
+  
+  // cosine similarity indexes store vectors normalized, and search
+  // by dot product
+  learner_metric  metric;
+  u_int64_t       seed;
+} hnsw_parameters;
+
+typedef struct {
+  hnsw_parameters parameters;
+  u_int32_t       dimensions;
+  u_int32_t       stride;
+  u_int64_t       capacity;
+  u_int64_t       count;
+  
+  // vectors are a vector block (see vector_block.h) of capacity rows.
+  // level 0 links are 1 + 2m ids per node: a count then neighbours;
+  // nodes above level 0 have levels * (1 + m) more in upper_links.
+  float           *vectors;
+  u_int8_t        *levels;
+  u_int32_t       *links;
+  u_int32_t       **upper_links;
+  
+  // the entry point is the first node to reach the top level; it's
+  // -1 (max_level) until the first node is inserted
+  u_int32_t       entry;
+  int32_t         max_level;
+  pthread_mutex_t entry_lock;
+  pthread_mutex_t *locks;
+  
+  // indexes loaded with hnsw_load use vectors and links mapped from
+  // their file, and are read only
+  paged_file      *file;
+} hnsw_index;
+
+// nodes are given ids from 0 in insertion order. capacity is fixed
+// when the index is created, so nodes never move.
+learner_error hnsw_new(u_int32_t dimensions, u_int64_t capacity, hnsw_parameters *parameters, hnsw_index **index);
+learner_error hnsw_free(hnsw_index *index);
+
+// any number of threads may insert and search at once, each with
+// its own accumulator (see column_index.h), which tracks the nodes
+// visited. hnsw_insert_matrix inserts every row of a dense matrix
+// across threads (0 for LEARNER_CORES), giving row r the id first + r.
+learner_error hnsw_insert(hnsw_index *index, column_accumulator *accumulator, Vector *vector, u_int64_t *id);
+learner_error hnsw_insert_matrix(hnsw_index *index, Matrix *matrix, u_int32_t threads, u_int64_t *first);
+
+// the (at most) k nodes closest to query, best first, as knn_search
+// reports them. ef (raised to k if lower) is the number of nodes
+// kept while searching level 0; higher values trade speed for recall.
+learner_error hnsw_search(hnsw_index *index, column_accumulator *accumulator, Vector *query, u_int32_t k, u_int32_t ef, knn_result *results, u_int32_t *found);
+
+// saving replaces path with a paged file holding the index; no
+// inserts may run while it's saved. loading maps the vectors and
+// links from the file rather than reading them, so large indexes
+// open without being rebuilt or copied.
+learner_error hnsw_save(hnsw_index *index, char *path);
+learner_error hnsw_load(char *path, hnsw_index **index);
+
+#endif
@@ -0,0 +1,640 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "algorithms/kmeans.h"
+#include "structures/dense_matrix.h"
+#include "structures/sparse_vector.h"
+#include "structures/vector_block.h"
+#include "structures/vector_kernels.h"
+
+// rows are divided between threads in ranges of this many rows
+#define KMEANS_GRANULARITY  256
+
+// per thread counters, padded to a cache line so threads don't
+// write to the same line
+typedef struct {
+  u_int64_t distances;
+  u_int64_t pruned;
+  u_int64_t changed;
+  double    inertia;
+  double    potential;
+  char      padding[24];
+} kmeans_counters;
+
+typedef struct {
+  Matrix            *matrix;
+  kmeans_parameters *parameters;
+  kmeans_result     *result;
+  u_int32_t         threads;
+  u_int32_t         k;
+  u_int32_t         stride;
+  float             *centres;
+  u_int64_t         random;
+  
+  // the rows clustered (every row set, bar zero rows for cosine
+  // k-means), with each row's magnitude, and the bounds on its
+  // distance to its own centre and to any other
+  u_int64_t         *present;
+  u_int64_t         present_count;
+  float             *magnitudes;
+  float             *upper;
+  float             *lower;
+  
+  // each centre's squared magnitude, its values before the last
+  // update and distance moved by it, and half the distance to the
+  // nearest other centre
+  float             *squares;
+  float             *previous;
+  float             *moved;
+  float             *gaps;
+  float             most_moved;
+  float             next_most_moved;
+  u_int32_t         most_moved_centre;
+  
+  // per thread sums of the rows assigned to each centre (k * stride
+  // values per thread) and counts of those rows, reduced after
+  // each pass over the rows
+  float             *sums;
+  u_int64_t         *counts;
+  kmeans_counters   *counters;
+  
+  // seeding: the squared distance from each row to its nearest centre
+  // so far. mini-batches: the batch rows, and the rows assigned to
+  // each centre over every batch so far.
+  float             *nearest;
+  u_int32_t         seeded;
+  u_int64_t         *batch;
+  u_int64_t         batch_count;
+  u_int64_t         *totals;
+} kmeans_context;
+
+
+// ------------------------------------------
+// distances
+// ------------------------------------------
+// splitmix64, stepping through the seed's sequence
+static u_int64_t kmeans_random(kmeans_context *context) {
+  u_int64_t x = (context->random += 0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+#define kmeans_uniform(context) ((kmeans_random(context) >> 11) * (1.0 / 9007199254740992.0))
+#define kmeans_centre(context, c) ((context)->centres + ((u_int64_t) (c) * (context)->stride))
+
+static float kmeans_dot(kmeans_context *context, u_int64_t r, float *centre) {
+  Matrix *matrix = context->matrix;
+  if(matrix->values)
+    return vector_kernels.dot_product(matrix->values + (r * matrix->stride), centre, matrix->stride);
+  
+  SparseVector *row;
+  Vector view;
+  float dot = 0.0;
+  matrix_get_row(matrix, r, &row);
+  vector_view(centre, context->stride, &view);
+  sparse_vector_dense_dot_product(row, &view, &dot);
+  return dot;
+}
+
+// distances are euclidean; for cosine k-means between the normalized
+// row and (normalized) centre, so the bounds' triangle inequality
+// holds for both metrics. |x - c|^2 = |x|^2 - 2x.c + |c|^2 needs only
+// the values of sparse rows, and the magnitudes of frozen rows.
+static float kmeans_distance(kmeans_context *context, u_int64_t r, u_int32_t c) {
+  float dot = kmeans_dot(context, r, kmeans_centre(context, c));
+  float magnitude = context->magnitudes[r], squares;
+  if(context->parameters->metric == COSINE_SIMILARITY)
+    squares = 2.0 - ((2.0 * dot) / magnitude);
+  else
+    squares = (magnitude * magnitude) - (2.0 * dot) + context->squares[c];
+  return (squares > 0.0) ? sqrtf(squares) : 0.0;
+}
+
+// sum += row, normalized for cosine k-means
+static void kmeans_add_row(kmeans_context *context, u_int64_t r, float *sum) {
+  Matrix *matrix = context->matrix;
+  float scale = (context->parameters->metric == COSINE_SIMILARITY) ? 1.0 / context->magnitudes[r] : 1.0;
+  if(matrix->values) {
+    vector_kernels.axpy(scale, matrix->values + (r * matrix->stride), sum, matrix->stride);
+    return;
+  }
+  
+  SparseVector *row;
+  Vector view;
+  matrix_get_row(matrix, r, &row);
+  vector_view(sum, context->stride, &view);
+  sparse_vector_dense_axpy(scale, row, &view);
+}
+
+// the nearest centre to a row, given its distance from the centre
+// skip (if any), along with the distance to the next nearest
+static u_int32_t kmeans_nearest(kmeans_context *context, u_int64_t r, u_int32_t skip, float *best, float *second) {
+  u_int32_t nearest = skip;
+  if(skip == KMEANS_UNASSIGNED)
+    *best = INFINITY;
+  *second = INFINITY;
+  for(u_int32_t c = 0; c < context->k; c++) {
+    if(c == skip) continue;
+    float distance = kmeans_distance(context, r, c);
+    if(distance < *best) {
+      *second  = *best;
+      *best    = distance;
+      nearest  = c;
+    } else if(distance < *second) {
+      *second = distance;
+    }
+  }
+  return nearest;
+}
+
+
+// ------------------------------------------
+// preparation and seeding
+// ------------------------------------------
+// rows that can't be clustered are given a negative magnitude
+static void kmeans_magnitudes(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  kmeans_context *context = (kmeans_context *) param;
+  Matrix *matrix = context->matrix;
+  SparseVector *row;
+  
+  for(u_int64_t r = start; r < end; r++) {
+    float magnitude = -1.0;
+    if(matrix->values)
+      magnitude = matrix->magnitudes ? matrix->magnitudes[r] : sqrtf(vector_kernels.sum_of_squares(matrix->values + (r * matrix->stride), matrix->stride));
+    else if(matrix_get_row(matrix, r, &row) == NO_ERROR)
+      sparse_vector_magnitude(row, &magnitude);
+    if(context->parameters->metric == COSINE_SIMILARITY && magnitude == 0.0)
+      magnitude = -1.0;
+    context->magnitudes[r] = magnitude;
+  }
+}
+
+static void kmeans_set_centre(kmeans_context *context, u_int32_t c, u_int64_t r) {
+  float *centre = kmeans_centre(context, c);
+  memset(centre, 0, context->stride * sizeof(float));
+  kmeans_add_row(context, r, centre);
+  context->squares[c] = vector_kernels.sum_of_squares(centre, context->stride);
+}
+
+// lowers each row's squared distance to its nearest centre to its
+// distance from the last centre seeded
+static void kmeans_seed_distances(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  kmeans_context *context = (kmeans_context *) param;
+  for(u_int64_t i = start; i < end; i++) {
+    float distance = kmeans_distance(context, context->present[i], context->seeded - 1);
+    if(distance * distance < context->nearest[i])
+      context->nearest[i] = distance * distance;
+  }
+}
+
+// the sum of squared distances to the nearest centre if the last
+// centre seeded were kept
+static void kmeans_seed_potential(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  kmeans_context *context = (kmeans_context *) param;
+  for(u_int64_t i = start; i < end; i++) {
+    float distance = kmeans_distance(context, context->present[i], context->seeded - 1);
+    context->counters[thread].potential += fminf(distance * distance, context->nearest[i]);
+  }
+}
+
+// a row picked with probability in proportion to its squared
+// distance from the nearest centre. if every row sits on a centre,
+// any row will do.
+static u_int64_t kmeans_sample(kmeans_context *context, double total) {
+  u_int64_t pick;
+  if(total <= 0.0)
+    return kmeans_random(context) % context->present_count;
+  
+  double target = kmeans_uniform(context) * total;
+  for(pick = 0; pick < context->present_count - 1; pick++) {
+    if(context->nearest[pick] > 0.0 && target < context->nearest[pick]) break;
+    target -= context->nearest[pick];
+  }
+  return pick;
+}
+
+// greedy k-means++. plain k-means++ often seeds two centres in one
+// cluster when clusters are close relative to their spread (as
+// sparse rows compared by angle tend to be), which assignment can't
+// undo. each centre after the first is the best of 2 + ln k rows
+// sampled: the one leaving the least total squared distance to the
+// nearest centre. picking rows is a sequential scan of the squared
+// distances, but scoring them and updating the distances for the
+// centre kept are split across threads.
+static learner_error kmeans_seed(kmeans_context *context) {
+  learner_error error = NO_ERROR;
+  u_int32_t candidates = 2 + (u_int32_t) log(context->k);
+  for(u_int64_t i = 0; i < context->present_count; i++)
+    context->nearest[i] = INFINITY;
+  
+  kmeans_set_centre(context, 0, context->present[kmeans_random(context) % context->present_count]);
+  context->seeded = 1;
+  for(u_int32_t c = 1; c <= context->k && !error; c++) {
+    if((error = learner_parallel_for(context->present_count, context->threads, KMEANS_GRANULARITY, kmeans_seed_distances, context)))
+      break;
+    if(c == context->k)
+      break;
+    
+    double total = 0.0, best = INFINITY;
+    u_int64_t best_pick = 0;
+    for(u_int64_t i = 0; i < context->present_count; i++)
+      total += context->nearest[i];
+    
+    context->seeded = c + 1;
+    for(u_int32_t candidate = 0; candidate < candidates && !error; candidate++) {
+      u_int64_t pick = kmeans_sample(context, total);
+      double potential = 0.0;
+      for(u_int32_t t = 0; t < context->threads; t++)
+        context->counters[t].potential = 0.0;
+      
+      kmeans_set_centre(context, c, context->present[pick]);
+      error = learner_parallel_for(context->present_count, context->threads, KMEANS_GRANULARITY, kmeans_seed_potential, context);
+      for(u_int32_t t = 0; t < context->threads; t++)
+        potential += context->counters[t].potential;
+      if(potential < best) {
+        best      = potential;
+        best_pick = pick;
+      }
+    }
+    kmeans_set_centre(context, c, context->present[best_pick]);
+  }
+  return error;
+}
+
+
+// ------------------------------------------
+// assignment
+// ------------------------------------------
+// rows are compared to every centre, setting their bounds
+static void kmeans_assign_all(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  kmeans_context *context = (kmeans_context *) param;
+  u_int32_t *assignments = context->result->assignments;
+  for(u_int64_t i = start; i < end; i++) {
+    u_int64_t r = context->present[i];
+    u_int32_t nearest = kmeans_nearest(context, r, KMEANS_UNASSIGNED, &context->upper[i], &context->lower[i]);
+    if(nearest != assignments[r]) {
+      assignments[r] = nearest;
+      context->counters[thread].changed++;
+    }
+  }
+  context->counters[thread].distances += (end - start) * context->k;
+}
+
+// hamerly's algorithm. the bounds are moved by how far the centres
+// moved; while the upper bound is below the lower bound and half the
+// gap to the next nearest centre, the row can't change centre. the
+// upper bound is tightened to the exact distance before giving up
+// and comparing the row to every other centre.
+static void kmeans_assign_bounded(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  kmeans_context *context = (kmeans_context *) param;
+  kmeans_counters *counters = &context->counters[thread];
+  u_int32_t *assignments = context->result->assignments, k = context->k;
+  
+  for(u_int64_t i = start; i < end; i++) {
+    u_int64_t r = context->present[i];
+    u_int32_t assigned = assignments[r];
+    context->upper[i] += context->moved[assigned];
+    context->lower[i] -= (assigned == context->most_moved_centre) ? context->next_most_moved : context->most_moved;
+    
+    float bound = (context->lower[i] > context->gaps[assigned]) ? context->lower[i] : context->gaps[assigned];
+    if(context->upper[i] <= bound) {
+      counters->pruned += k;
+      continue;
+    }
+    context->upper[i] = kmeans_distance(context, r, assigned);
+    counters->distances++;
+    if(context->upper[i] <= bound) {
+      counters->pruned += k - 1;
+      continue;
+    }
+    
+    u_int32_t nearest = kmeans_nearest(context, r, assigned, &context->upper[i], &context->lower[i]);
+    counters->distances += k - 1;
+    if(nearest != assigned) {
+      assignments[r] = nearest;
+      counters->changed++;
+    }
+  }
+}
+
+// half the distance from each centre to the nearest other centre
+static void kmeans_gaps(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  kmeans_context *context = (kmeans_context *) param;
+  for(u_int64_t c = start; c < end; c++) {
+    float nearest = INFINITY;
+    for(u_int32_t other = 0; other < context->k; other++) {
+      if(other == c) continue;
+      float squares = vector_kernels.squared_distance(kmeans_centre(context, c), kmeans_centre(context, other), context->stride);
+      if(squares < nearest)
+        nearest = squares;
+    }
+    context->gaps[c] = 0.5 * sqrtf(nearest);
+  }
+}
+
+
+// ------------------------------------------
+// updates
+// ------------------------------------------
+static void kmeans_accumulate(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  kmeans_context *context = (kmeans_context *) param;
+  float *sums = context->sums + ((u_int64_t) thread * context->k * context->stride);
+  u_int64_t *counts = context->counts + ((u_int64_t) thread * context->k);
+  for(u_int64_t i = start; i < end; i++) {
+    u_int64_t r = context->present[i];
+    u_int32_t assigned = context->result->assignments[r];
+    kmeans_add_row(context, r, sums + ((u_int64_t) assigned * context->stride));
+    counts[assigned]++;
+  }
+}
+
+// batch rows are assigned to their nearest centre as they're summed
+static void kmeans_accumulate_batch(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  kmeans_context *context = (kmeans_context *) param;
+  float *sums = context->sums + ((u_int64_t) thread * context->k * context->stride);
+  u_int64_t *counts = context->counts + ((u_int64_t) thread * context->k);
+  float best, second;
+  for(u_int64_t i = start; i < end; i++) {
+    u_int64_t r = context->batch[i];
+    u_int32_t nearest = kmeans_nearest(context, r, KMEANS_UNASSIGNED, &best, &second);
+    kmeans_add_row(context, r, sums + ((u_int64_t) nearest * context->stride));
+    counts[nearest]++;
+  }
+  context->counters[thread].distances += (end - start) * context->k;
+}
+
+// each centre is reduced from the per thread sums. full k-means
+// moves centres to the mean of their rows; mini-batches to the mean
+// of every row assigned to them so far, weighting the current centre
+// by the rows already assigned. centres with no rows don't move.
+static void kmeans_update(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  kmeans_context *context = (kmeans_context *) param;
+  u_int32_t k = context->k, stride = context->stride;
+  
+  for(u_int64_t c = start; c < end; c++) {
+    float *centre = kmeans_centre(context, c), *previous = context->previous + (c * stride);
+    u_int64_t count = 0, total = context->totals ? context->totals[c] : 0;
+    for(u_int32_t t = 0; t < context->threads; t++)
+      count += context->counts[(t * k) + c];
+    context->moved[c] = 0.0;
+    if(count == 0) continue;
+    
+    memcpy(previous, centre, stride * sizeof(float));
+    for(u_int32_t i = 0; i < stride; i++)
+      centre[i] *= total;
+    for(u_int32_t t = 0; t < context->threads; t++)
+      vector_kernels.axpy(1.0, context->sums + (((u_int64_t) t * k + c) * stride), centre, stride);
+    for(u_int32_t i = 0; i < stride; i++)
+      centre[i] /= (total + count);
+    if(context->totals)
+      context->totals[c] += count;
+    
+    // spherical centres are the normalized mean
+    if(context->parameters->metric == COSINE_SIMILARITY) {
+      float magnitude = sqrtf(vector_kernels.sum_of_squares(centre, stride));
+      if(magnitude > 0.0)
+        for(u_int32_t i = 0; i < stride; i++)
+          centre[i] /= magnitude;
+    }
+    context->squares[c] = vector_kernels.sum_of_squares(centre, stride);
+    context->moved[c] = sqrtf(vector_kernels.squared_distance(centre, previous, stride));
+  }
+}
+
+static learner_error kmeans_reduce(kmeans_context *context) {
+  learner_error error = learner_parallel_for(context->k, context->threads, 1, kmeans_update, context);
+  if(error) return error;
+  context->most_moved = context->next_most_moved = 0.0;
+  context->most_moved_centre = 0;
+  for(u_int32_t c = 0; c < context->k; c++) {
+    if(context->moved[c] > context->most_moved) {
+      context->next_most_moved   = context->most_moved;
+      context->most_moved        = context->moved[c];
+      context->most_moved_centre = c;
+    } else if(context->moved[c] > context->next_most_moved) {
+      context->next_most_moved = context->moved[c];
+    }
+  }
+  return NO_ERROR;
+}
+
+static void kmeans_inertia(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  kmeans_context *context = (kmeans_context *) param;
+  for(u_int64_t i = start; i < end; i++) {
+    u_int64_t r = context->present[i];
+    float distance = kmeans_distance(context, r, context->result->assignments[r]);
+    context->counters[thread].inertia += (context->parameters->metric == COSINE_SIMILARITY) ? (distance * distance) / 2.0 : distance * distance;
+  }
+}
+
+
+// ------------------------------------------
+// clustering
+// ------------------------------------------
+static learner_error kmeans_pass(kmeans_context *context, u_int64_t count, learner_parallel_work work) {
+  for(u_int32_t t = 0; t < context->threads; t++)
+    context->counters[t].changed = 0;
+  return learner_parallel_for(count, context->threads, KMEANS_GRANULARITY, work, context);
+}
+
+static u_int64_t kmeans_changed(kmeans_context *context) {
+  u_int64_t changed = 0;
+  for(u_int32_t t = 0; t < context->threads; t++)
+    changed += context->counters[t].changed;
+  return changed;
+}
+
+static learner_error kmeans_full(kmeans_context *context) {
+  kmeans_parameters *parameters = context->parameters;
+  u_int32_t iterations = parameters->iterations ? parameters->iterations : KMEANS_DEFAULT_ITERATIONS;
+  u_int64_t bytes = (u_int64_t) context->threads * context->k * context->stride * sizeof(float);
+  learner_error error = kmeans_pass(context, context->present_count, kmeans_assign_all);
+  
+  while(!error && context->result->iterations < iterations) {
+    memset(context->sums, 0, bytes);
+    memset(context->counts, 0, context->threads * context->k * sizeof(u_int64_t));
+    if((error = learner_parallel_for(context->present_count, context->threads, KMEANS_GRANULARITY, kmeans_accumulate, context))) break;
+    if((error = kmeans_reduce(context))) break;
+    context->result->iterations++;
+    
+    if(context->k == 1)
+      context->gaps[0] = INFINITY;
+    else if((error = learner_parallel_for(context->k, context->threads, 1, kmeans_gaps, context)))
+      break;
+    if((error = kmeans_pass(context, context->present_count, kmeans_assign_bounded))) break;
+    if(kmeans_changed(context) == 0 || context->most_moved <= parameters->tolerance) break;
+  }
+  return error;
+}
+
+static learner_error kmeans_mini_batch(kmeans_context *context) {
+  kmeans_parameters *parameters = context->parameters;
+  u_int32_t iterations = parameters->iterations ? parameters->iterations : KMEANS_DEFAULT_ITERATIONS;
+  u_int64_t bytes = (u_int64_t) context->threads * context->k * context->stride * sizeof(float);
+  learner_error error = NO_ERROR;
+  context->batch_count = parameters->batch;
+  
+  while(!error && context->result->iterations < iterations) {
+    for(u_int64_t i = 0; i < context->batch_count; i++)
+      context->batch[i] = context->present[kmeans_random(context) % context->present_count];
+    memset(context->sums, 0, bytes);
+    memset(context->counts, 0, context->threads * context->k * sizeof(u_int64_t));
+    if((error = learner_parallel_for(context->batch_count, context->threads, KMEANS_GRANULARITY, kmeans_accumulate_batch, context))) break;
+    if((error = kmeans_reduce(context))) break;
+    context->result->iterations++;
+    if(context->most_moved <= parameters->tolerance) break;
+  }
+  
+  // every row is assigned to the final centres
+  if(!error)
+    error = kmeans_pass(context, context->present_count, kmeans_assign_all);
+  return error;
+}
+
+
+static void kmeans_context_free(kmeans_context *context) {
+  free(context->present);
+  free(context->magnitudes);
+  free(context->upper);
+  free(context->lower);
+  free(context->squares);
+  vector_block_free(context->previous);
+  free(context->moved);
+  free(context->gaps);
+  vector_block_free(context->sums);
+  free(context->counts);
+  free(context->counters);
+  free(context->nearest);
+  free(context->batch);
+  free(context->totals);
+}
+
+// rows to cluster, and the dimensions of the centres
+static learner_error kmeans_prepare(kmeans_context *context, u_int32_t *dimensions) {
+  Matrix *matrix = context->matrix;
+  SparseVector *row;
+  u_int64_t rows = matrix->rows;
+  context->magnitudes = (float *) malloc((rows ? rows : 1) * sizeof(float));
+  context->present    = (u_int64_t *) malloc((rows ? rows : 1) * sizeof(u_int64_t));
+  if(!context->magnitudes || !context->present) return MEMORY_ERROR;
+  learner_error error = learner_parallel_for(rows, context->threads, KMEANS_GRANULARITY, kmeans_magnitudes, context);
+  if(error) return error;
+  
+  *dimensions = matrix->values ? matrix->columns : 1;
+  for(u_int64_t r = 0; r < rows; r++) {
+    if(context->magnitudes[r] < 0.0) continue;
+    context->present[context->present_count++] = r;
+    if(!matrix->values && matrix_get_row(matrix, r, &row) == NO_ERROR && row->header.count && row->header.max_index >= *dimensions)
+      *dimensions = row->header.max_index + 1;
+  }
+  return NO_ERROR;
+}
+
+static learner_error kmeans_allocate(kmeans_context *context) {
+  u_int64_t n = context->present_count, k = context->k, threads = context->threads;
+  context->upper    = (float *) malloc(n * sizeof(float));
+  context->lower    = (float *) malloc(n * sizeof(float));
+  context->nearest  = (float *) malloc(n * sizeof(float));
+  context->squares  = (float *) malloc(k * sizeof(float));
+  context->moved    = (float *) calloc(k, sizeof(float));
+  context->gaps     = (float *) malloc(k * sizeof(float));
+  context->counts   = (u_int64_t *) malloc(threads * k * sizeof(u_int64_t));
+  context->counters = (kmeans_counters *) calloc(threads, sizeof(kmeans_counters));
+  if(context->parameters->batch) {
+    context->batch  = (u_int64_t *) malloc(context->parameters->batch * sizeof(u_int64_t));
+    context->totals = (u_int64_t *) calloc(k, sizeof(u_int64_t));
+    if(!context->batch || !context->totals) return MEMORY_ERROR;
+  }
+  if(!context->upper || !context->lower || !context->nearest || !context->squares || !context->moved || !context->gaps ||
+     !context->counts || !context->counters)
+    return MEMORY_ERROR;
+  
+  // sums are added to centres a row at a time, so are aligned alike
+  learner_error error = vector_block_new(context->stride, k, &context->previous);
+  return error ? error : vector_block_new(context->stride, threads * k, &context->sums);
+}
+
+
+learner_error matrix_kmeans(Matrix *matrix, kmeans_parameters *parameters, kmeans_result **result) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!parameters || parameters->k == 0 || parameters->metric == DOT_PRODUCT) return INVALID_PARAMETERS;
+  u_int32_t dimensions;
+  learner_error error;
+  
+  kmeans_context context;
+  memset(&context, 0, sizeof(kmeans_context));
+  context.matrix     = matrix;
+  context.parameters = parameters;
+  context.threads    = learner_default_threads(parameters->threads);
+  context.k          = parameters->k;
+  context.random     = parameters->seed;
+  if((error = kmeans_prepare(&context, &dimensions))) {
+    kmeans_context_free(&context);
+    return error;
+  }
+  if(context.present_count < context.k) {
+    kmeans_context_free(&context);
+    return INVALID_PARAMETERS;
+  }
+  
+  *result = (kmeans_result *) calloc(1, sizeof(kmeans_result));
+  if(!*result) {
+    kmeans_context_free(&context);
+    return MEMORY_ERROR;
+  }
+  context.result = *result;
+  (*result)->assignments = (u_int32_t *) malloc((matrix->rows ? matrix->rows : 1) * sizeof(u_int32_t));
+  (*result)->sizes       = (u_int64_t *) calloc(context.k, sizeof(u_int64_t));
+  if(!(*result)->assignments || !(*result)->sizes)
+    error = MEMORY_ERROR;
+  if(!error)
+    error = matrix_new_dense(context.k, dimensions, &(*result)->centres);
+  if(!error) {
+    context.centres = (*result)->centres->values;
+    context.stride  = (*result)->centres->stride;
+    error = kmeans_allocate(&context);
+  }
+  
+  if(!error) {
+    for(u_int64_t r = 0; r < matrix->rows; r++)
+      (*result)->assignments[r] = KMEANS_UNASSIGNED;
+    error = kmeans_seed(&context);
+  }
+  if(!error)
+    error = parameters->batch ? kmeans_mini_batch(&context) : kmeans_full(&context);
+  if(!error)
+    error = learner_parallel_for(context.present_count, context.threads, KMEANS_GRANULARITY, kmeans_inertia, &context);
+  
+  if(!error) {
+    for(u_int64_t i = 0; i < context.present_count; i++)
+      (*result)->sizes[(*result)->assignments[context.present[i]]]++;
+    for(u_int32_t t = 0; t < context.threads; t++) {
+      (*result)->distances += context.counters[t].distances;
+      (*result)->pruned    += context.counters[t].pruned;
+      (*result)->inertia   += context.counters[t].inertia;
+    }
+  } else {
+    kmeans_result_free(*result);
+    *result = NULL;
+  }
+  kmeans_context_free(&context);
+  return error;
+}
+
+
+learner_error kmeans_result_free(kmeans_result *result) {
+  if(!result) return MISSING_VALUES;
+  if(result->centres)
+    matrix_free(result->centres);
+  free(result->assignments);
+  free(result->sizes);
+  free(result);
+  return NO_ERROR;
+}
@@ -0,0 +1,81 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/metric.h"
+
+#ifndef __learner_kmeans__
+#define __learner_kmeans__
+
+// k-means clustering of the rows of a sparse or dense matrix. centres
+// are seeded by greedy k-means++: the first is a random row, and each
+// after it the best of a few rows picked with probability
+// proportional to their squared distance from the nearest centre so
+// far.
+//
+// full k-means (batch 0) alternates assigning every row to its
+// nearest centre with moving each centre to the mean of its rows.
+// rows keep an upper bound on the distance to their centre and a
+// lower bound on the distance to any other (hamerly's algorithm);
+// bounds are loosened by how far centres move, and a row whose upper
+// bound is below both its lower bound and half the distance from its
+// centre to the next nearest centre can't change centre, so isn't
+// compared to any. most rows are skipped once clusters settle.
+//
+// mini-batch k-means instead assigns a random batch of rows each
+// iteration, moving each centre towards the mean of its batch rows
+// with a step size of 1 / (rows assigned to it so far).
+#define KMEANS_UNASSIGNED       ((u_int32_t) -1)
+#define KMEANS_DEFAULT_ITERATIONS 100
+
+typedef struct {
+  u_int32_t       k;
+  
+  // euclidean distance, or cosine similarity (spherical k-means: rows
+  // are compared by the angle between them, and centres are kept
+  // normalized). frozen sparse rows and frozen dense matrices supply
+  // magnitudes from their caches.
+  learner_metric  metric;
+  
+  // 0 for KMEANS_DEFAULT_ITERATIONS. iterations stop early once no
+  // row changes centre (full k-means) or no centre moves more than
+  // tolerance.
+  u_int32_t       iterations;
+  float           tolerance;
+  
+  // rows per mini-batch, or 0 for full k-means
+  u_int32_t       batch;
+  u_int64_t       seed;
+  
+  // 0 for LEARNER_CORES
+  u_int32_t       threads;
+} kmeans_parameters;
+
+typedef struct {
+  // a dense k x dimensions matrix, dimensions being the number of
+  // columns of a dense matrix, or one more than the largest column
+  // index of a sparse matrix
+  Matrix          *centres;
+  
+  // the centre of each row (KMEANS_UNASSIGNED for rows never set),
+  // and the number of rows of each centre
+  u_int32_t       *assignments;
+  u_int64_t       *sizes;
+  
+  // the sum of squared euclidean distances of rows from their centre,
+  // or of 1 - cosine similarity for cosine k-means
+  double          inertia;
+  u_int32_t       iterations;
+  
+  // distances computed between rows and centres while assigning
+  // rows, and distances the bounds showed weren't needed. each pass
+  // over the rows accounts for k per row between the two.
+  u_int64_t       distances;
+  u_int64_t       pruned;
+} kmeans_result;
+
+// k must be between 1 and the number of rows set. the dot product
+// metric isn't a distance, so is an INVALID_PARAMETERS error.
+learner_error matrix_kmeans(Matrix *matrix, kmeans_parameters *parameters, kmeans_result **result);
+learner_error kmeans_result_free(kmeans_result *result);
+
+#endif
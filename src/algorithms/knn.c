@@ -0,0 +1,449 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "algorithms/knn.h"
+#include "structures/dense_matrix.h"
+#include "structures/vector_block.h"
+#include "structures/vector_kernels.h"
+
+// dense rows are scored in chunks of this many rows by the batch
+// kernels before being pushed on to a heap
+#define KNN_DENSE_CHUNK 64
+
+// pruned searches order candidates lazily: the best chunk of bounds
+// is selected and sorted, searched, and only if some thread gets
+// through its share is the next (twice as large) chunk ordered
+#define KNN_CANDIDATE_CHUNK 1024
+
+// ------------------------------------------
+// bounded heaps
+// ------------------------------------------
+static inline int knn_better(learner_metric metric, float score_a, u_int64_t row_a, float score_b, u_int64_t row_b) {
+  if(score_a != score_b)
+    return (metric == EUCLIDEAN_DISTANCE) ? (score_a < score_b) : (score_a > score_b);
+  return row_a < row_b;
+}
+
+void knn_heap_push(knn_heap *heap, u_int64_t row, float score) {
+  knn_result *results = heap->results;
+  u_int32_t i, parent, child;
+  if(isnan(score)) return;
+  
+  if(heap->count < heap->k) {
+    // sift the new leaf up past any better parents
+    i = heap->count++;
+    while(i > 0) {
+      parent = (i - 1) / 2;
+      if(!knn_better(heap->metric, results[parent].score, results[parent].row, score, row)) break;
+      results[i] = results[parent];
+      i = parent;
+    }
+  } else {
+    if(!knn_better(heap->metric, score, row, results[0].score, results[0].row)) return;
+    
+    // replace the root, sifting it down past any worse children
+    i = 0;
+    while((child = (2 * i) + 1) < heap->count) {
+      if(child + 1 < heap->count && knn_better(heap->metric, results[child].score, results[child].row, results[child + 1].score, results[child + 1].row))
+        child++;
+      if(knn_better(heap->metric, results[child].score, results[child].row, score, row)) break;
+      results[i] = results[child];
+      i = child;
+    }
+  }
+  
+  results[i].row   = row;
+  results[i].score = score;
+}
+
+static int knn_compare_descending(const void *a, const void *b) {
+  const knn_result *x = (const knn_result *) a, *y = (const knn_result *) b;
+  if(x->score != y->score) return (x->score > y->score) ? -1 : 1;
+  return (x->row < y->row) ? -1 : (x->row > y->row);
+}
+
+static int knn_compare_ascending(const void *a, const void *b) {
+  const knn_result *x = (const knn_result *) a, *y = (const knn_result *) b;
+  if(x->score != y->score) return (x->score < y->score) ? -1 : 1;
+  return (x->row < y->row) ? -1 : (x->row > y->row);
+}
+
+void knn_heap_sort(knn_heap *heap) {
+  qsort(heap->results, heap->count, sizeof(knn_result), (heap->metric == EUCLIDEAN_DISTANCE) ? knn_compare_ascending : knn_compare_descending);
+}
+
+
+// ------------------------------------------
+// magnitude bounds
+// ------------------------------------------
+typedef struct {
+  u_int64_t row;
+  float     magnitude;
+  float     bound;
+} knn_candidate;
+
+#define knn_bound_better(descending, a, b) ((descending) ? (a) > (b) : (a) < (b))
+
+static int knn_compare_bounds_descending(const void *a, const void *b) {
+  float x = ((const knn_candidate *) a)->bound, y = ((const knn_candidate *) b)->bound;
+  return (x > y) ? -1 : (x < y);
+}
+
+static int knn_compare_bounds_ascending(const void *a, const void *b) {
+  float x = ((const knn_candidate *) a)->bound, y = ((const knn_candidate *) b)->bound;
+  return (x < y) ? -1 : (x > y);
+}
+
+// bounds are q.r <= |q||r| and |q - r| >= ||q| - |r||
+static void knn_bound_candidates(knn_candidate *candidates, u_int64_t count, learner_metric metric, float query_magnitude) {
+  for(u_int64_t i = 0; i < count; i++) {
+    if(metric == DOT_PRODUCT)
+      candidates[i].bound = query_magnitude * candidates[i].magnitude;
+    else
+      candidates[i].bound = fabsf(query_magnitude - candidates[i].magnitude);
+  }
+}
+
+static inline void knn_swap_candidates(knn_candidate *a, knn_candidate *b) {
+  knn_candidate swap = *a;
+  *a = *b;
+  *b = swap;
+}
+
+// quickselect: moves the n best bounds to the front of candidates,
+// in no particular order, in time linear in count. partitions are
+// three way, so runs of equal bounds (such as normalized rows) end
+// the selection rather than slowing it.
+static void knn_select_candidates(knn_candidate *candidates, u_int64_t count, u_int64_t n, int descending) {
+  u_int64_t low = 0, high = count;
+  while(high - low > 1) {
+    float a = candidates[low].bound, b = candidates[low + ((high - low) / 2)].bound, c = candidates[high - 1].bound;
+    float pivot = knn_bound_better(descending, a, b) ?
+      (knn_bound_better(descending, b, c) ? b : (knn_bound_better(descending, a, c) ? c : a)) :
+      (knn_bound_better(descending, a, c) ? a : (knn_bound_better(descending, b, c) ? c : b));
+    
+    // [low, better) beat the pivot, [worse, high) lose to it
+    u_int64_t better = low, worse = high, i = low;
+    while(i < worse) {
+      if(knn_bound_better(descending, candidates[i].bound, pivot))
+        knn_swap_candidates(&candidates[better++], &candidates[i++]);
+      else if(knn_bound_better(descending, pivot, candidates[i].bound))
+        knn_swap_candidates(&candidates[i], &candidates[--worse]);
+      else
+        i++;
+    }
+    if(n < better)
+      high = better;
+    else if(n > worse)
+      low = worse;
+    else
+      return;
+  }
+}
+
+// candidates are sorted best bound first, so once one can't be
+// accepted none of the candidates after it can be either. only the
+// first n of count are put in order, the rest all being worse.
+static void knn_order_candidates(knn_candidate *candidates, u_int64_t count, u_int64_t n, learner_metric metric) {
+  int descending = (metric == DOT_PRODUCT);
+  if(n < count)
+    knn_select_candidates(candidates, count, n, descending);
+  qsort(candidates, n, sizeof(knn_candidate), descending ? knn_compare_bounds_descending : knn_compare_bounds_ascending);
+}
+
+// scores are computed in single precision, so a bound is only
+// trusted to exclude a row when it misses by more than the rounding
+// error the kernels can introduce
+static inline int knn_exhausted(knn_heap *heap, knn_candidate *candidate, float query_magnitude) {
+  if(heap->count < heap->k) return 0;
+  float worst = heap->results[0].score;
+  if(heap->metric == DOT_PRODUCT)
+    return candidate->bound + (VECTOR_KERNEL_TOLERANCE * candidate->bound) < worst;
+  else
+    return candidate->bound - (VECTOR_KERNEL_TOLERANCE * (query_magnitude + candidate->magnitude)) > worst;
+}
+
+
+// ------------------------------------------
+// scoring
+// ------------------------------------------
+typedef struct {
+  Matrix          *matrix;
+  learner_metric  metric;
+  knn_heap        *heaps;
+  
+  // candidates with their bounds when pruning, otherwise NULL and
+  // rows are split in to contiguous ranges. candidates are ordered
+  // and searched a chunk at a time, [chunk_start, chunk_end); stripes
+  // whose thread reached a candidate that can't be accepted are
+  // marked exhausted and skip later chunks.
+  knn_candidate   *candidates;
+  u_int64_t       candidate_count;
+  u_int64_t       chunk_start;
+  u_int64_t       chunk_end;
+  u_int32_t       stripes;
+  u_int8_t        *exhausted;
+  
+  // dense queries are copied in to an aligned, padded row
+  float           *query;
+  SparseVector    *sparse_query;
+  float           query_magnitude;
+} knn_context;
+
+static float knn_dense_score(knn_context *context, u_int64_t row, float magnitude) {
+  Matrix *matrix = context->matrix;
+  float dot = vector_kernels.dot_product(context->query, matrix->values + (row * matrix->stride), matrix->stride);
+  if(context->metric == DOT_PRODUCT)
+    return dot;
+  float squares = (context->query_magnitude * context->query_magnitude) + (magnitude * magnitude) - (2 * dot);
+  return (squares > 0.0) ? sqrtf(squares) : 0.0;
+}
+
+// frozen rows only need a dot product, the remaining terms come from
+// the cached magnitudes. unfrozen rows are scored with a single merge.
+static float knn_sparse_score(knn_context *context, SparseVector *row) {
+  SparseVector *query = context->sparse_query;
+  float result, squares;
+  
+  if(!row->header.frozen) {
+    if(context->metric == DOT_PRODUCT)
+      sparse_vector_dot_product(query, row, &result);
+    else if(context->metric == COSINE_SIMILARITY)
+      sparse_vector_cosine_similarity(query, row, &result);
+    else
+      sparse_vector_euclidean_distance(query, row, &result);
+    return result;
+  }
+  
+  sparse_vector_dot_product(query, row, &result);
+  switch(context->metric) {
+    case DOT_PRODUCT:
+      return result;
+    case COSINE_SIMILARITY:
+      if(row->header.frozen == SPARSE_VECTOR_NORMALIZED && query->header.frozen == SPARSE_VECTOR_NORMALIZED)
+        return result;
+      return result / (context->query_magnitude * row->header.magnitude);
+    case EUCLIDEAN_DISTANCE:
+      squares = (context->query_magnitude * context->query_magnitude) + (row->header.magnitude * row->header.magnitude) - (2 * result);
+      return (squares > 0.0) ? sqrtf(squares) : 0.0;
+  }
+  return NAN;
+}
+
+// pruned searches stripe the sorted candidates across threads, so
+// each thread still sees candidates in bound order and can stop at
+// the first one that can't beat the worst result in its own heap
+static void search_candidates(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  knn_context *context = (knn_context *) param;
+  knn_heap *heap = &context->heaps[thread];
+  knn_candidate *candidate;
+  float score;
+  
+  for(u_int64_t stripe = start; stripe < end; stripe++) {
+    if(context->exhausted[stripe]) continue;
+    for(u_int64_t i = context->chunk_start + stripe; i < context->chunk_end; i += context->stripes) {
+      candidate = &context->candidates[i];
+      if(knn_exhausted(heap, candidate, context->query_magnitude)) {
+        context->exhausted[stripe] = 1;
+        break;
+      }
+      if(context->sparse_query)
+        score = knn_sparse_score(context, context->matrix->row_vectors[candidate->row]);
+      else
+        score = knn_dense_score(context, candidate->row, candidate->magnitude);
+      knn_heap_push(heap, candidate->row, score);
+    }
+  }
+}
+
+static void search_dense_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  knn_context *context = (knn_context *) param;
+  knn_heap *heap = &context->heaps[thread];
+  Matrix *matrix = context->matrix;
+  float scores[KNN_DENSE_CHUNK];
+  float query_squares = context->query_magnitude * context->query_magnitude;
+  
+  for(u_int64_t row = start; row < end; row += KNN_DENSE_CHUNK) {
+    u_int64_t count = (end - row < KNN_DENSE_CHUNK) ? end - row : KNN_DENSE_CHUNK;
+    vector_block_score(context->query, query_squares, matrix->values + (row * matrix->stride), matrix->stride, count, context->metric, scores);
+    for(u_int64_t i = 0; i < count; i++)
+      knn_heap_push(heap, row + i, scores[i]);
+  }
+}
+
+static void search_sparse_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  knn_context *context = (knn_context *) param;
+  knn_heap *heap = &context->heaps[thread];
+  SparseVector *row;
+  
+  for(u_int64_t i = start; i < end; i++) {
+    row = context->matrix->row_vectors[i];
+    if(row)
+      knn_heap_push(heap, i, knn_sparse_score(context, row));
+  }
+}
+
+
+// ------------------------------------------
+// search
+// ------------------------------------------
+// orders and searches candidates a chunk at a time until every
+// stripe is exhausted or every candidate has been searched, so a
+// search stopping early only pays to order the candidates it reached
+static learner_error knn_run_candidates(knn_context *context, u_int32_t threads) {
+  learner_error error = NO_ERROR;
+  u_int64_t count = context->candidate_count, chunk = KNN_CANDIDATE_CHUNK * threads;
+  context->stripes   = threads;
+  context->exhausted = (u_int8_t *) calloc(threads, sizeof(u_int8_t));
+  if(!context->exhausted) return MEMORY_ERROR;
+  
+  for(u_int64_t start = 0; start < count && !error; start += chunk, chunk *= 2) {
+    u_int64_t end = (count - start < chunk) ? count : start + chunk;
+    u_int32_t exhausted = 0;
+    for(u_int32_t i = 0; i < threads; i++)
+      exhausted += context->exhausted[i];
+    if(exhausted == threads) break;
+    
+    knn_order_candidates(context->candidates + start, count - start, end - start, context->metric);
+    context->chunk_start = start;
+    context->chunk_end   = end;
+    error = learner_parallel_for(threads, threads, 1, search_candidates, context);
+  }
+  
+  free(context->exhausted);
+  context->exhausted = NULL;
+  return error;
+}
+
+// runs a search with a heap per thread, then merges the heaps in to
+// a final heap and sorts it in to results
+static learner_error knn_run(knn_context *context, u_int64_t rows, u_int32_t threads, learner_parallel_work work, u_int64_t granularity, u_int32_t k, knn_result *results, u_int32_t *found) {
+  learner_error error;
+  knn_heap merged = {results, 0, k, context->metric};
+  
+  context->heaps = (knn_heap *) calloc(threads, sizeof(knn_heap));
+  knn_result *storage = (knn_result *) malloc((size_t) threads * k * sizeof(knn_result));
+  if(!context->heaps || !storage) {
+    free(context->heaps);
+    free(storage);
+    return MEMORY_ERROR;
+  }
+  for(u_int32_t i = 0; i < threads; i++) {
+    context->heaps[i].results = storage + ((size_t) i * k);
+    context->heaps[i].k       = k;
+    context->heaps[i].metric  = context->metric;
+  }
+  
+  if(context->candidates) {
+    error = knn_run_candidates(context, threads);
+  } else {
+    error = learner_parallel_for(rows, threads, granularity, work, context);
+  }
+  
+  if(!error) {
+    for(u_int32_t i = 0; i < threads; i++)
+      for(u_int32_t j = 0; j < context->heaps[i].count; j++)
+        knn_heap_push(&merged, context->heaps[i].results[j].row, context->heaps[i].results[j].score);
+    knn_heap_sort(&merged);
+    *found = merged.count;
+  }
+  
+  free(storage);
+  free(context->heaps);
+  context->heaps = NULL;
+  return error;
+}
+
+
+learner_error knn_search(Matrix *matrix, Vector *query, u_int32_t k, learner_metric metric, knn_result *results, u_int32_t *found) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!query) return MISSING_VECTOR;
+  if(!results) return MISSING_VALUES;
+  if(!matrix->values) return INVALID_MATRIX_STORAGE;
+  if(query->header.length != matrix->columns) return VECTORS_NOT_OF_EQUAL_LENGTH;
+  *found = 0;
+  if(k == 0) return NO_ERROR;
+  
+  knn_context context;
+  memset(&context, 0, sizeof(knn_context));
+  context.matrix = matrix;
+  context.metric = metric;
+  learner_error error = vector_block_new(query->header.length, 1, &context.query);
+  if(error) return error;
+  vector_block_set(context.query, 0, query);
+  
+  if(query->header._frozen)
+    context.query_magnitude = query->header._magnitude;
+  else
+    context.query_magnitude = sqrtf(vector_kernels.sum_of_squares(context.query, matrix->stride));
+  
+  // cosine similarities are bounded by 1 regardless of magnitude, so
+  // only dot product and euclidean searches can be pruned
+  if(matrix->magnitudes && metric != COSINE_SIMILARITY) {
+    context.candidates = (knn_candidate *) malloc(matrix->rows * sizeof(knn_candidate));
+    if(!context.candidates) {
+      vector_block_free(context.query);
+      return MEMORY_ERROR;
+    }
+    for(u_int64_t row = 0; row < matrix->rows; row++) {
+      context.candidates[row].row       = row;
+      context.candidates[row].magnitude = matrix->magnitudes[row];
+    }
+    context.candidate_count = matrix->rows;
+    knn_bound_candidates(context.candidates, context.candidate_count, metric, context.query_magnitude);
+  }
+  
+  u_int32_t threads = (matrix->rows * matrix->stride >= VECTOR_BLOCK_PARALLEL_THRESHOLD) ? LEARNER_CORES : 1;
+  error = knn_run(&context, matrix->rows, threads, search_dense_rows, KNN_DENSE_CHUNK, k, results, found);
+  free(context.candidates);
+  vector_block_free(context.query);
+  return error;
+}
+
+
+learner_error knn_search_sparse(Matrix *matrix, SparseVector *query, u_int32_t k, learner_metric metric, knn_result *results, u_int32_t *found) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!query) return MISSING_VECTOR;
+  if(!results) return MISSING_VALUES;
+  if(matrix->values) return INVALID_MATRIX_STORAGE;
+  *found = 0;
+  if(k == 0 || !matrix->row_vectors) return NO_ERROR;
+  
+  knn_context context;
+  memset(&context, 0, sizeof(knn_context));
+  context.matrix = matrix;
+  context.metric = metric;
+  context.sparse_query = query;
+  learner_error error = sparse_vector_magnitude(query, &context.query_magnitude);
+  if(error) return error;
+  
+  // rows can only be pruned when every row has a cached magnitude
+  u_int64_t rows = (matrix->rows < matrix->row_capacity) ? matrix->rows : matrix->row_capacity;
+  u_int64_t values = 0, present = 0;
+  int frozen = 1;
+  for(u_int64_t row = 0; row < rows; row++) {
+    if(!matrix->row_vectors[row]) continue;
+    values += matrix->row_vectors[row]->header.count;
+    frozen &= (matrix->row_vectors[row]->header.frozen != SPARSE_VECTOR_UNFROZEN);
+    present++;
+  }
+  
+  if(frozen && metric != COSINE_SIMILARITY) {
+    context.candidates = (knn_candidate *) malloc((present ? present : 1) * sizeof(knn_candidate));
+    if(!context.candidates) return MEMORY_ERROR;
+    for(u_int64_t row = 0; row < rows; row++) {
+      if(!matrix->row_vectors[row]) continue;
+      context.candidates[context.candidate_count].row       = row;
+      context.candidates[context.candidate_count].magnitude = matrix->row_vectors[row]->header.magnitude;
+      context.candidate_count++;
+    }
+    knn_bound_candidates(context.candidates, context.candidate_count, metric, context.query_magnitude);
+  }
+  
+  u_int32_t threads = (values >= VECTOR_BLOCK_PARALLEL_THRESHOLD) ? LEARNER_CORES : 1;
+  error = knn_run(&context, rows, threads, search_sparse_rows, 1, k, results, found);
+  free(context.candidates);
+  return error;
+}
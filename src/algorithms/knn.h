@@ -0,0 +1,47 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/vector.h"
+#include "structures/sparse_vector.h"
+#include "structures/metric.h"
+
+#ifndef __learner_knn__
+#define __learner_knn__
+
+typedef struct {
+  u_int64_t row;
+  float     score;
+} knn_result;
+
+// a heap holds the best k results seen so far with the worst at the
+// root, so most candidates are rejected by a single comparison.
+// sorting turns the heap in to a list, best first. heaps are used by
+// the searches below and the all pairs job (see similarity.h).
+typedef struct {
+  knn_result      *results;
+  u_int32_t       count;
+  u_int32_t       k;
+  learner_metric  metric;
+} knn_heap;
+
+void knn_heap_push(knn_heap *heap, u_int64_t row, float score);
+void knn_heap_sort(knn_heap *heap);
+
+// exact k nearest neighbour search. every row of matrix is scored
+// against query; the k best are written to results (which must have
+// room for k) best first: highest dot product or cosine similarity,
+// lowest euclidean distance, with ties broken by lower row number.
+// found is set to the number of results, which is less than k when
+// the matrix has fewer rows (or rows whose cosine similarity is
+// undefined because they, or the query, are all zeros).
+//
+// rows are split across threads, each keeping its own bounded heap,
+// and the heaps are merged at the end. when row magnitudes are
+// cached (frozen sparse rows, or see matrix_dense_freeze) dot product
+// and euclidean searches visit rows in order of their score bound
+// (|q||r| and ||q| - |r|| respectively) and stop as soon as no
+// remaining row can beat the worst result found.
+learner_error knn_search(Matrix *matrix, Vector *query, u_int32_t k, learner_metric metric, knn_result *results, u_int32_t *found);
+learner_error knn_search_sparse(Matrix *matrix, SparseVector *query, u_int32_t k, learner_metric metric, knn_result *results, u_int32_t *found);
+
+#endif
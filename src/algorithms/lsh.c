@@ -0,0 +1,412 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "algorithms/lsh.h"
+
+// bands start with room for this many buckets, doubling whenever
+// more than half are used
+#define LSH_MIN_BUCKETS         64
+#define LSH_MIN_BUCKET_ROWS     2
+#define LSH_PARALLEL_THRESHOLD  1024
+
+// ------------------------------------------
+// hashing
+// ------------------------------------------
+// splitmix64 finaliser; every projection sign and minhash permutation
+// is derived from it, so no per column state is kept
+static inline u_int64_t lsh_mix(u_int64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+#define lsh_signature_bits(parameters) ((parameters)->bands * (parameters)->rows_per_band)
+#define lsh_signature_of(index, row) ((u_int64_t *) ((index)->signatures + ((row) * (index)->signature_bytes)))
+
+// bit b of word w of a simhash signature is the sign of the vector's
+// projection on a hyperplane whose components are +/-1, taken from
+// bit b of the hash of (seed, column, w)
+static void lsh_simhash(lsh_parameters *parameters, SparseVector *vector, u_int64_t *signature) {
+  u_int32_t bits = lsh_signature_bits(parameters), words = (bits + 63) / 64;
+  float sums[64];
+  
+  for(u_int32_t w = 0; w < words; w++) {
+    memset(sums, 0, sizeof(sums));
+    for(int i = 0, count = vector->header.count; i < count; i++) {
+      u_int64_t signs = lsh_mix(parameters->seed ^ lsh_mix(((u_int64_t) sparse_vector_index_at(vector, i) << 8) | w));
+      float value = sparse_vector_value_at(vector, i);
+      for(int b = 0; b < 64; b++)
+        sums[b] += ((signs >> b) & 1) ? value : -value;
+    }
+    
+    u_int64_t word = 0;
+    for(int b = 0; b < 64; b++)
+      word |= (u_int64_t) (sums[b] > 0.0) << b;
+    if(w == words - 1 && (bits & 63))
+      word &= (1ULL << (bits & 63)) - 1;
+    signature[w] = word;
+  }
+}
+
+// hash h of a minhash signature is the minimum over the vector's
+// indexes of the permutation (a + h * b), from double hashing
+static void lsh_minhash(lsh_parameters *parameters, SparseVector *vector, u_int64_t *signature) {
+  u_int32_t hashes = lsh_signature_bits(parameters), *minimums = (u_int32_t *) signature;
+  for(u_int32_t h = 0; h < hashes; h++)
+    minimums[h] = UINT32_MAX;
+  
+  for(int i = 0, count = vector->header.count; i < count; i++) {
+    u_int64_t hash = lsh_mix(parameters->seed ^ sparse_vector_index_at(vector, i));
+    u_int64_t a = hash, b = lsh_mix(hash) | 1;
+    for(u_int32_t h = 0; h < hashes; h++) {
+      u_int32_t value = (u_int32_t) ((a + (h * b)) >> 32);
+      if(value < minimums[h])
+        minimums[h] = value;
+    }
+  }
+}
+
+static void lsh_signature(lsh_parameters *parameters, SparseVector *vector, u_int64_t *signature) {
+  if(parameters->family == LSH_SIMHASH)
+    lsh_simhash(parameters, vector, signature);
+  else
+    lsh_minhash(parameters, vector, signature);
+}
+
+// simhash bands are their bits, which may straddle two words; minhash
+// bands are a hash of their values
+static u_int64_t lsh_band_key(lsh_parameters *parameters, u_int64_t *signature, u_int32_t band) {
+  u_int32_t rows = parameters->rows_per_band;
+  if(parameters->family == LSH_SIMHASH) {
+    u_int32_t start = band * rows, word = start / 64, offset = start & 63;
+    u_int64_t key = signature[word] >> offset;
+    if(offset + rows > 64)
+      key |= signature[word + 1] << (64 - offset);
+    return (rows == 64) ? key : key & ((1ULL << rows) - 1);
+  }
+  
+  u_int32_t *values = ((u_int32_t *) signature) + (band * rows);
+  u_int64_t key = band;
+  for(u_int32_t i = 0; i < rows; i++)
+    key = lsh_mix(key ^ values[i]);
+  return key;
+}
+
+static u_int32_t lsh_hamming(u_int64_t *a, u_int64_t *b, u_int32_t words) {
+  u_int32_t distance = 0;
+  for(u_int32_t w = 0; w < words; w++)
+    distance += __builtin_popcountll(a[w] ^ b[w]);
+  return distance;
+}
+
+
+// ------------------------------------------
+// bands
+// ------------------------------------------
+// buckets are occupied once they have a row list; buckets emptied by
+// deletes keep their key until the band is next resized
+static lsh_bucket *lsh_band_find(lsh_band *band, u_int64_t key) {
+  u_int64_t mask = band->capacity - 1;
+  for(u_int64_t slot = lsh_mix(key) & mask;; slot = (slot + 1) & mask) {
+    lsh_bucket *bucket = &band->buckets[slot];
+    if(!bucket->rows || bucket->key == key)
+      return bucket;
+  }
+}
+
+static learner_error lsh_band_resize(lsh_band *band, u_int64_t capacity) {
+  lsh_bucket *old = band->buckets;
+  u_int64_t old_capacity = band->capacity;
+  band->buckets = (lsh_bucket *) calloc(capacity, sizeof(lsh_bucket));
+  if(!band->buckets) {
+    band->buckets = old;
+    return MEMORY_ERROR;
+  }
+  band->capacity = capacity;
+  band->used = 0;
+  
+  for(u_int64_t i = 0; i < old_capacity; i++) {
+    if(!old[i].rows) continue;
+    if(old[i].count == 0) {
+      free(old[i].rows);
+      continue;
+    }
+    *lsh_band_find(band, old[i].key) = old[i];
+    band->used++;
+  }
+  free(old);
+  return NO_ERROR;
+}
+
+static learner_error lsh_band_add(lsh_band *band, u_int64_t key, u_int64_t row) {
+  learner_error error;
+  if((band->used + 1) * 2 > band->capacity)
+    if((error = lsh_band_resize(band, band->capacity ? band->capacity * 2 : LSH_MIN_BUCKETS)))
+      return error;
+  
+  lsh_bucket *bucket = lsh_band_find(band, key);
+  if(!bucket->rows) {
+    if(!(bucket->rows = (u_int64_t *) malloc(LSH_MIN_BUCKET_ROWS * sizeof(u_int64_t))))
+      return MEMORY_ERROR;
+    bucket->key = key;
+    bucket->capacity = LSH_MIN_BUCKET_ROWS;
+    band->used++;
+  } else if(bucket->count == bucket->capacity) {
+    u_int64_t *rows = (u_int64_t *) realloc(bucket->rows, bucket->capacity * 2 * sizeof(u_int64_t));
+    if(!rows) return MEMORY_ERROR;
+    bucket->rows = rows;
+    bucket->capacity *= 2;
+  }
+  
+  bucket->rows[bucket->count++] = row;
+  return NO_ERROR;
+}
+
+// rows within a bucket are unordered, so the last row fills the gap
+static void lsh_band_remove(lsh_band *band, u_int64_t key, u_int64_t row) {
+  if(!band->buckets) return;
+  lsh_bucket *bucket = lsh_band_find(band, key);
+  for(u_int32_t i = 0; i < bucket->count; i++) {
+    if(bucket->rows[i] != row) continue;
+    bucket->rows[i] = bucket->rows[--bucket->count];
+    return;
+  }
+}
+
+
+// ------------------------------------------
+// index
+// ------------------------------------------
+learner_error lsh_new(Matrix *matrix, lsh_parameters *parameters, lsh_index **index) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!parameters) return MISSING_VALUES;
+  if(matrix->values) return INVALID_MATRIX_STORAGE;
+  if(parameters->family != LSH_SIMHASH && parameters->family != LSH_MINHASH)
+    return INVALID_PARAMETERS;
+  if(parameters->bands == 0 || parameters->rows_per_band == 0 || parameters->bands > LSH_MAX_SIGNATURE_BITS || parameters->rows_per_band > LSH_MAX_SIGNATURE_BITS)
+    return INVALID_PARAMETERS;
+  u_int32_t bits = lsh_signature_bits(parameters);
+  if(parameters->family == LSH_SIMHASH && (parameters->rows_per_band > LSH_MAX_BAND_BITS || bits > LSH_MAX_SIGNATURE_BITS))
+    return INVALID_PARAMETERS;
+  if(parameters->family == LSH_MINHASH && bits > LSH_MAX_SIGNATURE_HASHES)
+    return INVALID_PARAMETERS;
+  
+  *index = (lsh_index *) calloc(1, sizeof(lsh_index));
+  if(!*index) return MEMORY_ERROR;
+  (*index)->bands = (lsh_band *) calloc(parameters->bands, sizeof(lsh_band));
+  if(!(*index)->bands) {
+    free(*index);
+    *index = NULL;
+    return MEMORY_ERROR;
+  }
+  
+  (*index)->matrix = matrix;
+  (*index)->parameters = *parameters;
+  if(parameters->family == LSH_SIMHASH)
+    (*index)->signature_bytes = ((bits + 63) / 64) * sizeof(u_int64_t);
+  else
+    (*index)->signature_bytes = ((bits + 1) / 2) * sizeof(u_int64_t);
+  return NO_ERROR;
+}
+
+
+learner_error lsh_free(lsh_index *index) {
+  if(!index) return MISSING_VALUES;
+  for(u_int32_t b = 0; b < index->parameters.bands; b++) {
+    for(u_int64_t i = 0; i < index->bands[b].capacity; i++)
+      free(index->bands[b].buckets[i].rows);
+    free(index->bands[b].buckets);
+  }
+  free(index->bands);
+  free(index->signatures);
+  free(index->present);
+  free(index);
+  return NO_ERROR;
+}
+
+
+// the signature and present tables grow to cover row, doubling like
+// the matrix's rows table
+static learner_error lsh_reserve_rows(lsh_index *index, u_int64_t row) {
+  if(row < index->row_capacity) return NO_ERROR;
+  u_int64_t capacity = index->row_capacity ? index->row_capacity * 2 : LEARNER_DEFAULT_BUFFER_DELTA;
+  if(capacity <= row) capacity = row + 1;
+  
+  u_int8_t *signatures = (u_int8_t *) realloc(index->signatures, capacity * index->signature_bytes);
+  if(signatures) index->signatures = signatures;
+  u_int8_t *present = (u_int8_t *) realloc(index->present, capacity);
+  if(present) index->present = present;
+  if(!signatures || !present) return MEMORY_ERROR;
+  
+  memset(index->present + index->row_capacity, 0, capacity - index->row_capacity);
+  index->row_capacity = capacity;
+  return NO_ERROR;
+}
+
+// rows with no values have no similarity to anything, so they're
+// recorded as present but never become candidates
+static learner_error lsh_add_bands(lsh_index *index, u_int64_t row, SparseVector *vector) {
+  u_int64_t *signature = lsh_signature_of(index, row);
+  learner_error error;
+  index->present[row] = 1;
+  index->rows++;
+  if(vector->header.count == 0) return NO_ERROR;
+  for(u_int32_t b = 0; b < index->parameters.bands; b++)
+    if((error = lsh_band_add(&index->bands[b], lsh_band_key(&index->parameters, signature, b), row)))
+      return error;
+  return NO_ERROR;
+}
+
+
+learner_error lsh_delete(lsh_index *index, u_int64_t row) {
+  if(!index) return MISSING_VALUES;
+  if(row >= index->row_capacity || !index->present[row]) return NO_ERROR;
+  u_int64_t *signature = lsh_signature_of(index, row);
+  for(u_int32_t b = 0; b < index->parameters.bands; b++)
+    lsh_band_remove(&index->bands[b], lsh_band_key(&index->parameters, signature, b), row);
+  index->present[row] = 0;
+  index->rows--;
+  return NO_ERROR;
+}
+
+
+learner_error lsh_insert(lsh_index *index, u_int64_t row) {
+  if(!index) return MISSING_VALUES;
+  SparseVector *vector;
+  learner_error error = matrix_get_row(index->matrix, row, &vector);
+  if(error) return error;
+  if((error = lsh_reserve_rows(index, row)))
+    return error;
+  
+  lsh_delete(index, row);
+  lsh_signature(&index->parameters, vector, lsh_signature_of(index, row));
+  return lsh_add_bands(index, row, vector);
+}
+
+
+// signatures are independent, so they're computed in parallel; the
+// band tables are then filled by a single thread
+static void lsh_sign_rows(void *context, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  lsh_index *index = (lsh_index *) context;
+  Matrix *matrix = index->matrix;
+  for(u_int64_t row = start; row < end; row++)
+    if(matrix->row_vectors[row])
+      lsh_signature(&index->parameters, matrix->row_vectors[row], lsh_signature_of(index, row));
+}
+
+learner_error lsh_insert_all(lsh_index *index) {
+  if(!index) return MISSING_VALUES;
+  Matrix *matrix = index->matrix;
+  u_int64_t rows = (matrix->rows < matrix->row_capacity) ? matrix->rows : matrix->row_capacity;
+  learner_error error;
+  if(rows == 0 || !matrix->row_vectors) return NO_ERROR;
+  if((error = lsh_reserve_rows(index, rows - 1)))
+    return error;
+  
+  for(u_int64_t row = 0; row < rows; row++)
+    if(matrix->row_vectors[row])
+      lsh_delete(index, row);
+  
+  u_int32_t threads = (rows >= LSH_PARALLEL_THRESHOLD) ? learner_default_threads(index->parameters.threads) : 1;
+  if((error = learner_parallel_for(rows, threads, 64, lsh_sign_rows, index)))
+    return error;
+  
+  for(u_int64_t row = 0; row < rows; row++)
+    if(matrix->row_vectors[row] && (error = lsh_add_bands(index, row, matrix->row_vectors[row])))
+      return error;
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// queries
+// ------------------------------------------
+// jaccard similarity of the index sets of two vectors, by merging
+static float lsh_jaccard(SparseVector *v1, SparseVector *v2) {
+  u_int64_t i = 0, j = 0, common = 0, count1 = v1->header.count, count2 = v2->header.count;
+  if(count1 + count2 == 0) return NAN;
+  while(i < count1 && j < count2) {
+    u_int32_t a = sparse_vector_index_at(v1, i), b = sparse_vector_index_at(v2, j);
+    if(a == b) {
+      common++;
+      i++;
+      j++;
+    } else if(a < b) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+  return (float) common / (float) (count1 + count2 - common);
+}
+
+static int lsh_compare_descending(const void *a, const void *b) {
+  const knn_result *x = (const knn_result *) a, *y = (const knn_result *) b;
+  if(x->score != y->score) return (x->score > y->score) ? -1 : 1;
+  return (x->row < y->row) ? -1 : (x->row > y->row);
+}
+
+learner_error lsh_query(lsh_index *index, column_accumulator *accumulator, SparseVector *query, u_int32_t k, knn_result *results, u_int32_t *found) {
+  if(!index || !accumulator || !results) return MISSING_VALUES;
+  if(!query) return MISSING_VECTOR;
+  lsh_parameters *parameters = &index->parameters;
+  u_int64_t signature[LSH_MAX_SIGNATURE_HASHES / 2];
+  learner_error error;
+  SparseVector *row;
+  *found = 0;
+  
+  if((error = column_accumulator_start(accumulator, index->row_capacity)))
+    return error;
+  if(k == 0 || query->header.count == 0 || index->rows == 0) return NO_ERROR;
+  
+  // rows sharing any band with the query, each listed once
+  lsh_signature(parameters, query, signature);
+  u_int32_t stamp = accumulator->stamp, *stamps = accumulator->stamps;
+  u_int64_t *candidates = accumulator->rows, count = 0;
+  for(u_int32_t b = 0; b < parameters->bands; b++) {
+    lsh_band *band = &index->bands[b];
+    if(!band->buckets) continue;
+    lsh_bucket *bucket = lsh_band_find(band, lsh_band_key(parameters, signature, b));
+    for(u_int32_t i = 0; i < bucket->count; i++) {
+      if(stamps[bucket->rows[i]] == stamp) continue;
+      stamps[bucket->rows[i]] = stamp;
+      candidates[count++] = bucket->rows[i];
+    }
+  }
+  accumulator->count = count;
+  if(count == 0) return NO_ERROR;
+  
+  // candidates are filtered by their estimated similarity, then
+  // scored exactly and sorted
+  knn_result *scored = (knn_result *) malloc(count * sizeof(knn_result));
+  if(!scored) return MEMORY_ERROR;
+  u_int32_t words = index->signature_bytes / sizeof(u_int64_t);
+  u_int64_t kept = 0;
+  float score;
+  
+  for(u_int64_t i = 0; i < count; i++) {
+    u_int64_t id = candidates[i];
+    if(parameters->family == LSH_SIMHASH && lsh_hamming(signature, lsh_signature_of(index, id), words) > parameters->max_hamming)
+      continue;
+    if(matrix_get_row(index->matrix, id, &row) != NO_ERROR)
+      continue;
+    if(parameters->family == LSH_SIMHASH)
+      sparse_vector_cosine_similarity(query, row, &score);
+    else
+      score = lsh_jaccard(query, row);
+    if(isnan(score)) continue;
+    scored[kept].row   = id;
+    scored[kept].score = score;
+    kept++;
+  }
+  
+  qsort(scored, kept, sizeof(knn_result), lsh_compare_descending);
+  *found = (kept < k) ? kept : k;
+  memcpy(results, scored, *found * sizeof(knn_result));
+  free(scored);
+  return NO_ERROR;
+}
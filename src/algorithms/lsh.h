@@ -0,0 +1,96 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/sparse_vector.h"
+#include "structures/column_index.h"
+#include "algorithms/knn.h"
+
+#ifndef __learner_lsh__
+#define __learner_lsh__
+
+// locality sensitive hashing of the sparse rows of a matrix, for
+// approximate similarity search. simhash signatures are the signs
+// of random projections, so the fraction of differing bits estimates
+// the angle between vectors (cosine similarity). minhash signatures
+// are the minimum of random hashes of the indexes, so the fraction
+// of equal values estimates the jaccard similarity of the index sets
+// (values are ignored). projections and hashes are derived from the
+// column number and seed, so nothing is stored per column.
+//
+// signatures are split in to bands of rows_per_band bits (simhash)
+// or hashes (minhash). rows whose signatures agree on every position
+// of any band are candidates; more bands raise recall, more rows per
+// band raise precision. candidates are re-ranked exactly.
+typedef enum {
+  LSH_SIMHASH,
+  LSH_MINHASH
+} lsh_family;
+extern char *lsh_family_names[];
+
+#define LSH_MAX_SIGNATURE_BITS    1024
+#define LSH_MAX_SIGNATURE_HASHES  256
+#define LSH_MAX_BAND_BITS         64
+
+typedef struct {
+  lsh_family  family;
+  u_int32_t   bands;
+  u_int32_t   rows_per_band;
+  
+  // simhash candidates whose signatures differ from the query's in
+  // more than this many bits are dropped before re-ranking; set to
+  // bands * rows_per_band to re-rank every candidate
+  u_int32_t   max_hamming;
+  u_int64_t   seed;
+  
+  // threads computing signatures in lsh_insert_all (0 for
+  // LEARNER_CORES); small matrices are signed on the calling thread
+  u_int32_t   threads;
+} lsh_parameters;
+
+// each band is an open addressed hash table of buckets, keyed by a
+// hash of the band's part of the signature
+typedef struct {
+  u_int64_t key;
+  u_int64_t *rows;
+  u_int32_t count;
+  u_int32_t capacity;
+} lsh_bucket;
+
+typedef struct {
+  lsh_bucket  *buckets;
+  u_int64_t   capacity;
+  u_int64_t   used;
+} lsh_band;
+
+typedef struct {
+  Matrix          *matrix;
+  lsh_parameters  parameters;
+  lsh_band        *bands;
+  
+  // signatures by row, and whether each row is in the index
+  u_int8_t        *signatures;
+  u_int8_t        *present;
+  u_int32_t       signature_bytes;
+  u_int64_t       row_capacity;
+  u_int64_t       rows;
+} lsh_index;
+
+// rows are hashed from matrix, which must outlive the index
+learner_error lsh_new(Matrix *matrix, lsh_parameters *parameters, lsh_index **index);
+learner_error lsh_free(lsh_index *index);
+
+// inserting a row already in the index rehashes it, so rows changed
+// since being inserted can be updated. lsh_insert_all inserts every
+// row set on the matrix, computing signatures in parallel.
+learner_error lsh_insert(lsh_index *index, u_int64_t row);
+learner_error lsh_insert_all(lsh_index *index);
+learner_error lsh_delete(lsh_index *index, u_int64_t row);
+
+// the (at most) k candidates most similar to query, best first, with
+// scores from sparse_vector_cosine_similarity (simhash) or the exact
+// jaccard similarity of the index sets (minhash). candidates are
+// collected in accumulator (one per thread, see column_index.h),
+// whose count is left as the number of candidates found by banding.
+learner_error lsh_query(lsh_index *index, column_accumulator *accumulator, SparseVector *query, u_int32_t k, knn_result *results, u_int32_t *found);
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "algorithms/sgd.h"
+#include "structures/vector_kernels.h"
+
+// weights are shrunk (at the end of an epoch) in ranges of this many
+#define SGD_GRANULARITY     4096
+
+// per thread loss sums, padded to a cache line so threads don't
+// write to the same line
+typedef struct {
+  double    loss;
+  char      padding[56];
+} sgd_counters;
+
+typedef struct {
+  Matrix          *matrix;
+  float           *labels;
+  Vector          *weights;
+  sgd_parameters  *parameters;
+  u_int32_t       threads;
+  u_int32_t       batch;
+  u_int64_t       random;
+  
+  // the rows set, shuffled each epoch
+  u_int64_t       *order;
+  u_int64_t       count;
+  
+  // steps (batches) taken this epoch, and the step each weight was
+  // last shrunk at. the shrinking of a step is rate * lambda.
+  u_int64_t       step;
+  u_int64_t       *stamps;
+  float           rate;
+  double          shrink;
+  
+  // per thread batch scratch space (the gradient scale of each row)
+  // and loss sums
+  float           *scales;
+  sgd_counters    *counters;
+} sgd_context;
+
+
+// ------------------------------------------
+// losses
+// ------------------------------------------
+// splitmix64, stepping through the seed's sequence
+static u_int64_t sgd_random(sgd_context *context) {
+  u_int64_t x = (context->random += 0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+#define sgd_label(context, r) (((context)->labels[r] > 0.0) ? 1.0 : -1.0)
+
+// log(1 + e^-z) without overflowing for large |z|
+static double sgd_loss_of(sgd_loss loss, double z) {
+  if(loss == SGD_HINGE)
+    return (z < 1.0) ? 1.0 - z : 0.0;
+  return (z > 0.0) ? log1p(exp(-z)) : log1p(exp(z)) - z;
+}
+
+// the derivative of the loss by z = y x.w
+static float sgd_gradient_of(sgd_loss loss, float z) {
+  if(loss == SGD_HINGE)
+    return (z < 1.0) ? -1.0 : 0.0;
+  return -1.0 / (1.0 + expf(z));
+}
+
+
+// ------------------------------------------
+// training
+// ------------------------------------------
+// weight *= factor by compare and swap, so threads shrinking a weight
+// at once don't lose either shrink (gradient updates are still racy)
+static void sgd_shrink(float *weight, float factor) {
+  union {float value; u_int32_t bits;} current, shrunk;
+  do {
+    current.value = *weight;
+    shrunk.value  = current.value * factor;
+  } while(!__sync_bool_compare_and_swap((u_int32_t *) weight, current.bits, shrunk.bits));
+}
+
+// shrinks the weights a row reads by the steps they've missed. a
+// weight's stamp is advanced by compare and swap, so each step's
+// shrink is only applied by one thread.
+static void sgd_catch_up(sgd_context *context, SparseVector *row, u_int64_t step) {
+  float *weights = context->weights->values;
+  for(u_int64_t i = 0; i < row->header.count; i++) {
+    u_int32_t index = sparse_vector_index_at(row, i);
+    u_int64_t stamp = context->stamps[index];
+    if(stamp < step && __sync_val_compare_and_swap(&context->stamps[index], stamp, step) == stamp)
+      sgd_shrink(&weights[index], (float) exp(context->shrink * (double) (step - stamp)));
+  }
+}
+
+// margins for every row of a batch are found before any are added
+// to the weights, so each is a gradient at the same point
+static void sgd_train_batches(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  sgd_context *context = (sgd_context *) param;
+  sgd_loss loss = context->parameters->loss;
+  float *scales = context->scales + ((u_int64_t) thread * context->batch);
+  SparseVector *row;
+  float margin;
+  
+  for(u_int64_t b = start; b < end; b++) {
+    u_int64_t first = b * context->batch;
+    u_int64_t last  = (first + context->batch < context->count) ? first + context->batch : context->count;
+    u_int64_t step  = __sync_fetch_and_add(&context->step, 1);
+    
+    for(u_int64_t i = first; i < last; i++) {
+      u_int64_t r = context->order[i];
+      float y = sgd_label(context, r);
+      matrix_get_row(context->matrix, r, &row);
+      sgd_catch_up(context, row, step);
+      sparse_vector_dense_dot_product(row, context->weights, &margin);
+      context->counters[thread].loss += sgd_loss_of(loss, y * margin);
+      scales[i - first] = -context->rate * y * sgd_gradient_of(loss, y * margin) / (float) (last - first);
+    }
+    
+    for(u_int64_t i = first; i < last; i++) {
+      if(scales[i - first] == 0.0) continue;
+      matrix_get_row(context->matrix, context->order[i], &row);
+      sparse_vector_dense_axpy(scales[i - first], row, context->weights);
+    }
+  }
+}
+
+// brings every weight up to date with the epoch's steps, so the next
+// epoch (with a new rate) starts its stamps from 0
+static void sgd_shrink_all(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  sgd_context *context = (sgd_context *) param;
+  float *weights = context->weights->values;
+  for(u_int64_t j = start; j < end; j++) {
+    if(context->stamps[j] < context->step)
+      weights[j] *= (float) exp(context->shrink * (double) (context->step - context->stamps[j]));
+    context->stamps[j] = 0;
+  }
+}
+
+static void sgd_final_loss(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  sgd_context *context = (sgd_context *) param;
+  SparseVector *row;
+  float margin;
+  for(u_int64_t i = start; i < end; i++) {
+    u_int64_t r = context->order[i];
+    matrix_get_row(context->matrix, r, &row);
+    sparse_vector_dense_dot_product(row, context->weights, &margin);
+    context->counters[thread].loss += sgd_loss_of(context->parameters->loss, sgd_label(context, r) * margin);
+  }
+}
+
+// fisher-yates. a single pass over the row numbers, which is small
+// next to an epoch of training.
+static void sgd_shuffle(sgd_context *context) {
+  for(u_int64_t i = context->count - 1; i > 0; i--) {
+    u_int64_t j = sgd_random(context) % (i + 1);
+    u_int64_t r = context->order[i];
+    context->order[i] = context->order[j];
+    context->order[j] = r;
+  }
+}
+
+static double sgd_seconds(struct timespec *start, struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1e9);
+}
+
+static double sgd_loss_sum(sgd_context *context) {
+  double loss = 0.0;
+  for(u_int32_t t = 0; t < context->threads; t++) {
+    loss += context->counters[t].loss;
+    context->counters[t].loss = 0.0;
+  }
+  return loss;
+}
+
+static learner_error sgd_epochs(sgd_context *context, sgd_result *result) {
+  sgd_parameters *parameters = context->parameters;
+  u_int64_t batches = (context->count + context->batch - 1) / context->batch;
+  u_int64_t length  = context->weights->header.length;
+  u_int32_t epochs  = parameters->epochs ? parameters->epochs : SGD_DEFAULT_EPOCHS;
+  learner_error error = NO_ERROR;
+  struct timespec start, end;
+  
+  for(u_int32_t epoch = 0; epoch < epochs && !error; epoch++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    context->rate   = parameters->learning_rate / sqrtf(1.0 + epoch);
+    context->shrink = log1p(-(double) context->rate * parameters->lambda);
+    context->step   = 0;
+    sgd_shuffle(context);
+    
+    error = learner_parallel_for(batches, context->threads, 1, sgd_train_batches, context);
+    if(!error)
+      error = learner_parallel_for(length, context->threads, SGD_GRANULARITY, sgd_shrink_all, context);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    double seconds = sgd_seconds(&start, &end);
+    result->seconds  += seconds;
+    result->examples += context->count;
+    result->epochs++;
+    learner_log_with_format(DEBUG, "sgd epoch %u: mean loss %f, %.0f examples/sec", epoch + 1,
+      sgd_loss_sum(context) / context->count, context->count / seconds);
+  }
+  return error;
+}
+
+
+// ------------------------------------------
+// public
+// ------------------------------------------
+learner_error matrix_sgd_train(Matrix *matrix, float *labels, Vector *weights, sgd_parameters *parameters, sgd_result *result) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!weights) return MISSING_VECTOR;
+  if(!labels) return MISSING_VALUES;
+  if(matrix->values) return INVALID_MATRIX_STORAGE;
+  if(weights->quantized) return QUANTIZED_VECTOR;
+  if(!parameters || !result || parameters->learning_rate <= 0.0 || parameters->lambda < 0.0 ||
+     parameters->learning_rate * parameters->lambda >= 1.0 ||
+     (parameters->loss != SGD_LOGISTIC && parameters->loss != SGD_HINGE))
+    return INVALID_PARAMETERS;
+  
+  sgd_context context = {0};
+  learner_error error = NO_ERROR;
+  SparseVector *row;
+  context.matrix      = matrix;
+  context.labels      = labels;
+  context.weights     = weights;
+  context.parameters  = parameters;
+  context.threads     = learner_default_threads(parameters->threads);
+  context.batch       = parameters->batch ? parameters->batch : SGD_DEFAULT_BATCH;
+  context.random      = parameters->seed;
+  memset(result, 0, sizeof(sgd_result));
+  
+  context.order = (u_int64_t *) malloc((matrix->rows ? matrix->rows : 1) * sizeof(u_int64_t));
+  if(!context.order) return MEMORY_ERROR;
+  for(u_int64_t r = 0; r < matrix->rows && !error; r++) {
+    if(matrix_get_row(matrix, r, &row) != NO_ERROR) continue;
+    if(row->header.count && row->header.max_index >= weights->header.length)
+      error = INDEX_OUT_OF_RANGE;
+    context.order[context.count++] = r;
+  }
+  if(!error && context.count == 0)
+    error = INVALID_PARAMETERS;
+  
+  if(!error) {
+    context.stamps   = (u_int64_t *) calloc(weights->header.length, sizeof(u_int64_t));
+    context.scales   = (float *) malloc((u_int64_t) context.threads * context.batch * sizeof(float));
+    context.counters = (sgd_counters *) calloc(context.threads, sizeof(sgd_counters));
+    if(!context.stamps || !context.scales || !context.counters)
+      error = MEMORY_ERROR;
+  }
+  
+  if(!error) {
+    weights->header._frozen = VECTOR_UNFROZEN;
+    error = sgd_epochs(&context, result);
+  }
+  if(!error)
+    error = learner_parallel_for(context.count, context.threads, SGD_GRANULARITY, sgd_final_loss, &context);
+  
+  if(!error) {
+    float squares = vector_kernels.sum_of_squares(weights->values, weights->header.length);
+    result->loss = (sgd_loss_sum(&context) / context.count) + (parameters->lambda / 2.0) * squares;
+    result->examples_per_second = result->seconds > 0.0 ? result->examples / result->seconds : 0.0;
+  }
+  
+  free(context.order);
+  free(context.stamps);
+  free(context.scales);
+  free(context.counters);
+  return error;
+}
+
+learner_error sgd_predict(Vector *weights, sgd_loss loss, SparseVector *row, float *score) {
+  if(!weights || !row) return MISSING_VECTOR;
+  if(weights->quantized) return QUANTIZED_VECTOR;
+  learner_error error = sparse_vector_dense_dot_product(row, weights, score);
+  if(!error && loss == SGD_LOGISTIC)
+    *score = 1.0 / (1.0 + expf(-*score));
+  return error;
+}
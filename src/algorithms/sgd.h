@@ -0,0 +1,71 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/vector.h"
+#include "structures/sparse_vector.h"
+
+#ifndef __learner_sgd__
+#define __learner_sgd__
+
+// stochastic gradient descent training of linear models over the
+// sparse rows of a matrix, with a label per row. threads update one
+// shared dense weight vector without locks (hogwild): rows are sparse,
+// so threads rarely write the same weights, and a lost update only
+// costs a little progress.
+//
+// each epoch shuffles the rows and splits them in to mini-batches,
+// spread across threads. margins for a batch are computed against the
+// weights as they are, then each row's gradient is added to the
+// weights it touches. l2 regularisation shrinks every weight each
+// step; rather than touching every weight, a weight is shrunk by the
+// steps it missed only when a row next reads it (and every weight at
+// the end of an epoch).
+#define SGD_DEFAULT_EPOCHS        10
+#define SGD_DEFAULT_BATCH         64
+
+typedef enum {
+  SGD_LOGISTIC,   // log(1 + e^-yx.w): logistic regression
+  SGD_HINGE       // max(0, 1 - yx.w): a linear svm
+} sgd_loss;
+
+typedef struct {
+  sgd_loss    loss;
+  
+  // 0 for SGD_DEFAULT_EPOCHS and SGD_DEFAULT_BATCH
+  u_int32_t   epochs;
+  u_int32_t   batch;
+  
+  // the step size of epoch e is learning_rate / sqrt(1 + e)
+  float       learning_rate;
+  float       lambda;
+  u_int64_t   seed;
+  
+  // 0 for LEARNER_CORES
+  u_int32_t   threads;
+} sgd_parameters;
+
+typedef struct {
+  // the mean loss over every row once trained, plus lambda / 2 |w|^2
+  double      loss;
+  u_int32_t   epochs;
+  
+  // rows trained on (rows set, times epochs), and rows trained on
+  // per second of training, not counting the final loss pass
+  u_int64_t   examples;
+  double      seconds;
+  double      examples_per_second;
+} sgd_result;
+
+// trains weights (which may start at 0, or at an earlier model) on
+// the rows of a sparse matrix. labels has a value per row: rows with
+// labels above 0 are positive, others negative; unset rows are
+// skipped. weights must be longer than the largest column index;
+// for an intercept, give every row a constant column. dense matrices
+// are an INVALID_MATRIX_STORAGE error.
+learner_error matrix_sgd_train(Matrix *matrix, float *labels, Vector *weights, sgd_parameters *parameters, sgd_result *result);
+
+// the margin x.w of a row, and for logistic models the probability
+// the row is positive (the margin for svms)
+learner_error sgd_predict(Vector *weights, sgd_loss loss, SparseVector *row, float *score);
+
+#endif
@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "algorithms/similarity.h"
+#include "structures/sparse_vector.h"
+#include "structures/vector_block.h"
+#include "structures/vector_kernels.h"
+
+// a row's results over every candidate tile, reported once complete
+typedef struct {
+  knn_result  *results;
+  u_int32_t   count;
+  u_int32_t   capacity;
+} similarity_list;
+
+typedef struct {
+  Matrix                *matrix;
+  similarity_parameters *parameters;
+  similarity_callback   callback;
+  void                  *callback_context;
+  pthread_mutex_t       lock;
+  learner_error         error;
+  
+  // tile t is rows [tiles[t], tiles[t + 1]). threads take the next
+  // unscored tile of rows until none are left, as tiles near the end
+  // have fewer candidates when each pair is only scored once.
+  u_int64_t             *tiles;
+  u_int64_t             tile_count;
+  u_int64_t             next_tile;
+  u_int64_t             widest;
+  
+  // per row magnitudes, and for sparse rows the largest absolute
+  // value and sum of absolute values used to bound dot products
+  float                 *magnitudes;
+  float                 *maxima;
+  float                 *sums;
+} similarity_context;
+
+// per thread results for the rows of one tile
+typedef struct {
+  knn_heap        *heaps;
+  knn_result      *storage;
+  similarity_list *lists;
+  float           *scores;
+} similarity_scratch;
+
+
+// ------------------------------------------
+// preparation
+// ------------------------------------------
+static void similarity_row_bounds(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  similarity_context *context = (similarity_context *) param;
+  Matrix *matrix = context->matrix;
+  SparseVector *row;
+  float value;
+  
+  for(u_int64_t r = start; r < end; r++) {
+    if(matrix->values) {
+      context->magnitudes[r] = sqrtf(vector_kernels.sum_of_squares(matrix->values + (r * matrix->stride), matrix->stride));
+      continue;
+    }
+    context->magnitudes[r] = context->maxima[r] = context->sums[r] = 0.0;
+    if(matrix_get_row(matrix, r, &row) != NO_ERROR) continue;
+    for(int i = 0, count = row->header.count; i < count; i++) {
+      value = fabsf(sparse_vector_value_at(row, i));
+      context->sums[r] += value;
+      if(value > context->maxima[r])
+        context->maxima[r] = value;
+    }
+    if(row->header.frozen)
+      context->magnitudes[r] = row->header.magnitude;
+    else
+      sparse_vector_magnitude(row, &context->magnitudes[r]);
+  }
+}
+
+// rows are added to a tile until it holds SIMILARITY_TILE_BYTES
+static learner_error similarity_tiles(similarity_context *context) {
+  Matrix *matrix = context->matrix;
+  SparseVector *row;
+  u_int64_t bytes = 0, rows = 0;
+  context->tiles = (u_int64_t *) malloc((matrix->rows + 1) * sizeof(u_int64_t));
+  if(!context->tiles) return MEMORY_ERROR;
+  
+  context->tiles[0] = 0;
+  for(u_int64_t r = 0; r < matrix->rows; r++) {
+    u_int64_t row_bytes = matrix->stride * sizeof(float);
+    if(!matrix->values)
+      row_bytes = sizeof(SparseVector) + ((matrix_get_row(matrix, r, &row) == NO_ERROR) ? row->header.count * sizeof(sparse_vector_value) : 0);
+    if(rows > 0 && bytes + row_bytes > SIMILARITY_TILE_BYTES) {
+      context->tiles[++context->tile_count] = r;
+      bytes = rows = 0;
+    }
+    bytes += row_bytes;
+    rows++;
+    if(rows > context->widest)
+      context->widest = rows;
+  }
+  context->tiles[++context->tile_count] = matrix->rows;
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// scoring
+// ------------------------------------------
+static void similarity_accept(similarity_context *context, similarity_scratch *scratch, u_int64_t slot, u_int64_t row, float score) {
+  if(context->parameters->k) {
+    knn_heap_push(&scratch->heaps[slot], row, score);
+    return;
+  }
+  similarity_list *list = &scratch->lists[slot];
+  if(list->count == list->capacity) {
+    u_int32_t capacity = list->capacity ? list->capacity * 2 : 16;
+    knn_result *results = (knn_result *) realloc(list->results, capacity * sizeof(knn_result));
+    if(!results) {
+      context->error = MEMORY_ERROR;
+      return;
+    }
+    list->results  = results;
+    list->capacity = capacity;
+  }
+  list->results[list->count].row = row;
+  list->results[list->count].score = score;
+  list->count++;
+}
+
+// the lowest score a candidate for row slot could be accepted with
+static inline float similarity_floor(similarity_context *context, similarity_scratch *scratch, u_int64_t slot) {
+  float floor = context->parameters->threshold;
+  if(context->parameters->k) {
+    knn_heap *heap = &scratch->heaps[slot];
+    if(heap->count == heap->k && heap->results[0].score > floor)
+      floor = heap->results[0].score;
+  }
+  return floor;
+}
+
+static void similarity_score_sparse(similarity_context *context, similarity_scratch *scratch, u_int64_t first, u_int64_t i, u_int64_t start, u_int64_t end) {
+  learner_metric metric = context->parameters->metric;
+  SparseVector *a, *b;
+  float dot, score, denominator = 1.0, bound;
+  if(matrix_get_row(context->matrix, i, &a) != NO_ERROR || a->header.count == 0) return;
+  if(metric == COSINE_SIMILARITY && context->magnitudes[i] == 0.0) return;
+  
+  for(u_int64_t j = start; j < end; j++) {
+    if(j == i || (context->parameters->k == 0 && j < i)) continue;
+    if(matrix_get_row(context->matrix, j, &b) != NO_ERROR || b->header.count == 0) continue;
+    if(a->header.max_index < b->header.min_index || b->header.max_index < a->header.min_index) continue;
+    if(metric == COSINE_SIMILARITY) {
+      denominator = context->magnitudes[i] * context->magnitudes[j];
+      if(denominator == 0.0) continue;
+    }
+    
+    // as with knn searches, bounds only exclude candidates when they
+    // miss by more than the kernels' rounding error
+    bound = fminf(context->maxima[i] * context->sums[j], context->maxima[j] * context->sums[i]) / denominator;
+    if(bound + (VECTOR_KERNEL_TOLERANCE * bound) < similarity_floor(context, scratch, i - first)) continue;
+    sparse_vector_dot_product(a, b, &dot);
+    if(dot == 0.0) continue;
+    score = dot / denominator;
+    if(score >= context->parameters->threshold)
+      similarity_accept(context, scratch, i - first, j, score);
+  }
+}
+
+static void similarity_score_dense(similarity_context *context, similarity_scratch *scratch, u_int64_t first, u_int64_t i, u_int64_t start, u_int64_t end) {
+  Matrix *matrix = context->matrix;
+  learner_metric metric = context->parameters->metric;
+  float magnitude = context->magnitudes[i];
+  if(metric == COSINE_SIMILARITY && magnitude == 0.0) return;
+  if(context->parameters->k == 0 && start <= i)
+    start = i + 1;
+  if(start >= end) return;
+  
+  vector_block_score(matrix->values + (i * matrix->stride), magnitude * magnitude, matrix->values + (start * matrix->stride), matrix->stride, end - start, metric, scratch->scores);
+  for(u_int64_t j = start; j < end; j++) {
+    float score = scratch->scores[j - start];
+    if(j == i || isnan(score) || score < context->parameters->threshold) continue;
+    similarity_accept(context, scratch, i - first, j, score);
+  }
+}
+
+// results are sorted and reported a row at a time, in row order
+static void similarity_report(similarity_context *context, similarity_scratch *scratch, u_int64_t first, u_int64_t end) {
+  knn_heap list_heap;
+  for(u_int64_t i = first; i < end && !context->error; i++) {
+    knn_heap *heap = &scratch->heaps[i - first];
+    if(!context->parameters->k) {
+      similarity_list *list = &scratch->lists[i - first];
+      list_heap = (knn_heap) {list->results, list->count, list->count, context->parameters->metric};
+      heap = &list_heap;
+    }
+    if(heap->count == 0) continue;
+    knn_heap_sort(heap);
+    
+    pthread_mutex_lock(&context->lock);
+    if(!context->error) {
+      learner_error error = context->callback(context->callback_context, i, heap->results, heap->count);
+      if(error) context->error = error;
+    }
+    pthread_mutex_unlock(&context->lock);
+  }
+}
+
+static void similarity_work(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  // tiles are taken from a shared counter rather than the range
+  (void) start;
+  (void) end;
+  (void) thread;
+  similarity_context *context = (similarity_context *) param;
+  similarity_parameters *parameters = context->parameters;
+  u_int64_t widest = context->widest, tile;
+  similarity_scratch scratch = {0};
+  
+  if(parameters->k) {
+    scratch.heaps   = (knn_heap *) calloc(widest, sizeof(knn_heap));
+    scratch.storage = (knn_result *) malloc(widest * parameters->k * sizeof(knn_result));
+  } else {
+    scratch.lists   = (similarity_list *) calloc(widest, sizeof(similarity_list));
+  }
+  scratch.scores = (float *) malloc(widest * sizeof(float));
+  if((parameters->k && (!scratch.heaps || !scratch.storage)) || (!parameters->k && !scratch.lists) || !scratch.scores)
+    context->error = MEMORY_ERROR;
+  
+  while(!context->error && (tile = __sync_fetch_and_add(&context->next_tile, 1)) < context->tile_count) {
+    u_int64_t first = context->tiles[tile], last = context->tiles[tile + 1];
+    for(u_int64_t i = 0; i < last - first; i++) {
+      if(parameters->k)
+        scratch.heaps[i] = (knn_heap) {scratch.storage + (i * parameters->k), 0, parameters->k, parameters->metric};
+      else
+        scratch.lists[i].count = 0;
+    }
+    
+    // each pair is scored once when every pair is reported, so only
+    // tiles from this one onwards hold candidates
+    for(u_int64_t candidates = parameters->k ? 0 : tile; candidates < context->tile_count && !context->error; candidates++) {
+      for(u_int64_t i = first; i < last; i++) {
+        if(context->matrix->values)
+          similarity_score_dense(context, &scratch, first, i, context->tiles[candidates], context->tiles[candidates + 1]);
+        else
+          similarity_score_sparse(context, &scratch, first, i, context->tiles[candidates], context->tiles[candidates + 1]);
+      }
+    }
+    similarity_report(context, &scratch, first, last);
+  }
+  
+  if(scratch.lists)
+    for(u_int64_t i = 0; i < widest; i++)
+      free(scratch.lists[i].results);
+  free(scratch.lists);
+  free(scratch.heaps);
+  free(scratch.storage);
+  free(scratch.scores);
+}
+
+
+learner_error matrix_all_pairs_similarity(Matrix *matrix, similarity_parameters *parameters, similarity_callback callback, void *callback_context) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!parameters || !callback) return INVALID_PARAMETERS;
+  if(parameters->metric == EUCLIDEAN_DISTANCE) return INVALID_PARAMETERS;
+  if(matrix->rows == 0) return NO_ERROR;
+  u_int32_t threads = learner_default_threads(parameters->threads);
+  learner_error error;
+  
+  similarity_context context = {0};
+  context.matrix           = matrix;
+  context.parameters       = parameters;
+  context.callback         = callback;
+  context.callback_context = callback_context;
+  context.magnitudes = (float *) malloc(matrix->rows * sizeof(float));
+  context.maxima     = (float *) malloc(matrix->rows * sizeof(float));
+  context.sums       = (float *) malloc(matrix->rows * sizeof(float));
+  if(!context.magnitudes || !context.maxima || !context.sums)
+    error = MEMORY_ERROR;
+  else
+    error = similarity_tiles(&context);
+  
+  if(!error)
+    error = learner_parallel_for(matrix->rows, threads, 1024, similarity_row_bounds, &context);
+  if(!error) {
+    pthread_mutex_init(&context.lock, NULL);
+    error = learner_parallel_for(threads, threads, 1, similarity_work, &context);
+    pthread_mutex_destroy(&context.lock);
+  }
+  
+  free(context.tiles);
+  free(context.magnitudes);
+  free(context.maxima);
+  free(context.sums);
+  return error ? error : context.error;
+}
+
+
+learner_error similarity_write_pairs(void *context, u_int64_t row, knn_result *results, u_int32_t count) {
+  FILE *file = (FILE *) context;
+  for(u_int32_t i = 0; i < count; i++)
+    if(fprintf(file, "%llu\t%llu\t%f\n", (unsigned long long) row, (unsigned long long) results[i].row, results[i].score) < 0)
+      return FILE_IO_ERROR;
+  return NO_ERROR;
+}
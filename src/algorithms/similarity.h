@@ -0,0 +1,49 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/metric.h"
+#include "algorithms/knn.h"
+
+#ifndef __learner_similarity__
+#define __learner_similarity__
+
+// rows are compared a tile at a time: a tile of rows is scored against
+// each tile of candidate rows in turn, with tiles sized so both fit in
+// L2 together. tiles are at least one row.
+#define SIMILARITY_TILE_BYTES   (96 * 1024)
+
+typedef struct {
+  // dot product or cosine similarity; larger scores are better
+  learner_metric  metric;
+  
+  // pairs scoring below threshold are dropped, as are sparse pairs
+  // scoring 0 (rows with no column in common)
+  float           threshold;
+  
+  // 0 reports every pair above the threshold once, listed under the
+  // lower row number. otherwise each row's best k other rows are
+  // reported, so pairs are listed under both rows.
+  u_int32_t       k;
+  
+  // 0 for LEARNER_CORES
+  u_int32_t       threads;
+} similarity_parameters;
+
+// called once per row with its results, best first. rows are reported
+// in no particular order, but calls are serialised so callbacks don't
+// need to be thread safe. rows with no results aren't reported, and
+// results is only valid during the call. returning an error stops the
+// job, which returns that error.
+typedef learner_error (*similarity_callback)(void *context, u_int64_t row, knn_result *results, u_int32_t count);
+
+// compares every pair of rows of a sparse or dense matrix, streaming
+// the results to callback, so memory use is independent of the number
+// of pairs. sparse rows use cached magnitudes when frozen. candidates
+// are skipped without being scored when bounded below the threshold
+// (or the worst of a row's best k) by |a.b| <= max|a| * sum|b|.
+learner_error matrix_all_pairs_similarity(Matrix *matrix, similarity_parameters *parameters, similarity_callback callback, void *context);
+
+// a callback writing "row\tother\tscore" lines to a FILE * context
+learner_error similarity_write_pairs(void *context, u_int64_t row, knn_result *results, u_int32_t count);
+
+#endif
@@ -0,0 +1,19 @@
+#include "core/cpu.h"
+
+learner_cpu_level learner_cpu_detect() {
+#ifdef LEARNER_X86_SIMD
+  // __builtin_cpu_supports reads cpuid (and xgetbv for the avx
+  // levels, so we don't select a level the OS doesn't save
+  // register state for). the avx levels also require the byte
+  // and half float extensions used by the quantized kernels;
+  // every processor shipping avx2 or avx-512bw has them.
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return CPU_AVX512;
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+    return CPU_AVX2;
+  if(__builtin_cpu_supports("sse2"))
+    return CPU_SSE2;
+#endif
+  return CPU_SCALAR;
+}
@@ -0,0 +1,26 @@
+#ifndef __learner_cpu__
+#define __learner_cpu__
+
+// simd kernels are only compiled for x86 processors; other
+// architectures always use the scalar implementations
+#if defined(__x86_64__) || defined(__i386__)
+#define LEARNER_X86_SIMD
+#endif
+
+// instruction set levels, ordered so a level implies all
+// levels below it are also available
+typedef enum {
+  CPU_SCALAR,
+  CPU_SSE2,
+  CPU_AVX2,
+  CPU_AVX512
+} learner_cpu_level;
+extern char *learner_cpu_level_names[];
+
+// the level detected by learner_initialize
+extern learner_cpu_level learner_cpu;
+
+// query cpuid for the highest level supported by this processor
+learner_cpu_level learner_cpu_detect();
+
+#endif
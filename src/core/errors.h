@@ -18,7 +18,17 @@ typedef enum {
   FILE_NOT_FOUND,
   FILE_IO_ERROR,
   PARSE_ERROR,
-  MISSING_MATRIX
+  MISSING_MATRIX,
+  UNSUPPORTED_CPU_LEVEL,
+  MEMORY_ERROR,
+  VECTOR_IS_VIEW,
+  INVALID_MATRIX_STORAGE,
+  INCOMPATIBLE_DIMENSIONS,
+  INVALID_QUANTIZATION,
+  QUANTIZED_VECTOR,
+  INVALID_ENCODING,
+  VECTOR_NOT_IN_MATRIX,
+  INVALID_PARAMETERS
 } learner_error;
 
 #endif
@@ -5,6 +5,10 @@
 // extern references resolved
 
 #include "logging.h"
+#include "cpu.h"
+#include "structures/metric.h"
+#include "structures/quantize.h"
+#include "structures/sparse_vector.h"
 #ifndef __learner_globals__
 #define __learner_globals__
 
@@ -27,7 +31,17 @@ char *learner_error_codes[] = {
   "file not found",
   "file IO error",
   "parse error",
-  "missing matrix"
+  "missing matrix",
+  "the requested instruction set is not supported by this cpu",
+  "unable to allocate memory",
+  "the vector is a view of values owned by another structure",
+  "the matrix does not use the storage this operation requires",
+  "matrix dimensions are not compatible",
+  "unknown quantization type",
+  "the vector is quantized and read only",
+  "the encoded vector is malformed or truncated",
+  "the vector was created on a different matrix",
+  "invalid parameters"
 };
 
 // ------------------------------------------
@@ -43,6 +57,48 @@ char *learner_logging_level_names[] = {
   " FATAL "
 };
 
+// ------------------------------------------
+// cpu
+// ------------------------------------------
+learner_cpu_level learner_cpu = CPU_SCALAR;
+char *learner_cpu_level_names[] = {
+  "scalar",
+  "sse2",
+  "avx2",
+  "avx-512"
+};
+
+// ------------------------------------------
+// metrics
+// ------------------------------------------
+char *learner_metric_names[] = {
+  "dot product",
+  "cosine similarity",
+  "euclidean distance"
+};
+
+// ------------------------------------------
+// quantization
+// ------------------------------------------
+char *quantization_type_names[] = {
+  "float32",
+  "float16",
+  "int8"
+};
+
+// ------------------------------------------
+// sparse vectors
+// ------------------------------------------
+u_int32_t sparse_vector_gallop_ratio = SPARSE_VECTOR_GALLOP_RATIO;
+
+// ------------------------------------------
+// locality sensitive hashing
+// ------------------------------------------
+char *lsh_family_names[] = {
+  "simhash",
+  "minhash"
+};
+
 // ------------------------------------------
 // distributed api
 // ------------------------------------------
@@ -13,5 +13,8 @@ learner_error learner_initialize() {
   }
   set_learner_logging_level(DEBUG);
   learner_logging_file = stderr;
+  
+  // select the fastest vector kernels this cpu supports
+  vector_kernels_initialize();
   return NO_ERROR;
 }
@@ -0,0 +1,72 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "core/logging.h"
+#include "core/threads.h"
+
+typedef struct {
+  learner_parallel_work work;
+  void                  *context;
+  u_int64_t             start;
+  u_int64_t             end;
+  u_int32_t             thread;
+} parallel_range;
+
+static void *run_parallel_range(void *param) {
+  parallel_range *range = (parallel_range *) param;
+  range->work(range->context, range->start, range->end, range->thread);
+  return NULL;
+}
+
+learner_error learner_parallel_for(u_int64_t count, u_int32_t threads, u_int64_t granularity, learner_parallel_work work, void *context) {
+  threads = learner_default_threads(threads);
+  if(granularity == 0) granularity = 1;
+  
+  // don't create threads that would have no work to do
+  u_int64_t units = (count + granularity - 1) / granularity;
+  if(units < threads) threads = units;
+  if(threads <= 1) {
+    if(count > 0) work(context, 0, count, 0);
+    return NO_ERROR;
+  }
+  
+  parallel_range *ranges = (parallel_range *) calloc(threads, sizeof(parallel_range));
+  pthread_t *handles = (pthread_t *) calloc(threads, sizeof(pthread_t));
+  int *started = (int *) calloc(threads, sizeof(int));
+  if(!ranges || !handles || !started) {
+    free(started);
+    free(handles);
+    free(ranges);
+    return MEMORY_ERROR;
+  }
+  
+  u_int64_t per_thread = (units / threads) * granularity, remainder = units % threads, start = 0;
+  for(u_int32_t i = 0; i < threads; i++) {
+    u_int64_t length = per_thread + ((i < remainder) ? granularity : 0);
+    ranges[i].work    = work;
+    ranges[i].context = context;
+    ranges[i].thread  = i;
+    ranges[i].start   = start;
+    ranges[i].end     = (start + length > count || i == threads - 1) ? count : start + length;
+    start = ranges[i].end;
+  }
+  
+  // if a thread can't be created its range is run on this thread
+  // once the others have been started
+  for(u_int32_t i = 1; i < threads; i++) {
+    started[i] = (pthread_create(&handles[i], NULL, run_parallel_range, &ranges[i]) == 0);
+    if(!started[i]) warn("Unable to create worker thread, running range on the calling thread");
+  }
+  
+  run_parallel_range(&ranges[0]);
+  for(u_int32_t i = 1; i < threads; i++) {
+    if(started[i])
+      pthread_join(handles[i], NULL);
+    else
+      run_parallel_range(&ranges[i]);
+  }
+  
+  free(started);
+  free(handles);
+  free(ranges);
+  return NO_ERROR;
+}
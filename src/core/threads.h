@@ -0,0 +1,21 @@
+#include <sys/types.h>
+#include "core/errors.h"
+
+#ifndef __learner_threads__
+#define __learner_threads__
+
+// work functions are called with a half open range [start, end) of
+// the items being processed and the number (0...threads - 1) of the
+// thread running it, so per thread scratch space can be indexed
+typedef void (*learner_parallel_work)(void *context, u_int64_t start, u_int64_t end, u_int32_t thread);
+
+// returns the thread count to use when the caller passes 0
+#define learner_default_threads(threads) ((threads) ? (threads) : LEARNER_CORES)
+
+// split count items in to contiguous ranges, one per thread, and
+// run work over each range. the calling thread processes the first
+// range itself and returns once every range is complete. ranges
+// are rounded to multiples of granularity (except the last).
+learner_error learner_parallel_for(u_int64_t count, u_int32_t threads, u_int64_t granularity, learner_parallel_work work, void *context);
+
+#endif
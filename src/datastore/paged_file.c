@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <math.h>
 
 // ------------------------------------------
@@ -103,21 +104,23 @@ pf_error paged_file_open(char *path, uint64_t page_size, paged_file **file) {
     // check the header format
     error_for((*file)->header.magic != PAGED_FILE_MAGIC_COOKIE, PF_WRONG_FORMAT);
     error_for((*file)->header.version != PAGED_FILE_VERSION, PF_WRONG_FORMAT);
-        
+  
   } else {
     // initialise the header & object
     (*file)->header.magic     = PAGED_FILE_MAGIC_COOKIE;
     (*file)->header.version   = PAGED_FILE_VERSION;
-    (*file)->header.page_size = page_size || DEFAULT_PAGE_SIZE;
+    (*file)->header.page_size = page_size ? page_size : DEFAULT_PAGE_SIZE;
     
     // create the db file and write the header
-    (*file)->file = open(path, O_RDWR | O_CREAT | O_TRUNC);
+    (*file)->file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
     error_for((*file)->file == -1, PF_IO_ERROR);
     push_cleanup_handler(4);
     error_for(_pf_sync_header(*file), PF_IO_ERROR);
   }
   
-  // cache useful calculations rather than performing a calc per call
+  // cache useful calculations rather than performing a calc per call.
+  // existing files keep the page size they were created with.
+  page_size = (*file)->header.page_size;
   (*file)->sector_length = 8 * page_size;
   (*file)->sector_offset = 1 + (8 * page_size);
   (*file)->length = sizeof(paged_file_header) + ((*file)->header.pages * page_size);
@@ -139,6 +142,8 @@ pf_error paged_file_close(paged_file *file) {
   if(error) return error;
   
   // close file and release memory
+  if(file->map && munmap(file->map, file->map_length))
+    return PF_IO_ERROR;
   if(close(file->file))
     return PF_IO_ERROR;
   if(pthread_rwlock_destroy(file->lock))
@@ -154,6 +159,9 @@ pf_error paged_file_flush(paged_file *file) {
   
   obtain_write_lock();
   push_cleanup_handler(1);
+  
+  // attributes are only changed in memory, so the header is rewritten
+  error_for(_pf_sync_header(file), PF_IO_ERROR);
   int error = fsync(file->file);
   error_for(error, PF_IO_ERROR);
   
@@ -201,28 +209,38 @@ pf_error paged_file_write_new(paged_file *file, uint64_t *index, void *data, uin
   obtain_write_lock();
   push_cleanup_handler(1);
   
-  // pad the buffer to be a multiple of page size if necessary
-  void *buffer = data;
-  if((length % file->header.page_size) != 0) {
-    uint64_t data_length = length;
-    length += file->header.page_size - (length % file->header.page_size);
-    
-    buffer = malloc(length);
-    error_for(!buffer, PF_MEMORY_ERROR);
+  // new pages are appended after the last written page. sector start
+  // pages are reserved, so a run that would include one starts after it
+  uint64_t page_size = file->header.page_size;
+  uint64_t pages = (length + page_size - 1) / page_size;
+  uint64_t start = file->header.pages;
+  error_for(pages == 0 || pages >= file->sector_offset, PF_LENGTH_INVALID);
+  if((start % file->sector_offset) == 0)
+    start++;
+  if((start / file->sector_offset) != ((start + pages - 1) / file->sector_offset))
+    start = (((start + pages - 1) / file->sector_offset) * file->sector_offset) + 1;
+  
+  // pad the last page with zeros if necessary
+  uint64_t offset = sizeof(paged_file_header) + (start * page_size);
+  void *padding = NULL;
+  error_for(_pf_write(file, offset, data, length), PF_IO_ERROR);
+  if((length % page_size) != 0) {
+    padding = calloc(page_size - (length % page_size), 1);
+    error_for(!padding, PF_MEMORY_ERROR);
     push_cleanup_handler(2);
-    
-    memcpy(buffer, data, data_length);
-    memset(buffer + length, 0, (length - data_length) + 1);
+    error_for(_pf_write(file, offset + length, padding, page_size - (length % page_size)), PF_IO_ERROR);
   }
   
-  // perform the write and set our return error to be the response
-  uint64_t pages = 0;
-  pf_error error = _pf_write(file, (*index) * file->header.page_size, data, length);
-  set_error(error);  
+  // record the new pages in the header
+  file->header.pages   = start + pages;
+  file->header.sectors = (file->header.pages + file->sector_offset - 1) / file->sector_offset;
+  file->length = sizeof(paged_file_header) + (file->header.pages * page_size);
+  error_for(_pf_sync_header(file), PF_IO_ERROR);
+  *index = start;
   
   // cleanup
   cleanups:
-  cleanup(2) free(buffer);
+  cleanup(2) free(padding);
   cleanup(1) cleanup_lock();
   finish();
 }
@@ -283,8 +301,39 @@ pf_error paged_file_read_offset(paged_file *file, uint64_t index, uint64_t offse
   ssize_t bytes = pread(file->file, *data, length, start);
   error_for(bytes != length, PF_IO_ERROR);
   
+  // the buffer is only freed on errors
+  pop_cleanup_handler();
+  
   cleanups:
   cleanup(2) {free(*data); *data = NULL;}
   cleanup(1) cleanup_lock();
   finish();
 }
+
+
+pf_error paged_file_map(paged_file *file, uint64_t index, void **data) {
+  test_for_uninitialised_pf();
+  initialise_cleanup();
+  obtain_write_lock();
+  push_cleanup_handler(1);
+  
+  uint64_t start = sizeof(paged_file_header) + (index * file->header.page_size);
+  error_for(start >= file->length, PF_INDEX_OUT_OF_RANGE);
+  
+  // remap if pages have been written since the file was mapped
+  if(file->map && file->map_length < file->length) {
+    munmap(file->map, file->map_length);
+    file->map = NULL;
+  }
+  if(!file->map) {
+    void *map = mmap(NULL, file->length, PROT_READ, MAP_SHARED, file->file, 0);
+    error_for(map == MAP_FAILED, PF_IO_ERROR);
+    file->map = map;
+    file->map_length = file->length;
+  }
+  *data = ((char *) file->map) + start;
+  
+  cleanups:
+  cleanup(1) cleanup_lock();
+  finish();
+}
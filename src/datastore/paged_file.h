@@ -61,6 +61,10 @@ typedef struct {
   uint64_t          sector_length;
   uint64_t          sector_offset;
   uint64_t          length;
+  
+  // read only mapping of the file (see paged_file_map), or NULL
+  void              *map;
+  uint64_t          map_length;
 } paged_file;
 
 
@@ -84,4 +88,11 @@ pf_error paged_file_read_offset(paged_file *file, uint64_t index, uint64_t offse
 #define  paged_file_read(file, index, data, length) paged_file_read_offset(file, index, 0, data, length)
 #define  paged_file_get_attribute(paged_file, index) (paged_file->header.attributes[index])
 
+// maps the file in to memory (read only, and shared with any other
+// process mapping it) and points data at page index, so large runs
+// of pages can be used in place rather than read. the mapping lasts
+// until the file is closed; mapping after pages have been written
+// remaps the file, which invalidates addresses returned earlier.
+pf_error paged_file_map(paged_file *file, uint64_t index, void **data);
+
 #endif
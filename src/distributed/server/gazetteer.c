@@ -1,8 +1,58 @@
-learner_error get_or_create_row_name(matrix_ref matrix, void *name, int name_length, row_ref *row) {
-  int value_size = 0;
-  void *value = tchdbget(db, const void *kbuf, int ksiz, &value_size);
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "distributed/server/gazetteer.h"
+
+static learner_error gazetteer_dictionary(char *path, char *suffix, dictionary **dictionary) {
+  char *log = (char *) malloc(strlen(path) + strlen(suffix) + 1);
+  if(!log) return MEMORY_ERROR;
+  sprintf(log, "%s%s", path, suffix);
+  learner_error error = dictionary_new(log, dictionary);
+  free(log);
+  return error;
+}
+
+learner_error gazetteer_open(char *path, gazetteer **gazetteer) {
+  if(!path) return NAME_MISSING;
+  learner_error error;
+  *gazetteer = (struct _gazetteer *) calloc(1, sizeof(struct _gazetteer));
+  if(!*gazetteer) return MEMORY_ERROR;
+  if((error = gazetteer_dictionary(path, ".rows", &(*gazetteer)->rows)) ||
+     (error = gazetteer_dictionary(path, ".columns", &(*gazetteer)->columns))) {
+    gazetteer_close(*gazetteer);
+    *gazetteer = NULL;
+  }
+  return error;
+}
+
+learner_error gazetteer_close(gazetteer *gazetteer) {
+  if(!gazetteer) return MISSING_VALUES;
+  learner_error error = NO_ERROR, closed;
+  if(gazetteer->rows && (closed = dictionary_free(gazetteer->rows)))
+    error = closed;
+  if(gazetteer->columns && (closed = dictionary_free(gazetteer->columns)))
+    error = closed;
+  free(gazetteer);
+  return error;
+}
+
+learner_error gazetteer_flush(gazetteer *gazetteer) {
+  if(!gazetteer) return MISSING_VALUES;
+  learner_error error = dictionary_flush(gazetteer->rows);
+  return error ? error : dictionary_flush(gazetteer->columns);
+}
+
+
+// names are resolved without touching disk; new names are added to
+// the dictionaries' buffered logs
+learner_error get_or_create_row_name(gazetteer *matrix, void *name, int name_length, u_int32_t *row) {
+  if(!matrix) return MISSING_MATRIX;
+  if(name_length < 0) return INVALID_LENGTH;
+  return dictionary_find_or_create(matrix->rows, name, name_length, row);
 }
 
-learner_error get_or_create_column_name(matrix_ref matrix, void *name, int name_length, column_ref *column) {
-  
+learner_error get_or_create_column_name(gazetteer *matrix, void *name, int name_length, u_int32_t *column) {
+  if(!matrix) return MISSING_MATRIX;
+  if(name_length < 0) return INVALID_LENGTH;
+  return dictionary_find_or_create(matrix->columns, name, name_length, column);
 }
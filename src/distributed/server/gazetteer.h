@@ -0,0 +1,24 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/dictionary.h"
+
+#ifndef __learner_gazetteer__
+#define __learner_gazetteer__
+
+// the names of a matrix's rows and columns. names are resolved in
+// memory (see dictionary.h), and logged to <path>.rows and
+// <path>.columns so they survive restarts.
+typedef struct _gazetteer {
+  dictionary  *rows;
+  dictionary  *columns;
+} gazetteer;
+
+learner_error gazetteer_open(char *path, gazetteer **gazetteer);
+learner_error gazetteer_close(gazetteer *gazetteer);
+learner_error gazetteer_flush(gazetteer *gazetteer);
+
+// the index of a named row or column, created if the name is new
+learner_error get_or_create_row_name(gazetteer *matrix, void *name, int name_length, u_int32_t *row);
+learner_error get_or_create_column_name(gazetteer *matrix, void *name, int name_length, u_int32_t *column);
+
+#endif
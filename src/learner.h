@@ -3,8 +3,27 @@
 
 #include "core/errors.h"
 #include "core/logging.h"
+#include "core/cpu.h"
+#include "core/threads.h"
 #include "structures/vector.h"
+#include "structures/vector_kernels.h"
+#include "structures/vector_block.h"
 #include "structures/sparse_vector.h"
+#include "structures/sparse_vector_builder.h"
+#include "structures/sparse_vector_codec.h"
+#include "structures/column_index.h"
+#include "structures/matrix_csr.h"
+#include "structures/dense_matrix.h"
+#include "structures/sparse_matrix.h"
+#include "structures/matrix_file.h"
+#include "structures/dictionary.h"
+#include "algorithms/knn.h"
+#include "algorithms/lsh.h"
+#include "algorithms/hnsw.h"
+#include "algorithms/similarity.h"
+#include "algorithms/kmeans.h"
+#include "algorithms/sgd.h"
+#include "algorithms/als.h"
 
 learner_error learner_initialize();
 
@@ -0,0 +1,470 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "structures/column_index.h"
+
+#define COLUMN_POSTINGS_MIN_CAPACITY  4
+
+// ------------------------------------------
+// posting lists
+// ------------------------------------------
+// the columns table grows to cover column, doubling like the rows table
+static learner_error column_index_reserve_columns(column_index *index, u_int64_t column) {
+  if(column < index->column_capacity) return NO_ERROR;
+  u_int64_t capacity = index->column_capacity ? index->column_capacity * 2 : LEARNER_DEFAULT_BUFFER_DELTA;
+  if(capacity <= column) capacity = column + 1;
+  column_postings *columns = (column_postings *) realloc(index->columns, capacity * sizeof(column_postings));
+  if(!columns) return MEMORY_ERROR;
+  memset(columns + index->column_capacity, 0, (capacity - index->column_capacity) * sizeof(column_postings));
+  index->columns = columns;
+  index->column_capacity = capacity;
+  return NO_ERROR;
+}
+
+static learner_error column_postings_grow(matrix_arena *arena, column_postings *list, u_int32_t capacity) {
+  learner_error error;
+  if(capacity <= list->capacity) return NO_ERROR;
+  if(list->postings)
+    error = matrix_arena_realloc(arena, (void **) &list->postings, list->capacity * sizeof(column_posting), capacity * sizeof(column_posting));
+  else
+    error = matrix_arena_alloc(arena, capacity * sizeof(column_posting), (void **) &list->postings);
+  if(error) return error;
+  list->capacity = capacity;
+  return NO_ERROR;
+}
+
+// first position in the list with a row >= row
+static u_int32_t column_postings_find(column_postings *list, u_int64_t row) {
+  u_int32_t low = 0, high = list->count, mid;
+  if(list->count == 0 || list->postings[list->count - 1].row < row)
+    return list->count;
+  while(low < high) {
+    mid = (low + high) / 2;
+    if(list->postings[mid].row < row)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+
+// ------------------------------------------
+// maintenance
+// ------------------------------------------
+// rows are usually set in increasing order, so postings are appended;
+// otherwise they're inserted in place to keep each list sorted. rows
+// already in a list (changed in place) have their weight replaced.
+static learner_error column_index_put(Matrix *matrix, column_index *index, u_int32_t column, u_int64_t id, float weight) {
+  column_postings *list = &index->columns[column];
+  u_int32_t position = column_postings_find(list, id);
+  if(position < list->count && list->postings[position].row == id) {
+    list->postings[position].weight = weight;
+    return NO_ERROR;
+  }
+  
+  if(list->count == list->capacity) {
+    u_int32_t capacity = list->capacity ? list->capacity * 2 : COLUMN_POSTINGS_MIN_CAPACITY;
+    learner_error error = column_postings_grow(matrix->arena, list, capacity);
+    if(error) return error;
+  }
+  memmove(list->postings + position + 1, list->postings + position, (list->count - position) * sizeof(column_posting));
+  list->postings[position].row = id;
+  list->postings[position].weight = weight;
+  list->count++;
+  index->postings++;
+  return NO_ERROR;
+}
+
+
+learner_error column_index_add_row(Matrix *matrix, SparseVector *row) {
+  column_index *index = matrix->column_index;
+  learner_error error = NO_ERROR;
+  if(!index) return NO_ERROR;
+  if(row->header.count > 0 && (error = column_index_reserve_columns(index, row->header.max_index)))
+    return error;
+  for(int i = 0, count = row->header.count; i < count && !error; i++)
+    error = column_index_put(matrix, index, sparse_vector_index_at(row, i), row->header.matrix_index, sparse_vector_value_at(row, i));
+  return error;
+}
+
+
+// vectors that aren't rows of an indexed matrix have no postings
+static int column_index_has_row(SparseVector *row) {
+  Matrix *matrix = row->matrix;
+  return matrix && matrix->column_index && row->header.matrix_index < matrix->rows &&
+         row->header.matrix_index < matrix->row_capacity && matrix->row_vectors[row->header.matrix_index] == row;
+}
+
+
+learner_error column_index_update_row(SparseVector *row) {
+  if(!row || !column_index_has_row(row)) return NO_ERROR;
+  return column_index_add_row(row->matrix, row);
+}
+
+
+learner_error column_index_update_value(SparseVector *row, u_int32_t column, float value) {
+  if(!row || !column_index_has_row(row)) return NO_ERROR;
+  column_index *index = row->matrix->column_index;
+  learner_error error = column_index_reserve_columns(index, column);
+  if(error) return error;
+  return column_index_put(row->matrix, index, column, row->header.matrix_index, value);
+}
+
+
+learner_error column_index_remove_row(Matrix *matrix, SparseVector *row) {
+  column_index *index = matrix->column_index;
+  u_int64_t id = row->header.matrix_index, column;
+  if(!index) return NO_ERROR;
+  
+  for(int i = 0, count = row->header.count; i < count; i++) {
+    column = sparse_vector_index_at(row, i);
+    if(column >= index->column_capacity) break;
+    column_postings *list = &index->columns[column];
+    u_int32_t position = column_postings_find(list, id);
+    if(position == list->count || list->postings[position].row != id) continue;
+    memmove(list->postings + position, list->postings + position + 1, (list->count - position - 1) * sizeof(column_posting));
+    list->count--;
+    index->postings--;
+  }
+  return NO_ERROR;
+}
+
+
+// the index is built by transposing the rows in two passes. postings
+// are counted per column (across rows, so counts are added atomically)
+// then every list is allocated once at its final size. the columns
+// are split in to ranges with roughly equal postings, and each thread
+// walks the rows in order filling its range, which leaves each list
+// sorted without any locking.
+typedef struct {
+  Matrix        *matrix;
+  column_index  *index;
+  u_int64_t     *bounds;
+} column_index_transpose;
+
+static void column_index_count_rows(void *context, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  column_index_transpose *transpose = (column_index_transpose *) context;
+  column_postings *columns = transpose->index->columns;
+  SparseVector *row;
+  for(u_int64_t r = start; r < end; r++) {
+    if(matrix_get_row(transpose->matrix, r, &row) != NO_ERROR) continue;
+    for(int i = 0, count = row->header.count; i < count; i++)
+      __sync_fetch_and_add(&columns[sparse_vector_index_at(row, i)].count, 1);
+  }
+}
+
+// first position in the row with an index >= column
+static int column_index_row_find(SparseVector *row, u_int64_t column) {
+  int low = 0, high = row->header.count, mid;
+  while(low < high) {
+    mid = (low + high) / 2;
+    if(sparse_vector_index_at(row, mid) < column)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+static void column_index_fill_columns(void *context, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  column_index_transpose *transpose = (column_index_transpose *) context;
+  column_postings *columns = transpose->index->columns;
+  Matrix *matrix = transpose->matrix;
+  SparseVector *row;
+  
+  for(u_int64_t range = start; range < end; range++) {
+    u_int64_t first = transpose->bounds[range], last = transpose->bounds[range + 1];
+    if(first == last) continue;
+    for(u_int64_t r = 0; r < matrix->rows; r++) {
+      if(matrix_get_row(matrix, r, &row) != NO_ERROR || row->header.count == 0) continue;
+      if(row->header.max_index < first || row->header.min_index >= last) continue;
+      for(int i = column_index_row_find(row, first), count = row->header.count; i < count; i++) {
+        u_int32_t column = sparse_vector_index_at(row, i);
+        if(column >= last) break;
+        column_postings *list = &columns[column];
+        list->postings[list->count].row = r;
+        list->postings[list->count].weight = sparse_vector_value_at(row, i);
+        list->count++;
+      }
+    }
+  }
+}
+
+learner_error matrix_index_columns(Matrix *matrix, u_int32_t threads) {
+  if(!matrix) return MISSING_MATRIX;
+  if(matrix->values) return INVALID_MATRIX_STORAGE;
+  if(matrix->column_index) return NO_ERROR;
+  threads = learner_default_threads(threads);
+  SparseVector *row;
+  learner_error error = NO_ERROR;
+  
+  column_index *index = (column_index *) calloc(1, sizeof(column_index));
+  if(!index) return MEMORY_ERROR;
+  matrix->column_index = index;
+  
+  u_int64_t columns = 0;
+  for(u_int64_t r = 0; r < matrix->rows; r++)
+    if(matrix_get_row(matrix, r, &row) == NO_ERROR && row->header.count > 0 && row->header.max_index + 1 > columns)
+      columns = row->header.max_index + 1;
+  column_index_transpose transpose = {matrix, index, NULL};
+  if(columns > 0)
+    error = column_index_reserve_columns(index, columns - 1);
+  if(!error)
+    error = learner_parallel_for(matrix->rows, threads, 1024, column_index_count_rows, &transpose);
+  
+  for(u_int64_t column = 0; column < columns && !error; column++) {
+    column_postings *list = &index->columns[column];
+    index->postings += list->count;
+    if(list->count == 0) continue;
+    error = column_postings_grow(matrix->arena, list, list->count);
+  }
+  
+  // range t ends at the first column where the running total of
+  // postings reaches t / threads of them
+  if(!error && !(transpose.bounds = (u_int64_t *) calloc(threads + 1, sizeof(u_int64_t))))
+    error = MEMORY_ERROR;
+  if(!error) {
+    u_int64_t total = 0, range = 1;
+    for(u_int64_t column = 0; column < columns; column++) {
+      total += index->columns[column].count;
+      index->columns[column].count = 0;
+      while(range < threads && total * threads >= index->postings * range)
+        transpose.bounds[range++] = column + 1;
+    }
+    while(range <= threads)
+      transpose.bounds[range++] = columns;
+    error = learner_parallel_for(threads, threads, 1, column_index_fill_columns, &transpose);
+  }
+  
+  free(transpose.bounds);
+  if(error)
+    matrix_drop_column_index(matrix);
+  return error;
+}
+
+
+learner_error matrix_drop_column_index(Matrix *matrix) {
+  if(!matrix) return MISSING_MATRIX;
+  column_index *index = matrix->column_index;
+  if(!index) return NO_ERROR;
+  for(u_int64_t column = 0; column < index->column_capacity; column++)
+    if(index->columns[column].postings)
+      matrix_arena_release(matrix->arena, index->columns[column].postings, index->columns[column].capacity * sizeof(column_posting));
+  free(index->columns);
+  free(index);
+  matrix->column_index = NULL;
+  return NO_ERROR;
+}
+
+
+learner_error matrix_column_index_memory(Matrix *matrix, u_int64_t *bytes) {
+  if(!matrix) return MISSING_MATRIX;
+  column_index *index = matrix->column_index;
+  if(!index) return INVALID_MATRIX_STORAGE;
+  *bytes = sizeof(column_index) + (index->column_capacity * sizeof(column_postings));
+  for(u_int64_t column = 0; column < index->column_capacity; column++)
+    *bytes += index->columns[column].capacity * sizeof(column_posting);
+  return NO_ERROR;
+}
+
+
+// moves each posting list in to a block sized to fit (see matrix_compact)
+learner_error column_index_compact(Matrix *matrix) {
+  column_index *index = matrix->column_index;
+  learner_error error;
+  void *moved;
+  if(!index) return NO_ERROR;
+  
+  for(u_int64_t column = 0; column < index->column_capacity; column++) {
+    column_postings *list = &index->columns[column];
+    if(!list->postings) continue;
+    if((error = matrix_arena_alloc(matrix->arena, list->count * sizeof(column_posting), &moved)))
+      return error;
+    memcpy(moved, list->postings, list->count * sizeof(column_posting));
+    matrix_arena_release(matrix->arena, list->postings, list->capacity * sizeof(column_posting));
+    list->postings = (column_posting *) moved;
+    list->capacity = list->count;
+  }
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// columns
+// ------------------------------------------
+learner_error matrix_get_column(Matrix *matrix, u_int64_t column, column_postings **postings) {
+  if(!matrix) return MISSING_MATRIX;
+  column_index *index = matrix->column_index;
+  if(!index) return INVALID_MATRIX_STORAGE;
+  if(column >= index->column_capacity || index->columns[column].count == 0) return INDEX_NOT_FOUND;
+  *postings = &index->columns[column];
+  return NO_ERROR;
+}
+
+
+// vector indexes are 32 bit, so only the first 2^32 - 1 rows fit
+learner_error matrix_get_column_vector(Matrix *matrix, u_int64_t column, SparseVector **vector) {
+  column_postings *list;
+  learner_error error = matrix_get_column(matrix, column, &list);
+  if(error) return error;
+  if(list->postings[list->count - 1].row >= (u_int32_t) -1) return INDEX_OUT_OF_RANGE;
+  if((error = sparse_vector_new(vector, matrix)))
+    return error;
+  
+  if((error = matrix_arena_alloc(matrix->arena, list->count * sizeof(sparse_vector_value), (void **) &(*vector)->values))) {
+    (*vector)->values = NULL;
+    sparse_vector_free(*vector);
+    return error;
+  }
+  for(u_int32_t i = 0; i < list->count; i++) {
+    (*vector)->values[i].index = list->postings[i].row;
+    (*vector)->values[i].value = list->postings[i].weight;
+  }
+  (*vector)->header.count = list->count;
+  (*vector)->header.min_index = list->postings[0].row;
+  (*vector)->header.max_index = list->postings[list->count - 1].row;
+  return NO_ERROR;
+}
+
+
+learner_error matrix_column_similarity(Matrix *matrix, u_int64_t a, u_int64_t b, learner_metric metric, float *result) {
+  if(!matrix) return MISSING_MATRIX;
+  column_index *index = matrix->column_index;
+  if(!index) return INVALID_MATRIX_STORAGE;
+  static column_postings empty;
+  column_postings *x = (a < index->column_capacity) ? &index->columns[a] : &empty;
+  column_postings *y = (b < index->column_capacity) ? &index->columns[b] : &empty;
+  float dot = 0.0, squares_x = 0.0, squares_y = 0.0, distance = 0.0, value;
+  u_int32_t i = 0, j = 0;
+  
+  while(i < x->count && j < y->count) {
+    if(x->postings[i].row < y->postings[j].row) {
+      value = x->postings[i++].weight;
+      squares_x += value * value;
+      distance += value * value;
+    } else if(x->postings[i].row > y->postings[j].row) {
+      value = y->postings[j++].weight;
+      squares_y += value * value;
+      distance += value * value;
+    } else {
+      value = x->postings[i].weight - y->postings[j].weight;
+      dot += x->postings[i].weight * y->postings[j].weight;
+      squares_x += x->postings[i].weight * x->postings[i].weight;
+      squares_y += y->postings[j].weight * y->postings[j].weight;
+      distance += value * value;
+      i++, j++;
+    }
+  }
+  for(; i < x->count; i++) {
+    value = x->postings[i].weight;
+    squares_x += value * value;
+    distance += value * value;
+  }
+  for(; j < y->count; j++) {
+    value = y->postings[j].weight;
+    squares_y += value * value;
+    distance += value * value;
+  }
+  
+  if(metric == DOT_PRODUCT)
+    *result = dot;
+  else if(metric == COSINE_SIMILARITY)
+    *result = (squares_x > 0.0 && squares_y > 0.0) ? dot / (sqrtf(squares_x) * sqrtf(squares_y)) : 0.0;
+  else
+    *result = sqrtf(distance);
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// queries
+// ------------------------------------------
+learner_error column_accumulator_new(column_accumulator **accumulator) {
+  *accumulator = (column_accumulator *) calloc(1, sizeof(column_accumulator));
+  if(!*accumulator) return MEMORY_ERROR;
+  return NO_ERROR;
+}
+
+
+learner_error column_accumulator_free(column_accumulator *accumulator) {
+  if(!accumulator) return MISSING_VALUES;
+  free(accumulator->dots);
+  free(accumulator->stamps);
+  free(accumulator->rows);
+  free(accumulator);
+  return NO_ERROR;
+}
+
+
+// new rows are given a stamp of 0, which no query uses. stamps wrap
+// after 2^32 - 1 queries; clearing them keeps stamp 0 unused.
+learner_error column_accumulator_start_visits(column_accumulator *accumulator, u_int64_t rows) {
+  if(!accumulator) return MISSING_VALUES;
+  accumulator->count = 0;
+  if(++accumulator->stamp == 0) {
+    memset(accumulator->stamps, 0, accumulator->stamp_capacity * sizeof(u_int32_t));
+    accumulator->stamp = 1;
+  }
+  if(rows <= accumulator->stamp_capacity) return NO_ERROR;
+  
+  u_int32_t *stamps = (u_int32_t *) realloc(accumulator->stamps, rows * sizeof(u_int32_t));
+  if(!stamps) return MEMORY_ERROR;
+  accumulator->stamps = stamps;
+  memset(accumulator->stamps + accumulator->stamp_capacity, 0, (rows - accumulator->stamp_capacity) * sizeof(u_int32_t));
+  accumulator->stamp_capacity = rows;
+  return NO_ERROR;
+}
+
+
+learner_error column_accumulator_start(column_accumulator *accumulator, u_int64_t rows) {
+  learner_error error = column_accumulator_start_visits(accumulator, rows);
+  if(error || rows <= accumulator->capacity) return error;
+  
+  float *dots = (float *) realloc(accumulator->dots, rows * sizeof(float));
+  if(dots) accumulator->dots = dots;
+  u_int64_t *list = (u_int64_t *) realloc(accumulator->rows, rows * sizeof(u_int64_t));
+  if(list) accumulator->rows = list;
+  if(!dots || !list) return MEMORY_ERROR;
+  accumulator->capacity = rows;
+  return NO_ERROR;
+}
+
+
+learner_error matrix_column_dot_products(Matrix *matrix, SparseVector *query, column_accumulator *accumulator) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!query) return MISSING_VECTOR;
+  if(!accumulator) return MISSING_VALUES;
+  column_index *index = matrix->column_index;
+  if(!index) return INVALID_MATRIX_STORAGE;
+  learner_error error = column_accumulator_start(accumulator, matrix->rows);
+  if(error) return error;
+  u_int32_t stamp = accumulator->stamp;
+  u_int64_t *rows = accumulator->rows, touched = 0, column;
+  u_int32_t *stamps = accumulator->stamps;
+  float *dots = accumulator->dots, value;
+  
+  for(int i = 0, count = query->header.count; i < count; i++) {
+    column = sparse_vector_index_at(query, i);
+    if(column >= index->column_capacity) break;
+    column_postings *list = &index->columns[column];
+    value = sparse_vector_value_at(query, i);
+    
+    for(u_int32_t p = 0; p < list->count; p++) {
+      u_int64_t row = list->postings[p].row;
+      if(stamps[row] != stamp) {
+        stamps[row] = stamp;
+        dots[row] = 0.0;
+        rows[touched++] = row;
+      }
+      dots[row] += value * list->postings[p].weight;
+    }
+  }
+  
+  accumulator->count = touched;
+  return NO_ERROR;
+}
@@ -0,0 +1,102 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/sparse_vector.h"
+#include "structures/metric.h"
+
+#ifndef __learner_column_index__
+#define __learner_column_index__
+
+// an inverted index over the columns of a sparse matrix. each column
+// has a posting list of the rows with a value in that column, sorted
+// by row, so the rows sharing any column with a query are found by
+// walking the query's columns rather than comparing every row.
+#pragma pack(push)
+#pragma pack(1)
+typedef struct {
+  u_int64_t row;
+  float     weight;
+} column_posting;
+#pragma pack(pop)
+
+typedef struct {
+  column_posting  *postings;
+  u_int32_t       count;
+  u_int32_t       capacity;
+} column_postings;
+
+typedef struct _column_index {
+  column_postings *columns;
+  u_int64_t       column_capacity;
+  u_int64_t       postings;
+} column_index;
+
+// accumulates the dot products of one query at a time. rows are
+// stamped when first reached, so nothing is cleared between queries;
+// rows lists the rows reached, and dots[row] their dot products.
+// stamps are grown separately, for searches that only mark visits.
+typedef struct {
+  float       *dots;
+  u_int32_t   *stamps;
+  u_int64_t   *rows;
+  u_int64_t   count;
+  u_int64_t   capacity;
+  u_int64_t   stamp_capacity;
+  u_int32_t   stamp;
+} column_accumulator;
+
+// indexes every row set so far, transposing the rows across threads
+// (0 for LEARNER_CORES). once indexed, the index is kept current as
+// rows are set, adopted (see matrix_csr.h) or changed in place by the
+// sparse vector functions (set, scale, axpy, add, normalization and
+// quantization). rows changed through their values directly must be
+// set again. posting lists are allocated from the matrix's arena.
+learner_error matrix_index_columns(Matrix *matrix, u_int32_t threads);
+learner_error matrix_drop_column_index(Matrix *matrix);
+
+// the bytes used by the index beyond the rows themselves: the columns
+// table and the capacity of every posting list
+learner_error matrix_column_index_memory(Matrix *matrix, u_int64_t *bytes);
+
+// used by matrix_set_row and matrix_compact to maintain the index
+learner_error column_index_add_row(Matrix *matrix, SparseVector *row);
+learner_error column_index_remove_row(Matrix *matrix, SparseVector *row);
+learner_error column_index_compact(Matrix *matrix);
+
+// used by the sparse vector functions changing a row in place, after
+// it has changed. changes in place never remove a column from a row,
+// so its postings are only replaced or added to. vectors that aren't
+// rows of an indexed matrix are ignored.
+learner_error column_index_update_row(SparseVector *row);
+learner_error column_index_update_value(SparseVector *row, u_int32_t column, float value);
+
+// accumulators are per thread; queries only read the index. other
+// searches collecting candidate rows (see lsh.h) reuse them, starting
+// each query with column_accumulator_start. searches that only need
+// to know which rows they've visited (see hnsw.h) start with
+// column_accumulator_start_visits, which only allocates stamps.
+learner_error column_accumulator_new(column_accumulator **accumulator);
+learner_error column_accumulator_free(column_accumulator *accumulator);
+learner_error column_accumulator_start(column_accumulator *accumulator, u_int64_t rows);
+learner_error column_accumulator_start_visits(column_accumulator *accumulator, u_int64_t rows);
+
+// the posting list of a column is the column itself: its rows and
+// values in row order. matrix_get_column returns the list in place
+// (valid until the column next changes), reporting columns with no
+// values missing, as matrix_get_row does unset rows.
+// matrix_get_column_vector copies the column in to a new vector on
+// the matrix, indexed by row, for use with the sparse vector functions.
+learner_error matrix_get_column(Matrix *matrix, u_int64_t column, column_postings **postings);
+learner_error matrix_get_column_vector(Matrix *matrix, u_int64_t column, SparseVector **vector);
+
+// similarity of two columns by merging their posting lists, in time
+// linear in their values. missing columns are treated as zero; the
+// cosine similarity of a zero column is 0.
+learner_error matrix_column_similarity(Matrix *matrix, u_int64_t a, u_int64_t b, learner_metric metric, float *result);
+
+// the dot product of query with every row sharing a column with it,
+// in time proportional to the postings of the query's columns. rows
+// sharing no column have a dot product of 0 and aren't listed.
+learner_error matrix_column_dot_products(Matrix *matrix, SparseVector *query, column_accumulator *accumulator);
+
+#endif
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "structures/dense_matrix.h"
+#include "structures/vector_block.h"
+#include "structures/vector_kernels.h"
+
+learner_error matrix_new_dense(u_int64_t rows, u_int32_t columns, Matrix **matrix) {
+  if(rows == 0 || columns == 0) return INVALID_LENGTH;
+  learner_error error = matrix_new(matrix);
+  if(error) return error;
+  
+  (*matrix)->rows    = rows;
+  (*matrix)->columns = columns;
+  (*matrix)->stride  = vector_block_stride(columns);
+  error = vector_block_new(columns, rows, &(*matrix)->values);
+  if(error) {
+    matrix_free(*matrix);
+    *matrix = NULL;
+  }
+  return error;
+}
+
+
+learner_error matrix_dense_row(Matrix *matrix, u_int64_t row, Vector *view) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!matrix->values) return INVALID_MATRIX_STORAGE;
+  if(row >= matrix->rows) return INDEX_OUT_OF_RANGE;
+  return vector_view(matrix->values + (row * matrix->stride), matrix->columns, view);
+}
+
+
+learner_error matrix_dense_set_row(Matrix *matrix, u_int64_t row, Vector *vector) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!vector) return MISSING_VECTOR;
+  if(!matrix->values) return INVALID_MATRIX_STORAGE;
+  if(row >= matrix->rows) return INDEX_OUT_OF_RANGE;
+  if(vector->header.length != matrix->columns) return VECTORS_NOT_OF_EQUAL_LENGTH;
+  learner_error error = vector_block_set(matrix->values, row, vector);
+  if(error) return error;
+  
+  if(matrix->magnitudes)
+    matrix->magnitudes[row] = sqrtf(vector_kernels.sum_of_squares(matrix->values + (row * matrix->stride), matrix->stride));
+  return NO_ERROR;
+}
+
+
+learner_error matrix_dense_freeze(Matrix *matrix) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!matrix->values) return INVALID_MATRIX_STORAGE;
+  if(!matrix->magnitudes) {
+    matrix->magnitudes = (float *) malloc(matrix->rows * sizeof(float));
+    if(!matrix->magnitudes) return MEMORY_ERROR;
+  }
+  for(u_int64_t row = 0; row < matrix->rows; row++)
+    matrix->magnitudes[row] = sqrtf(vector_kernels.sum_of_squares(matrix->values + (row * matrix->stride), matrix->stride));
+  return NO_ERROR;
+}
+
+
+learner_error matrix_dense_unfreeze(Matrix *matrix) {
+  if(!matrix) return MISSING_MATRIX;
+  if(matrix->magnitudes)
+    free(matrix->magnitudes);
+  matrix->magnitudes = NULL;
+  return NO_ERROR;
+}
+
+
+// rows are scored against the vector four at a time by the batch
+// kernels, which also take care of splitting large products across
+// threads. the vector (one row's worth of values) stays in cache.
+learner_error matrix_vector_product(Matrix *matrix, Vector *vector, Vector **result) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!vector) return MISSING_VECTOR;
+  if(!matrix->values) return INVALID_MATRIX_STORAGE;
+  if(vector->header.length != matrix->columns) return VECTORS_NOT_OF_EQUAL_LENGTH;
+  if(matrix->rows > INT_MAX) return INVALID_PARAMETERS;
+  
+  learner_error error = vector_new((int) matrix->rows, result);
+  if(error) return error;
+  error = vector_similarity_batch(vector, matrix->values, matrix->rows, DOT_PRODUCT, (*result)->values);
+  if(error) {
+    vector_free(*result);
+    *result = NULL;
+  }
+  return error;
+}
+
+
+// ------------------------------------------
+// blocked matrix product
+// ------------------------------------------
+typedef struct {
+  Matrix *a;
+  Matrix *b;
+  Matrix *c;
+} product_context;
+
+// each thread computes a contiguous range of rows of c. within the
+// range, tiles of rows of a are multiplied against tiles of b so a
+// depth tile of b is reused by every row in the row tile before
+// moving on. the inner loop is an axpy of a row of b in to c.
+static void multiply_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  product_context *context = (product_context *) param;
+  Matrix *a = context->a, *b = context->b, *c = context->c;
+  u_int64_t depth = a->columns, columns = b->columns;
+  
+  for(u_int64_t row_tile = start; row_tile < end; row_tile += DENSE_MATRIX_ROW_TILE) {
+    u_int64_t row_end = (row_tile + DENSE_MATRIX_ROW_TILE < end) ? row_tile + DENSE_MATRIX_ROW_TILE : end;
+    
+    for(u_int64_t column_tile = 0; column_tile < columns; column_tile += DENSE_MATRIX_COLUMN_TILE) {
+      u_int32_t width = (column_tile + DENSE_MATRIX_COLUMN_TILE < columns) ? DENSE_MATRIX_COLUMN_TILE : columns - column_tile;
+      
+      for(u_int64_t depth_tile = 0; depth_tile < depth; depth_tile += DENSE_MATRIX_DEPTH_TILE) {
+        u_int64_t depth_end = (depth_tile + DENSE_MATRIX_DEPTH_TILE < depth) ? depth_tile + DENSE_MATRIX_DEPTH_TILE : depth;
+        
+        for(u_int64_t row = row_tile; row < row_end; row++) {
+          float *a_row = a->values + (row * a->stride);
+          float *c_row = c->values + (row * c->stride) + column_tile;
+          for(u_int64_t k = depth_tile; k < depth_end; k++) {
+            if(a_row[k] != 0.0)
+              vector_kernels.axpy(a_row[k], b->values + (k * b->stride) + column_tile, c_row, width);
+          }
+        }
+      }
+    }
+  }
+}
+
+learner_error matrix_matrix_product(Matrix *a, Matrix *b, Matrix **result) {
+  if(!a || !b) return MISSING_MATRIX;
+  if(!a->values || !b->values) return INVALID_MATRIX_STORAGE;
+  if(a->columns != b->rows) return INCOMPATIBLE_DIMENSIONS;
+  
+  learner_error error = matrix_new_dense(a->rows, b->columns, result);
+  if(error) return error;
+  
+  product_context context = {a, b, *result};
+  u_int32_t threads = (a->rows * a->columns * b->columns >= VECTOR_BLOCK_PARALLEL_THRESHOLD) ? LEARNER_CORES : 1;
+  return learner_parallel_for(a->rows, threads, DENSE_MATRIX_ROW_TILE, multiply_rows, &context);
+}
@@ -0,0 +1,38 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/vector.h"
+
+#ifndef __learner_dense_matrix__
+#define __learner_dense_matrix__
+
+// tile sizes for the blocked matrix product. a depth tile of rows
+// of b (128 * 512 floats = 256kb) is sized to stay in L2 while a
+// tile of rows of a is multiplied against it.
+#define DENSE_MATRIX_ROW_TILE     32
+#define DENSE_MATRIX_DEPTH_TILE   128
+#define DENSE_MATRIX_COLUMN_TILE  512
+
+// dense matrices store their values in a single vector block (see
+// vector_block.h), so rows are aligned and can be scored in batches
+learner_error matrix_new_dense(u_int64_t rows, u_int32_t columns, Matrix **matrix);
+
+// rows are read and written as vectors. matrix_dense_row fills in
+// a view (see vector_view), so no memory is allocated per row.
+learner_error matrix_dense_row(Matrix *matrix, u_int64_t row, Vector *view);
+learner_error matrix_dense_set_row(Matrix *matrix, u_int64_t row, Vector *vector);
+
+// freezing caches the magnitude of every row, as frozen vectors do.
+// matrix_dense_set_row keeps the cache current, but rows written
+// through views aren't tracked; refreeze after changing them.
+learner_error matrix_dense_freeze(Matrix *matrix);
+learner_error matrix_dense_unfreeze(Matrix *matrix);
+
+// result = matrix * vector, allocating result (of length rows).
+// INVALID_PARAMETERS if rows is too many for a vector
+learner_error matrix_vector_product(Matrix *matrix, Vector *vector, Vector **result);
+
+// result = a * b, allocating a new (a rows x b columns) dense matrix
+learner_error matrix_matrix_product(Matrix *a, Matrix *b, Matrix **result);
+
+#endif
@@ -0,0 +1,358 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "core/logging.h"
+#include "structures/dictionary.h"
+
+// a log is a header, then a record per name followed by its bytes
+#pragma pack(push)
+#pragma pack(1)
+typedef struct {
+  u_int32_t magic;
+  u_int32_t version;
+} dictionary_log_header;
+
+typedef struct {
+  u_int32_t index;
+  u_int32_t length;
+  u_int64_t hash;
+} dictionary_log_record;
+#pragma pack(pop)
+
+#define dictionary_shard(hash)    ((hash) >> (64 - DICTIONARY_SHARD_BITS))
+#define dictionary_full(table, count) (((u_int64_t) (count) + 1) * 4 > (table)->capacity * 3)
+
+// fnv-1a
+static u_int64_t dictionary_hash(void *name, u_int32_t length) {
+  u_int64_t hash = 14695981039346656037ULL;
+  for(u_int32_t i = 0; i < length; i++) {
+    hash ^= ((unsigned char *) name)[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+// ------------------------------------------
+// tables
+// ------------------------------------------
+static learner_error dictionary_table_new(u_int64_t capacity, dictionary_table **table) {
+  *table = (dictionary_table *) calloc(1, sizeof(dictionary_table));
+  if(!*table) return MEMORY_ERROR;
+  (*table)->slots = (dictionary_entry **) calloc(capacity, sizeof(dictionary_entry *));
+  if(!(*table)->slots) {
+    free(*table);
+    *table = NULL;
+    return MEMORY_ERROR;
+  }
+  (*table)->capacity = capacity;
+  return NO_ERROR;
+}
+
+// linear probing from the slot the hash picks, until the name or an
+// empty slot is found
+static dictionary_entry *dictionary_probe(dictionary_table *table, u_int64_t hash, void *name, u_int32_t length) {
+  u_int64_t mask = table->capacity - 1;
+  for(u_int64_t slot = hash & mask, probes = 0; probes < table->capacity; slot = (slot + 1) & mask, probes++) {
+    dictionary_entry *entry = table->slots[slot];
+    if(!entry) return NULL;
+    if(entry->hash == hash && entry->length == length && memcmp(entry->name, name, length) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+// creates of different shards may race for the same empty slot, so
+// slots are claimed by compare and swap. entries are complete before
+// they're swapped in, so readers never see one partly written.
+static int dictionary_insert(dictionary_table *table, dictionary_entry *entry) {
+  u_int64_t mask = table->capacity - 1;
+  for(u_int64_t slot = entry->hash & mask, probes = 0; probes < table->capacity; slot = (slot + 1) & mask, probes++)
+    if(!table->slots[slot] && __sync_bool_compare_and_swap(&table->slots[slot], NULL, entry))
+      return 1;
+  return 0;
+}
+
+// with resize held for writing no creates are running, so every
+// entry is in the table. the new table is filled before it's
+// published, and the old one kept for readers still probing it.
+static learner_error dictionary_grow(dictionary *dictionary) {
+  dictionary_table *table = dictionary->table, *grown;
+  if(!dictionary_full(table, dictionary->count)) return NO_ERROR;
+  learner_error error = dictionary_table_new(table->capacity * 2, &grown);
+  if(error) return error;
+  
+  for(u_int64_t slot = 0; slot < table->capacity; slot++)
+    if(table->slots[slot])
+      dictionary_insert(grown, table->slots[slot]);
+  grown->previous = table;
+  __sync_synchronize();
+  dictionary->table = grown;
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// names
+// ------------------------------------------
+// entries are copied in to the arena before they're given an index,
+// so a create that fails never takes one
+static learner_error dictionary_entry_new(dictionary *dictionary, u_int64_t hash, void *name, u_int32_t length, dictionary_entry **created) {
+  dictionary_entry *entry;
+  learner_error error = matrix_arena_alloc(dictionary->arena, sizeof(dictionary_entry) + length + 1, (void **) &entry);
+  if(error) return error;
+  entry->hash   = hash;
+  entry->length = length;
+  memcpy(entry->name, name, length);
+  entry->name[length] = 0;
+  *created = entry;
+  return NO_ERROR;
+}
+
+// chunks are allocated by whichever thread first needs one
+static learner_error dictionary_chunk(dictionary *dictionary, u_int32_t index) {
+  u_int32_t chunk = index >> DICTIONARY_CHUNK_BITS;
+  if(dictionary->chunks[chunk]) return NO_ERROR;
+  dictionary_entry **names = (dictionary_entry **) calloc(DICTIONARY_CHUNK, sizeof(dictionary_entry *));
+  if(!names) return MEMORY_ERROR;
+  if(!__sync_bool_compare_and_swap(&dictionary->chunks[chunk], NULL, names))
+    free(names);
+  return NO_ERROR;
+}
+
+// indexes are claimed by compare and swap once their chunk exists, so
+// nothing can fail between an index being taken and its entry being
+// published. the last index, (u_int32_t) -1, is never given out.
+static learner_error dictionary_reserve(dictionary *dictionary, u_int32_t *index) {
+  learner_error error;
+  u_int32_t next;
+  do {
+    next = dictionary->count;
+    if(next == (u_int32_t) -1) return INDEX_OUT_OF_RANGE;
+    if((error = dictionary_chunk(dictionary, next))) return error;
+  } while(!__sync_bool_compare_and_swap(&dictionary->count, next, next + 1));
+  *index = next;
+  return NO_ERROR;
+}
+
+// entries are published in the index table, then the hash table. the
+// entry's chunk has already been allocated.
+static learner_error dictionary_add(dictionary *dictionary, dictionary_entry *entry) {
+  dictionary->chunks[entry->index >> DICTIONARY_CHUNK_BITS][entry->index & (DICTIONARY_CHUNK - 1)] = entry;
+  __sync_synchronize();
+  if(!dictionary_insert(dictionary->table, entry)) return MEMORY_ERROR;
+  return NO_ERROR;
+}
+
+static learner_error dictionary_log(dictionary *dictionary, dictionary_entry *entry) {
+  if(!dictionary->log) return NO_ERROR;
+  dictionary_log_record record = {entry->index, entry->length, entry->hash};
+  pthread_mutex_lock(&dictionary->log_lock);
+  int failed = fwrite(&record, sizeof(dictionary_log_record), 1, dictionary->log) != 1 ||
+               (entry->length && fwrite(entry->name, entry->length, 1, dictionary->log) != 1);
+  pthread_mutex_unlock(&dictionary->log_lock);
+  return failed ? FILE_IO_ERROR : NO_ERROR;
+}
+
+
+// ------------------------------------------
+// logs
+// ------------------------------------------
+// records are replayed in the order written, which (as creates run
+// in parallel) isn't necessarily index order
+static learner_error dictionary_replay(dictionary *dictionary, FILE *log) {
+  dictionary_log_header header;
+  dictionary_log_record record;
+  dictionary_entry *entry;
+  learner_error error = NO_ERROR;
+  char *name = NULL;
+  u_int32_t capacity = 0;
+  long complete;
+  
+  if(fread(&header, sizeof(dictionary_log_header), 1, log) != 1) {
+    // a new (or empty) log gets its header
+    rewind(log);
+    header = (dictionary_log_header) {DICTIONARY_LOG_MAGIC, DICTIONARY_LOG_VERSION};
+    if(ftruncate(fileno(log), 0) != 0 || fwrite(&header, sizeof(dictionary_log_header), 1, log) != 1)
+      return FILE_IO_ERROR;
+    return NO_ERROR;
+  }
+  if(header.magic != DICTIONARY_LOG_MAGIC || header.version != DICTIONARY_LOG_VERSION)
+    return PARSE_ERROR;
+  
+  while(!error) {
+    complete = ftell(log);
+    if(fread(&record, sizeof(dictionary_log_record), 1, log) != 1) break;
+    if(record.length > capacity) {
+      char *grown = (char *) realloc(name, record.length);
+      if(!grown) {
+        error = MEMORY_ERROR;
+        break;
+      }
+      name = grown;
+      capacity = record.length;
+    }
+    if(record.length && fread(name, record.length, 1, log) != 1) break;
+    complete = ftell(log);
+    
+    // the hash guards against damaged records, and indexes must be
+    // ones a create could have given out
+    if(record.hash != dictionary_hash(name, record.length) || dictionary_probe(dictionary->table, record.hash, name, record.length) ||
+       record.index == (u_int32_t) -1 ||
+       (dictionary->chunks[record.index >> DICTIONARY_CHUNK_BITS] && dictionary->chunks[record.index >> DICTIONARY_CHUNK_BITS][record.index & (DICTIONARY_CHUNK - 1)])) {
+      error = PARSE_ERROR;
+      break;
+    }
+    if(dictionary_full(dictionary->table, dictionary->count) && (error = dictionary_grow(dictionary)))
+      break;
+    if((error = dictionary_entry_new(dictionary, record.hash, name, record.length, &entry)) ||
+       (error = dictionary_chunk(dictionary, record.index)))
+      break;
+    entry->index = record.index;
+    if((error = dictionary_add(dictionary, entry)))
+      break;
+    if(record.index >= dictionary->count)
+      dictionary->count = record.index + 1;
+  }
+  free(name);
+  if(error) return error;
+  
+  // a partly written record is cut off so new records follow the
+  // last complete one
+  if(fseek(log, complete, SEEK_SET) != 0 || ftruncate(fileno(log), complete) != 0)
+    return FILE_IO_ERROR;
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// api
+// ------------------------------------------
+learner_error dictionary_new(char *path, dictionary **dictionary) {
+  learner_error error;
+  *dictionary = (struct _dictionary *) calloc(1, sizeof(struct _dictionary));
+  if(!*dictionary) return MEMORY_ERROR;
+  if((error = matrix_arena_new(&(*dictionary)->arena)) || (error = dictionary_table_new(DICTIONARY_MIN_CAPACITY, &(*dictionary)->table))) {
+    dictionary_free(*dictionary);
+    *dictionary = NULL;
+    return error;
+  }
+  pthread_rwlock_init(&(*dictionary)->resize, NULL);
+  pthread_mutex_init(&(*dictionary)->log_lock, NULL);
+  for(int i = 0; i < DICTIONARY_SHARDS; i++)
+    pthread_mutex_init(&(*dictionary)->shards[i], NULL);
+  if(!path) return NO_ERROR;
+  
+  FILE *log = fopen(path, "r+b");
+  if(!log && errno == ENOENT)
+    log = fopen(path, "w+b");
+  if(!log) {
+    error = FILE_IO_ERROR;
+  } else {
+    (*dictionary)->log = log;
+    error = dictionary_replay(*dictionary, log);
+  }
+  if(error) {
+    dictionary_free(*dictionary);
+    *dictionary = NULL;
+  }
+  return error;
+}
+
+
+learner_error dictionary_free(dictionary *dictionary) {
+  if(!dictionary) return MISSING_VALUES;
+  learner_error error = NO_ERROR;
+  if(dictionary->log && fclose(dictionary->log) != 0)
+    error = FILE_IO_ERROR;
+  while(dictionary->table) {
+    dictionary_table *previous = dictionary->table->previous;
+    free(dictionary->table->slots);
+    free(dictionary->table);
+    dictionary->table = previous;
+  }
+  for(u_int32_t chunk = 0; chunk < DICTIONARY_CHUNKS; chunk++)
+    free(dictionary->chunks[chunk]);
+  if(dictionary->arena) {
+    pthread_rwlock_destroy(&dictionary->resize);
+    pthread_mutex_destroy(&dictionary->log_lock);
+    for(int i = 0; i < DICTIONARY_SHARDS; i++)
+      pthread_mutex_destroy(&dictionary->shards[i]);
+    matrix_arena_free(dictionary->arena);
+  }
+  free(dictionary);
+  return error;
+}
+
+
+learner_error dictionary_flush(dictionary *dictionary) {
+  if(!dictionary) return MISSING_VALUES;
+  if(!dictionary->log) return NO_ERROR;
+  pthread_mutex_lock(&dictionary->log_lock);
+  int failed = fflush(dictionary->log) != 0 || fsync(fileno(dictionary->log)) != 0;
+  pthread_mutex_unlock(&dictionary->log_lock);
+  return failed ? FILE_IO_ERROR : NO_ERROR;
+}
+
+
+learner_error dictionary_find(dictionary *dictionary, void *name, u_int32_t length, u_int32_t *index) {
+  if(!dictionary) return MISSING_VALUES;
+  if(!name && length) return NAME_MISSING;
+  dictionary_entry *entry = dictionary_probe(dictionary->table, dictionary_hash(name, length), name, length);
+  if(!entry) return UNKNOWN_KEY;
+  *index = entry->index;
+  return NO_ERROR;
+}
+
+
+learner_error dictionary_find_or_create(dictionary *dictionary, void *name, u_int32_t length, u_int32_t *index) {
+  if(!dictionary) return MISSING_VALUES;
+  if(!name && length) return NAME_MISSING;
+  u_int64_t hash = dictionary_hash(name, length);
+  learner_error error = NO_ERROR;
+  dictionary_entry *entry = dictionary_probe(dictionary->table, hash, name, length);
+  if(entry) {
+    *index = entry->index;
+    return NO_ERROR;
+  }
+  
+  // the table is doubled before it can fill, then the name looked up
+  // again under its shard lock in case another thread created it
+  pthread_rwlock_rdlock(&dictionary->resize);
+  while(dictionary_full(dictionary->table, dictionary->count)) {
+    pthread_rwlock_unlock(&dictionary->resize);
+    pthread_rwlock_wrlock(&dictionary->resize);
+    error = dictionary_grow(dictionary);
+    pthread_rwlock_unlock(&dictionary->resize);
+    if(error) return error;
+    pthread_rwlock_rdlock(&dictionary->resize);
+  }
+  
+  pthread_mutex_t *shard = &dictionary->shards[dictionary_shard(hash)];
+  pthread_mutex_lock(shard);
+  entry = dictionary_probe(dictionary->table, hash, name, length);
+  if(!entry && !(error = dictionary_entry_new(dictionary, hash, name, length, &entry))) {
+    if((error = dictionary_reserve(dictionary, &entry->index))) {
+      matrix_arena_release(dictionary->arena, entry, sizeof(dictionary_entry) + length + 1);
+      entry = NULL;
+    } else if(!(error = dictionary_add(dictionary, entry))) {
+      error = dictionary_log(dictionary, entry);
+    }
+  }
+  pthread_mutex_unlock(shard);
+  pthread_rwlock_unlock(&dictionary->resize);
+  if(entry) *index = entry->index;
+  return error;
+}
+
+
+learner_error dictionary_name(dictionary *dictionary, u_int32_t index, char **name, u_int32_t *length) {
+  if(!dictionary) return MISSING_VALUES;
+  dictionary_entry **chunk = dictionary->chunks[index >> DICTIONARY_CHUNK_BITS];
+  dictionary_entry *entry = chunk ? chunk[index & (DICTIONARY_CHUNK - 1)] : NULL;
+  if(!entry) return INDEX_OUT_OF_RANGE;
+  *name = entry->name;
+  if(length) *length = entry->length;
+  return NO_ERROR;
+}
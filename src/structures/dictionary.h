@@ -0,0 +1,91 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "core/errors.h"
+#include "structures/matrix_arena.h"
+
+#ifndef __learner_dictionary__
+#define __learner_dictionary__
+
+#define DICTIONARY_LOG_MAGIC        0x6c646963
+#define DICTIONARY_LOG_VERSION      1
+
+// names are hashed in to an open addressing table of at least this
+// many slots, which doubles once more than 3/4 of its slots are used
+#define DICTIONARY_MIN_CAPACITY     1024
+
+// creates lock one of these shards, chosen by the top bits of the
+// name's hash, so creates of different names rarely wait
+#define DICTIONARY_SHARD_BITS       6
+#define DICTIONARY_SHARDS           (1 << DICTIONARY_SHARD_BITS)
+
+// the index to name table is split in to chunks of this many names,
+// allocated as indexes reach them, so it never moves once read
+#define DICTIONARY_CHUNK_BITS       16
+#define DICTIONARY_CHUNK            (1 << DICTIONARY_CHUNK_BITS)
+#define DICTIONARY_CHUNKS           (1 << (32 - DICTIONARY_CHUNK_BITS))
+
+// names are immutable once created. the name is followed by a 0 byte
+// so text names can be used as strings.
+typedef struct {
+  u_int64_t hash;
+  u_int32_t index;
+  u_int32_t length;
+  char      name[];
+} dictionary_entry;
+
+// slots are only ever filled, never emptied, so readers can probe a
+// table while it's being added to. tables replaced by a larger one
+// are kept until the dictionary is freed, as readers may still be
+// probing them.
+typedef struct _dictionary_table {
+  dictionary_entry          **slots;
+  u_int64_t                 capacity;
+  struct _dictionary_table  *previous;
+} dictionary_table;
+
+// a two way map between names (any bytes) and dense indexes, 0 up,
+// in the order names were created. names are copied in to an arena.
+typedef struct _dictionary {
+  dictionary_table  *table;
+  dictionary_entry  **chunks[DICTIONARY_CHUNKS];
+  u_int32_t         count;
+  matrix_arena      *arena;
+  
+  // creates hold resize for reading and their name's shard lock;
+  // doubling the table holds resize for writing
+  pthread_rwlock_t  resize;
+  pthread_mutex_t   shards[DICTIONARY_SHARDS];
+  
+  // every name created is appended to the log (if any) as a record
+  // of its index, length and hash, then the name
+  FILE              *log;
+  pthread_mutex_t   log_lock;
+} dictionary;
+
+// a dictionary with a log at path (or none if path is NULL). names in
+// an existing log are read back in. a partly written last record,
+// left by a crash, is dropped; any other damage is a PARSE_ERROR.
+learner_error dictionary_new(char *path, dictionary **dictionary);
+
+// flushes and closes the log, and frees every name
+learner_error dictionary_free(dictionary *dictionary);
+
+// log records are buffered, so creates don't wait for the disk.
+// flushing writes and syncs every record so far.
+learner_error dictionary_flush(dictionary *dictionary);
+
+// lookups take no locks, so can run alongside creates. a name being
+// created as it's looked up may or may not be found. UNKNOWN_KEY if
+// the name doesn't exist.
+learner_error dictionary_find(dictionary *dictionary, void *name, u_int32_t length, u_int32_t *index);
+
+// the index of name, creating (and logging) it with the next index if
+// it doesn't exist. any number of threads can create names at once.
+learner_error dictionary_find_or_create(dictionary *dictionary, void *name, u_int32_t length, u_int32_t *index);
+
+// the name of index, valid until the dictionary is freed.
+// INDEX_OUT_OF_RANGE if no name has been created with index.
+learner_error dictionary_name(dictionary *dictionary, u_int32_t index, char **name, u_int32_t *length);
+
+#endif
@@ -1,16 +1,112 @@
 #include <stdlib.h>
+#include <string.h>
 #include "core/errors.h"
 #include "core/logging.h"
 #include "matrix.h"
+#include "sparse_vector.h"
+#include "column_index.h"
+#include "matrix_csr.h"
 
 learner_error matrix_new(Matrix **matrix) {
   *matrix = (Matrix *) calloc(1, sizeof(Matrix));
+  if(!*matrix) return MEMORY_ERROR;
+  learner_error error = matrix_arena_new(&(*matrix)->arena);
+  if(error) {
+    free(*matrix);
+    *matrix = NULL;
+    return error;
+  }
   (*matrix)->buffer_delta = LEARNER_DEFAULT_BUFFER_DELTA;
   return NO_ERROR;
 }
 
+// rows are released in bulk with the arena rather than one by one
 learner_error matrix_free(Matrix *matrix) {
   if(!matrix) return MISSING_MATRIX;
+  if(matrix->values)
+    free(matrix->values);
+  if(matrix->magnitudes)
+    free(matrix->magnitudes);
+  if(matrix->row_vectors)
+    free(matrix->row_vectors);
+  matrix_drop_column_index(matrix);
+  matrix_csr_free(matrix->csr);
+  matrix_arena_free(matrix->arena);
   free(matrix);
   return NO_ERROR;
 }
+
+
+learner_error matrix_compact(Matrix *matrix) {
+  if(!matrix) return MISSING_MATRIX;
+  learner_error error = matrix_arena_retire(matrix->arena);
+  if(error) return error;
+  
+  for(u_int64_t row = 0; row < matrix->rows && row < matrix->row_capacity; row++) {
+    if(!matrix->row_vectors[row] || matrix->row_vectors[row]->header._view) continue;
+    error = sparse_vector_compact(matrix->row_vectors[row]);
+    if(error) break;
+  }
+  if(!error)
+    error = column_index_compact(matrix);
+  
+  // trimming returns the retired slabs to service even on failure
+  learner_error trimmed = matrix_arena_trim(matrix->arena);
+  return error ? error : trimmed;
+}
+
+
+learner_error matrix_memory(Matrix *matrix, matrix_arena_usage *usage) {
+  if(!matrix) return MISSING_MATRIX;
+  return matrix_arena_usage_of(matrix->arena, usage);
+}
+
+
+// ------------------------------------------
+// sparse rows
+// ------------------------------------------
+learner_error matrix_set_row(Matrix *matrix, u_int64_t row, SparseVector *vector) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!vector) return MISSING_VECTOR;
+  if(matrix->values) return INVALID_MATRIX_STORAGE;
+  if(vector->matrix != matrix) return VECTOR_NOT_IN_MATRIX;
+  if(vector->header._view && vector->header.matrix_index != row) return VECTOR_IS_VIEW;
+  
+  // the row table doubles in size as rows are added
+  if(row >= matrix->row_capacity) {
+    u_int64_t capacity = matrix->row_capacity ? matrix->row_capacity * 2 : matrix->buffer_delta;
+    if(capacity <= row) capacity = row + 1;
+    struct _sparse_vector **rows = realloc(matrix->row_vectors, capacity * sizeof(SparseVector *));
+    if(!rows) return MEMORY_ERROR;
+    memset(rows + matrix->row_capacity, 0, (capacity - matrix->row_capacity) * sizeof(SparseVector *));
+    matrix->row_vectors  = rows;
+    matrix->row_capacity = capacity;
+  }
+  
+  // the replaced row's postings are removed from the column index
+  // (if any) before it's freed, and the new row's added once set.
+  // packed rows aren't freed; the row is staged until the next merge.
+  SparseVector *previous = matrix->row_vectors[row];
+  learner_error error;
+  if(previous && (error = column_index_remove_row(matrix, previous)))
+    return error;
+  if(matrix->csr && !vector->header._view && (!previous || previous->header._view))
+    matrix->csr->staged++;
+  if(matrix->csr && vector->header._view && previous && !previous->header._view)
+    matrix->csr->staged--;
+  if(previous && previous != vector && !previous->header._view)
+    sparse_vector_free(previous);
+  matrix->row_vectors[row] = vector;
+  vector->header.matrix_index = row;
+  if(row >= matrix->rows)
+    matrix->rows = row + 1;
+  return column_index_add_row(matrix, vector);
+}
+
+
+learner_error matrix_get_row(Matrix *matrix, u_int64_t row, SparseVector **vector) {
+  if(!matrix) return MISSING_MATRIX;
+  if(row >= matrix->rows) return INDEX_OUT_OF_RANGE;
+  *vector = (row < matrix->row_capacity) ? matrix->row_vectors[row] : NULL;
+  return *vector ? NO_ERROR : INDEX_NOT_FOUND;
+}
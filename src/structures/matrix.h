@@ -1,17 +1,59 @@
+#include "structures/matrix_arena.h"
+
 #ifndef __learner_matrix__
 #define __learner_matrix__
 
 #define LEARNER_DEFAULT_BUFFER_DELTA  256
 
+// sparse_vector.h includes this file, so sparse rows are referred
+// to through their struct name
+struct _sparse_vector;
+struct _column_index;
+struct _matrix_csr;
+
 typedef struct {
   u_int64_t index;
   u_int64_t rows;
   u_int64_t columns;
   u_int32_t buffer_delta;
   char      *name;
+  
+  // sparse rows (see matrix_set_row), indexed by row number. rows
+  // set on a matrix are owned by it and freed with the matrix.
+  struct _sparse_vector **row_vectors;
+  u_int64_t             row_capacity;
+  
+  // packed rows, or NULL until the first matrix_csr_merge (see
+  // matrix_csr.h); row_vectors then holds views of packed rows
+  struct _matrix_csr    *csr;
+  
+  // every sparse vector created on the matrix, row or not, is
+  // allocated from its arena, and freed with it by matrix_free
+  matrix_arena          *arena;
+  
+  // inverted index of the sparse rows by column, or NULL (see
+  // column_index.h)
+  struct _column_index  *column_index;
+  
+  // dense storage (see dense_matrix.h); a single aligned vector
+  // block of rows * stride values. NULL for sparse matrices.
+  float     *values;
+  u_int32_t stride;
+  
+  // cached row magnitudes (see matrix_dense_freeze), or NULL
+  float     *magnitudes;
 } Matrix;
 
 learner_error matrix_new(Matrix **matrix);
 learner_error matrix_free(Matrix *matrix);
 
+// compaction moves the values of every row (and the column index's
+// posting lists) in to newly packed slabs, dropping spare capacity,
+// then frees the slabs left empty. row vectors themselves don't move,
+// but pointers to their values do. csr rows are already packed, so
+// are left in place. no other operation may use the matrix while
+// it's compacted.
+learner_error matrix_compact(Matrix *matrix);
+learner_error matrix_memory(Matrix *matrix, matrix_arena_usage *usage);
+
 #endif
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "core/logging.h"
+#include "structures/matrix_arena.h"
+
+// slabs are aligned to their size, so the slab owning a block is
+// found by masking the block's address. the header sits in the first
+// MATRIX_ARENA_SLAB_HEADER bytes, keeping the first block aligned.
+struct _matrix_arena_slab {
+  matrix_arena_slab *next;
+  matrix_arena_slab *previous;
+  matrix_arena_slab *next_available;
+  matrix_arena_slab *previous_available;
+  void              *free;
+  u_int32_t         bump;
+  u_int32_t         live;
+  u_int8_t          size_class;
+  u_int8_t          available;
+  u_int8_t          retired;
+};
+
+struct _matrix_arena_large {
+  matrix_arena_large *next;
+  matrix_arena_large *previous;
+  u_int64_t          bytes;
+};
+
+#define slab_of(block) ((matrix_arena_slab *) ((uintptr_t) (block) & ~((uintptr_t) MATRIX_ARENA_SLAB_BYTES - 1)))
+
+
+// ------------------------------------------
+// size classes
+// ------------------------------------------
+// two classes per power of two: three quarters of it, and the power
+// itself, so no more than a quarter of a block is lost to rounding
+static int size_class(u_int64_t bytes) {
+  if(bytes <= MATRIX_ARENA_MIN_BLOCK) return 0;
+  if(bytes > MATRIX_ARENA_MAX_BLOCK) return -1;
+  int power = 64 - __builtin_clzll(bytes - 1);
+  return (2 * (power - 4)) - ((bytes <= (3ULL << (power - 2))) ? 1 : 0);
+}
+
+static u_int64_t class_bytes(int size_class) {
+  if(size_class == 0) return MATRIX_ARENA_MIN_BLOCK;
+  int power = ((size_class + 1) / 2) + 4;
+  return (size_class & 1) ? (3ULL << (power - 2)) : (1ULL << power);
+}
+
+u_int64_t matrix_arena_block_bytes(u_int64_t bytes) {
+  int size = size_class(bytes);
+  return (size < 0) ? bytes : class_bytes(size);
+}
+
+
+// ------------------------------------------
+// slabs
+// ------------------------------------------
+static int slab_has_space(matrix_arena_slab *slab) {
+  return slab->free || (slab->bump + class_bytes(slab->size_class) <= MATRIX_ARENA_SLAB_BYTES);
+}
+
+static void push_available(matrix_arena *arena, matrix_arena_slab *slab) {
+  matrix_arena_slab **head = &arena->available[slab->size_class];
+  slab->previous_available = NULL;
+  slab->next_available = *head;
+  if(*head)
+    (*head)->previous_available = slab;
+  *head = slab;
+  slab->available = 1;
+}
+
+static void remove_available(matrix_arena *arena, matrix_arena_slab *slab) {
+  if(slab->previous_available)
+    slab->previous_available->next_available = slab->next_available;
+  else
+    arena->available[slab->size_class] = slab->next_available;
+  if(slab->next_available)
+    slab->next_available->previous_available = slab->previous_available;
+  slab->next_available = slab->previous_available = NULL;
+  slab->available = 0;
+}
+
+static learner_error new_slab(matrix_arena *arena, int size_class, matrix_arena_slab **slab) {
+  if(posix_memalign((void **) slab, MATRIX_ARENA_SLAB_BYTES, MATRIX_ARENA_SLAB_BYTES))
+    return MEMORY_ERROR;
+  memset(*slab, 0, sizeof(matrix_arena_slab));
+  (*slab)->size_class = size_class;
+  (*slab)->bump = MATRIX_ARENA_SLAB_HEADER;
+  
+  (*slab)->next = arena->slabs;
+  if(arena->slabs)
+    arena->slabs->previous = *slab;
+  arena->slabs = *slab;
+  push_available(arena, *slab);
+  arena->usage.slabs++;
+  arena->usage.reserved += MATRIX_ARENA_SLAB_BYTES;
+  return NO_ERROR;
+}
+
+static void free_slab(matrix_arena *arena, matrix_arena_slab *slab) {
+  if(slab->available)
+    remove_available(arena, slab);
+  if(slab->previous)
+    slab->previous->next = slab->next;
+  else
+    arena->slabs = slab->next;
+  if(slab->next)
+    slab->next->previous = slab->previous;
+  arena->usage.slabs--;
+  arena->usage.reserved -= MATRIX_ARENA_SLAB_BYTES;
+  free(slab);
+}
+
+
+// ------------------------------------------
+// allocation
+// ------------------------------------------
+learner_error matrix_arena_new(matrix_arena **arena) {
+  *arena = (matrix_arena *) calloc(1, sizeof(matrix_arena));
+  if(!*arena) return MEMORY_ERROR;
+  if(pthread_mutex_init(&(*arena)->lock, NULL)) {
+    free(*arena);
+    *arena = NULL;
+    return MEMORY_ERROR;
+  }
+  return NO_ERROR;
+}
+
+
+learner_error matrix_arena_free(matrix_arena *arena) {
+  if(!arena) return MISSING_VALUES;
+  matrix_arena_slab *slab = arena->slabs, *next_slab;
+  matrix_arena_large *large = arena->large, *next_large;
+  for(; slab; slab = next_slab) {
+    next_slab = slab->next;
+    free(slab);
+  }
+  for(; large; large = next_large) {
+    next_large = large->next;
+    free(large);
+  }
+  pthread_mutex_destroy(&arena->lock);
+  free(arena);
+  return NO_ERROR;
+}
+
+
+// blocks larger than the largest class are allocated individually,
+// with a header linking them so they can be freed with the arena
+static learner_error large_alloc(matrix_arena *arena, u_int64_t bytes, void **block) {
+  matrix_arena_large *large;
+  if(posix_memalign((void **) &large, MATRIX_ARENA_SLAB_HEADER, MATRIX_ARENA_SLAB_HEADER + bytes))
+    return MEMORY_ERROR;
+  large->bytes = bytes;
+  large->previous = NULL;
+  large->next = arena->large;
+  if(arena->large)
+    arena->large->previous = large;
+  arena->large = large;
+  
+  arena->usage.large++;
+  arena->usage.reserved += MATRIX_ARENA_SLAB_HEADER + bytes;
+  arena->usage.allocated += bytes;
+  *block = ((u_int8_t *) large) + MATRIX_ARENA_SLAB_HEADER;
+  return NO_ERROR;
+}
+
+static void large_release(matrix_arena *arena, void *block) {
+  matrix_arena_large *large = (matrix_arena_large *) (((u_int8_t *) block) - MATRIX_ARENA_SLAB_HEADER);
+  if(large->previous)
+    large->previous->next = large->next;
+  else
+    arena->large = large->next;
+  if(large->next)
+    large->next->previous = large->previous;
+  
+  arena->usage.large--;
+  arena->usage.reserved -= MATRIX_ARENA_SLAB_HEADER + large->bytes;
+  arena->usage.allocated -= large->bytes;
+  free(large);
+}
+
+// released blocks are reused first, then fresh blocks are carved
+// from the end of the slab
+static learner_error slab_alloc(matrix_arena *arena, int size_class, void **block) {
+  matrix_arena_slab *slab = arena->available[size_class];
+  u_int64_t size = class_bytes(size_class);
+  if(!slab) {
+    learner_error error = new_slab(arena, size_class, &slab);
+    if(error) return error;
+  }
+  
+  if(slab->free) {
+    *block = slab->free;
+    slab->free = *(void **) slab->free;
+  } else {
+    *block = ((u_int8_t *) slab) + slab->bump;
+    slab->bump += size;
+  }
+  
+  slab->live++;
+  arena->usage.allocated += size;
+  if(!slab_has_space(slab))
+    remove_available(arena, slab);
+  return NO_ERROR;
+}
+
+// an empty slab is freed straight away when its class has another
+// slab to allocate from, so a single block being allocated and
+// released repeatedly doesn't churn slabs
+static void slab_release(matrix_arena *arena, void *block, int size_class) {
+  matrix_arena_slab *slab = slab_of(block);
+  *(void **) block = slab->free;
+  slab->free = block;
+  slab->live--;
+  arena->usage.allocated -= class_bytes(size_class);
+  
+  if(slab->retired) return;
+  if(!slab->available)
+    push_available(arena, slab);
+  if(slab->live == 0 && (slab->next_available || slab->previous_available))
+    free_slab(arena, slab);
+}
+
+
+learner_error matrix_arena_alloc(matrix_arena *arena, u_int64_t bytes, void **block) {
+  if(!arena) return MISSING_VALUES;
+  int size = size_class(bytes);
+  pthread_mutex_lock(&arena->lock);
+  learner_error error = (size < 0) ? large_alloc(arena, bytes, block) : slab_alloc(arena, size, block);
+  if(!error)
+    arena->usage.requested += bytes;
+  pthread_mutex_unlock(&arena->lock);
+  return error;
+}
+
+
+learner_error matrix_arena_release(matrix_arena *arena, void *block, u_int64_t bytes) {
+  if(!arena || !block) return MISSING_VALUES;
+  int size = size_class(bytes);
+  pthread_mutex_lock(&arena->lock);
+  if(size < 0)
+    large_release(arena, block);
+  else
+    slab_release(arena, block, size);
+  arena->usage.requested -= bytes;
+  pthread_mutex_unlock(&arena->lock);
+  return NO_ERROR;
+}
+
+
+learner_error matrix_arena_realloc(matrix_arena *arena, void **block, u_int64_t bytes, u_int64_t new_bytes) {
+  if(!arena || !*block) return MISSING_VALUES;
+  int size = size_class(bytes);
+  if(size >= 0 && size == size_class(new_bytes)) {
+    pthread_mutex_lock(&arena->lock);
+    arena->usage.requested = arena->usage.requested - bytes + new_bytes;
+    pthread_mutex_unlock(&arena->lock);
+    return NO_ERROR;
+  }
+  
+  void *moved;
+  learner_error error = matrix_arena_alloc(arena, new_bytes, &moved);
+  if(error) return error;
+  memcpy(moved, *block, (bytes < new_bytes) ? bytes : new_bytes);
+  matrix_arena_release(arena, *block, bytes);
+  *block = moved;
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// compaction
+// ------------------------------------------
+learner_error matrix_arena_retire(matrix_arena *arena) {
+  if(!arena) return MISSING_VALUES;
+  pthread_mutex_lock(&arena->lock);
+  for(matrix_arena_slab *slab = arena->slabs; slab; slab = slab->next) {
+    if(slab->available)
+      remove_available(arena, slab);
+    slab->retired = 1;
+  }
+  pthread_mutex_unlock(&arena->lock);
+  return NO_ERROR;
+}
+
+
+learner_error matrix_arena_trim(matrix_arena *arena) {
+  if(!arena) return MISSING_VALUES;
+  matrix_arena_slab *slab, *next;
+  pthread_mutex_lock(&arena->lock);
+  for(slab = arena->slabs; slab; slab = next) {
+    next = slab->next;
+    slab->retired = 0;
+    if(slab->live == 0)
+      free_slab(arena, slab);
+    else if(!slab->available && slab_has_space(slab))
+      push_available(arena, slab);
+  }
+  pthread_mutex_unlock(&arena->lock);
+  return NO_ERROR;
+}
+
+
+learner_error matrix_arena_usage_of(matrix_arena *arena, matrix_arena_usage *usage) {
+  if(!arena) return MISSING_VALUES;
+  pthread_mutex_lock(&arena->lock);
+  *usage = arena->usage;
+  pthread_mutex_unlock(&arena->lock);
+  return NO_ERROR;
+}
@@ -0,0 +1,68 @@
+#include <sys/types.h>
+#include <pthread.h>
+#include "core/errors.h"
+
+#ifndef __learner_matrix_arena__
+#define __learner_matrix_arena__
+
+// arenas carve small blocks out of large slabs so millions of short
+// vectors don't each cost a trip through malloc. blocks are grouped
+// in to size classes (16, 24, 32, 48, 64, 96... 64kb); every slab
+// holds blocks of a single class, and blocks larger than the largest
+// class are allocated individually. classes that are multiples of 64
+// bytes are 64 byte aligned.
+#define MATRIX_ARENA_SLAB_BYTES   (1 << 20)
+#define MATRIX_ARENA_SLAB_HEADER  64
+#define MATRIX_ARENA_MIN_BLOCK    16
+#define MATRIX_ARENA_MAX_BLOCK    (64 * 1024)
+#define MATRIX_ARENA_CLASSES      25
+
+typedef struct _matrix_arena_slab  matrix_arena_slab;
+typedef struct _matrix_arena_large matrix_arena_large;
+
+// reserved is every byte held from the system; allocated is the bytes
+// of blocks in use (rounded up to their class) and requested the
+// bytes asked for, so allocated - requested is lost to rounding and
+// reserved - allocated is free space held for reuse
+typedef struct {
+  u_int64_t reserved;
+  u_int64_t allocated;
+  u_int64_t requested;
+  u_int64_t slabs;
+  u_int64_t large;
+} matrix_arena_usage;
+
+typedef struct {
+  matrix_arena_slab   *available[MATRIX_ARENA_CLASSES];
+  matrix_arena_slab   *slabs;
+  matrix_arena_large  *large;
+  matrix_arena_usage  usage;
+  pthread_mutex_t     lock;
+} matrix_arena;
+
+learner_error matrix_arena_new(matrix_arena **arena);
+
+// releases every slab and large block at once, including blocks
+// never released individually
+learner_error matrix_arena_free(matrix_arena *arena);
+
+// blocks are released with the size they were allocated with, so no
+// per block header is needed. allocating 0 bytes returns a minimum
+// size block rather than NULL. resizing within a class keeps the block.
+learner_error matrix_arena_alloc(matrix_arena *arena, u_int64_t bytes, void **block);
+learner_error matrix_arena_realloc(matrix_arena *arena, void **block, u_int64_t bytes, u_int64_t new_bytes);
+learner_error matrix_arena_release(matrix_arena *arena, void *block, u_int64_t bytes);
+
+// the bytes actually available in a block allocated with bytes, so
+// growing buffers can use the rounding rather than waste it
+u_int64_t matrix_arena_block_bytes(u_int64_t bytes);
+
+// compaction: retiring stops new blocks being carved from the slabs
+// that exist now, so blocks reallocated afterwards are packed in to
+// new slabs. trimming frees slabs with no blocks left in use and
+// returns retired slabs to service.
+learner_error matrix_arena_retire(matrix_arena *arena);
+learner_error matrix_arena_trim(matrix_arena *arena);
+learner_error matrix_arena_usage_of(matrix_arena *arena, matrix_arena_usage *usage);
+
+#endif
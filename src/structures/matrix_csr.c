@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "structures/matrix_csr.h"
+#include "structures/column_index.h"
+
+// rows are copied in ranges of this many rows per thread
+#define MATRIX_CSR_GRANULARITY  1024
+
+// packed arrays start on a cache line, like structure of arrays rows
+static void *matrix_csr_block(u_int64_t bytes) {
+  void *block;
+  if(posix_memalign(&block, SPARSE_VECTOR_ALIGNMENT, bytes ? bytes : SPARSE_VECTOR_ALIGNMENT))
+    return NULL;
+  return block;
+}
+
+learner_error matrix_csr_alloc(u_int64_t nonzeros, u_int32_t **indexes, float **values) {
+  *indexes = (u_int32_t *) matrix_csr_block(nonzeros * sizeof(u_int32_t));
+  *values  = (float *) matrix_csr_block(nonzeros * sizeof(float));
+  if(*indexes && *values) return NO_ERROR;
+  free(*indexes);
+  free(*values);
+  *indexes = NULL;
+  *values  = NULL;
+  return MEMORY_ERROR;
+}
+
+learner_error matrix_csr_free(matrix_csr *csr) {
+  if(!csr) return NO_ERROR;
+  if(csr->mapping) {
+    munmap(csr->mapping, csr->mapping_length);
+  } else {
+    free(csr->offsets);
+    free(csr->indexes);
+    free(csr->values);
+  }
+  free(csr->views);
+  free(csr);
+  return NO_ERROR;
+}
+
+typedef struct {
+  Matrix      *matrix;
+  matrix_csr  *csr;
+} matrix_csr_context;
+
+// copies each row (if any) in to the new arrays and fills in its
+// view. rows keep their freeze state, except that views are always
+// frozen. adopted arrays have no rows to copy from.
+static void matrix_csr_pack_rows(void *context, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  matrix_csr_context *pack = (matrix_csr_context *) context;
+  matrix_csr *csr = pack->csr;
+  SparseVector *row, *view;
+  
+  for(u_int64_t r = start; r < end; r++) {
+    view = &csr->views[r];
+    view->header.min_index    = -1;
+    view->header.max_index    = -1;
+    view->header.matrix_index = r;
+    view->header._view        = 1;
+    view->matrix  = pack->matrix;
+    view->indexes = csr->indexes + csr->offsets[r];
+    view->weights = csr->values + csr->offsets[r];
+    
+    u_int64_t count = csr->offsets[r + 1] - csr->offsets[r];
+    row = (r < pack->matrix->row_capacity) ? pack->matrix->row_vectors[r] : NULL;
+    if(row && row->weights) {
+      memcpy(view->indexes, row->indexes, count * sizeof(u_int32_t));
+      memcpy(view->weights, row->weights, count * sizeof(float));
+    } else if(row) {
+      for(u_int64_t i = 0; i < count; i++) {
+        view->indexes[i] = sparse_vector_index_at(row, i);
+        view->weights[i] = sparse_vector_value_at(row, i);
+      }
+    }
+    
+    view->header.count = count;
+    if(count) {
+      view->header.min_index = view->indexes[0];
+      view->header.max_index = view->indexes[count - 1];
+    }
+    if(row && row->header.frozen != SPARSE_VECTOR_UNFROZEN) {
+      view->header.magnitude = row->header.magnitude;
+      view->header.frozen    = row->header.frozen;
+    } else {
+      float squares = 0.0;
+      for(u_int64_t i = 0; i < count; i++)
+        squares += view->weights[i] * view->weights[i];
+      view->header.magnitude = sqrtf(squares);
+      view->header.frozen    = SPARSE_VECTOR_FROZEN;
+    }
+  }
+}
+
+
+learner_error matrix_csr_merge(Matrix *matrix, u_int32_t threads) {
+  if(!matrix) return MISSING_MATRIX;
+  if(matrix->values) return INVALID_MATRIX_STORAGE;
+  u_int64_t rows = matrix->rows;
+  learner_error error;
+  
+  matrix_csr *csr = (matrix_csr *) calloc(1, sizeof(matrix_csr));
+  if(!csr) return MEMORY_ERROR;
+  csr->rows    = rows;
+  csr->offsets = (u_int64_t *) malloc((rows + 1) * sizeof(u_int64_t));
+  csr->views   = (SparseVector *) calloc(rows ? rows : 1, sizeof(SparseVector));
+  if(!csr->offsets || !csr->views) {
+    matrix_csr_free(csr);
+    return MEMORY_ERROR;
+  }
+  
+  // row offsets are the running total of the row counts
+  csr->offsets[0] = 0;
+  for(u_int64_t r = 0; r < rows; r++) {
+    SparseVector *row = (r < matrix->row_capacity) ? matrix->row_vectors[r] : NULL;
+    csr->offsets[r + 1] = csr->offsets[r] + (row ? row->header.count : 0);
+  }
+  csr->nonzeros = csr->offsets[rows];
+  
+  if((error = matrix_csr_alloc(csr->nonzeros, &csr->indexes, &csr->values))) {
+    matrix_csr_free(csr);
+    return error;
+  }
+  
+  matrix_csr_context context = {matrix, csr};
+  error = learner_parallel_for(rows, learner_default_threads(threads), MATRIX_CSR_GRANULARITY, matrix_csr_pack_rows, &context);
+  if(error) {
+    matrix_csr_free(csr);
+    return error;
+  }
+  
+  // staged rows are freed and every row replaced with its new view.
+  // column index postings refer to rows by number, so stay valid.
+  for(u_int64_t r = 0; r < rows && r < matrix->row_capacity; r++) {
+    SparseVector *row = matrix->row_vectors[r];
+    if(!row) continue;
+    if(!row->header._view)
+      sparse_vector_free(row);
+    matrix->row_vectors[r] = &csr->views[r];
+  }
+  matrix_csr_free(matrix->csr);
+  matrix->csr = csr;
+  return NO_ERROR;
+}
+
+
+learner_error matrix_csr_adopt(Matrix *matrix, u_int64_t rows, u_int64_t *offsets, u_int32_t *indexes, float *values, u_int32_t threads) {
+  if(!matrix) return MISSING_MATRIX;
+  if(matrix->values || matrix->rows || matrix->csr) return INVALID_MATRIX_STORAGE;
+  learner_error error;
+  
+  matrix_csr *csr = (matrix_csr *) calloc(1, sizeof(matrix_csr));
+  if(!csr) return MEMORY_ERROR;
+  matrix->row_vectors = (SparseVector **) malloc((rows ? rows : 1) * sizeof(SparseVector *));
+  csr->views = (SparseVector *) calloc(rows ? rows : 1, sizeof(SparseVector));
+  if(!matrix->row_vectors || !csr->views) {
+    free(csr->views);
+    free(csr);
+    return MEMORY_ERROR;
+  }
+  csr->rows     = rows;
+  csr->nonzeros = offsets[rows];
+  csr->offsets  = offsets;
+  csr->indexes  = indexes;
+  csr->values   = values;
+  
+  matrix_csr_context context = {matrix, csr};
+  if((error = learner_parallel_for(rows, learner_default_threads(threads), MATRIX_CSR_GRANULARITY, matrix_csr_pack_rows, &context))) {
+    free(csr->views);
+    free(csr);
+    return error;
+  }
+  for(u_int64_t r = 0; r < rows; r++)
+    matrix->row_vectors[r] = &csr->views[r];
+  matrix->row_capacity = rows;
+  matrix->rows = rows;
+  matrix->csr  = csr;
+  
+  if(matrix->column_index) {
+    matrix_drop_column_index(matrix);
+    return matrix_index_columns(matrix, threads);
+  }
+  return NO_ERROR;
+}
@@ -0,0 +1,62 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/sparse_vector.h"
+
+#ifndef __learner_matrix_csr__
+#define __learner_matrix_csr__
+
+// compressed sparse row storage. the values of every row are packed
+// in row order in to one aligned array of indexes and one parallel
+// array of values, with row r at [offsets[r], offsets[r + 1]), so
+// scanning the rows streams through memory rather than chasing a
+// separately allocated block per row.
+//
+// each packed row has a view: a sparse vector in structure of arrays
+// form whose indexes and weights point in to the packed arrays. views
+// are what row_vectors (and so matrix_get_row) hand out, so anything
+// reading sparse rows works unchanged. views are frozen and read
+// only; functions changing a vector return VECTOR_IS_VIEW.
+typedef struct _matrix_csr {
+  u_int64_t     rows;
+  u_int64_t     nonzeros;
+  u_int64_t     *offsets;
+  u_int32_t     *indexes;
+  float         *values;
+  SparseVector  *views;
+  
+  // rows set since the last merge are staged: row_vectors holds the
+  // (ordinary, mutable) vector set rather than the packed row's view
+  u_int64_t     staged;
+  
+  // offsets, indexes and values of a matrix loaded from a file (see
+  // matrix_file.h) point in to its mapping, which is unmapped rather
+  // than freed. NULL otherwise.
+  void          *mapping;
+  u_int64_t     mapping_length;
+} matrix_csr;
+
+// a merge is worthwhile once this fraction of rows is staged
+#define MATRIX_CSR_MERGE_RATIO    8
+#define matrix_csr_should_merge(matrix) ((matrix)->csr && ((matrix)->csr->staged * MATRIX_CSR_MERGE_RATIO) > (matrix)->csr->rows)
+
+// merging packs every row (packed or staged) in to new arrays, across
+// threads (0 for LEARNER_CORES), and frees the staged vectors. the
+// first merge switches a sparse matrix to csr storage; after it
+// matrix_set_row stages rows until the next merge. views (and staged
+// vectors) obtained before a merge are invalid after it, and no
+// other operation may use the matrix while it's merged.
+learner_error matrix_csr_merge(Matrix *matrix, u_int32_t threads);
+
+// an empty sparse matrix can instead adopt rows already packed (e.g.
+// by a product, see sparse_matrix.h), taking ownership of offsets
+// (rows + 1 values, allocated with malloc) and of indexes and values,
+// allocated with matrix_csr_alloc. every row, empty or not, is set,
+// and a column index made before the rows is rebuilt over them.
+learner_error matrix_csr_alloc(u_int64_t nonzeros, u_int32_t **indexes, float **values);
+learner_error matrix_csr_adopt(Matrix *matrix, u_int64_t rows, u_int64_t *offsets, u_int32_t *indexes, float *values, u_int32_t threads);
+
+// used by matrix_free
+learner_error matrix_csr_free(matrix_csr *csr);
+
+#endif
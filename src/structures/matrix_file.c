@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "structures/matrix_file.h"
+#include "structures/sparse_vector.h"
+
+// views are set up in ranges of this many rows per thread
+#define MATRIX_FILE_GRANULARITY   4096
+
+// values are converted to packed form this many at a time
+#define MATRIX_FILE_BUFFER        1024
+
+#define matrix_file_align(offset) (((offset) + MATRIX_FILE_ALIGNMENT - 1) & ~((u_int64_t) MATRIX_FILE_ALIGNMENT - 1))
+
+
+// ------------------------------------------
+// saving
+// ------------------------------------------
+// sections are padded with zeros up to the next page boundary
+static int matrix_file_pad(FILE *file, u_int64_t *written) {
+  static const char zeros[MATRIX_FILE_ALIGNMENT];
+  u_int64_t padding = matrix_file_align(*written) - *written;
+  *written += padding;
+  return padding && fwrite(zeros, 1, padding, file) != padding;
+}
+
+static int matrix_file_write(FILE *file, void *data, u_int64_t bytes, u_int64_t *written) {
+  *written += bytes;
+  return bytes && fwrite(data, 1, bytes, file) != bytes;
+}
+
+// a row's indexes (or values), written directly when the row keeps
+// them in an array, and otherwise converted a buffer at a time
+static int matrix_file_write_row(FILE *file, SparseVector *row, int indexes, u_int64_t *written) {
+  union {
+    u_int32_t indexes[MATRIX_FILE_BUFFER];
+    float     values[MATRIX_FILE_BUFFER];
+  } buffer;
+  u_int64_t count = row->header.count;
+  
+  if(indexes && row->indexes)
+    return matrix_file_write(file, row->indexes, count * sizeof(u_int32_t), written);
+  if(!indexes && row->weights)
+    return matrix_file_write(file, row->weights, count * sizeof(float), written);
+  
+  for(u_int64_t start = 0; start < count; start += MATRIX_FILE_BUFFER) {
+    u_int64_t end = (start + MATRIX_FILE_BUFFER < count) ? start + MATRIX_FILE_BUFFER : count;
+    for(u_int64_t i = start; i < end; i++) {
+      if(indexes)
+        buffer.indexes[i - start] = sparse_vector_index_at(row, i);
+      else
+        buffer.values[i - start] = sparse_vector_value_at(row, i);
+    }
+    if(matrix_file_write(file, &buffer, (end - start) * sizeof(float), written))
+      return 1;
+  }
+  return 0;
+}
+
+static learner_error matrix_file_write_sections(Matrix *matrix, FILE *file, matrix_file_header *header, u_int64_t *offsets) {
+  u_int64_t written = 0;
+  matrix_file_row record;
+  SparseVector *row;
+  int failed = 0;
+  
+  failed |= matrix_file_write(file, header, sizeof(matrix_file_header), &written);
+  failed |= matrix_file_pad(file, &written);
+  for(u_int64_t r = 0; r < header->rows && !failed; r++) {
+    memset(&record, 0, sizeof(matrix_file_row));
+    if(matrix_get_row(matrix, r, &row) == NO_ERROR) {
+      record.present = 1;
+      if(row->header.count) {
+        record.min_index = row->header.min_index;
+        record.max_index = row->header.max_index;
+      }
+      
+      // rows are frozen once packed, as when merged
+      sparse_vector_magnitude(row, &record.magnitude);
+      record.frozen = row->header.frozen ? row->header.frozen : SPARSE_VECTOR_FROZEN;
+    }
+    failed |= matrix_file_write(file, &record, sizeof(matrix_file_row), &written);
+  }
+  
+  failed |= matrix_file_pad(file, &written);
+  failed |= matrix_file_write(file, offsets, (header->rows + 1) * sizeof(u_int64_t), &written);
+  for(int indexes = 1; indexes >= 0 && !failed; indexes--) {
+    failed |= matrix_file_pad(file, &written);
+    for(u_int64_t r = 0; r < header->rows && !failed; r++)
+      if(matrix_get_row(matrix, r, &row) == NO_ERROR)
+        failed |= matrix_file_write_row(file, row, indexes, &written);
+  }
+  failed |= matrix_file_pad(file, &written);
+  return (failed || written != header->length) ? FILE_IO_ERROR : NO_ERROR;
+}
+
+
+learner_error matrix_file_save(Matrix *matrix, char *path) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!path) return NAME_MISSING;
+  if(matrix->values) return INVALID_MATRIX_STORAGE;
+  matrix_file_header header;
+  SparseVector *row;
+  learner_error error;
+  
+  u_int64_t rows = matrix->rows;
+  u_int64_t *offsets = (u_int64_t *) malloc((rows + 1) * sizeof(u_int64_t));
+  char *temporary = (char *) malloc(strlen(path) + 5);
+  if(!offsets || !temporary) {
+    free(offsets);
+    free(temporary);
+    return MEMORY_ERROR;
+  }
+  offsets[0] = 0;
+  for(u_int64_t r = 0; r < rows; r++)
+    offsets[r + 1] = offsets[r] + ((matrix_get_row(matrix, r, &row) == NO_ERROR) ? row->header.count : 0);
+  
+  memset(&header, 0, sizeof(matrix_file_header));
+  header.magic       = MATRIX_FILE_MAGIC;
+  header.version     = MATRIX_FILE_VERSION;
+  header.rows        = rows;
+  header.columns     = matrix->columns;
+  header.nonzeros    = offsets[rows];
+  header.row_records = matrix_file_align(sizeof(matrix_file_header));
+  header.offsets     = matrix_file_align(header.row_records + (rows * sizeof(matrix_file_row)));
+  header.indexes     = matrix_file_align(header.offsets + ((rows + 1) * sizeof(u_int64_t)));
+  header.values      = matrix_file_align(header.indexes + (header.nonzeros * sizeof(u_int32_t)));
+  header.length      = matrix_file_align(header.values + (header.nonzeros * sizeof(float)));
+  
+  // the new file only replaces the old once completely written
+  sprintf(temporary, "%s.tmp", path);
+  FILE *file = fopen(temporary, "wb");
+  if(!file) {
+    error = FILE_IO_ERROR;
+  } else {
+    error = matrix_file_write_sections(matrix, file, &header, offsets);
+    if(fclose(file) != 0 && !error)
+      error = FILE_IO_ERROR;
+    if(!error && rename(temporary, path) != 0)
+      error = FILE_IO_ERROR;
+    if(error)
+      unlink(temporary);
+  }
+  
+  free(offsets);
+  free(temporary);
+  return error;
+}
+
+
+// ------------------------------------------
+// loading
+// ------------------------------------------
+typedef struct {
+  Matrix          *matrix;
+  matrix_csr      *csr;
+  matrix_file_row *records;
+  int             invalid;
+} matrix_file_context;
+
+// a row's indexes must ascend, from its record's min_index to its
+// max_index, which callers trust as the bounds of the row
+static int matrix_file_indexes_valid(matrix_file_row *record, u_int32_t *indexes, u_int64_t count) {
+  if(count == 0) return 1;
+  if(indexes[0] != record->min_index || indexes[count - 1] != record->max_index) return 0;
+  for(u_int64_t i = 1; i < count; i++)
+    if(indexes[i - 1] >= indexes[i]) return 0;
+  return 1;
+}
+
+// views point in to the mapped arrays. offsets and indexes are checked
+// as they're read, so a damaged file can't produce views outside the
+// mapping, or rows reaching past their bounds.
+static void matrix_file_views(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  matrix_file_context *context = (matrix_file_context *) param;
+  matrix_csr *csr = context->csr;
+  SparseVector *view;
+  (void) thread;
+  
+  for(u_int64_t r = start; r < end; r++) {
+    matrix_file_row *record = &context->records[r];
+    u_int64_t offset = csr->offsets[r], count = csr->offsets[r + 1] - offset;
+    if(csr->offsets[r + 1] < offset || csr->offsets[r + 1] > csr->nonzeros || (count && !record->present) ||
+       !matrix_file_indexes_valid(record, csr->indexes + offset, count)) {
+      context->invalid = 1;
+      return;
+    }
+    
+    view = &csr->views[r];
+    view->header.count        = count;
+    view->header.min_index    = count ? (u_int64_t) record->min_index : (u_int64_t) -1;
+    view->header.max_index    = count ? (u_int64_t) record->max_index : (u_int64_t) -1;
+    view->header.matrix_index = r;
+    view->header.magnitude    = record->magnitude;
+    view->header.frozen       = record->frozen;
+    view->header._view        = 1;
+    view->matrix  = context->matrix;
+    view->indexes = csr->indexes + offset;
+    view->weights = csr->values + offset;
+    context->matrix->row_vectors[r] = record->present ? view : NULL;
+  }
+}
+
+// sections must lie in order within the file, each long enough for
+// the arrays the header says it holds
+static int matrix_file_valid(matrix_file_header *header, u_int64_t length) {
+  if(header->magic != MATRIX_FILE_MAGIC || header->version != MATRIX_FILE_VERSION || header->length != length)
+    return 0;
+  if((header->row_records | header->offsets | header->indexes | header->values) % MATRIX_FILE_ALIGNMENT)
+    return 0;
+  if(header->rows > length / sizeof(matrix_file_row) || header->nonzeros > length / sizeof(float))
+    return 0;
+  return header->row_records >= sizeof(matrix_file_header) &&
+         header->offsets >= header->row_records + (header->rows * sizeof(matrix_file_row)) &&
+         header->indexes >= header->offsets + ((header->rows + 1) * sizeof(u_int64_t)) &&
+         header->values  >= header->indexes + (header->nonzeros * sizeof(u_int32_t)) &&
+         length          >= header->values  + (header->nonzeros * sizeof(float));
+}
+
+
+learner_error matrix_file_load(char *path, u_int32_t threads, Matrix **matrix) {
+  if(!path) return NAME_MISSING;
+  matrix_file_header *header;
+  learner_error error = NO_ERROR;
+  struct stat status;
+  void *mapping;
+  
+  // the mapping holds its own reference to the file, so the
+  // descriptor is only needed until it's mapped
+  int file = open(path, O_RDONLY);
+  if(file < 0) return (errno == ENOENT) ? FILE_NOT_FOUND : FILE_IO_ERROR;
+  if(fstat(file, &status) != 0) {
+    close(file);
+    return FILE_IO_ERROR;
+  }
+  if(status.st_size < (off_t) sizeof(matrix_file_header)) {
+    close(file);
+    return PARSE_ERROR;
+  }
+  mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0);
+  close(file);
+  if(mapping == MAP_FAILED) return FILE_IO_ERROR;
+  
+  header = (matrix_file_header *) mapping;
+  if(!matrix_file_valid(header, status.st_size)) {
+    munmap(mapping, status.st_size);
+    return PARSE_ERROR;
+  }
+  
+  u_int64_t rows = header->rows;
+  matrix_csr *csr = (matrix_csr *) calloc(1, sizeof(matrix_csr));
+  if(!csr) {
+    munmap(mapping, status.st_size);
+    return MEMORY_ERROR;
+  }
+  csr->mapping        = mapping;
+  csr->mapping_length = status.st_size;
+  if((error = matrix_new(matrix))) {
+    matrix_csr_free(csr);
+    return error;
+  }
+  (*matrix)->csr = csr;
+  
+  csr->rows     = rows;
+  csr->nonzeros = header->nonzeros;
+  csr->offsets  = (u_int64_t *) ((char *) mapping + header->offsets);
+  csr->indexes  = (u_int32_t *) ((char *) mapping + header->indexes);
+  csr->values   = (float *) ((char *) mapping + header->values);
+  csr->views    = (SparseVector *) calloc(rows ? rows : 1, sizeof(SparseVector));
+  (*matrix)->row_vectors = (SparseVector **) calloc(rows ? rows : 1, sizeof(SparseVector *));
+  if(!csr->views || !(*matrix)->row_vectors) {
+    matrix_free(*matrix);
+    *matrix = NULL;
+    return MEMORY_ERROR;
+  }
+  (*matrix)->row_capacity = rows;
+  (*matrix)->rows         = rows;
+  (*matrix)->columns      = header->columns;
+  
+  matrix_file_context context = {*matrix, csr, (matrix_file_row *) ((char *) mapping + header->row_records), 0};
+  if(csr->offsets[0] != 0 || csr->offsets[rows] != csr->nonzeros)
+    context.invalid = 1;
+  else
+    error = learner_parallel_for(rows, learner_default_threads(threads), MATRIX_FILE_GRANULARITY, matrix_file_views, &context);
+  if(!error && context.invalid)
+    error = PARSE_ERROR;
+  
+  if(error) {
+    matrix_free(*matrix);
+    *matrix = NULL;
+  }
+  return error;
+}
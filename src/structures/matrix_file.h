@@ -0,0 +1,67 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/matrix_csr.h"
+
+#ifndef __learner_matrix_file__
+#define __learner_matrix_file__
+
+#define MATRIX_FILE_MAGIC       0x6c6d7478
+#define MATRIX_FILE_VERSION     1
+
+// every section starts on a page boundary, so arrays mapped from the
+// file are aligned for the vector kernels
+#define MATRIX_FILE_ALIGNMENT   4096
+
+// a matrix file holds a sparse matrix in csr form (see matrix_csr.h):
+// a header page, then a record per row, the row offsets (rows + 1),
+// and the packed index and value arrays. values are stored in host
+// byte order; files written on a host of the other order fail the
+// magic number check.
+#pragma pack(push)
+#pragma pack(1)
+typedef struct {
+  u_int32_t magic;
+  u_int32_t version;
+  u_int64_t rows;
+  u_int64_t columns;
+  u_int64_t nonzeros;
+  u_int64_t length;             // of the whole file, in bytes
+  
+  // byte offsets of each section from the start of the file
+  u_int64_t row_records;
+  u_int64_t offsets;
+  u_int64_t indexes;
+  u_int64_t values;
+} matrix_file_header;
+
+// row headers are kept so opening a file never reads the value
+// array. rows never set are stored empty, with present 0.
+typedef struct {
+  u_int32_t min_index;
+  u_int32_t max_index;
+  float     magnitude;
+  u_int8_t  frozen;
+  u_int8_t  present;
+  u_int16_t reserved;
+} matrix_file_row;
+#pragma pack(pop)
+
+// writes the rows of a sparse matrix (in any form, packed or not) to
+// a new file at path. the file is written beside path then renamed
+// over it, so processes with the previous file open keep reading
+// the old version until they reopen it.
+learner_error matrix_file_save(Matrix *matrix, char *path);
+
+// opens a matrix file as a new csr matrix whose rows are views of
+// the file mapped in to memory (read only, and shared with every
+// other process mapping it), so no values are read or copied: pages
+// are loaded by the OS as rows are used. views are set up across
+// threads (0 for LEARNER_CORES) from the row records, with each row's
+// indexes checked to ascend between the record's min_index and
+// max_index (callers trust them as the row's bounds); a file failing
+// any check is a PARSE_ERROR. rows can be set and merged as with any
+// csr matrix; the file is unmapped when the matrix is freed or merged.
+learner_error matrix_file_load(char *path, u_int32_t threads, Matrix **matrix);
+
+#endif
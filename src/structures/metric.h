@@ -0,0 +1,14 @@
+#ifndef __learner_metric__
+#define __learner_metric__
+
+// measures used by the batch and search functions. for dot product
+// and cosine similarity larger is closer, for euclidean distance
+// smaller is closer.
+typedef enum {
+  DOT_PRODUCT,
+  COSINE_SIMILARITY,
+  EUCLIDEAN_DISTANCE
+} learner_metric;
+extern char *learner_metric_names[];
+
+#endif
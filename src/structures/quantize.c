@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "core/logging.h"
+#include "structures/quantize.h"
+#include "structures/vector_kernels.h"
+
+// ------------------------------------------
+// half precision conversion
+// ------------------------------------------
+// conversions round to nearest even, and handle subnormals,
+// infinities and NaN. values too large for a half become infinity.
+u_int16_t float_to_half(float value) {
+  u_int32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  u_int16_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+  u_int32_t mantissa = bits & 0x7FFFFF;
+
+  // infinity and NaN
+  if(((bits >> 23) & 0xFF) == 0xFF)
+    return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+
+  // overflow to infinity
+  if(exponent >= 31)
+    return sign | 0x7C00;
+
+  // subnormal halfs, or underflow to zero
+  if(exponent <= 0) {
+    if(exponent < -10)
+      return sign;
+    mantissa |= 0x800000;
+    u_int32_t shift = 14 - exponent;
+    u_int32_t half = mantissa >> shift;
+    u_int32_t remainder = mantissa & ((1 << shift) - 1), halfway = 1 << (shift - 1);
+    if(remainder > halfway || (remainder == halfway && (half & 1)))
+      half++;
+    return sign | half;
+  }
+
+  // normal values; a carry out of the mantissa correctly bumps
+  // the exponent (and may round up to infinity)
+  u_int16_t half = sign | (exponent << 10) | (mantissa >> 13);
+  u_int32_t remainder = mantissa & 0x1FFF;
+  if(remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    half++;
+  return half;
+}
+
+float half_to_float(u_int16_t value) {
+  u_int32_t sign = (value & 0x8000) << 16;
+  u_int32_t exponent = (value >> 10) & 0x1F;
+  u_int32_t mantissa = value & 0x3FF;
+  u_int32_t bits;
+
+  if(exponent == 0x1F) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else if(exponent == 0) {
+    if(mantissa == 0) {
+      bits = sign;
+    } else {
+      // normalise the subnormal value
+      exponent = 127 - 15 + 1;
+      while(!(mantissa & 0x400)) {
+        mantissa <<= 1;
+        exponent--;
+      }
+      bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+  } else {
+    bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+
+// ------------------------------------------
+// quantizing
+// ------------------------------------------
+learner_error quantize_values(float *values, u_int32_t count, quantization_type type, void **quantized, quantization *params, quantization_error *error) {
+  if(!values && count > 0) return MISSING_VALUES;
+  if(type != QUANTIZE_FLOAT16 && type != QUANTIZE_INT8) return INVALID_QUANTIZATION;
+
+  memset(params, 0, sizeof(quantization));
+  params->type  = type;
+  params->scale = 1.0;
+  *quantized = malloc((count ? count : 1) * quantization_width(type));
+  if(!*quantized) return MEMORY_ERROR;
+
+  if(type == QUANTIZE_FLOAT16) {
+    u_int16_t *halfs = (u_int16_t *) *quantized;
+    for(u_int32_t i = 0; i < count; i++)
+      halfs[i] = float_to_half(values[i]);
+
+  } else {
+    float min = 0.0, max = 0.0;
+    if(count > 0) min = max = values[0];
+    for(u_int32_t i = 1; i < count; i++) {
+      if(values[i] < min) min = values[i];
+      if(values[i] > max) max = values[i];
+    }
+
+    // constant vectors are represented entirely by the offset
+    params->offset = (max + min) / 2;
+    params->scale  = (max > min) ? (max - min) / 254 : 1.0;
+
+    int8_t *bytes = (int8_t *) *quantized;
+    for(u_int32_t i = 0; i < count; i++) {
+      float q = roundf((values[i] - params->offset) / params->scale);
+      bytes[i] = (int8_t) (q > 127 ? 127 : (q < -127 ? -127 : q));
+      params->sum += bytes[i];
+    }
+  }
+
+  if(error) {
+    float difference, squares = 0.0;
+    error->max_error = 0.0;
+    for(u_int32_t i = 0; i < count; i++) {
+      difference = fabsf(values[i] - quantized_value(*quantized, params, i));
+      squares += difference * difference;
+      if(difference > error->max_error)
+        error->max_error = difference;
+    }
+    error->rms_error = count ? sqrtf(squares / count) : 0.0;
+  }
+
+  return NO_ERROR;
+}
+
+
+void dequantize_values(void *quantized, quantization *params, u_int32_t start, u_int32_t count, float *values) {
+  if(params->type == QUANTIZE_FLOAT16) {
+    vector_kernels.float16_to_float(((u_int16_t *) quantized) + start, values, count);
+  } else {
+    int8_t *bytes = ((int8_t *) quantized) + start;
+    float scale = params->scale, offset = params->offset;
+    for(u_int32_t i = 0; i < count; i++)
+      values[i] = (scale * bytes[i]) + offset;
+  }
+}
+
+
+float quantized_value(void *quantized, quantization *params, u_int32_t i) {
+  if(params->type == QUANTIZE_FLOAT16)
+    return half_to_float(((u_int16_t *) quantized)[i]);
+  else
+    return (params->scale * ((int8_t *) quantized)[i]) + params->offset;
+}
+
+
+float quantized_dot_product(void *a, quantization *params_a, void *b, quantization *params_b, u_int32_t length) {
+  if(params_a->type == QUANTIZE_FLOAT16)
+    return vector_kernels.dot_product_float16((u_int16_t *) a, (u_int16_t *) b, length);
+
+  int64_t dot = 0;
+  for(u_int32_t start = 0; start < length; start += VECTOR_KERNEL_INT8_CHUNK) {
+    u_int32_t count = (length - start < VECTOR_KERNEL_INT8_CHUNK) ? length - start : VECTOR_KERNEL_INT8_CHUNK;
+    dot += vector_kernels.dot_product_int8(((int8_t *) a) + start, ((int8_t *) b) + start, count);
+  }
+  return quantized_int8_expand(dot, params_a, params_a->sum, params_b, params_b->sum, length);
+}
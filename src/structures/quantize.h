@@ -0,0 +1,64 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include "core/errors.h"
+
+#ifndef __learner_quantize__
+#define __learner_quantize__
+
+// quantized vectors store each value in fewer bits. float16 values
+// are stored directly as half precision floats. int8 values are
+// stored as q in [-127, 127] and read as (scale * q) + offset, with
+// offset the midpoint and scale half the range of the vector.
+typedef enum {
+  QUANTIZE_NONE,
+  QUANTIZE_FLOAT16,
+  QUANTIZE_INT8
+} quantization_type;
+extern char *quantization_type_names[];
+
+#pragma pack(push)
+#pragma pack(1)
+typedef struct {
+  u_int8_t  type;
+  float     scale;
+  float     offset;
+  int64_t   sum;      // sum of the int8 values, used to expand dot products
+} quantization;
+#pragma pack(pop)
+
+// the error introduced by quantizing a vector, measured against the
+// original float values
+typedef struct {
+  float max_error;
+  float rms_error;
+} quantization_error;
+
+// bytes used per quantized value
+#define quantization_width(type) ((type) == QUANTIZE_INT8 ? 1 : ((type) == QUANTIZE_FLOAT16 ? 2 : sizeof(float)))
+
+// conversion of single values
+u_int16_t float_to_half(float value);
+float     half_to_float(u_int16_t value);
+
+// quantize count values in to a newly allocated buffer, filling in
+// params and (if not NULL) the error introduced
+learner_error quantize_values(float *values, u_int32_t count, quantization_type type, void **quantized, quantization *params, quantization_error *error);
+
+// expand count quantized values starting at start back to floats
+void dequantize_values(void *quantized, quantization *params, u_int32_t start, u_int32_t count, float *values);
+
+// value at index i of a quantized buffer
+float quantized_value(void *quantized, quantization *params, u_int32_t i);
+
+// dot product of two buffers quantized with the same type. for int8
+// buffers the matched parameter gives the number of terms in the sum
+// and sum_a/sum_b the sums of the int8 values that took part; dense
+// vectors pass the length and the cached sums.
+float quantized_dot_product(void *a, quantization *params_a, void *b, quantization *params_b, u_int32_t length);
+#define quantized_int8_expand(dot, params_a, sum_a, params_b, sum_b, matched) (\
+  ((params_a)->scale * (params_b)->scale * (float) (dot)) +\
+  ((params_a)->scale * (params_b)->offset * (float) (sum_a)) +\
+  ((params_b)->scale * (params_a)->offset * (float) (sum_b)) +\
+  ((float) (matched) * (params_a)->offset * (params_b)->offset))
+
+#endif
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "structures/sparse_matrix.h"
+#include "structures/matrix_csr.h"
+#include "structures/dense_matrix.h"
+#include "structures/vector_kernels.h"
+
+// ------------------------------------------
+// partitioning
+// ------------------------------------------
+// the work of rows [0, r) is the number of values before row r plus r.
+// bounds[t] is the first row of range t; bounds[threads] is rows.
+static learner_error sparse_matrix_partition(Matrix *matrix, u_int32_t threads, u_int64_t **bounds) {
+  u_int64_t rows = matrix->rows, total = 0, work = 0, range = 1;
+  SparseVector *row;
+  *bounds = (u_int64_t *) calloc(threads + 1, sizeof(u_int64_t));
+  if(!*bounds) return MEMORY_ERROR;
+  (*bounds)[threads] = rows;
+  
+  // packed rows are found by binary search of the offsets
+  matrix_csr *csr = matrix->csr;
+  if(csr && csr->staged == 0 && csr->rows == rows) {
+    total = csr->nonzeros + rows;
+    for(; range < threads; range++) {
+      u_int64_t target = (total * range) / threads, low = 0, high = rows;
+      while(low < high) {
+        u_int64_t mid = (low + high) / 2;
+        if(csr->offsets[mid] + mid < target)
+          low = mid + 1;
+        else
+          high = mid;
+      }
+      (*bounds)[range] = low;
+    }
+    return NO_ERROR;
+  }
+  
+  for(u_int64_t r = 0; r < rows; r++)
+    total += 1 + ((matrix_get_row(matrix, r, &row) == NO_ERROR) ? row->header.count : 0);
+  for(u_int64_t r = 0; r < rows && range < threads; r++) {
+    while(range < threads && work * threads >= total * range)
+      (*bounds)[range++] = r;
+    work += 1 + ((matrix_get_row(matrix, r, &row) == NO_ERROR) ? row->header.count : 0);
+  }
+  while(range < threads)
+    (*bounds)[range++] = rows;
+  return NO_ERROR;
+}
+
+typedef struct {
+  Matrix        *a;
+  Matrix        *b;
+  Matrix        *c;
+  Vector        *vector;
+  float         *result;
+  u_int64_t     *bounds;
+  learner_error error;
+  
+  // sparse products: a dense accumulator, mark per column and list of
+  // marked columns for each thread, and the packed rows of c. values
+  // are only summed once numeric is set, after rows are counted.
+  u_int64_t     columns;
+  int           numeric;
+  float         **sums;
+  u_int8_t      **marks;
+  u_int32_t     **touched;
+  u_int64_t     *offsets;
+  u_int32_t     *indexes;
+  float         *values;
+} sparse_product_context;
+
+static learner_error sparse_product_run(sparse_product_context *context, Matrix *matrix, u_int32_t threads, learner_parallel_work work) {
+  learner_error error = sparse_matrix_partition(matrix, threads, &context->bounds);
+  if(error) return error;
+  error = learner_parallel_for(threads, threads, 1, work, context);
+  free(context->bounds);
+  context->bounds = NULL;
+  return error ? error : context->error;
+}
+
+
+// ------------------------------------------
+// sparse * vector
+// ------------------------------------------
+static void multiply_vector_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  sparse_product_context *context = (sparse_product_context *) param;
+  SparseVector *row;
+  learner_error error;
+  for(u_int64_t r = context->bounds[start]; r < context->bounds[end]; r++) {
+    context->result[r] = 0.0;
+    if(matrix_get_row(context->a, r, &row) != NO_ERROR) continue;
+    if((error = sparse_vector_dense_dot_product(row, context->vector, &context->result[r])))
+      context->error = error;
+  }
+}
+
+learner_error matrix_sparse_vector_product(Matrix *matrix, Vector *vector, u_int32_t threads, Vector **result) {
+  if(!matrix) return MISSING_MATRIX;
+  if(!vector) return MISSING_VECTOR;
+  if(matrix->values) return INVALID_MATRIX_STORAGE;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  
+  learner_error error = vector_new(matrix->rows, result);
+  if(error) return error;
+  sparse_product_context context = {0};
+  context.a      = matrix;
+  context.vector = vector;
+  context.result = (*result)->values;
+  error = sparse_product_run(&context, matrix, learner_default_threads(threads), multiply_vector_rows);
+  if(error) {
+    vector_free(*result);
+    *result = NULL;
+  }
+  return error;
+}
+
+
+// ------------------------------------------
+// sparse * dense
+// ------------------------------------------
+// rows of b and c are padded to the same stride, so whole strides
+// are added with the aligned kernel
+static void multiply_dense_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  sparse_product_context *context = (sparse_product_context *) param;
+  Matrix *b = context->b, *c = context->c;
+  SparseVector *row;
+  for(u_int64_t r = context->bounds[start]; r < context->bounds[end]; r++) {
+    if(matrix_get_row(context->a, r, &row) != NO_ERROR || row->header.count == 0) continue;
+    if(row->header.max_index >= b->rows) {
+      context->error = INDEX_OUT_OF_RANGE;
+      continue;
+    }
+    float *c_row = c->values + (r * c->stride);
+    for(int i = 0, count = row->header.count; i < count; i++)
+      vector_kernels.axpy(sparse_vector_value_at(row, i), b->values + (sparse_vector_index_at(row, i) * b->stride), c_row, b->stride);
+  }
+}
+
+learner_error matrix_sparse_dense_product(Matrix *a, Matrix *b, u_int32_t threads, Matrix **result) {
+  if(!a || !b) return MISSING_MATRIX;
+  if(a->values || !b->values) return INVALID_MATRIX_STORAGE;
+  
+  learner_error error = matrix_new_dense(a->rows, b->columns, result);
+  if(error) return error;
+  sparse_product_context context = {0};
+  context.a = a;
+  context.b = b;
+  context.c = *result;
+  error = sparse_product_run(&context, a, learner_default_threads(threads), multiply_dense_rows);
+  if(error) {
+    matrix_free(*result);
+    *result = NULL;
+  }
+  return error;
+}
+
+
+// ------------------------------------------
+// sparse * sparse
+// ------------------------------------------
+static int compare_columns(const void *a, const void *b) {
+  u_int32_t x = *(u_int32_t *) a, y = *(u_int32_t *) b;
+  return (x > y) - (x < y);
+}
+
+// adds value * row k of b to the thread's accumulator, listing the
+// columns reached for the first time
+static inline u_int32_t accumulate_row(sparse_product_context *context, u_int32_t thread, u_int64_t k, float value, u_int32_t touched) {
+  float *sums = context->sums[thread];
+  u_int8_t *marks = context->marks[thread];
+  u_int32_t *list = context->touched[thread], column;
+  SparseVector *row;
+  if(matrix_get_row(context->b, k, &row) != NO_ERROR) return touched;
+  for(int i = 0, count = row->header.count; i < count; i++) {
+    column = sparse_vector_index_at(row, i);
+    if(!marks[column]) {
+      marks[column] = 1;
+      sums[column] = 0.0;
+      list[touched++] = column;
+    }
+    if(context->numeric)
+      sums[column] += value * sparse_vector_value_at(row, i);
+  }
+  return touched;
+}
+
+// the first pass only counts the columns of each row of c, so the
+// packed arrays are allocated once at their final size
+static void count_sparse_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  sparse_product_context *context = (sparse_product_context *) param;
+  SparseVector *row;
+  for(u_int64_t r = context->bounds[start]; r < context->bounds[end]; r++) {
+    u_int32_t touched = 0;
+    if(matrix_get_row(context->a, r, &row) == NO_ERROR)
+      for(int i = 0, count = row->header.count; i < count; i++)
+        touched = accumulate_row(context, thread, sparse_vector_index_at(row, i), 0.0, touched);
+    for(u_int32_t i = 0; i < touched; i++)
+      context->marks[thread][context->touched[thread][i]] = 0;
+    context->offsets[r + 1] = touched;
+  }
+}
+
+static void multiply_sparse_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  sparse_product_context *context = (sparse_product_context *) param;
+  u_int32_t *list = context->touched[thread];
+  SparseVector *row;
+  for(u_int64_t r = context->bounds[start]; r < context->bounds[end]; r++) {
+    u_int32_t touched = 0;
+    if(matrix_get_row(context->a, r, &row) == NO_ERROR)
+      for(int i = 0, count = row->header.count; i < count; i++)
+        touched = accumulate_row(context, thread, sparse_vector_index_at(row, i), sparse_vector_value_at(row, i), touched);
+    
+    qsort(list, touched, sizeof(u_int32_t), compare_columns);
+    u_int32_t *indexes = context->indexes + context->offsets[r];
+    float *values = context->values + context->offsets[r];
+    for(u_int32_t i = 0; i < touched; i++) {
+      indexes[i] = list[i];
+      values[i] = context->sums[thread][list[i]];
+      context->marks[thread][list[i]] = 0;
+    }
+  }
+}
+
+static void free_sparse_scratch(sparse_product_context *context, u_int32_t threads) {
+  for(u_int32_t t = 0; t < threads; t++) {
+    if(context->sums) free(context->sums[t]);
+    if(context->marks) free(context->marks[t]);
+    if(context->touched) free(context->touched[t]);
+  }
+  free(context->sums);
+  free(context->marks);
+  free(context->touched);
+}
+
+learner_error matrix_sparse_product(Matrix *a, Matrix *b, u_int32_t threads, Matrix **result) {
+  if(!a || !b) return MISSING_MATRIX;
+  if(a->values || b->values) return INVALID_MATRIX_STORAGE;
+  threads = learner_default_threads(threads);
+  sparse_product_context context = {0};
+  context.a = a;
+  context.b = b;
+  learner_error error = NO_ERROR;
+  SparseVector *row;
+  
+  for(u_int64_t r = 0; r < b->rows; r++)
+    if(matrix_get_row(b, r, &row) == NO_ERROR && row->header.count && row->header.max_index + 1 > context.columns)
+      context.columns = row->header.max_index + 1;
+  
+  context.sums    = (float **) calloc(threads, sizeof(float *));
+  context.marks   = (u_int8_t **) calloc(threads, sizeof(u_int8_t *));
+  context.touched = (u_int32_t **) calloc(threads, sizeof(u_int32_t *));
+  context.offsets = (u_int64_t *) malloc((a->rows + 1) * sizeof(u_int64_t));
+  if(!context.sums || !context.marks || !context.touched || !context.offsets)
+    error = MEMORY_ERROR;
+  for(u_int32_t t = 0; t < threads && !error; t++) {
+    context.sums[t]    = (float *) malloc((context.columns ? context.columns : 1) * sizeof(float));
+    context.marks[t]   = (u_int8_t *) calloc(context.columns ? context.columns : 1, sizeof(u_int8_t));
+    context.touched[t] = (u_int32_t *) malloc((context.columns ? context.columns : 1) * sizeof(u_int32_t));
+    if(!context.sums[t] || !context.marks[t] || !context.touched[t])
+      error = MEMORY_ERROR;
+  }
+  
+  if(!error)
+    error = sparse_product_run(&context, a, threads, count_sparse_rows);
+  
+  // row counts become offsets, then rows are filled in place
+  if(!error) {
+    context.offsets[0] = 0;
+    for(u_int64_t r = 0; r < a->rows; r++)
+      context.offsets[r + 1] += context.offsets[r];
+    error = matrix_csr_alloc(context.offsets[a->rows], &context.indexes, &context.values);
+    context.numeric = 1;
+  }
+  if(!error)
+    error = sparse_product_run(&context, a, threads, multiply_sparse_rows);
+  free_sparse_scratch(&context, threads);
+  
+  if(!error && !(error = matrix_new(result))) {
+    (*result)->columns = context.columns;
+    if((error = matrix_csr_adopt(*result, a->rows, context.offsets, context.indexes, context.values, threads))) {
+      matrix_free(*result);
+      *result = NULL;
+    }
+  }
+  if(error) {
+    free(context.offsets);
+    free(context.indexes);
+    free(context.values);
+  }
+  return error;
+}
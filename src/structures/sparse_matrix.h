@@ -0,0 +1,33 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/vector.h"
+#include "structures/sparse_vector.h"
+
+#ifndef __learner_sparse_matrix__
+#define __learner_sparse_matrix__
+
+// products of sparse matrices, split across threads (0 for
+// LEARNER_CORES). rows are divided in to one range per thread with
+// roughly equal numbers of values (counting each row as one more),
+// so a few long rows don't leave the other threads idle. csr
+// matrices (see matrix_csr.h) with no staged rows are divided using
+// their row offsets without reading the rows.
+
+// result = matrix * vector, allocating result (of length rows). the
+// vector must be longer than the largest column index of any row.
+learner_error matrix_sparse_vector_product(Matrix *matrix, Vector *vector, u_int32_t threads, Vector **result);
+
+// result = a * b for sparse a and dense b, allocating a new dense
+// matrix (a rows x b columns). each value of a row of a adds that
+// multiple of a row of b, so b must have more rows than a has columns.
+learner_error matrix_sparse_dense_product(Matrix *a, Matrix *b, u_int32_t threads, Matrix **result);
+
+// result = a * b for sparse a and b, allocating a new csr matrix with
+// a row (possibly empty) for every row of a. rows of a row are
+// accumulated in a dense array per thread (as wide as b's largest
+// column index), then packed in column order. columns of a past the
+// last row of b, and rows of b never set, are zero.
+learner_error matrix_sparse_product(Matrix *a, Matrix *b, u_int32_t threads, Matrix **result);
+
+#endif
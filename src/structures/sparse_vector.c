@@ -5,12 +5,18 @@
 #include <math.h>
 #include "core/logging.h"
 #include "structures/sparse_vector.h"
+#include "structures/column_index.h"
+#include "structures/quantize.h"
+#include "structures/vector_kernels.h"
 
 learner_error sparse_vector_new(SparseVector **vector, Matrix *matrix) {
   if(!matrix) return MISSING_MATRIX;
-  *vector = (SparseVector *) calloc(1, sizeof(SparseVector));
+  learner_error error = matrix_arena_alloc(matrix->arena, sizeof(SparseVector), (void **) vector);
+  if(error) return error;
+  memset(*vector, 0, sizeof(SparseVector));
   (*vector)->header.min_index  = -1;
   (*vector)->header.max_index  = -1;
+  (*vector)->header.matrix_index = -1;
   (*vector)->matrix = matrix;
   return NO_ERROR;
 }
@@ -18,34 +24,117 @@ learner_error sparse_vector_new(SparseVector **vector, Matrix *matrix) {
 
 learner_error sparse_vector_free(SparseVector *vector) {
   if(!vector) return MISSING_VECTOR;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  matrix_arena *arena = vector->matrix->arena;
   if(vector->values)
-    free(vector->values);
-  free(vector);
+    matrix_arena_release(arena, vector->values, sparse_vector_values_bytes(vector));
+  if(vector->indexes)
+    matrix_arena_release(arena, vector->indexes, sparse_vector_array_bytes(vector->header.count));
+  if(vector->weights)
+    matrix_arena_release(arena, vector->weights, sparse_vector_array_bytes(vector->header.count));
+  if(vector->quantized)
+    matrix_arena_release(arena, vector->quantized, sparse_vector_quantized_bytes(vector));
+  matrix_arena_release(arena, vector, sizeof(SparseVector));
   return NO_ERROR;
 }
 
 
+// allocates a new block and copies the old one in to it, even when
+// the sizes are in the same class, so compaction always moves blocks
+static learner_error move_block(matrix_arena *arena, void **block, u_int64_t bytes, u_int64_t new_bytes) {
+  void *moved;
+  learner_error error = matrix_arena_alloc(arena, new_bytes, &moved);
+  if(error) return error;
+  memcpy(moved, *block, (bytes < new_bytes) ? bytes : new_bytes);
+  matrix_arena_release(arena, *block, bytes);
+  *block = moved;
+  return NO_ERROR;
+}
+
+learner_error sparse_vector_compact(SparseVector *vector) {
+  if(!vector) return MISSING_VECTOR;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  matrix_arena *arena = vector->matrix->arena;
+  u_int64_t count = vector->header.count, array_bytes = sparse_vector_array_bytes(count);
+  learner_error error = NO_ERROR;
+  
+  if(vector->values) {
+    error = move_block(arena, (void **) &vector->values, sparse_vector_values_bytes(vector), count * sizeof(sparse_vector_value));
+    if(error) return error;
+    vector->header.buffer_remaining = 0;
+  }
+  if(vector->indexes && (error = move_block(arena, (void **) &vector->indexes, array_bytes, array_bytes)))
+    return error;
+  if(vector->weights && (error = move_block(arena, (void **) &vector->weights, array_bytes, array_bytes)))
+    return error;
+  if(vector->quantized)
+    error = move_block(arena, &vector->quantized, sparse_vector_quantized_bytes(vector), sparse_vector_quantized_bytes(vector));
+  return error;
+}
+
+
 learner_error sparse_vector_freeze(SparseVector *vector) {
   if(!vector) return MISSING_VECTOR;
   if(!vector->header.frozen) {
     learner_error error = sparse_vector_magnitude(vector, &vector->header.magnitude);
     if(error) return error;
-    vector->header.frozen = 1;
+    vector->header.frozen = SPARSE_VECTOR_FROZEN;
   }
   return NO_ERROR;
 }
 
 
+// scales the vector to unit length in place. zero vectors can't be
+// normalized, so they're frozen with a magnitude of 0 instead.
+learner_error sparse_vector_freeze_normalized(SparseVector *vector) {
+  if(!vector) return MISSING_VECTOR;
+  if(vector->header.frozen == SPARSE_VECTOR_NORMALIZED) return NO_ERROR;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  
+  float magnitude;
+  vector->header.frozen = SPARSE_VECTOR_UNFROZEN;
+  learner_error error = sparse_vector_magnitude(vector, &magnitude);
+  if(error) return error;
+  
+  if(magnitude == 0.0) {
+    vector->header.magnitude = 0.0;
+    vector->header.frozen = SPARSE_VECTOR_FROZEN;
+    return NO_ERROR;
+  }
+  
+  float scale = 1.0 / magnitude;
+  for(int i = 0, count = vector->header.count; i < count; i++) {
+    if(vector->weights)
+      vector->weights[i] *= scale;
+    else
+      vector->values[i].value *= scale;
+  }
+  vector->header.magnitude = 1.0;
+  vector->header.frozen = SPARSE_VECTOR_NORMALIZED;
+  return column_index_update_row(vector);
+}
+
+
 learner_error sparse_vector_frozen(SparseVector *vector, int *frozen) {
   if(!vector) return MISSING_VECTOR;
-  *frozen = (vector->header.frozen == 1);
+  *frozen = (vector->header.frozen != SPARSE_VECTOR_UNFROZEN);
+  return NO_ERROR;
+}
+
+
+learner_error sparse_vector_normalized(SparseVector *vector, int *normalized) {
+  if(!vector) return MISSING_VECTOR;
+  *normalized = (vector->header.frozen == SPARSE_VECTOR_NORMALIZED);
   return NO_ERROR;
 }
 
 
 learner_error sparse_vector_unfreeze(SparseVector *vector) {
   if(!vector) return MISSING_VECTOR;
-  vector->header.frozen = 0;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  vector->header.frozen = SPARSE_VECTOR_UNFROZEN;
   return NO_ERROR;
 }
 
@@ -62,9 +151,9 @@ int sparse_vector_value_index(SparseVector *vector, u_int32_t index, u_int32_t *
   // really don't know why... this implementation ends up being
   // around 30% faster than well known single comparison versions.
   while(low <= high) {
-    if (vector->values[mid].index < index) {
+    if (sparse_vector_index_at(vector, mid) < index) {
       low = mid + 1;
-    } else if(vector->values[mid].index > index) {
+    } else if(sparse_vector_index_at(vector, mid) > index) {
       high = mid - 1;
     } else {
       return mid;
@@ -80,43 +169,57 @@ int sparse_vector_value_index(SparseVector *vector, u_int32_t index, u_int32_t *
 
 learner_error sparse_vector_set(SparseVector *vector, u_int32_t index, float value) {
   if(!vector) return MISSING_VECTOR;
-  if(index < 0) return INDEX_OUT_OF_RANGE;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  if(vector->quantized) return QUANTIZED_VECTOR;
   
-  int i = -1, hint = -1;
+  int i = -1;
+  u_int32_t hint = 0;
   i = sparse_vector_value_index(vector, index, &hint);
   
+  // existing values can be updated in place in either form
+  if(i != -1 && vector->weights) {
+    vector->weights[i] = value;
+    return column_index_update_value(vector, index, value);
+  }
+  
   if(i == -1) {
+    if(vector->weights) {
+      learner_error error = sparse_vector_to_aos(vector);
+      if(error) return error;
+    }
+    // vectors grow by a quarter, rounded up to fill the arena block
     if(vector->header.buffer_remaining == 0) {
-      vector->values = realloc(vector->values, (vector->header.count + vector->matrix->buffer_delta) * sizeof(sparse_vector_value));
-      vector->header.buffer_remaining = vector->matrix->buffer_delta;
-    }
-    // when we set a new value we need to shift all the values with indexes greater
-    // than the new value up by one. if we were to copy from left to right values
-    // would obliterate each other (e.g a, b, c shifted by one would overwrite b
-    // with a before overwriting c with a again). copy from right to left is very
-    // slow because the CPU caches from left to right, so we create a temporary
-    // buffer, copy the necessary values to it, then copy it back.
-    int bytes = (vector->header.count - hint) * sizeof(sparse_vector_value);
-    sparse_vector_value *block = (sparse_vector_value *) malloc(bytes);
-    memcpy(block, vector->values + hint, bytes);
-    memcpy(vector->values + hint + 1, block, bytes);
-    free(block);
+      u_int64_t count = vector->header.count;
+      u_int64_t bytes = matrix_arena_block_bytes((count + 1 + (count / 4)) * sizeof(sparse_vector_value));
+      learner_error error;
+      if(vector->values)
+        error = matrix_arena_realloc(vector->matrix->arena, (void **) &vector->values, sparse_vector_values_bytes(vector), bytes);
+      else
+        error = matrix_arena_alloc(vector->matrix->arena, bytes, (void **) &vector->values);
+      if(error) return error;
+      vector->header.buffer_remaining = (bytes / sizeof(sparse_vector_value)) - count;
+    }
+    // values with indexes greater than the new value are shifted up
+    // by one in place. memmove handles the overlapping ranges, so no
+    // temporary buffer is needed. building large vectors in random
+    // order is still quadratic; see sparse_vector_builder.h.
+    memmove(vector->values + hint + 1, vector->values + hint, (vector->header.count - hint) * sizeof(sparse_vector_value));
     
     vector->values[hint].value = value;
     vector->values[hint].index = index;
     
-    if(index < vector->header.min_index || vector->header.min_index == -1)
+    if(index < vector->header.min_index || vector->header.min_index == (u_int64_t) -1)
       vector->header.min_index = index;
-    if(index > vector->header.max_index || vector->header.max_index == -1)
+    if(index > vector->header.max_index || vector->header.max_index == (u_int64_t) -1)
       vector->header.max_index = index;
     
     vector->header.count++;
     vector->header.buffer_remaining--;  
-    return NO_ERROR;
-    
+    return column_index_update_value(vector, index, value);
+  
   } else {
     vector->values[i].value = value;
-    return NO_ERROR;
+    return column_index_update_value(vector, index, value);
   }
 }
 
@@ -125,10 +228,10 @@ learner_error sparse_vector_get(SparseVector *vector, u_int32_t index, float *va
   if(!vector) return MISSING_VECTOR;
   if(index < vector->header.min_index || index > vector->header.max_index) return INDEX_OUT_OF_RANGE;
   
-  u_int32_t i = sparse_vector_value_index(vector, index, NULL);
+  int i = sparse_vector_value_index(vector, index, NULL);
   
   if(i != -1) {
-    *value = vector->values[i].value;
+    *value = sparse_vector_value_at(vector, i);
     return NO_ERROR;
   } else {
     *value = 0.0;
@@ -137,30 +240,440 @@ learner_error sparse_vector_get(SparseVector *vector, u_int32_t index, float *va
 }
 
 
-learner_error sparse_vector_dot_product(SparseVector *v1, SparseVector *v2, float *result) {
-  if(!v1 || !v2) return MISSING_VECTOR;
-  if(v1->header.count == 0 || v2->header.count == 0) {*result = 0.0; return NO_ERROR;}
+// ------------------------------------------
+// structure of arrays
+// ------------------------------------------
+learner_error sparse_vector_to_soa(SparseVector *vector) {
+  if(!vector) return MISSING_VECTOR;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  if(vector->weights) return NO_ERROR;
+  int count = vector->header.count;
+  matrix_arena *arena = vector->matrix->arena;
+  u_int64_t bytes = sparse_vector_array_bytes(count);
+  
+  learner_error error = matrix_arena_alloc(arena, bytes, (void **) &vector->indexes);
+  if(error) {
+    vector->indexes = NULL;
+    return error;
+  }
+  error = matrix_arena_alloc(arena, bytes, (void **) &vector->weights);
+  if(error) {
+    matrix_arena_release(arena, vector->indexes, bytes);
+    vector->indexes = NULL;
+    vector->weights = NULL;
+    return error;
+  }
+  
+  for(int i = 0; i < count; i++) {
+    vector->indexes[i] = vector->values[i].index;
+    vector->weights[i] = vector->values[i].value;
+  }
+  if(vector->values)
+    matrix_arena_release(arena, vector->values, sparse_vector_values_bytes(vector));
+  vector->values = NULL;
+  vector->header.buffer_remaining = 0;
+  return NO_ERROR;
+}
+
+
+learner_error sparse_vector_to_aos(SparseVector *vector) {
+  if(!vector) return MISSING_VECTOR;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  if(!vector->weights) return NO_ERROR;
+  int count = vector->header.count;
+  matrix_arena *arena = vector->matrix->arena;
+  
+  learner_error error = matrix_arena_alloc(arena, count * sizeof(sparse_vector_value), (void **) &vector->values);
+  if(error) {
+    vector->values = NULL;
+    return error;
+  }
+  for(int i = 0; i < count; i++) {
+    vector->values[i].index = vector->indexes[i];
+    vector->values[i].value = vector->weights[i];
+  }
+  
+  matrix_arena_release(arena, vector->indexes, sparse_vector_array_bytes(count));
+  matrix_arena_release(arena, vector->weights, sparse_vector_array_bytes(count));
+  vector->indexes = NULL;
+  vector->weights = NULL;
+  vector->header.buffer_remaining = 0;
+  return NO_ERROR;
+}
+
+
+learner_error sparse_vector_soa(SparseVector *vector, int *soa) {
+  if(!vector) return MISSING_VECTOR;
+  *soa = (vector->weights != NULL);
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// quantization
+// ------------------------------------------
+learner_error sparse_vector_quantize(SparseVector *vector, quantization_type type, quantization_error *error) {
+  if(!vector) return MISSING_VECTOR;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  int count = vector->header.count;
+  learner_error err;
+  if(vector->weights && (err = sparse_vector_to_aos(vector)))
+    return err;
+  
+  // values and indexes are split in to separate arrays
+  matrix_arena *arena = vector->matrix->arena;
+  float *values = (float *) malloc(sizeof(float) * (count ? count : 1));
+  if(!values) return MEMORY_ERROR;
+  err = matrix_arena_alloc(arena, sparse_vector_array_bytes(count), (void **) &vector->indexes);
+  if(err) {
+    free(values);
+    vector->indexes = NULL;
+    return err;
+  }
+  for(int i = 0; i < count; i++) {
+    values[i] = vector->values[i].value;
+    vector->indexes[i] = vector->values[i].index;
+  }
   
-  // TODO: binary search or fixed length jumping. rather than just iterating through
-  // each entry to find the next entry we're interested in, we can use a binary search
-  // to help us 'jump' through the list, like skip lists. We could aso use fixed length
-  // jumps (such as every 10 elements, or one quarter of the list).
+  // quantized values are copied in to the arena alongside the indexes
+  void *quantized;
+  err = quantize_values(values, count, type, &quantized, &vector->quantization, error);
+  free(values);
+  if(!err) {
+    err = matrix_arena_alloc(arena, sparse_vector_quantized_bytes(vector), &vector->quantized);
+    if(!err)
+      memcpy(vector->quantized, quantized, sparse_vector_quantized_bytes(vector));
+    free(quantized);
+  }
+  if(err) {
+    matrix_arena_release(arena, vector->indexes, sparse_vector_array_bytes(count));
+    vector->indexes = NULL;
+    vector->quantized = NULL;
+    return err;
+  }
+  
+  if(vector->values)
+    matrix_arena_release(arena, vector->values, sparse_vector_values_bytes(vector));
+  vector->values = NULL;
+  vector->header.buffer_remaining = 0;
+  
+  // the cached magnitude is of the quantized values, so identities
+  // using it stay consistent with the quantized dot products
+  float squares = 0.0, value;
+  for(int i = 0; i < count; i++) {
+    value = quantized_value(vector->quantized, &vector->quantization, i);
+    squares += value * value;
+  }
+  vector->header.magnitude = sqrtf(squares);
+  vector->header.frozen = SPARSE_VECTOR_FROZEN;
+  return column_index_update_row(vector);
+}
+
+
+learner_error sparse_vector_dequantize(SparseVector *vector) {
+  if(!vector) return MISSING_VECTOR;
+  if(!vector->quantized) return NO_ERROR;
+  int count = vector->header.count;
+  matrix_arena *arena = vector->matrix->arena;
+  
+  learner_error error = matrix_arena_alloc(arena, count * sizeof(sparse_vector_value), (void **) &vector->values);
+  if(error) {
+    vector->values = NULL;
+    return error;
+  }
+  for(int i = 0; i < count; i++) {
+    vector->values[i].index = vector->indexes[i];
+    vector->values[i].value = quantized_value(vector->quantized, &vector->quantization, i);
+  }
+  
+  matrix_arena_release(arena, vector->indexes, sparse_vector_array_bytes(count));
+  matrix_arena_release(arena, vector->quantized, sparse_vector_quantized_bytes(vector));
+  vector->indexes = NULL;
+  vector->quantized = NULL;
+  memset(&vector->quantization, 0, sizeof(quantization));
+  return NO_ERROR;
+}
+
+
+learner_error sparse_vector_quantized(SparseVector *vector, int *quantized) {
+  if(!vector) return MISSING_VECTOR;
+  *quantized = (vector->quantized != NULL);
+  return NO_ERROR;
+}
+
+
+// dot product of two vectors quantized with the same type. int8
+// products are accumulated as integers along with the sums of the
+// matched values, then expanded with the scales and offsets.
+static float sparse_vector_quantized_dot_product(SparseVector *v1, SparseVector *v2) {
   int v1_count = v1->header.count, v2_count = v2->header.count;
   int v1_pos = 0, v2_pos = 0;
-  *result = 0.0;
+  int64_t dot = 0, sum_v1 = 0, sum_v2 = 0, matched = 0;
+  float result = 0.0;
   
   while(v1_pos < v1_count && v2_pos < v2_count) {
-    if(v1->values[v1_pos].index == v2->values[v2_pos].index) {
-      *result += v1->values[v1_pos].value * v2->values[v2_pos].value;
+    if(v1->indexes[v1_pos] == v2->indexes[v2_pos]) {
+      if(v1->quantization.type == QUANTIZE_INT8) {
+        int8_t a = ((int8_t *) v1->quantized)[v1_pos], b = ((int8_t *) v2->quantized)[v2_pos];
+        dot    += a * b;
+        sum_v1 += a;
+        sum_v2 += b;
+        matched++;
+      } else {
+        result += half_to_float(((u_int16_t *) v1->quantized)[v1_pos]) * half_to_float(((u_int16_t *) v2->quantized)[v2_pos]);
+      }
       v1_pos++;
       v2_pos++;
-    } else if(v1->values[v1_pos].index < v2->values[v2_pos].index) {
+    } else if(v1->indexes[v1_pos] < v2->indexes[v2_pos]) {
       v1_pos++;
     } else {
       v2_pos++;
     }
   }
   
+  if(v1->quantization.type == QUANTIZE_INT8)
+    result = quantized_int8_expand(dot, &v1->quantization, sum_v1, &v2->quantization, sum_v2, matched);
+  return result;
+}
+
+
+// merge of two vectors in any representation, used when at least
+// one is quantized. computes the dot product, both sums of squares
+// and the squared distance in a single pass.
+static void sparse_vector_generic_merge(SparseVector *v1, SparseVector *v2, float *dot, float *squares_v1, float *squares_v2, float *distance) {
+  int v1_count = v1->header.count, v2_count = v2->header.count;
+  int v1_pos = 0, v2_pos = 0;
+  u_int32_t a_index, b_index;
+  float a, b;
+  *dot = *squares_v1 = *squares_v2 = *distance = 0.0;
+  
+  while(v1_pos < v1_count || v2_pos < v2_count) {
+    a_index = (v1_pos < v1_count) ? sparse_vector_index_at(v1, v1_pos) : (u_int32_t) -1;
+    b_index = (v2_pos < v2_count) ? sparse_vector_index_at(v2, v2_pos) : (u_int32_t) -1;
+    a = (v1_pos < v1_count && a_index <= b_index) ? sparse_vector_value_at(v1, v1_pos) : 0.0;
+    b = (v2_pos < v2_count && b_index <= a_index) ? sparse_vector_value_at(v2, v2_pos) : 0.0;
+    
+    *dot        += a * b;
+    *squares_v1 += a * a;
+    *squares_v2 += b * b;
+    *distance   += (a - b) * (a - b);
+    
+    if(v1_pos < v1_count && a_index <= b_index) v1_pos++;
+    if(v2_pos < v2_count && b_index <= a_index) v2_pos++;
+  }
+}
+
+
+// ------------------------------------------
+// intersection
+// ------------------------------------------
+// either form of unquantized vector seen as an index array and a
+// value array, each stride elements (of 4 bytes) apart. packed pairs
+// have a stride of 2, structure of arrays vectors a stride of 1.
+typedef struct {
+  u_int32_t *indexes;
+  float     *values;
+  int       stride;
+  int       count;
+} sparse_vector_arrays;
+
+#define sparse_array_index(arrays, i) ((arrays).indexes[(i) * (arrays).stride])
+#define sparse_array_value(arrays, i) ((arrays).values[(i) * (arrays).stride])
+
+static inline sparse_vector_arrays sparse_vector_arrays_of(SparseVector *vector) {
+  sparse_vector_arrays arrays = {NULL, NULL, 1, vector->header.count};
+  if(vector->weights) {
+    arrays.indexes = vector->indexes;
+    arrays.values  = vector->weights;
+  } else if(vector->values) {
+    arrays.indexes = &vector->values[0].index;
+    arrays.values  = &vector->values[0].value;
+    arrays.stride  = sizeof(sparse_vector_value) / sizeof(float);
+  }
+  return arrays;
+}
+
+// first position at or after start whose index is >= index. the
+// probe distance doubles until it passes index, then the last gap
+// is binary searched, so skipping n values costs O(log n).
+static inline int sparse_vector_gallop(sparse_vector_arrays *arrays, int start, u_int32_t index) {
+  int low = start, high = start, step = 1, mid, count = arrays->count;
+  while(high < count && sparse_array_index(*arrays, high) < index) {
+    low = high + 1;
+    high += step;
+    step <<= 1;
+  }
+  if(high > count) high = count;
+  
+  while(low < high) {
+    mid = (low + high) / 2;
+    if(sparse_array_index(*arrays, mid) < index)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+static inline float sparse_vector_squares(SparseVector *vector) {
+  if(vector->header.frozen)
+    return vector->header.magnitude * vector->header.magnitude;
+  sparse_vector_arrays arrays = sparse_vector_arrays_of(vector);
+  float squares = 0.0;
+  for(int i = 0; i < arrays.count; i++)
+    squares += sparse_array_value(arrays, i) * sparse_array_value(arrays, i);
+  return squares;
+}
+
+// the intersection engine behind the dot product, cosine similarity
+// and euclidean distance of unquantized vectors. vectors with
+// disjoint index ranges are skipped entirely. when one vector has
+// at least sparse_vector_gallop_ratio times the values of the other,
+// each value of the smaller vector gallops through the larger one,
+// otherwise the two are merged; dot products of two structure of
+// arrays vectors are merged by the block compare kernels. with full
+// set, the sums of squares and the squared distance over the union
+// of indexes are computed too; a merge does this in the same pass,
+// galloping computes them over the matched values and tops them up
+// with a scan of each vector.
+static void sparse_vector_intersect(SparseVector *v1, SparseVector *v2, int full, sparse_vector_intersection *result) {
+  sparse_vector_arrays x = sparse_vector_arrays_of(v1), y = sparse_vector_arrays_of(v2);
+  int x_pos = 0, y_pos = 0;
+  float dot = 0.0, squares_v1 = 0.0, squares_v2 = 0.0, distance = 0.0, a, b;
+  u_int32_t a_index, b_index;
+  
+  int disjoint = (x.count == 0 || y.count == 0 || v1->header.max_index < v2->header.min_index || v2->header.max_index < v1->header.min_index);
+  int gallop = ((u_int64_t) x.count >= (u_int64_t) y.count * sparse_vector_gallop_ratio) ||
+               ((u_int64_t) y.count >= (u_int64_t) x.count * sparse_vector_gallop_ratio);
+  
+  if(disjoint) {
+    if(full) {
+      squares_v1 = sparse_vector_squares(v1);
+      squares_v2 = sparse_vector_squares(v2);
+      distance   = squares_v1 + squares_v2;
+    }
+  
+  } else if(gallop) {
+    // small and large refer to the vectors by size, so squares of
+    // matched values are tracked by size and swapped back after
+    int swapped = (x.count > y.count);
+    sparse_vector_arrays *small = swapped ? &y : &x, *large = swapped ? &x : &y;
+    u_int32_t large_min = sparse_array_index(*large, 0), large_max = sparse_array_index(*large, large->count - 1);
+    float matched_small = 0.0, matched_large = 0.0;
+    int small_pos = sparse_vector_gallop(small, 0, large_min), large_pos = 0;
+    
+    for(; small_pos < small->count && (a_index = sparse_array_index(*small, small_pos)) <= large_max; small_pos++) {
+      large_pos = sparse_vector_gallop(large, large_pos, a_index);
+      if(large_pos == large->count) break;
+      if(sparse_array_index(*large, large_pos) != a_index) continue;
+      
+      a = sparse_array_value(*small, small_pos);
+      b = sparse_array_value(*large, large_pos);
+      dot += a * b;
+      if(full) {
+        matched_small += a * a;
+        matched_large += b * b;
+        distance      += (a - b) * (a - b);
+      }
+      large_pos++;
+    }
+    
+    if(full) {
+      squares_v1 = sparse_vector_squares(v1);
+      squares_v2 = sparse_vector_squares(v2);
+      distance  += (squares_v1 - (swapped ? matched_large : matched_small)) + (squares_v2 - (swapped ? matched_small : matched_large));
+      if(distance < 0.0) distance = 0.0;
+    }
+  
+  } else if(full) {
+    while(x_pos < x.count && y_pos < y.count) {
+      a = sparse_array_value(x, x_pos);
+      b = sparse_array_value(y, y_pos);
+      a_index = sparse_array_index(x, x_pos);
+      b_index = sparse_array_index(y, y_pos);
+      if(a_index == b_index) {
+        dot        += a * b;
+        squares_v1 += a * a;
+        squares_v2 += b * b;
+        distance   += (a - b) * (a - b);
+        x_pos++;
+        y_pos++;
+      } else if(a_index < b_index) {
+        squares_v1 += a * a;
+        distance   += a * a;
+        x_pos++;
+      } else {
+        squares_v2 += b * b;
+        distance   += b * b;
+        y_pos++;
+      }
+    }
+    
+    // only one of these loops will run
+    for(; x_pos < x.count; x_pos++) {
+      a = sparse_array_value(x, x_pos);
+      squares_v1 += a * a;
+      distance   += a * a;
+    }
+    for(; y_pos < y.count; y_pos++) {
+      b = sparse_array_value(y, y_pos);
+      squares_v2 += b * b;
+      distance   += b * b;
+    }
+  
+  } else {
+    // values outside the other vector's index range can't match,
+    // so the merge starts within the overlapping range
+    x_pos = sparse_vector_gallop(&x, 0, v2->header.min_index);
+    y_pos = sparse_vector_gallop(&y, 0, v1->header.min_index);
+    
+    if(x.stride == 1 && y.stride == 1) {
+      dot = vector_kernels.sparse_dot_product(x.indexes + x_pos, x.values + x_pos, x.count - x_pos, y.indexes + y_pos, y.values + y_pos, y.count - y_pos);
+    } else {
+      while(x_pos < x.count && y_pos < y.count) {
+        a_index = sparse_array_index(x, x_pos);
+        b_index = sparse_array_index(y, y_pos);
+        if(a_index == b_index) {
+          dot += sparse_array_value(x, x_pos) * sparse_array_value(y, y_pos);
+          x_pos++;
+          y_pos++;
+        } else if(a_index < b_index) {
+          x_pos++;
+        } else {
+          y_pos++;
+        }
+      }
+    }
+  }
+  
+  result->dot        = dot;
+  result->squares_v1 = squares_v1;
+  result->squares_v2 = squares_v2;
+  result->distance   = distance;
+}
+
+
+// ------------------------------------------
+// calculations
+// ------------------------------------------
+learner_error sparse_vector_dot_product(SparseVector *v1, SparseVector *v2, float *result) {
+  if(!v1 || !v2) return MISSING_VECTOR;
+  if(v1->header.count == 0 || v2->header.count == 0) {*result = 0.0; return NO_ERROR;}
+  
+  if(v1->quantized || v2->quantized) {
+    if(v1->quantized && v2->quantized && v1->quantization.type == v2->quantization.type) {
+      *result = sparse_vector_quantized_dot_product(v1, v2);
+    } else {
+      float squares_v1, squares_v2, distance;
+      sparse_vector_generic_merge(v1, v2, result, &squares_v1, &squares_v2, &distance);
+    }
+    return NO_ERROR;
+  }
+  
+  sparse_vector_intersection intersection;
+  sparse_vector_intersect(v1, v2, 0, &intersection);
+  *result = intersection.dot;
   return NO_ERROR;
 }
 
@@ -169,34 +682,48 @@ learner_error sparse_vector_magnitude(SparseVector *vector, float *result) {
   if(!vector) return MISSING_VECTOR;
   if(vector->header.frozen) {*result = vector->header.magnitude; return NO_ERROR;}
   if(vector->header.count == 0) {*result = 0.0; return NO_ERROR;}
-
-  *result = 0.0;
-  for(int i = 0, count = vector->header.count; i < count; i++)
-    *result += powf(vector->values[i].value, 2);
-  *result = sqrtf(*result);
+  
+  *result = sqrtf(sparse_vector_squares(vector));
   return NO_ERROR;
 }
 
 
-// TODO: add optimisation for euclidean normal 1 vectors (just return dot product)
+// normalized vectors only need the dot product, frozen vectors only
+// need the dot product and their cached magnitudes. otherwise the
+// dot product and both magnitudes come from one intersection.
 learner_error sparse_vector_cosine_similarity(SparseVector *v1, SparseVector *v2, float *result) {
-  float dot_product, magnitude_v1, magnitude_v2;
+  if(!v1 || !v2) return MISSING_VECTOR;
   learner_error error;
+  float dot_product;
   
-  if(error = sparse_vector_dot_product(v1, v2, &dot_product))
-    return error;
-  
-  if(error = sparse_vector_magnitude(v1, &magnitude_v1))
-    return error;
+  if(v1->header.frozen && v2->header.frozen) {
+    if((error = sparse_vector_dot_product(v1, v2, &dot_product)))
+      return error;
+    if(v1->header.frozen == SPARSE_VECTOR_NORMALIZED && v2->header.frozen == SPARSE_VECTOR_NORMALIZED)
+      *result = dot_product;
+    else
+      *result = dot_product / (v1->header.magnitude * v2->header.magnitude);
+    return NO_ERROR;
+  }
   
-  if(error = sparse_vector_magnitude(v2, &magnitude_v2))
-    return error;
+  float squares_v1, squares_v2, a;
+  if(v1->quantized || v2->quantized) {
+    sparse_vector_generic_merge(v1, v2, &dot_product, &squares_v1, &squares_v2, &a);
+    *result = dot_product / (sqrtf(squares_v1) * sqrtf(squares_v2));
+    return NO_ERROR;
+  }
   
-  *result = dot_product / (magnitude_v1 * magnitude_v2);
+  sparse_vector_intersection intersection;
+  sparse_vector_intersect(v1, v2, 1, &intersection);
+  *result = intersection.dot / (sqrtf(intersection.squares_v1) * sqrtf(intersection.squares_v2));
   return NO_ERROR;
 }
 
 
+// with cached magnitudes the distance is sqrt(|a|^2 + |b|^2 - 2a.b),
+// so only the matching indexes need to be visited. this loses
+// precision to cancellation when the vectors are nearly identical,
+// so the result is clamped to be non negative.
 learner_error sparse_vector_euclidean_distance(SparseVector *v1, SparseVector *v2, float *result) {
   // if one vector is length 0, the euclidean distance is equivalent to the magnitude of the other vector
   if(!v1 || !v2) return MISSING_VECTOR;
@@ -205,35 +732,374 @@ learner_error sparse_vector_euclidean_distance(SparseVector *v1, SparseVector *v
   else if(v2->header.count == 0)
     return sparse_vector_magnitude(v1, result);
   
-  int v1_count = v1->header.count, v2_count = v2->header.count;
-  int v1_pos = 0, v2_pos = 0;
-  *result = 0.0;
+  if(v1->header.frozen && v2->header.frozen) {
+    float dot_product;
+    learner_error error = sparse_vector_dot_product(v1, v2, &dot_product);
+    if(error) return error;
+    float squares = (v1->header.magnitude * v1->header.magnitude) + (v2->header.magnitude * v2->header.magnitude) - (2 * dot_product);
+    *result = (squares > 0.0) ? sqrtf(squares) : 0.0;
+    return NO_ERROR;
+  }
   
-  // TODO: change loop condition so we don't need the 'catch up' loop below
-  while(v1_pos < v1_count && v2_pos < v2_count) {
-    if(v1->values[v1_pos].index == v2->values[v2_pos].index) {
-      *result += powf(v1->values[v1_pos].value - v2->values[v2_pos].value, 2);
-      v1_pos++;
-      v2_pos++;
-    } else if(v1->values[v1_pos].index < v2->values[v2_pos].index) {
-      *result += powf(v1->values[v1_pos].value, 2);
-      v1_pos++;
+  if(v1->quantized || v2->quantized) {
+    float dot_product, squares_v1, squares_v2, distance;
+    sparse_vector_generic_merge(v1, v2, &dot_product, &squares_v1, &squares_v2, &distance);
+    *result = sqrtf(distance);
+    return NO_ERROR;
+  }
+  
+  sparse_vector_intersection intersection;
+  sparse_vector_intersect(v1, v2, 1, &intersection);
+  *result = sqrtf(intersection.distance);
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// sparse . dense
+// ------------------------------------------
+// quantized vectors on either side fall back to reading each value
+// through the accessors; otherwise the gather and scatter kernels
+// read the sparse values in place in either layout
+static float sparse_vector_dense_dot(SparseVector *sparse, Vector *dense) {
+  if(sparse->quantized || dense->quantized) {
+    float dot = 0.0, value;
+    for(int i = 0, count = sparse->header.count; i < count; i++) {
+      u_int32_t index = sparse_vector_index_at(sparse, i);
+      value = dense->quantized ? quantized_value(dense->quantized, &dense->_quantization, index) : dense->values[index];
+      dot += sparse_vector_value_at(sparse, i) * value;
+    }
+    return dot;
+  }
+  
+  sparse_vector_arrays arrays = sparse_vector_arrays_of(sparse);
+  return vector_kernels.gather_dot_product(arrays.indexes, arrays.values, arrays.stride, arrays.count, dense->values);
+}
+
+learner_error sparse_vector_dense_dot_product(SparseVector *sparse, Vector *dense, float *result) {
+  if(!sparse || !dense) return MISSING_VECTOR;
+  if(sparse->header.count == 0) {*result = 0.0; return NO_ERROR;}
+  if(sparse->header.max_index >= dense->header.length) return INDEX_OUT_OF_RANGE;
+  *result = sparse_vector_dense_dot(sparse, dense);
+  return NO_ERROR;
+}
+
+
+// |s - d|^2 = |s|^2 + |d|^2 - 2s.d, using cached magnitudes for
+// frozen vectors, so only the dense values at the sparse indexes
+// are read. as with frozen vectors the result is clamped at 0.
+learner_error sparse_vector_dense_euclidean_distance(SparseVector *sparse, Vector *dense, float *result) {
+  if(!sparse || !dense) return MISSING_VECTOR;
+  if(sparse->header.count && sparse->header.max_index >= dense->header.length) return INDEX_OUT_OF_RANGE;
+  
+  float dense_magnitude, sparse_squares = 0.0, dot = 0.0;
+  learner_error error = vector_magnitude(dense, &dense_magnitude);
+  if(error) return error;
+  
+  if(sparse->header.count > 0) {
+    dot = sparse_vector_dense_dot(sparse, dense);
+    if(sparse->header.frozen) {
+      sparse_squares = sparse->header.magnitude * sparse->header.magnitude;
     } else {
-      *result += powf(v2->values[v2_pos].value, 2);
-      v2_pos++;
+      for(int i = 0, count = sparse->header.count; i < count; i++)
+        sparse_squares += sparse_vector_value_at(sparse, i) * sparse_vector_value_at(sparse, i);
     }
   }
   
-  // if the length of the vectors is uneven, 'catch up' the remainder
-  // of the longer vector here
-  if(v1_pos < v1_count) {
-    for(; v1_pos < v1_count; v1_pos++)
-      *result += powf(v1->values[v1_pos].value, 2);
-  } else if(v2_pos < v2_count) {
-    for(; v2_pos < v2_count; v2_pos++)
-      *result += powf(v2->values[v2_pos].value, 2);
+  float squares = sparse_squares + (dense_magnitude * dense_magnitude) - (2 * dot);
+  *result = (squares > 0.0) ? sqrtf(squares) : 0.0;
+  return NO_ERROR;
+}
+
+
+learner_error sparse_vector_dense_axpy(float alpha, SparseVector *sparse, Vector *dense) {
+  if(!sparse || !dense) return MISSING_VECTOR;
+  if(dense->quantized) return QUANTIZED_VECTOR;
+  if(sparse->header.count == 0) return NO_ERROR;
+  if(sparse->header.max_index >= dense->header.length) return INDEX_OUT_OF_RANGE;
+  dense->header._frozen = VECTOR_UNFROZEN;
+  
+  if(sparse->quantized) {
+    for(int i = 0, count = sparse->header.count; i < count; i++)
+      dense->values[sparse->indexes[i]] += alpha * sparse_vector_value_at(sparse, i);
+    return NO_ERROR;
+  }
+  
+  sparse_vector_arrays arrays = sparse_vector_arrays_of(sparse);
+  vector_kernels.scatter_axpy(alpha, arrays.indexes, arrays.values, arrays.stride, arrays.count, dense->values);
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// arithmetic
+// ------------------------------------------
+// frozen vectors keep their cached magnitude, scaled along with the
+// values. normalized vectors stay normalized only when alpha is +-1.
+learner_error sparse_vector_scale(SparseVector *vector, float alpha) {
+  if(!vector) return MISSING_VECTOR;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  sparse_vector_arrays arrays = sparse_vector_arrays_of(vector);
+  for(int i = 0; i < arrays.count; i++)
+    sparse_array_value(arrays, i) *= alpha;
+  
+  if(vector->header.frozen) {
+    vector->header.magnitude *= fabsf(alpha);
+    if(fabsf(alpha) != 1.0)
+      vector->header.frozen = SPARSE_VECTOR_FROZEN;
+  }
+  return column_index_update_row(vector);
+}
+
+
+// the number of distinct indexes in either vector
+static int sparse_vector_union_count(SparseVector *x, SparseVector *y) {
+  int x_count = x->header.count, y_count = y->header.count, x_pos = 0, y_pos = 0, count = 0;
+  u_int32_t a_index, b_index;
+  if(x_count == 0 || y_count == 0 || x->header.max_index < y->header.min_index || y->header.max_index < x->header.min_index)
+    return x_count + y_count;
+  
+  while(x_pos < x_count && y_pos < y_count) {
+    a_index = sparse_vector_index_at(x, x_pos);
+    b_index = sparse_vector_index_at(y, y_pos);
+    x_pos += (a_index <= b_index);
+    y_pos += (b_index <= a_index);
+    count++;
+  }
+  return count + (x_count - x_pos) + (y_count - y_pos);
+}
+
+// allocates arrays for count values in the same form as vector,
+// returning a view of them in result
+static learner_error sparse_vector_arrays_alloc(SparseVector *vector, int count, sparse_vector_arrays *result) {
+  matrix_arena *arena = vector->matrix->arena;
+  learner_error error;
+  result->count = count;
+  
+  if(vector->weights) {
+    u_int64_t bytes = sparse_vector_array_bytes(count);
+    if((error = matrix_arena_alloc(arena, bytes, (void **) &result->indexes)))
+      return error;
+    if((error = matrix_arena_alloc(arena, bytes, (void **) &result->values))) {
+      matrix_arena_release(arena, result->indexes, bytes);
+      return error;
+    }
+    result->stride = 1;
+  } else {
+    sparse_vector_value *values;
+    if((error = matrix_arena_alloc(arena, count * sizeof(sparse_vector_value), (void **) &values)))
+      return error;
+    result->indexes = &values[0].index;
+    result->values  = &values[0].value;
+    result->stride  = sizeof(sparse_vector_value) / sizeof(float);
+  }
+  return NO_ERROR;
+}
+
+// when every index of x is already in y, y's values are updated in
+// place. otherwise the two are merged once in to arrays sized to
+// the union, which replace y's. a frozen y has its magnitude kept
+// current: in place from the change in each updated value, or from
+// the merged values.
+learner_error sparse_vector_axpy(float alpha, SparseVector *x, SparseVector *y) {
+  if(!x || !y) return MISSING_VECTOR;
+  if(y->header._view) return VECTOR_IS_VIEW;
+  if(y->quantized) return QUANTIZED_VECTOR;
+  if(x == y) return sparse_vector_scale(y, 1.0 + alpha);
+  
+  sparse_vector_arrays target = sparse_vector_arrays_of(y);
+  int x_count = x->header.count, y_count = y->header.count, x_pos = 0, y_pos = 0;
+  int total = sparse_vector_union_count(x, y);
+  double squares = (double) y->header.magnitude * y->header.magnitude;
+  u_int32_t a_index, b_index;
+  float value;
+  
+  if(total == y_count) {
+    for(; x_pos < x_count; x_pos++, y_pos++) {
+      a_index = sparse_vector_index_at(x, x_pos);
+      while(sparse_array_index(target, y_pos) < a_index)
+        y_pos++;
+      value = sparse_array_value(target, y_pos);
+      sparse_array_value(target, y_pos) += alpha * sparse_vector_value_at(x, x_pos);
+      squares += ((double) sparse_array_value(target, y_pos) * sparse_array_value(target, y_pos)) - ((double) value * value);
+    }
+  
+  } else {
+    sparse_vector_arrays merged;
+    learner_error error = sparse_vector_arrays_alloc(y, total, &merged);
+    if(error) return error;
+    
+    squares = 0.0;
+    for(int out = 0; out < total; out++) {
+      a_index = (x_pos < x_count) ? sparse_vector_index_at(x, x_pos) : (u_int32_t) -1;
+      b_index = (y_pos < y_count) ? sparse_array_index(target, y_pos) : (u_int32_t) -1;
+      value = 0.0;
+      if(b_index <= a_index)
+        value = sparse_array_value(target, y_pos++);
+      if(a_index <= b_index)
+        value += alpha * sparse_vector_value_at(x, x_pos++);
+      sparse_array_index(merged, out) = (a_index < b_index) ? a_index : b_index;
+      sparse_array_value(merged, out) = value;
+      squares += (double) value * value;
+    }
+    
+    // the old arrays are released with the sizes they were allocated
+    // with, before the count changes
+    matrix_arena *arena = y->matrix->arena;
+    if(y->weights) {
+      matrix_arena_release(arena, y->indexes, sparse_vector_array_bytes(y_count));
+      matrix_arena_release(arena, y->weights, sparse_vector_array_bytes(y_count));
+      y->indexes = merged.indexes;
+      y->weights = merged.values;
+    } else {
+      if(y->values)
+        matrix_arena_release(arena, y->values, sparse_vector_values_bytes(y));
+      y->values = (sparse_vector_value *) merged.indexes;
+    }
+    y->header.count = total;
+    y->header.buffer_remaining = 0;
+    y->header.min_index = sparse_array_index(merged, 0);
+    y->header.max_index = sparse_array_index(merged, total - 1);
+  }
+  
+  if(y->header.frozen) {
+    y->header.magnitude = (squares > 0.0) ? sqrt(squares) : 0.0;
+    y->header.frozen = SPARSE_VECTOR_FROZEN;
+  }
+  return column_index_update_row(y);
+}
+
+
+learner_error sparse_vector_add(SparseVector *vector, SparseVector *other) {
+  return sparse_vector_axpy(1.0, other, vector);
+}
+
+
+// a min heap of the next unmerged value of each vector being summed
+typedef struct {
+  u_int32_t index;
+  u_int32_t vector;
+  u_int32_t position;
+} sparse_vector_sum_entry;
+
+static void sum_heap_down(sparse_vector_sum_entry *heap, int count, int i) {
+  sparse_vector_sum_entry entry = heap[i];
+  int child;
+  while((child = (2 * i) + 1) < count) {
+    if(child + 1 < count && heap[child + 1].index < heap[child].index)
+      child++;
+    if(heap[child].index >= entry.index)
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = entry;
+}
+
+// the sum is built as packed pairs. a dense scratch array spanning
+// the vectors' index range is used when the range is small compared
+// to the number of values being summed (SPARSE_VECTOR_SUM_DENSE_RATIO),
+// otherwise the vectors are merged through a heap in
+// O(values * log(vectors)). the pairs are allocated once: exactly in
+// the dense case, or for every value summed when merging, with the
+// unused space left as buffer_remaining.
+learner_error sparse_vector_sum(SparseVector **vectors, u_int32_t count, Matrix *matrix, SparseVector **result) {
+  if(!vectors) return MISSING_VECTOR;
+  if(!matrix) return MISSING_MATRIX;
+  u_int64_t total = 0, min = (u_int32_t) -1, max = 0, unique = 0, capacity = 0, i;
+  for(i = 0; i < count; i++) {
+    if(!vectors[i]) return MISSING_VECTOR;
+    if(vectors[i]->header.count == 0) continue;
+    total += vectors[i]->header.count;
+    if(vectors[i]->header.min_index < min) min = vectors[i]->header.min_index;
+    if(vectors[i]->header.max_index > max) max = vectors[i]->header.max_index;
+  }
+  
+  learner_error error = sparse_vector_new(result, matrix);
+  if(error || total == 0) return error;
+  SparseVector *sum = *result;
+  
+  if((max - min + 1) <= total * SPARSE_VECTOR_SUM_DENSE_RATIO) {
+    u_int64_t range = max - min + 1;
+    float *scratch = (float *) calloc(range, sizeof(float));
+    u_int8_t *present = (u_int8_t *) calloc(range, sizeof(u_int8_t));
+    if(!scratch || !present) {
+      error = MEMORY_ERROR;
+    } else {
+      for(u_int32_t v = 0; v < count; v++) {
+        for(int j = 0, values = vectors[v]->header.count; j < values; j++) {
+          u_int64_t offset = sparse_vector_index_at(vectors[v], j) - min;
+          scratch[offset] += sparse_vector_value_at(vectors[v], j);
+          present[offset] = 1;
+        }
+      }
+      for(i = 0; i < range; i++)
+        capacity += present[i];
+      error = matrix_arena_alloc(matrix->arena, capacity * sizeof(sparse_vector_value), (void **) &sum->values);
+    }
+    
+    if(!error) {
+      for(i = 0; i < range; i++) {
+        if(!present[i]) continue;
+        sum->values[unique].index = min + i;
+        sum->values[unique].value = scratch[i];
+        unique++;
+      }
+    }
+    free(scratch);
+    free(present);
+  
+  } else {
+    sparse_vector_sum_entry *heap = (sparse_vector_sum_entry *) malloc(count * sizeof(sparse_vector_sum_entry));
+    int entries = 0;
+    capacity = total;
+    if(!heap)
+      error = MEMORY_ERROR;
+    else
+      error = matrix_arena_alloc(matrix->arena, capacity * sizeof(sparse_vector_value), (void **) &sum->values);
+    
+    if(!error) {
+      for(u_int32_t v = 0; v < count; v++) {
+        if(vectors[v]->header.count == 0) continue;
+        heap[entries].index = sparse_vector_index_at(vectors[v], 0);
+        heap[entries].vector = v;
+        heap[entries].position = 0;
+        entries++;
+      }
+      for(int j = (entries / 2) - 1; j >= 0; j--)
+        sum_heap_down(heap, entries, j);
+      
+      while(entries > 0) {
+        SparseVector *vector = vectors[heap[0].vector];
+        float value = sparse_vector_value_at(vector, heap[0].position);
+        if(unique > 0 && sum->values[unique - 1].index == heap[0].index) {
+          sum->values[unique - 1].value += value;
+        } else {
+          sum->values[unique].index = heap[0].index;
+          sum->values[unique].value = value;
+          unique++;
+        }
+        
+        if(++heap[0].position < vector->header.count)
+          heap[0].index = sparse_vector_index_at(vector, heap[0].position);
+        else
+          heap[0] = heap[--entries];
+        sum_heap_down(heap, entries, 0);
+      }
+    }
+    free(heap);
+  }
+  
+  if(error) {
+    sparse_vector_free(sum);
+    *result = NULL;
+    return error;
   }
   
-  *result = sqrtf(*result);
+  sum->header.count = unique;
+  sum->header.buffer_remaining = capacity - unique;
+  sum->header.min_index = sum->values[0].index;
+  sum->header.max_index = sum->values[unique - 1].index;
   return NO_ERROR;
 }
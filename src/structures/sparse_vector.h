@@ -1,10 +1,20 @@
 #include <sys/types.h>
 #include "core/errors.h"
 #include "matrix.h"
+#include "structures/quantize.h"
+#include "structures/vector.h"
 
 #ifndef __learner_sparse_vector__
 #define __learner_sparse_vector__
 
+// structure of arrays indexes and weights start on a cache line
+#define SPARSE_VECTOR_ALIGNMENT   64
+
+// freeze states, matching the dense vector states
+#define SPARSE_VECTOR_UNFROZEN    0
+#define SPARSE_VECTOR_FROZEN      1
+#define SPARSE_VECTOR_NORMALIZED  2
+
 #pragma pack(push)
 #pragma pack(1)
 typedef struct {
@@ -21,31 +31,121 @@ typedef struct {
   u_int64_t buffer_remaining;
   float     magnitude;
   u_int8_t  frozen;
+  u_int8_t  _view;
 } sparse_vector_header;
 
-typedef struct {
+typedef struct _sparse_vector {
   sparse_vector_header  header;
   sparse_vector_value   *values;
   Matrix                *matrix;
+  
+  // quantized vectors (see sparse_vector_quantize) and vectors in
+  // structure of arrays form (see sparse_vector_to_soa) store their
+  // indexes and values in separate arrays; values is NULL. views of
+  // csr rows (see matrix_csr.h) point in to the matrix's arrays.
+  u_int32_t             *indexes;
+  float                 *weights;
+  void                  *quantized;
+  quantization          quantization;
 } SparseVector;
 #pragma pack(pop)
 
+// results of intersecting two vectors (see sparse_vector.c)
+typedef struct {
+  float dot;
+  float squares_v1;
+  float squares_v2;
+  float distance;
+} sparse_vector_intersection;
+
+// dot products gallop through the larger vector when it has at least
+// this many times the values of the smaller one, rather than merging.
+// measured with make benchmark (tests/benchmark_sparse_vector.c): on
+// avx-512, merging is still ahead at 4x (~2.8us against ~3.2us to
+// gallop) and galloping first wins at 8x (~5.1us against ~4.4us).
+#define SPARSE_VECTOR_GALLOP_RATIO  8
+extern u_int32_t sparse_vector_gallop_ratio;
+
+// index and value of the i'th non zero element in any representation
+#define sparse_vector_index_at(vector, i) ((vector)->indexes ? (vector)->indexes[i] : (vector)->values[i].index)
+#define sparse_vector_value_at(vector, i) ((vector)->quantized ? quantized_value((vector)->quantized, &(vector)->quantization, i) : \
+                                          ((vector)->weights ? (vector)->weights[i] : (vector)->values[i].value))
+
+
+// vectors, and their values, are allocated from their matrix's arena
+// (see matrix_arena.h), which needs the size of each block released.
+// pairs have room for count + buffer_remaining values. index and
+// weight arrays are padded to a multiple of SPARSE_VECTOR_ALIGNMENT.
+#define sparse_vector_values_bytes(vector) (((vector)->header.count + (vector)->header.buffer_remaining) * sizeof(sparse_vector_value))
+#define sparse_vector_array_bytes(count)   ((count) ? ((((count) * sizeof(float)) + SPARSE_VECTOR_ALIGNMENT - 1) & ~(SPARSE_VECTOR_ALIGNMENT - 1)) : SPARSE_VECTOR_ALIGNMENT)
+#define sparse_vector_quantized_bytes(vector) ((vector)->header.count * quantization_width((vector)->quantization.type))
+
 
 // core functions
 learner_error sparse_vector_new(SparseVector **vector, Matrix *matrix);
 learner_error sparse_vector_free(SparseVector *vector);
 learner_error sparse_vector_freeze(SparseVector *vector);
+learner_error sparse_vector_freeze_normalized(SparseVector *vector);
 learner_error sparse_vector_frozen(SparseVector *vector, int *frozen);
+learner_error sparse_vector_normalized(SparseVector *vector, int *normalized);
 learner_error sparse_vector_unfreeze(SparseVector *vector);
 
+// moves the values in to new blocks sized to fit (see matrix_compact)
+learner_error sparse_vector_compact(SparseVector *vector);
+
+// quantizing replaces the float values with float16 or int8 values,
+// freezing the vector and reporting the error introduced (error may
+// be NULL). quantized vectors are read only until dequantized.
+learner_error sparse_vector_quantize(SparseVector *vector, quantization_type type, quantization_error *error);
+learner_error sparse_vector_dequantize(SparseVector *vector);
+learner_error sparse_vector_quantized(SparseVector *vector, int *quantized);
+
+// the packed (index, value) pairs can be split in to an aligned array
+// of indexes and a parallel array of weights, letting intersections
+// load and compare blocks of indexes at a time. every function works
+// with either form; setting a new index converts back to pairs.
+learner_error sparse_vector_to_soa(SparseVector *vector);
+learner_error sparse_vector_to_aos(SparseVector *vector);
+learner_error sparse_vector_soa(SparseVector *vector, int *soa);
+
 // getter & setter required because we don't have contiguous data
 learner_error sparse_vector_set(SparseVector *vector, u_int32_t index, float value);
 learner_error sparse_vector_get(SparseVector *vector, u_int32_t index, float *value);
 
+// sparse matrices are built from rows of sparse vectors. the
+// matrix takes ownership of a row (freeing any vector it replaces)
+// and sets its matrix_index. rows never set are reported missing.
+// rows of csr matrices are views until set again (see matrix_csr.h).
+learner_error matrix_set_row(Matrix *matrix, u_int64_t row, SparseVector *vector);
+learner_error matrix_get_row(Matrix *matrix, u_int64_t row, SparseVector **vector);
+
+// arithmetic, in place on the first vector (or y). each runs in time
+// linear in the values of both vectors, allocating at most once, and
+// frozen vectors stay frozen with their magnitude kept current.
+// axpy sets y = alpha * x + y; add sets vector = vector + other.
+// rows of a matrix with a column index are re-indexed as they change.
+learner_error sparse_vector_scale(SparseVector *vector, float alpha);
+learner_error sparse_vector_axpy(float alpha, SparseVector *x, SparseVector *y);
+learner_error sparse_vector_add(SparseVector *vector, SparseVector *other);
+
+// sums count vectors in to a new (unfrozen) vector on matrix, e.g.
+// to accumulate a centroid before scaling it by 1 / count. sums are
+// accumulated in a dense array when the vectors' combined index range
+// is at most this many times their total number of values.
+#define SPARSE_VECTOR_SUM_DENSE_RATIO 4
+learner_error sparse_vector_sum(SparseVector **vectors, u_int32_t count, Matrix *matrix, SparseVector **result);
+
 // calculations
 learner_error sparse_vector_dot_product(SparseVector *v1, SparseVector *v2, float *result);
 learner_error sparse_vector_magnitude(SparseVector *vector, float *result);
 learner_error sparse_vector_cosine_similarity(SparseVector *v1, SparseVector *v2, float *result);
 learner_error sparse_vector_euclidean_distance(SparseVector *v1, SparseVector *v2, float *result);
 
+// sparse . dense calculations read the dense values directly at the
+// sparse indexes, so the dense vector must be longer than max_index.
+// axpy adds alpha * sparse to dense in place, unfreezing dense.
+learner_error sparse_vector_dense_dot_product(SparseVector *sparse, Vector *dense, float *result);
+learner_error sparse_vector_dense_euclidean_distance(SparseVector *sparse, Vector *dense, float *result);
+learner_error sparse_vector_dense_axpy(float alpha, SparseVector *sparse, Vector *dense);
+
 #endif
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include "core/logging.h"
+#include "structures/sparse_vector_builder.h"
+
+learner_error sparse_vector_builder_new(sparse_vector_builder **builder) {
+  *builder = (sparse_vector_builder *) calloc(1, sizeof(sparse_vector_builder));
+  if(!*builder) return MEMORY_ERROR;
+  return NO_ERROR;
+}
+
+
+learner_error sparse_vector_builder_free(sparse_vector_builder *builder) {
+  if(!builder) return MISSING_VALUES;
+  if(builder->values)
+    free(builder->values);
+  if(builder->scratch)
+    free(builder->scratch);
+  free(builder);
+  return NO_ERROR;
+}
+
+
+// the buffer doubles in size so appending is amortised constant time
+learner_error sparse_vector_builder_append(sparse_vector_builder *builder, u_int32_t index, float value) {
+  if(!builder) return MISSING_VALUES;
+  if(builder->count == builder->capacity) {
+    u_int64_t capacity = builder->capacity ? builder->capacity * 2 : LEARNER_DEFAULT_BUFFER_DELTA;
+    sparse_vector_value *values = (sparse_vector_value *) realloc(builder->values, capacity * sizeof(sparse_vector_value));
+    if(!values) return MEMORY_ERROR;
+    builder->values   = values;
+    builder->capacity = capacity;
+  }
+  builder->values[builder->count].index = index;
+  builder->values[builder->count].value = value;
+  builder->count++;
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// sorting
+// ------------------------------------------
+// stable sorts keep duplicate indexes in the order they were appended,
+// so the last appended value of each index ends up last in its run
+static void insertion_sort(sparse_vector_value *values, u_int64_t count) {
+  sparse_vector_value value;
+  u_int64_t j;
+  for(u_int64_t i = 1; i < count; i++) {
+    value = values[i];
+    for(j = i; j > 0 && values[j - 1].index > value.index; j--)
+      values[j] = values[j - 1];
+    values[j] = value;
+  }
+}
+
+// least significant digit radix sort, a byte at a time. the four
+// histograms are built in a single pass, and passes where every
+// index shares the same byte (common with small indexes) are skipped.
+// returns whichever of values or scratch holds the sorted values.
+static sparse_vector_value *radix_sort(sparse_vector_value *values, sparse_vector_value *scratch, u_int64_t count) {
+  u_int64_t histograms[4][256], offsets[256], total;
+  sparse_vector_value *source = values, *destination = scratch, *swap;
+  memset(histograms, 0, sizeof(histograms));
+  
+  for(u_int64_t i = 0; i < count; i++) {
+    u_int32_t index = values[i].index;
+    histograms[0][index & 0xFF]++;
+    histograms[1][(index >> 8) & 0xFF]++;
+    histograms[2][(index >> 16) & 0xFF]++;
+    histograms[3][index >> 24]++;
+  }
+  
+  for(int pass = 0, shift = 0; pass < 4; pass++, shift += 8) {
+    if(histograms[pass][(source[0].index >> shift) & 0xFF] == count)
+      continue;
+    
+    total = 0;
+    for(int digit = 0; digit < 256; digit++) {
+      offsets[digit] = total;
+      total += histograms[pass][digit];
+    }
+    for(u_int64_t i = 0; i < count; i++)
+      destination[offsets[(source[i].index >> shift) & 0xFF]++] = source[i];
+    
+    swap = source;
+    source = destination;
+    destination = swap;
+  }
+  
+  return source;
+}
+
+
+learner_error sparse_vector_builder_finalize(sparse_vector_builder *builder, Matrix *matrix, SparseVector **vector) {
+  if(!builder) return MISSING_VALUES;
+  if(!matrix) return MISSING_MATRIX;
+  u_int64_t count = builder->count, unique = 0;
+  sparse_vector_value *sorted = builder->values;
+  
+  if(count >= SPARSE_VECTOR_BUILDER_RADIX_THRESHOLD) {
+    sparse_vector_value *scratch = (sparse_vector_value *) realloc(builder->scratch, builder->capacity * sizeof(sparse_vector_value));
+    if(!scratch) return MEMORY_ERROR;
+    builder->scratch = scratch;
+    sorted = radix_sort(builder->values, builder->scratch, count);
+  } else {
+    insertion_sort(sorted, count);
+  }
+  
+  learner_error error = sparse_vector_new(vector, matrix);
+  if(error) return error;
+  if(count > 0) {
+    error = matrix_arena_alloc(matrix->arena, count * sizeof(sparse_vector_value), (void **) &(*vector)->values);
+    if(error) {
+      (*vector)->values = NULL;
+      sparse_vector_free(*vector);
+      *vector = NULL;
+      return error;
+    }
+  }
+  
+  // only the last value in each run of an index is kept
+  for(u_int64_t i = 0; i < count; i++) {
+    if(i + 1 < count && sorted[i + 1].index == sorted[i].index)
+      continue;
+    (*vector)->values[unique++] = sorted[i];
+  }
+  
+  if(unique > 0) {
+    (*vector)->header.min_index = (*vector)->values[0].index;
+    (*vector)->header.max_index = (*vector)->values[unique - 1].index;
+  }
+  (*vector)->header.count = unique;
+  (*vector)->header.buffer_remaining = count - unique;
+  builder->count = 0;
+  return NO_ERROR;
+}
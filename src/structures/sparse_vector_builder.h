@@ -0,0 +1,33 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/sparse_vector.h"
+
+#ifndef __learner_sparse_vector_builder__
+#define __learner_sparse_vector_builder__
+
+// builders below this size are sorted by insertion rather than radix
+#define SPARSE_VECTOR_BUILDER_RADIX_THRESHOLD 64
+
+// builders collect unsorted (index, value) pairs, then sort and
+// deduplicate them in one go when finalized. this avoids the cost
+// of keeping a vector sorted while it's built one value at a time.
+typedef struct {
+  sparse_vector_value *values;
+  sparse_vector_value *scratch;
+  u_int64_t           count;
+  u_int64_t           capacity;
+} sparse_vector_builder;
+
+learner_error sparse_vector_builder_new(sparse_vector_builder **builder);
+learner_error sparse_vector_builder_free(sparse_vector_builder *builder);
+
+// pairs may be appended in any order. when an index is appended more
+// than once the last value appended wins, as with sparse_vector_set.
+learner_error sparse_vector_builder_append(sparse_vector_builder *builder, u_int32_t index, float value);
+
+// creates a new (unfrozen) vector from the appended pairs and resets
+// the builder so it can be reused for the next vector
+learner_error sparse_vector_builder_finalize(sparse_vector_builder *builder, Matrix *matrix, SparseVector **vector);
+
+#endif
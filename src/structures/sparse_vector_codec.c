@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include "core/logging.h"
+#include "structures/sparse_vector_codec.h"
+#include "structures/vector_kernels.h"
+
+learner_error sparse_vector_encode(SparseVector *vector, quantization_type values, void **buffer, u_int64_t *size) {
+  if(!vector) return MISSING_VECTOR;
+  if(values != QUANTIZE_NONE && values != QUANTIZE_FLOAT16) return INVALID_QUANTIZATION;
+  u_int32_t count = vector->header.count, previous = 0, index, delta, length;
+  u_int64_t controls = (count + 3) / 4, width = (values == QUANTIZE_FLOAT16) ? sizeof(u_int16_t) : sizeof(float);
+  
+  // allocate for the worst case of 4 byte deltas, then shrink
+  u_int8_t *out = (u_int8_t *) malloc(sizeof(sparse_vector_encoding_header) + controls + (count * (4 + width)));
+  if(!out) return MEMORY_ERROR;
+  sparse_vector_encoding_header *header = (sparse_vector_encoding_header *) out;
+  u_int8_t *control = out + sizeof(sparse_vector_encoding_header), *data = control + controls;
+  memset(control, 0, controls);
+  
+  for(u_int32_t i = 0; i < count; i++) {
+    index = sparse_vector_index_at(vector, i);
+    delta = index - previous;
+    previous = index;
+    length = (delta < (1 << 8)) ? 1 : (delta < (1 << 16)) ? 2 : (delta < (1 << 24)) ? 3 : 4;
+    control[i / 4] |= (length - 1) << (2 * (i % 4));
+    memcpy(data, &delta, length);
+    data += length;
+  }
+  
+  header->version    = SPARSE_VECTOR_ENCODING_VERSION;
+  header->values     = values;
+  header->count      = count;
+  header->data_bytes = data - (control + controls);
+  
+  for(u_int32_t i = 0; i < count; i++) {
+    float value = sparse_vector_value_at(vector, i);
+    if(values == QUANTIZE_FLOAT16) {
+      u_int16_t half = float_to_half(value);
+      memcpy(data, &half, sizeof(u_int16_t));
+    } else {
+      memcpy(data, &value, sizeof(float));
+    }
+    data += width;
+  }
+  
+  // trim to the encoded size; the untrimmed buffer is kept if that fails
+  *size = data - out;
+  u_int8_t *trimmed = (u_int8_t *) realloc(out, *size);
+  *buffer = trimmed ? trimmed : out;
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// decoding
+// ------------------------------------------
+typedef struct {
+  sparse_vector_encoding_header header;
+  u_int8_t  *controls;
+  u_int8_t  *data;
+  u_int8_t  *data_end;
+  u_int8_t  *values;
+  u_int32_t position;
+  u_int32_t previous;
+} encoded_reader;
+
+// checks the header and that the sections add up to the buffer size
+static learner_error encoded_reader_open(void *buffer, u_int64_t size, encoded_reader *reader) {
+  if(!buffer) return MISSING_VALUES;
+  if(size < sizeof(sparse_vector_encoding_header)) return INVALID_ENCODING;
+  memcpy(&reader->header, buffer, sizeof(sparse_vector_encoding_header));
+  
+  sparse_vector_encoding_header *header = &reader->header;
+  if(header->version != SPARSE_VECTOR_ENCODING_VERSION) return INVALID_ENCODING;
+  if(header->values != QUANTIZE_NONE && header->values != QUANTIZE_FLOAT16) return INVALID_ENCODING;
+  
+  u_int64_t controls = ((u_int64_t) header->count + 3) / 4;
+  u_int64_t width = (header->values == QUANTIZE_FLOAT16) ? sizeof(u_int16_t) : sizeof(float);
+  if(size != sizeof(sparse_vector_encoding_header) + controls + header->data_bytes + (header->count * width))
+    return INVALID_ENCODING;
+  
+  reader->controls = ((u_int8_t *) buffer) + sizeof(sparse_vector_encoding_header);
+  reader->data     = reader->controls + controls;
+  reader->data_end = reader->data + header->data_bytes;
+  reader->values   = reader->data_end;
+  reader->position = 0;
+  reader->previous = 0;
+  return NO_ERROR;
+}
+
+// decodes up to SPARSE_VECTOR_DECODE_CHUNK indexes and values, setting
+// count to the number decoded (0 once every value has been read).
+// indexes must strictly increase, so a zero delta after the first
+// value, or a sum that wraps, means the encoding is malformed.
+static learner_error encoded_reader_next(encoded_reader *reader, u_int32_t *indexes, float *values, u_int32_t *count) {
+  u_int32_t remaining = reader->header.count - reader->position;
+  *count = (remaining < SPARSE_VECTOR_DECODE_CHUNK) ? remaining : SPARSE_VECTOR_DECODE_CHUNK;
+  if(*count == 0) return NO_ERROR;
+  
+  reader->data = vector_kernels.delta_decode(reader->controls + (reader->position / 4), reader->data, reader->data_end, *count, reader->previous, indexes);
+  if(!reader->data) return INVALID_ENCODING;
+  
+  u_int32_t previous = reader->previous;
+  for(u_int32_t i = 0; i < *count; i++) {
+    if(indexes[i] <= previous && (reader->position > 0 || i > 0)) return INVALID_ENCODING;
+    previous = indexes[i];
+  }
+  reader->previous = previous;
+  
+  if(reader->header.values == QUANTIZE_FLOAT16) {
+    u_int16_t halfs[SPARSE_VECTOR_DECODE_CHUNK];
+    memcpy(halfs, reader->values + (reader->position * sizeof(u_int16_t)), *count * sizeof(u_int16_t));
+    vector_kernels.float16_to_float(halfs, values, *count);
+  } else {
+    memcpy(values, reader->values + (reader->position * sizeof(float)), *count * sizeof(float));
+  }
+  
+  reader->position += *count;
+  if(reader->position == reader->header.count && reader->data != reader->data_end)
+    return INVALID_ENCODING;
+  return NO_ERROR;
+}
+
+
+// decoded vectors are in structure of arrays form (see
+// sparse_vector_to_soa), so the indexes are decoded in place
+learner_error sparse_vector_decode(void *buffer, u_int64_t size, Matrix *matrix, SparseVector **vector) {
+  if(!matrix) return MISSING_MATRIX;
+  encoded_reader reader;
+  learner_error error = encoded_reader_open(buffer, size, &reader);
+  if(error) return error;
+  
+  error = sparse_vector_new(vector, matrix);
+  if(error) return error;
+  // the count is set first so a failed decode releases the arrays
+  // with the sizes they were allocated with
+  (*vector)->header.count = reader.header.count;
+  u_int64_t bytes = sparse_vector_array_bytes(reader.header.count);
+  if((error = matrix_arena_alloc(matrix->arena, bytes, (void **) &(*vector)->indexes)))
+    (*vector)->indexes = NULL;
+  else if((error = matrix_arena_alloc(matrix->arena, bytes, (void **) &(*vector)->weights)))
+    (*vector)->weights = NULL;
+  
+  u_int32_t decoded = 0, count;
+  while(!error) {
+    error = encoded_reader_next(&reader, (*vector)->indexes + decoded, (*vector)->weights + decoded, &count);
+    if(count == 0) break;
+    decoded += count;
+  }
+  
+  if(error) {
+    sparse_vector_free(*vector);
+    *vector = NULL;
+    return error;
+  }
+  
+  if(decoded > 0) {
+    (*vector)->header.min_index = (*vector)->indexes[0];
+    (*vector)->header.max_index = (*vector)->indexes[decoded - 1];
+  }
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// dot products while decoding
+// ------------------------------------------
+learner_error sparse_vector_encoded_dense_dot_product(void *buffer, u_int64_t size, Vector *dense, float *result) {
+  if(!dense) return MISSING_VECTOR;
+  encoded_reader reader;
+  learner_error error = encoded_reader_open(buffer, size, &reader);
+  if(error) return error;
+  
+  u_int32_t indexes[SPARSE_VECTOR_DECODE_CHUNK], count;
+  float values[SPARSE_VECTOR_DECODE_CHUNK];
+  *result = 0.0;
+  
+  while(1) {
+    error = encoded_reader_next(&reader, indexes, values, &count);
+    if(error) return error;
+    if(count == 0) break;
+    
+    // indexes are sorted, so only the last of each chunk is checked
+    if(indexes[count - 1] >= dense->header.length) return INDEX_OUT_OF_RANGE;
+    if(dense->quantized) {
+      for(u_int32_t i = 0; i < count; i++)
+        *result += values[i] * quantized_value(dense->quantized, &dense->_quantization, indexes[i]);
+    } else {
+      *result += vector_kernels.gather_dot_product(indexes, values, 1, count, dense->values);
+    }
+  }
+  
+  return NO_ERROR;
+}
+
+
+// each decoded chunk is merged against the vector, picking up from
+// where the previous chunk left off
+learner_error sparse_vector_encoded_dot_product(void *buffer, u_int64_t size, SparseVector *vector, float *result) {
+  if(!vector) return MISSING_VECTOR;
+  encoded_reader reader;
+  learner_error error = encoded_reader_open(buffer, size, &reader);
+  if(error) return error;
+  
+  u_int32_t indexes[SPARSE_VECTOR_DECODE_CHUNK], count, i, position = 0, vector_count = vector->header.count, index;
+  float values[SPARSE_VECTOR_DECODE_CHUNK];
+  *result = 0.0;
+  
+  while(position < vector_count) {
+    error = encoded_reader_next(&reader, indexes, values, &count);
+    if(error) return error;
+    if(count == 0) break;
+    
+    i = 0;
+    while(i < count && position < vector_count) {
+      index = sparse_vector_index_at(vector, position);
+      if(indexes[i] == index) {
+        *result += values[i] * sparse_vector_value_at(vector, position);
+        i++;
+        position++;
+      } else if(indexes[i] < index) {
+        i++;
+      } else {
+        position++;
+      }
+    }
+  }
+  
+  return NO_ERROR;
+}
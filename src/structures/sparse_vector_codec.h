@@ -0,0 +1,43 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/matrix.h"
+#include "structures/vector.h"
+#include "structures/sparse_vector.h"
+
+#ifndef __learner_sparse_vector_codec__
+#define __learner_sparse_vector_codec__
+
+#define SPARSE_VECTOR_ENCODING_VERSION  1
+
+// encoded vectors are decoded this many values at a time when
+// computing dot products, so nothing larger is materialised
+#define SPARSE_VECTOR_DECODE_CHUNK      256
+
+// a compact format for storing and sending sparse vectors. indexes
+// are delta encoded in stream vbyte form: a control byte per four
+// deltas holding their lengths (1 to 4 bytes), followed by the delta
+// bytes. values follow as floats, or optionally as float16s. vectors
+// of short, dense runs of indexes take around 1.25 bytes per index
+// rather than 4. all fields are little endian.
+//
+// header | controls (count + 3) / 4 | deltas (data_bytes) | values
+#pragma pack(push)
+#pragma pack(1)
+typedef struct {
+  u_int8_t  version;
+  u_int8_t  values;
+  u_int32_t count;
+  u_int32_t data_bytes;
+} sparse_vector_encoding_header;
+#pragma pack(pop)
+
+// values is either QUANTIZE_NONE (float values) or QUANTIZE_FLOAT16.
+// buffer is allocated and must be freed by the caller.
+learner_error sparse_vector_encode(SparseVector *vector, quantization_type values, void **buffer, u_int64_t *size);
+learner_error sparse_vector_decode(void *buffer, u_int64_t size, Matrix *matrix, SparseVector **vector);
+
+// dot products computed while decoding an encoded vector in chunks
+learner_error sparse_vector_encoded_dense_dot_product(void *buffer, u_int64_t size, Vector *dense, float *result);
+learner_error sparse_vector_encoded_dot_product(void *buffer, u_int64_t size, SparseVector *vector, float *result);
+
+#endif
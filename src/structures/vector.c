@@ -1,8 +1,10 @@
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "core/logging.h"
 #include "core/errors.h"
 #include "structures/vector.h"
+#include "structures/vector_kernels.h"
 
 learner_error vector_new(int length, Vector **vector) {
   if(length <= 0) return INVALID_LENGTH;
@@ -15,34 +17,85 @@ learner_error vector_new(int length, Vector **vector) {
 
 learner_error vector_free(Vector *vector) {
   if(!vector) return MISSING_VECTOR;
-  if(!vector->values) return MISSING_VALUES;
-  free(vector->values);
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  if(!vector->values && !vector->quantized) return MISSING_VALUES;
+  if(vector->values)
+    free(vector->values);
+  if(vector->quantized)
+    free(vector->quantized);
   free(vector);
   return NO_ERROR;
 }
 
 
+learner_error vector_view(float *values, u_int32_t length, Vector *view) {
+  if(!view) return MISSING_VECTOR;
+  if(!values) return MISSING_VALUES;
+  if(length == 0) return INVALID_LENGTH;
+  memset(view, 0, sizeof(Vector));
+  view->header.length = length;
+  view->header._view  = 1;
+  view->values = values;
+  return NO_ERROR;
+}
+
+
 learner_error vector_freeze(Vector *vector) {
   if(!vector) return MISSING_VECTOR;
   if(!vector->header._frozen) {
     learner_error error = vector_magnitude(vector, &vector->header._magnitude);
     if(error) return error;
-    vector->header._frozen = 1;
+    vector->header._frozen = VECTOR_FROZEN;
+  }
+  return NO_ERROR;
+}
+
+
+// scales the vector to unit length in place. zero vectors can't be
+// normalized, so they're frozen with a magnitude of 0 instead.
+learner_error vector_freeze_normalized(Vector *vector) {
+  if(!vector) return MISSING_VECTOR;
+  if(vector->header._frozen == VECTOR_NORMALIZED) return NO_ERROR;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  
+  float magnitude;
+  vector->header._frozen = VECTOR_UNFROZEN;
+  learner_error error = vector_magnitude(vector, &magnitude);
+  if(error) return error;
+  
+  if(magnitude == 0.0) {
+    vector->header._magnitude = 0.0;
+    vector->header._frozen = VECTOR_FROZEN;
+    return NO_ERROR;
   }
+  
+  float scale = 1.0 / magnitude;
+  for(u_int32_t i = 0, length = vector->header.length; i < length; i++)
+    vector->values[i] *= scale;
+  vector->header._magnitude = 1.0;
+  vector->header._frozen = VECTOR_NORMALIZED;
   return NO_ERROR;
 }
 
 
 learner_error vector_frozen(Vector *vector, int *frozen) {
   if(!vector) return MISSING_VECTOR;
-  *frozen = (vector->header._frozen == 1);
+  *frozen = (vector->header._frozen != VECTOR_UNFROZEN);
+  return NO_ERROR;
+}
+
+
+learner_error vector_normalized(Vector *vector, int *normalized) {
+  if(!vector) return MISSING_VECTOR;
+  *normalized = (vector->header._frozen == VECTOR_NORMALIZED);
   return NO_ERROR;
 }
 
 
 learner_error vector_unfreeze(Vector *vector) {
   if(!vector) return MISSING_VECTOR;
-  vector->header._frozen = 0;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  vector->header._frozen = VECTOR_UNFROZEN;
   return NO_ERROR;
 }
 
@@ -50,6 +103,7 @@ learner_error vector_unfreeze(Vector *vector) {
 learner_error vector_set(Vector *vector, int index, float value) {
   if(!vector) return MISSING_VECTOR;
   if(index < 0 || index > (vector->header.length - 1)) return INDEX_OUT_OF_RANGE;
+  if(vector->quantized) return QUANTIZED_VECTOR;
   vector->values[index] = value;
   return NO_ERROR;
 }
@@ -58,17 +112,101 @@ learner_error vector_set(Vector *vector, int index, float value) {
 learner_error vector_get(Vector *vector, int index, float *value) {
   if(!vector) return MISSING_VECTOR;
   if(index < 0 || index > (vector->header.length - 1)) return INDEX_OUT_OF_RANGE;
-  *value = vector->values[index];
+  if(vector->quantized)
+    *value = quantized_value(vector->quantized, &vector->_quantization, index);
+  else
+    *value = vector->values[index];
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// quantization
+// ------------------------------------------
+learner_error vector_quantize(Vector *vector, quantization_type type, quantization_error *error) {
+  if(!vector) return MISSING_VECTOR;
+  if(vector->header._view) return VECTOR_IS_VIEW;
+  if(vector->quantized) return QUANTIZED_VECTOR;
+  
+  learner_error err = quantize_values(vector->values, vector->header.length, type, &vector->quantized, &vector->_quantization, error);
+  if(err) return err;
+  free(vector->values);
+  vector->values = NULL;
+  
+  // the cached magnitude is of the quantized values, so identities
+  // using it stay consistent with the quantized dot products
+  float squares = quantized_dot_product(vector->quantized, &vector->_quantization, vector->quantized, &vector->_quantization, vector->header.length);
+  vector->header._magnitude = (squares > 0.0) ? sqrtf(squares) : 0.0;
+  vector->header._frozen = VECTOR_FROZEN;
   return NO_ERROR;
 }
 
 
+learner_error vector_dequantize(Vector *vector) {
+  if(!vector) return MISSING_VECTOR;
+  if(!vector->quantized) return NO_ERROR;
+  vector->values = (float *) malloc(sizeof(float) * vector->header.length);
+  if(!vector->values) return MEMORY_ERROR;
+  dequantize_values(vector->quantized, &vector->_quantization, 0, vector->header.length, vector->values);
+  free(vector->quantized);
+  vector->quantized = NULL;
+  memset(&vector->_quantization, 0, sizeof(quantization));
+  return NO_ERROR;
+}
+
+
+learner_error vector_quantized(Vector *vector, int *quantized) {
+  if(!vector) return MISSING_VECTOR;
+  *quantized = (vector->quantized != NULL);
+  return NO_ERROR;
+}
+
+
+// vectors with different representations are compared a chunk at
+// a time, expanding quantized chunks in to stack buffers so the
+// float kernels can be used. returns a.b, or |a - b|^2 if distance.
+#define VECTOR_MIXED_CHUNK 256
+static float vector_mixed_kernel(Vector *v1, Vector *v2, int distance) {
+  float buffer_v1[VECTOR_MIXED_CHUNK], buffer_v2[VECTOR_MIXED_CHUNK], *a, *b, result = 0.0;
+  u_int32_t length = v1->header.length, count;
+  
+  for(u_int32_t start = 0; start < length; start += VECTOR_MIXED_CHUNK) {
+    count = (length - start < VECTOR_MIXED_CHUNK) ? length - start : VECTOR_MIXED_CHUNK;
+    if(v1->quantized) {
+      dequantize_values(v1->quantized, &v1->_quantization, start, count, buffer_v1);
+      a = buffer_v1;
+    } else {
+      a = v1->values + start;
+    }
+    if(v2->quantized) {
+      dequantize_values(v2->quantized, &v2->_quantization, start, count, buffer_v2);
+      b = buffer_v2;
+    } else {
+      b = v2->values + start;
+    }
+    result += distance ? vector_kernels.squared_distance(a, b, count) : vector_kernels.dot_product(a, b, count);
+  }
+  
+  return result;
+}
+
+// dot product of two vectors of equal length in any representation
+static float vector_dot(Vector *v1, Vector *v2) {
+  if(!v1->quantized && !v2->quantized)
+    return vector_kernels.dot_product(v1->values, v2->values, v1->header.length);
+  if(v1->quantized && v2->quantized && v1->_quantization.type == v2->_quantization.type)
+    return quantized_dot_product(v1->quantized, &v1->_quantization, v2->quantized, &v2->_quantization, v1->header.length);
+  return vector_mixed_kernel(v1, v2, 0);
+}
+
+
+// ------------------------------------------
+// calculations
+// ------------------------------------------
 learner_error vector_dot_product(Vector *v1, Vector *v2, float *result) {
   if(!v1 || !v2) return MISSING_VECTOR;
   if(v1->header.length != v2->header.length) return VECTORS_NOT_OF_EQUAL_LENGTH;
-  *result = 0.0;
-  for(int i = 0, length = v1->header.length; i < length; i++)
-    *result += v1->values[i] * v2->values[i];
+  *result = vector_dot(v1, v2);
   return NO_ERROR;
 }
 
@@ -76,39 +214,57 @@ learner_error vector_dot_product(Vector *v1, Vector *v2, float *result) {
 learner_error vector_magnitude(Vector *vector, float *result) {
   if(!vector) return MISSING_VECTOR;
   if(vector->header._frozen) {*result = vector->header._magnitude; return NO_ERROR;}
-  *result = 0.0;
-  for(int i = 0, length = vector->header.length; i < length; i++)
-    *result += powf(vector->values[i], 2);
-  *result = sqrtf(*result);
+  *result = sqrtf(vector_kernels.sum_of_squares(vector->values, vector->header.length));
   return NO_ERROR;
 }
 
 
-// TODO: add optimisation for euclidean normal 1 vectors (just return dot product)
+// normalized vectors only need the dot product, frozen vectors only
+// need the dot product and their cached magnitudes. otherwise the
+// dot product and both magnitudes are computed in a single pass.
 learner_error vector_cosine_similarity(Vector *v1, Vector *v2, float *result) {
-  float dot_product, magnitude_v1, magnitude_v2;
-  learner_error error;
-  
-  if(error = vector_dot_product(v1, v2, &dot_product))
-    return error;
-  
-  if(error = vector_magnitude(v1, &magnitude_v1))
-    return error;
+  if(!v1 || !v2) return MISSING_VECTOR;
+  if(v1->header.length != v2->header.length) return VECTORS_NOT_OF_EQUAL_LENGTH;
+  float dot_product, squares_v1, squares_v2;
   
-  if(error = vector_magnitude(v2, &magnitude_v2))
-    return error;
+  if(v1->header._frozen && v2->header._frozen) {
+    dot_product = vector_dot(v1, v2);
+    if(v1->header._frozen == VECTOR_NORMALIZED && v2->header._frozen == VECTOR_NORMALIZED)
+      *result = dot_product;
+    else
+      *result = dot_product / (v1->header._magnitude * v2->header._magnitude);
+  } else if(!v1->quantized && !v2->quantized) {
+    vector_kernels.dot_and_squares(v1->values, v2->values, v1->header.length, &dot_product, &squares_v1, &squares_v2);
+    *result = dot_product / (sqrtf(squares_v1) * sqrtf(squares_v2));
+  } else {
+    // one vector is quantized (and so frozen), the other isn't
+    float magnitude_v1, magnitude_v2;
+    vector_magnitude(v1, &magnitude_v1);
+    vector_magnitude(v2, &magnitude_v2);
+    *result = vector_dot(v1, v2) / (magnitude_v1 * magnitude_v2);
+  }
   
-  *result = dot_product / (magnitude_v1 * magnitude_v2);
   return NO_ERROR;
 }
 
 
+// with cached magnitudes the distance is sqrt(|a|^2 + |b|^2 - 2a.b),
+// which only needs the dot product. this loses precision to
+// cancellation when the vectors are nearly identical, so the
+// result is clamped to be non negative.
 learner_error vector_euclidean_distance(Vector *v1, Vector *v2, float *result) {
   if(!v1 || !v2) return MISSING_VECTOR;
   if(v1->header.length != v2->header.length) return VECTORS_NOT_OF_EQUAL_LENGTH;
-  *result = 0.0;
-  for(int i = 0, length = v1->header.length; i < length; i++)
-    *result += powf(v1->values[i] - v2->values[i], 2);
-  *result = sqrtf(*result);
+  
+  if(v1->header._frozen && v2->header._frozen) {
+    float dot_product = vector_dot(v1, v2);
+    float squares = (v1->header._magnitude * v1->header._magnitude) + (v2->header._magnitude * v2->header._magnitude) - (2 * dot_product);
+    *result = (squares > 0.0) ? sqrtf(squares) : 0.0;
+  } else if(!v1->quantized && !v2->quantized) {
+    *result = sqrtf(vector_kernels.squared_distance(v1->values, v2->values, v1->header.length));
+  } else {
+    *result = sqrtf(vector_mixed_kernel(v1, v2, 1));
+  }
+  
   return NO_ERROR;
 }
@@ -1,20 +1,34 @@
 #include <sys/types.h>
 #include "core/errors.h"
+#include "structures/quantize.h"
 
 #ifndef __learner_vector__
 #define __learner_vector__
 
+// freeze states. frozen vectors cache their magnitude; normalized
+// vectors are additionally scaled to unit length when frozen, so
+// cosine similarity is just the dot product.
+#define VECTOR_UNFROZEN   0
+#define VECTOR_FROZEN     1
+#define VECTOR_NORMALIZED 2
+
 #pragma pack(push)
 #pragma pack(1)
 typedef struct {
   u_int32_t length;
   u_int8_t  _frozen;
   float     _magnitude;  
+  u_int8_t  _view;
 } vector_header;
 
 typedef struct {
   vector_header header;
   float *values;
+  
+  // quantized vectors (see vector_quantize) store their values here
+  // rather than in values, which is NULL
+  void          *quantized;
+  quantization  _quantization;
 } Vector;
 #pragma pack(pop)
 
@@ -22,9 +36,23 @@ typedef struct {
 learner_error vector_new(int length, Vector **vector);
 learner_error vector_free(Vector *vector);
 learner_error vector_freeze(Vector *vector);
+learner_error vector_freeze_normalized(Vector *vector);
 learner_error vector_frozen(Vector *vector, int *frozen);
+learner_error vector_normalized(Vector *vector, int *normalized);
 learner_error vector_unfreeze(Vector *vector);
 
+// views are vectors over values owned by something else (such as a
+// row of a dense matrix). they're normally declared on the stack;
+// vector_free must not be called on them.
+learner_error vector_view(float *values, u_int32_t length, Vector *view);
+
+// quantizing replaces the float values with float16 or int8 values,
+// freezing the vector and reporting the error introduced (error may
+// be NULL). quantized vectors are read only until dequantized.
+learner_error vector_quantize(Vector *vector, quantization_type type, quantization_error *error);
+learner_error vector_dequantize(Vector *vector);
+learner_error vector_quantized(Vector *vector, int *quantized);
+
 // getter & setter to match the sparse vector functions
 learner_error vector_set(Vector *vector, int index, float value);
 learner_error vector_get(Vector *vector, int index, float *value);
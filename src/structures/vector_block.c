@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "core/logging.h"
+#include "core/threads.h"
+#include "structures/vector_block.h"
+#include "structures/vector_kernels.h"
+
+learner_error vector_block_new(u_int32_t length, u_int64_t count, float **block) {
+  if(length == 0) return INVALID_LENGTH;
+  size_t bytes = (size_t) vector_block_stride(length) * count * sizeof(float);
+  if(posix_memalign((void **) block, VECTOR_BLOCK_ALIGNMENT, bytes ? bytes : VECTOR_BLOCK_ALIGNMENT))
+    return MEMORY_ERROR;
+  memset(*block, 0, bytes);
+  return NO_ERROR;
+}
+
+
+learner_error vector_block_free(float *block) {
+  if(!block) return MISSING_VALUES;
+  free(block);
+  return NO_ERROR;
+}
+
+
+learner_error vector_block_set(float *block, u_int64_t row, Vector *vector) {
+  if(!vector) return MISSING_VECTOR;
+  if(!block) return MISSING_VALUES;
+  float *destination = vector_block_row(block, vector->header.length, row);
+  if(vector->quantized)
+    dequantize_values(vector->quantized, &vector->_quantization, 0, vector->header.length, destination);
+  else
+    memcpy(destination, vector->values, vector->header.length * sizeof(float));
+  return NO_ERROR;
+}
+
+
+// ------------------------------------------
+// batch scoring
+// ------------------------------------------
+typedef struct {
+  float           *query;
+  float           *block;
+  float           *scores;
+  float           query_squares;
+  u_int32_t       stride;
+  learner_metric  metric;
+} batch_context;
+
+// rows are scored four at a time; a trailing group of fewer than
+// four rows is scored as part of a group ending at the last row,
+// which is safe because scores are simply recomputed. the query's
+// sum of squares is already known, so single rows discard it.
+void vector_block_score(float *query, float query_squares, float *block, u_int32_t stride, u_int64_t count, learner_metric metric, float *scores) {
+  float dots[4], squares[4], unused, *rows;
+  u_int64_t row = 0;
+  int group;
+  
+  while(row < count) {
+    if(count < 4)
+      group = 1;
+    else {
+      if(row + 4 > count) row = count - 4;
+      group = 4;
+    }
+    rows = block + (row * stride);
+    
+    if(group == 1) {
+      if(metric == DOT_PRODUCT)
+        dots[0] = vector_kernels.dot_product(query, rows, stride);
+      else
+        vector_kernels.dot_and_squares(query, rows, stride, &dots[0], &unused, &squares[0]);
+    } else {
+      if(metric == DOT_PRODUCT)
+        vector_kernels.dot_product_x4(query, rows, stride, stride, dots);
+      else
+        vector_kernels.dot_and_squares_x4(query, rows, stride, stride, dots, squares);
+    }
+    
+    for(int i = 0; i < group; i++) {
+      switch(metric) {
+        case DOT_PRODUCT:
+          scores[row + i] = dots[i];
+          break;
+        case COSINE_SIMILARITY:
+          scores[row + i] = dots[i] / (sqrtf(query_squares) * sqrtf(squares[i]));
+          break;
+        case EUCLIDEAN_DISTANCE: {
+          float distance = query_squares + squares[i] - (2 * dots[i]);
+          scores[row + i] = (distance > 0.0) ? sqrtf(distance) : 0.0;
+          break;
+        }
+      }
+    }
+    row += group;
+  }
+}
+
+static void score_rows(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  (void) thread;
+  batch_context *context = (batch_context *) param;
+  u_int32_t stride = context->stride;
+  vector_block_score(context->query, context->query_squares, context->block + (start * stride), stride, end - start, context->metric, context->scores + start);
+}
+
+learner_error vector_similarity_batch(Vector *query, float *block, u_int64_t count, learner_metric metric, float *scores) {
+  if(!query) return MISSING_VECTOR;
+  if(!block || !scores) return MISSING_VALUES;
+  if(count == 0) return NO_ERROR;
+  
+  // the query is copied in to an aligned, zero padded row so the
+  // kernels can step over the full stride without remainder loops
+  batch_context context;
+  context.stride = vector_block_stride(query->header.length);
+  context.block  = block;
+  context.scores = scores;
+  context.metric = metric;
+  learner_error error = vector_block_new(query->header.length, 1, &context.query);
+  if(error) return error;
+  vector_block_set(context.query, 0, query);
+  
+  if(query->header._frozen)
+    context.query_squares = query->header._magnitude * query->header._magnitude;
+  else
+    context.query_squares = vector_kernels.sum_of_squares(context.query, context.stride);
+  
+  u_int32_t threads = (count * context.stride >= VECTOR_BLOCK_PARALLEL_THRESHOLD) ? LEARNER_CORES : 1;
+  error = learner_parallel_for(count, threads, 4, score_rows, &context);
+  vector_block_free(context.query);
+  return error;
+}
@@ -0,0 +1,38 @@
+#include <sys/types.h>
+#include "core/errors.h"
+#include "structures/vector.h"
+#include "structures/metric.h"
+
+#ifndef __learner_vector_block__
+#define __learner_vector_block__
+
+// a vector block is a contiguous, row major array of equal length
+// vectors. the block and every row start on a 64 byte (cache line)
+// boundary; rows are padded with zeros up to the stride.
+#define VECTOR_BLOCK_ALIGNMENT  64
+#define vector_block_stride(length) ((((length) + 15) / 16) * 16)
+
+// batches touching fewer values than this are scored on the
+// calling thread; larger batches are split across LEARNER_CORES
+#define VECTOR_BLOCK_PARALLEL_THRESHOLD (256 * 1024)
+
+learner_error vector_block_new(u_int32_t length, u_int64_t count, float **block);
+learner_error vector_block_free(float *block);
+
+// copy a vector in to, or view a row of, a block
+learner_error vector_block_set(float *block, u_int64_t row, Vector *vector);
+#define vector_block_row(block, length, row) ((block) + ((row) * vector_block_stride(length)))
+
+// score query against each of the count rows of block, writing one
+// score per row to scores. rows must be the same length as query.
+// euclidean distances are computed from the dot product and sums of
+// squares, so share the cancellation caveat of frozen vectors.
+learner_error vector_similarity_batch(Vector *query, float *block, u_int64_t count, learner_metric metric, float *scores);
+
+// the single threaded scoring loop behind vector_similarity_batch,
+// for callers managing their own threads. query must be an aligned,
+// padded row (see vector_block_set) and query_squares its sum of
+// squares; rows are stride floats apart.
+void vector_block_score(float *query, float query_squares, float *block, u_int32_t stride, u_int64_t count, learner_metric metric, float *scores);
+
+#endif
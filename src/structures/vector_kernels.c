@@ -0,0 +1,975 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "core/logging.h"
+#include "structures/vector_kernels.h"
+#include "structures/quantize.h"
+
+#ifdef LEARNER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// ------------------------------------------
+// scalar kernels
+// ------------------------------------------
+// four independent accumulators let the processor overlap the
+// additions rather than waiting on a single dependency chain
+static float scalar_dot_product(float *a, float *b, u_int32_t length) {
+  float s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  u_int32_t i = 0;
+  for(; i + 4 <= length; i += 4) {
+    s0 += a[i]     * b[i];
+    s1 += a[i + 1] * b[i + 1];
+    s2 += a[i + 2] * b[i + 2];
+    s3 += a[i + 3] * b[i + 3];
+  }
+  for(; i < length; i++)
+    s0 += a[i] * b[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+static float scalar_sum_of_squares(float *a, u_int32_t length) {
+  return scalar_dot_product(a, a, length);
+}
+
+static float scalar_squared_distance(float *a, float *b, u_int32_t length) {
+  float s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0, d0, d1, d2, d3;
+  u_int32_t i = 0;
+  for(; i + 4 <= length; i += 4) {
+    d0 = a[i]     - b[i];
+    d1 = a[i + 1] - b[i + 1];
+    d2 = a[i + 2] - b[i + 2];
+    d3 = a[i + 3] - b[i + 3];
+    s0 += d0 * d0;
+    s1 += d1 * d1;
+    s2 += d2 * d2;
+    s3 += d3 * d3;
+  }
+  for(; i < length; i++) {
+    d0 = a[i] - b[i];
+    s0 += d0 * d0;
+  }
+  return (s0 + s1) + (s2 + s3);
+}
+
+static void scalar_dot_and_squares(float *a, float *b, u_int32_t length, float *dot, float *squares_a, float *squares_b) {
+  float d0 = 0.0, d1 = 0.0, a0 = 0.0, a1 = 0.0, b0 = 0.0, b1 = 0.0;
+  u_int32_t i = 0;
+  for(; i + 2 <= length; i += 2) {
+    d0 += a[i]     * b[i];
+    d1 += a[i + 1] * b[i + 1];
+    a0 += a[i]     * a[i];
+    a1 += a[i + 1] * a[i + 1];
+    b0 += b[i]     * b[i];
+    b1 += b[i + 1] * b[i + 1];
+  }
+  if(i < length) {
+    d0 += a[i] * b[i];
+    a0 += a[i] * a[i];
+    b0 += b[i] * b[i];
+  }
+  *dot       = d0 + d1;
+  *squares_a = a0 + a1;
+  *squares_b = b0 + b1;
+}
+
+
+// ------------------------------------------
+// scalar blocked kernels
+// ------------------------------------------
+static void scalar_dot_product_x4(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots) {
+  float *r0 = rows, *r1 = rows + stride, *r2 = rows + (2 * stride), *r3 = rows + (3 * stride);
+  float d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0, q;
+  for(u_int32_t i = 0; i < length; i++) {
+    q = query[i];
+    d0 += q * r0[i];
+    d1 += q * r1[i];
+    d2 += q * r2[i];
+    d3 += q * r3[i];
+  }
+  dots[0] = d0; dots[1] = d1; dots[2] = d2; dots[3] = d3;
+}
+
+static void scalar_dot_and_squares_x4(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots, float *squares) {
+  float *r0 = rows, *r1 = rows + stride, *r2 = rows + (2 * stride), *r3 = rows + (3 * stride);
+  float d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0, s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0, q;
+  for(u_int32_t i = 0; i < length; i++) {
+    q = query[i];
+    d0 += q * r0[i];
+    d1 += q * r1[i];
+    d2 += q * r2[i];
+    d3 += q * r3[i];
+    s0 += r0[i] * r0[i];
+    s1 += r1[i] * r1[i];
+    s2 += r2[i] * r2[i];
+    s3 += r3[i] * r3[i];
+  }
+  dots[0] = d0; dots[1] = d1; dots[2] = d2; dots[3] = d3;
+  squares[0] = s0; squares[1] = s1; squares[2] = s2; squares[3] = s3;
+}
+
+static void scalar_axpy(float alpha, float *x, float *y, u_int32_t length) {
+  for(u_int32_t i = 0; i < length; i++)
+    y[i] += alpha * x[i];
+}
+
+
+// ------------------------------------------
+// scalar quantized kernels
+// ------------------------------------------
+static int32_t scalar_dot_product_int8(int8_t *a, int8_t *b, u_int32_t length) {
+  int32_t sum = 0;
+  for(u_int32_t i = 0; i < length; i++)
+    sum += (int32_t) a[i] * (int32_t) b[i];
+  return sum;
+}
+
+static void scalar_float16_to_float(u_int16_t *in, float *out, u_int32_t length) {
+  for(u_int32_t i = 0; i < length; i++)
+    out[i] = half_to_float(in[i]);
+}
+
+static float scalar_dot_product_float16(u_int16_t *a, u_int16_t *b, u_int32_t length) {
+  float sum = 0.0;
+  for(u_int32_t i = 0; i < length; i++)
+    sum += half_to_float(a[i]) * half_to_float(b[i]);
+  return sum;
+}
+
+// merge of the two index arrays, which also finishes off the block
+// compare kernels once fewer than a block of indexes remain
+static float scalar_sparse_dot_product(u_int32_t *a_indexes, float *a_values, u_int32_t a_count, u_int32_t *b_indexes, float *b_values, u_int32_t b_count) {
+  u_int32_t i = 0, j = 0;
+  float dot = 0.0;
+  while(i < a_count && j < b_count) {
+    if(a_indexes[i] == b_indexes[j]) {
+      dot += a_values[i] * b_values[j];
+      i++;
+      j++;
+    } else if(a_indexes[i] < b_indexes[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+  return dot;
+}
+
+static float scalar_gather_dot_product(u_int32_t *indexes, float *values, u_int32_t stride, u_int32_t count, float *dense) {
+  float s0 = 0.0, s1 = 0.0;
+  u_int32_t i = 0;
+  for(; i + 2 <= count; i += 2) {
+    s0 += values[i * stride]       * dense[indexes[i * stride]];
+    s1 += values[(i + 1) * stride] * dense[indexes[(i + 1) * stride]];
+  }
+  for(; i < count; i++)
+    s0 += values[i * stride] * dense[indexes[i * stride]];
+  return s0 + s1;
+}
+
+static void scalar_scatter_axpy(float alpha, u_int32_t *indexes, float *values, u_int32_t stride, u_int32_t count, float *dense) {
+  for(u_int32_t i = 0; i < count; i++)
+    dense[indexes[i * stride]] += alpha * values[i * stride];
+}
+
+// deltas are stored little endian in 1 to 4 bytes; the two bit code
+// for the i'th delta is in bits 2(i % 4)...2(i % 4) + 1 of its control
+static u_int8_t *scalar_delta_decode(u_int8_t *controls, u_int8_t *data, u_int8_t *data_end, u_int32_t count, u_int32_t previous, u_int32_t *indexes) {
+  u_int32_t delta, length;
+  for(u_int32_t i = 0; i < count; i++) {
+    length = ((controls[i / 4] >> (2 * (i % 4))) & 3) + 1;
+    if(data + length > data_end) return NULL;
+    delta = 0;
+    memcpy(&delta, data, length);
+    data += length;
+    previous += delta;
+    indexes[i] = previous;
+  }
+  return data;
+}
+
+
+#ifdef LEARNER_X86_SIMD
+// ------------------------------------------
+// sse2 kernels
+// ------------------------------------------
+__attribute__((target("sse2")))
+static inline float sse2_sum(__m128 v) {
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse2")))
+static float sse2_dot_product(float *a, float *b, u_int32_t length) {
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+  u_int32_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i),      _mm_loadu_ps(b + i)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),  _mm_loadu_ps(b + i + 4)));
+    s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(a + i + 8),  _mm_loadu_ps(b + i + 8)));
+    s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12)));
+  }
+  for(; i + 4 <= length; i += 4)
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  float result = sse2_sum(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+  for(; i < length; i++)
+    result += a[i] * b[i];
+  return result;
+}
+
+__attribute__((target("sse2")))
+static float sse2_sum_of_squares(float *a, u_int32_t length) {
+  return sse2_dot_product(a, a, length);
+}
+
+__attribute__((target("sse2")))
+static float sse2_squared_distance(float *a, float *b, u_int32_t length) {
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+  __m128 d0, d1, d2, d3;
+  u_int32_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    d0 = _mm_sub_ps(_mm_loadu_ps(a + i),      _mm_loadu_ps(b + i));
+    d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4),  _mm_loadu_ps(b + i + 4));
+    d2 = _mm_sub_ps(_mm_loadu_ps(a + i + 8),  _mm_loadu_ps(b + i + 8));
+    d3 = _mm_sub_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12));
+    s0 = _mm_add_ps(s0, _mm_mul_ps(d0, d0));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(d1, d1));
+    s2 = _mm_add_ps(s2, _mm_mul_ps(d2, d2));
+    s3 = _mm_add_ps(s3, _mm_mul_ps(d3, d3));
+  }
+  for(; i + 4 <= length; i += 4) {
+    d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    s0 = _mm_add_ps(s0, _mm_mul_ps(d0, d0));
+  }
+  float result = sse2_sum(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3))), d;
+  for(; i < length; i++) {
+    d = a[i] - b[i];
+    result += d * d;
+  }
+  return result;
+}
+
+// two accumulators for each of the three sums keeps all six in
+// registers while still hiding most of the add latency
+__attribute__((target("sse2")))
+static void sse2_dot_and_squares(float *a, float *b, u_int32_t length, float *dot, float *squares_a, float *squares_b) {
+  __m128 d0 = _mm_setzero_ps(), d1 = _mm_setzero_ps(), a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), b0 = _mm_setzero_ps(), b1 = _mm_setzero_ps();
+  __m128 x0, x1, y0, y1;
+  u_int32_t i = 0;
+  for(; i + 8 <= length; i += 8) {
+    x0 = _mm_loadu_ps(a + i);
+    x1 = _mm_loadu_ps(a + i + 4);
+    y0 = _mm_loadu_ps(b + i);
+    y1 = _mm_loadu_ps(b + i + 4);
+    d0 = _mm_add_ps(d0, _mm_mul_ps(x0, y0));
+    d1 = _mm_add_ps(d1, _mm_mul_ps(x1, y1));
+    a0 = _mm_add_ps(a0, _mm_mul_ps(x0, x0));
+    a1 = _mm_add_ps(a1, _mm_mul_ps(x1, x1));
+    b0 = _mm_add_ps(b0, _mm_mul_ps(y0, y0));
+    b1 = _mm_add_ps(b1, _mm_mul_ps(y1, y1));
+  }
+  float d = sse2_sum(_mm_add_ps(d0, d1)), sa = sse2_sum(_mm_add_ps(a0, a1)), sb = sse2_sum(_mm_add_ps(b0, b1));
+  for(; i < length; i++) {
+    d  += a[i] * b[i];
+    sa += a[i] * a[i];
+    sb += b[i] * b[i];
+  }
+  *dot = d; *squares_a = sa; *squares_b = sb;
+}
+
+__attribute__((target("sse2")))
+static void sse2_dot_product_x4(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots) {
+  float *r0 = rows, *r1 = rows + stride, *r2 = rows + (2 * stride), *r3 = rows + (3 * stride);
+  __m128 d0 = _mm_setzero_ps(), d1 = _mm_setzero_ps(), d2 = _mm_setzero_ps(), d3 = _mm_setzero_ps(), q;
+  for(u_int32_t i = 0; i < length; i += 4) {
+    q  = _mm_load_ps(query + i);
+    d0 = _mm_add_ps(d0, _mm_mul_ps(q, _mm_load_ps(r0 + i)));
+    d1 = _mm_add_ps(d1, _mm_mul_ps(q, _mm_load_ps(r1 + i)));
+    d2 = _mm_add_ps(d2, _mm_mul_ps(q, _mm_load_ps(r2 + i)));
+    d3 = _mm_add_ps(d3, _mm_mul_ps(q, _mm_load_ps(r3 + i)));
+  }
+  dots[0] = sse2_sum(d0); dots[1] = sse2_sum(d1); dots[2] = sse2_sum(d2); dots[3] = sse2_sum(d3);
+}
+
+__attribute__((target("sse2")))
+static void sse2_dot_and_squares_x4(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots, float *squares) {
+  float *r0 = rows, *r1 = rows + stride, *r2 = rows + (2 * stride), *r3 = rows + (3 * stride);
+  __m128 d0 = _mm_setzero_ps(), d1 = _mm_setzero_ps(), d2 = _mm_setzero_ps(), d3 = _mm_setzero_ps();
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+  __m128 q, x0, x1, x2, x3;
+  for(u_int32_t i = 0; i < length; i += 4) {
+    q  = _mm_load_ps(query + i);
+    x0 = _mm_load_ps(r0 + i);
+    x1 = _mm_load_ps(r1 + i);
+    x2 = _mm_load_ps(r2 + i);
+    x3 = _mm_load_ps(r3 + i);
+    d0 = _mm_add_ps(d0, _mm_mul_ps(q, x0));
+    d1 = _mm_add_ps(d1, _mm_mul_ps(q, x1));
+    d2 = _mm_add_ps(d2, _mm_mul_ps(q, x2));
+    d3 = _mm_add_ps(d3, _mm_mul_ps(q, x3));
+    s0 = _mm_add_ps(s0, _mm_mul_ps(x0, x0));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(x1, x1));
+    s2 = _mm_add_ps(s2, _mm_mul_ps(x2, x2));
+    s3 = _mm_add_ps(s3, _mm_mul_ps(x3, x3));
+  }
+  dots[0] = sse2_sum(d0); dots[1] = sse2_sum(d1); dots[2] = sse2_sum(d2); dots[3] = sse2_sum(d3);
+  squares[0] = sse2_sum(s0); squares[1] = sse2_sum(s1); squares[2] = sse2_sum(s2); squares[3] = sse2_sum(s3);
+}
+
+__attribute__((target("sse2")))
+static void sse2_axpy(float alpha, float *x, float *y, u_int32_t length) {
+  __m128 a = _mm_set1_ps(alpha);
+  u_int32_t i = 0;
+  for(; i + 4 <= length; i += 4)
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(a, _mm_loadu_ps(x + i))));
+  for(; i < length; i++)
+    y[i] += alpha * x[i];
+}
+
+// sse2 has no sign extending byte load, so bytes are unpacked in to
+// the high half of each 16 bit lane and arithmetic shifted down
+__attribute__((target("sse2")))
+static int32_t sse2_dot_product_int8(int8_t *a, int8_t *b, u_int32_t length) {
+  __m128i sum = _mm_setzero_si128(), x, y;
+  u_int32_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    x = _mm_loadu_si128((__m128i *) (a + i));
+    y = _mm_loadu_si128((__m128i *) (b + i));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8), _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8)));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8), _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8)));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t result = _mm_cvtsi128_si32(sum);
+  for(; i < length; i++)
+    result += (int32_t) a[i] * (int32_t) b[i];
+  return result;
+}
+
+// blocks of four indexes from a are compared against each rotation
+// of a block of four from b. indexes are unique, so each lane of a
+// matches at most one rotation; the matching b value is rotated in
+// to the same lane and masked in to the sum. whichever block ends
+// on the lower index is then advanced (both when they end equal).
+__attribute__((target("sse2")))
+static float sse2_sparse_dot_product(u_int32_t *a_indexes, float *a_values, u_int32_t a_count, u_int32_t *b_indexes, float *b_values, u_int32_t b_count) {
+  __m128 sum = _mm_setzero_ps(), a, b;
+  __m128i x, y;
+  u_int32_t i = 0, j = 0;
+  while(i + 4 <= a_count && j + 4 <= b_count) {
+    x = _mm_loadu_si128((__m128i *) (a_indexes + i));
+    y = _mm_loadu_si128((__m128i *) (b_indexes + j));
+    a = _mm_loadu_ps(a_values + i);
+    b = _mm_loadu_ps(b_values + j);
+    for(int rotation = 0; rotation < 4; rotation++) {
+      sum = _mm_add_ps(sum, _mm_and_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, y)), _mm_mul_ps(a, b)));
+      y = _mm_shuffle_epi32(y, _MM_SHUFFLE(0, 3, 2, 1));
+      b = _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 3, 2, 1));
+    }
+    u_int32_t a_last = a_indexes[i + 3], b_last = b_indexes[j + 3];
+    if(a_last <= b_last) i += 4;
+    if(b_last <= a_last) j += 4;
+  }
+  return sse2_sum(sum) + scalar_sparse_dot_product(a_indexes + i, a_values + i, a_count - i, b_indexes + j, b_values + j, b_count - j);
+}
+
+
+// ------------------------------------------
+// stream vbyte tables
+// ------------------------------------------
+// for each control byte, the shuffle that moves each delta's bytes
+// in to the low bytes of a 32 bit lane (0x80 zeroes a byte), and the
+// total length of the four deltas. built when kernels are selected.
+static u_int8_t delta_decode_shuffles[256][16] __attribute__((aligned(16)));
+static u_int8_t delta_decode_lengths[256];
+
+static void build_delta_decode_tables() {
+  for(int control = 0; control < 256; control++) {
+    u_int8_t offset = 0;
+    for(int lane = 0; lane < 4; lane++) {
+      u_int8_t length = ((control >> (2 * lane)) & 3) + 1;
+      for(int byte = 0; byte < 4; byte++)
+        delta_decode_shuffles[control][(lane * 4) + byte] = (byte < length) ? offset + byte : 0x80;
+      offset += length;
+    }
+    delta_decode_lengths[control] = offset;
+  }
+}
+
+
+// ------------------------------------------
+// avx2 + fma kernels
+// ------------------------------------------
+__attribute__((target("avx2,fma")))
+static inline float avx2_sum(__m256 v) {
+  __m128 r = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+  r = _mm_add_ss(r, _mm_shuffle_ps(r, r, 1));
+  return _mm_cvtss_f32(r);
+}
+
+__attribute__((target("avx2,fma")))
+static float avx2_dot_product(float *a, float *b, u_int32_t length) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+  u_int32_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),      _mm256_loadu_ps(b + i),      s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),  _mm256_loadu_ps(b + i + 8),  s1);
+    s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), s2);
+    s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), s3);
+  }
+  for(; i + 8 <= length; i += 8)
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+  float result = avx2_sum(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+  for(; i < length; i++)
+    result += a[i] * b[i];
+  return result;
+}
+
+__attribute__((target("avx2,fma")))
+static float avx2_sum_of_squares(float *a, u_int32_t length) {
+  return avx2_dot_product(a, a, length);
+}
+
+__attribute__((target("avx2,fma")))
+static float avx2_squared_distance(float *a, float *b, u_int32_t length) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+  __m256 d0, d1, d2, d3;
+  u_int32_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),      _mm256_loadu_ps(b + i));
+    d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),  _mm256_loadu_ps(b + i + 8));
+    d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+    d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+    s0 = _mm256_fmadd_ps(d0, d0, s0);
+    s1 = _mm256_fmadd_ps(d1, d1, s1);
+    s2 = _mm256_fmadd_ps(d2, d2, s2);
+    s3 = _mm256_fmadd_ps(d3, d3, s3);
+  }
+  for(; i + 8 <= length; i += 8) {
+    d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    s0 = _mm256_fmadd_ps(d0, d0, s0);
+  }
+  float result = avx2_sum(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3))), d;
+  for(; i < length; i++) {
+    d = a[i] - b[i];
+    result += d * d;
+  }
+  return result;
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_dot_and_squares(float *a, float *b, u_int32_t length, float *dot, float *squares_a, float *squares_b) {
+  __m256 d0 = _mm256_setzero_ps(), d1 = _mm256_setzero_ps(), a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), b0 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+  __m256 x0, x1, y0, y1;
+  u_int32_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    x0 = _mm256_loadu_ps(a + i);
+    x1 = _mm256_loadu_ps(a + i + 8);
+    y0 = _mm256_loadu_ps(b + i);
+    y1 = _mm256_loadu_ps(b + i + 8);
+    d0 = _mm256_fmadd_ps(x0, y0, d0);
+    d1 = _mm256_fmadd_ps(x1, y1, d1);
+    a0 = _mm256_fmadd_ps(x0, x0, a0);
+    a1 = _mm256_fmadd_ps(x1, x1, a1);
+    b0 = _mm256_fmadd_ps(y0, y0, b0);
+    b1 = _mm256_fmadd_ps(y1, y1, b1);
+  }
+  float d = avx2_sum(_mm256_add_ps(d0, d1)), sa = avx2_sum(_mm256_add_ps(a0, a1)), sb = avx2_sum(_mm256_add_ps(b0, b1));
+  for(; i < length; i++) {
+    d  += a[i] * b[i];
+    sa += a[i] * a[i];
+    sb += b[i] * b[i];
+  }
+  *dot = d; *squares_a = sa; *squares_b = sb;
+}
+
+
+__attribute__((target("avx2,fma")))
+static void avx2_dot_product_x4(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots) {
+  float *r0 = rows, *r1 = rows + stride, *r2 = rows + (2 * stride), *r3 = rows + (3 * stride);
+  __m256 d0 = _mm256_setzero_ps(), d1 = _mm256_setzero_ps(), d2 = _mm256_setzero_ps(), d3 = _mm256_setzero_ps(), q;
+  for(u_int32_t i = 0; i < length; i += 8) {
+    q  = _mm256_load_ps(query + i);
+    d0 = _mm256_fmadd_ps(q, _mm256_load_ps(r0 + i), d0);
+    d1 = _mm256_fmadd_ps(q, _mm256_load_ps(r1 + i), d1);
+    d2 = _mm256_fmadd_ps(q, _mm256_load_ps(r2 + i), d2);
+    d3 = _mm256_fmadd_ps(q, _mm256_load_ps(r3 + i), d3);
+  }
+  dots[0] = avx2_sum(d0); dots[1] = avx2_sum(d1); dots[2] = avx2_sum(d2); dots[3] = avx2_sum(d3);
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_dot_and_squares_x4(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots, float *squares) {
+  float *r0 = rows, *r1 = rows + stride, *r2 = rows + (2 * stride), *r3 = rows + (3 * stride);
+  __m256 d0 = _mm256_setzero_ps(), d1 = _mm256_setzero_ps(), d2 = _mm256_setzero_ps(), d3 = _mm256_setzero_ps();
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+  __m256 q, x0, x1, x2, x3;
+  for(u_int32_t i = 0; i < length; i += 8) {
+    q  = _mm256_load_ps(query + i);
+    x0 = _mm256_load_ps(r0 + i);
+    x1 = _mm256_load_ps(r1 + i);
+    x2 = _mm256_load_ps(r2 + i);
+    x3 = _mm256_load_ps(r3 + i);
+    d0 = _mm256_fmadd_ps(q, x0, d0);
+    d1 = _mm256_fmadd_ps(q, x1, d1);
+    d2 = _mm256_fmadd_ps(q, x2, d2);
+    d3 = _mm256_fmadd_ps(q, x3, d3);
+    s0 = _mm256_fmadd_ps(x0, x0, s0);
+    s1 = _mm256_fmadd_ps(x1, x1, s1);
+    s2 = _mm256_fmadd_ps(x2, x2, s2);
+    s3 = _mm256_fmadd_ps(x3, x3, s3);
+  }
+  dots[0] = avx2_sum(d0); dots[1] = avx2_sum(d1); dots[2] = avx2_sum(d2); dots[3] = avx2_sum(d3);
+  squares[0] = avx2_sum(s0); squares[1] = avx2_sum(s1); squares[2] = avx2_sum(s2); squares[3] = avx2_sum(s3);
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_axpy(float alpha, float *x, float *y, u_int32_t length) {
+  __m256 a = _mm256_set1_ps(alpha);
+  u_int32_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    _mm256_storeu_ps(y + i,     _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i),     _mm256_loadu_ps(y + i)));
+    _mm256_storeu_ps(y + i + 8, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8)));
+  }
+  for(; i + 8 <= length; i += 8)
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+  for(; i < length; i++)
+    y[i] += alpha * x[i];
+}
+
+__attribute__((target("avx2,fma")))
+static int32_t avx2_dot_product_int8(int8_t *a, int8_t *b, u_int32_t length) {
+  __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+  u_int32_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i *) (a + i))),      _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i *) (b + i)))));
+    s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i *) (a + i + 16))), _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i *) (b + i + 16)))));
+  }
+  for(; i + 16 <= length; i += 16)
+    s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i *) (a + i))), _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i *) (b + i)))));
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(_mm256_add_epi32(s0, s1)), _mm256_extracti128_si256(_mm256_add_epi32(s0, s1), 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t result = _mm_cvtsi128_si32(sum);
+  for(; i < length; i++)
+    result += (int32_t) a[i] * (int32_t) b[i];
+  return result;
+}
+
+// as the sse2 kernel, with blocks of eight and cross lane rotations
+__attribute__((target("avx2,fma")))
+static float avx2_sparse_dot_product(u_int32_t *a_indexes, float *a_values, u_int32_t a_count, u_int32_t *b_indexes, float *b_values, u_int32_t b_count) {
+  const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+  __m256 sum = _mm256_setzero_ps(), a, b;
+  __m256i x, y;
+  u_int32_t i = 0, j = 0;
+  while(i + 8 <= a_count && j + 8 <= b_count) {
+    x = _mm256_loadu_si256((__m256i *) (a_indexes + i));
+    y = _mm256_loadu_si256((__m256i *) (b_indexes + j));
+    a = _mm256_loadu_ps(a_values + i);
+    b = _mm256_loadu_ps(b_values + j);
+    for(int rotation = 0; rotation < 8; rotation++) {
+      sum = _mm256_fmadd_ps(a, _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, y)), b), sum);
+      y = _mm256_permutevar8x32_epi32(y, rotate);
+      b = _mm256_permutevar8x32_ps(b, rotate);
+    }
+    u_int32_t a_last = a_indexes[i + 7], b_last = b_indexes[j + 7];
+    if(a_last <= b_last) i += 8;
+    if(b_last <= a_last) j += 8;
+  }
+  return avx2_sum(sum) + scalar_sparse_dot_product(a_indexes + i, a_values + i, a_count - i, b_indexes + j, b_values + j, b_count - j);
+}
+
+// packed pairs are split in to indexes and values by shuffling two
+// loads of four pairs. the shuffle reorders the lanes, but indexes
+// and values are reordered alike, which is all a sum needs.
+__attribute__((target("avx2,fma")))
+static float avx2_gather_dot_product(u_int32_t *indexes, float *values, u_int32_t stride, u_int32_t count, float *dense) {
+  __m256 sum = _mm256_setzero_ps(), lo, hi, v;
+  __m256i index;
+  u_int32_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    if(stride == 1) {
+      index = _mm256_loadu_si256((__m256i *) (indexes + i));
+      v = _mm256_loadu_ps(values + i);
+    } else {
+      lo = _mm256_loadu_ps((float *) (indexes + (i * 2)));
+      hi = _mm256_loadu_ps((float *) (indexes + (i * 2) + 8));
+      index = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+      v = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+    }
+    sum = _mm256_fmadd_ps(v, _mm256_i32gather_ps(dense, index, 4), sum);
+  }
+  return avx2_sum(sum) + scalar_gather_dot_product(indexes + (i * stride), values + (i * stride), stride, count - i, dense);
+}
+
+// stream vbyte decoding with a byte shuffle per control byte (ssse3,
+// which every avx2 cpu has). the shuffle expands the four deltas to
+// 32 bits, then a log step prefix sum turns them in to indexes. a
+// full 16 bytes is loaded each step, so the last few groups are
+// decoded by the scalar kernel to avoid reading past the data.
+__attribute__((target("avx2,fma")))
+static u_int8_t *avx2_delta_decode(u_int8_t *controls, u_int8_t *data, u_int8_t *data_end, u_int32_t count, u_int32_t previous, u_int32_t *indexes) {
+  __m128i deltas;
+  u_int32_t i = 0;
+  for(; i + 4 <= count && data + 16 <= data_end; i += 4) {
+    u_int8_t control = controls[i / 4];
+    deltas = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) data), _mm_load_si128((__m128i *) delta_decode_shuffles[control]));
+    deltas = _mm_add_epi32(deltas, _mm_slli_si128(deltas, 4));
+    deltas = _mm_add_epi32(deltas, _mm_slli_si128(deltas, 8));
+    deltas = _mm_add_epi32(deltas, _mm_set1_epi32(previous));
+    _mm_storeu_si128((__m128i *) (indexes + i), deltas);
+    previous = indexes[i + 3];
+    data += delta_decode_lengths[control];
+  }
+  if(i == count) return data;
+  return scalar_delta_decode(controls + (i / 4), data, data_end, count - i, previous, indexes + i);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void avx2_float16_to_float(u_int16_t *in, float *out, u_int32_t length) {
+  u_int32_t i = 0;
+  for(; i + 8 <= length; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (in + i))));
+  for(; i < length; i++)
+    out[i] = half_to_float(in[i]);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float avx2_dot_product_float16(u_int16_t *a, u_int16_t *b, u_int32_t length) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  u_int32_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    s0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (a + i))),     _mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (b + i))),     s0);
+    s1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (a + i + 8))), _mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (b + i + 8))), s1);
+  }
+  float result = avx2_sum(_mm256_add_ps(s0, s1));
+  for(; i < length; i++)
+    result += half_to_float(a[i]) * half_to_float(b[i]);
+  return result;
+}
+
+
+// ------------------------------------------
+// avx-512 kernels
+// ------------------------------------------
+// the remainder is handled with a masked load rather than a
+// scalar loop; masked out lanes load as zero
+__attribute__((target("avx512f")))
+static float avx512_dot_product(float *a, float *b, u_int32_t length) {
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+  u_int32_t i = 0;
+  for(; i + 64 <= length; i += 64) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i),      _mm512_loadu_ps(b + i),      s0);
+    s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+    s2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), s2);
+    s3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), s3);
+  }
+  for(; i + 16 <= length; i += 16)
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+  if(i < length) {
+    __mmask16 mask = (__mmask16) ((1 << (length - i)) - 1);
+    s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+__attribute__((target("avx512f")))
+static float avx512_sum_of_squares(float *a, u_int32_t length) {
+  return avx512_dot_product(a, a, length);
+}
+
+__attribute__((target("avx512f")))
+static float avx512_squared_distance(float *a, float *b, u_int32_t length) {
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+  __m512 d0, d1, d2, d3;
+  u_int32_t i = 0;
+  for(; i + 64 <= length; i += 64) {
+    d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i),      _mm512_loadu_ps(b + i));
+    d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+    d2 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32));
+    d3 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48));
+    s0 = _mm512_fmadd_ps(d0, d0, s0);
+    s1 = _mm512_fmadd_ps(d1, d1, s1);
+    s2 = _mm512_fmadd_ps(d2, d2, s2);
+    s3 = _mm512_fmadd_ps(d3, d3, s3);
+  }
+  for(; i + 16 <= length; i += 16) {
+    d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    s0 = _mm512_fmadd_ps(d0, d0, s0);
+  }
+  if(i < length) {
+    __mmask16 mask = (__mmask16) ((1 << (length - i)) - 1);
+    d1 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+    s1 = _mm512_fmadd_ps(d1, d1, s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+__attribute__((target("avx512f")))
+static void avx512_dot_and_squares(float *a, float *b, u_int32_t length, float *dot, float *squares_a, float *squares_b) {
+  __m512 d0 = _mm512_setzero_ps(), d1 = _mm512_setzero_ps(), a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps(), b0 = _mm512_setzero_ps(), b1 = _mm512_setzero_ps();
+  __m512 x0, x1, y0, y1;
+  u_int32_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    x0 = _mm512_loadu_ps(a + i);
+    x1 = _mm512_loadu_ps(a + i + 16);
+    y0 = _mm512_loadu_ps(b + i);
+    y1 = _mm512_loadu_ps(b + i + 16);
+    d0 = _mm512_fmadd_ps(x0, y0, d0);
+    d1 = _mm512_fmadd_ps(x1, y1, d1);
+    a0 = _mm512_fmadd_ps(x0, x0, a0);
+    a1 = _mm512_fmadd_ps(x1, x1, a1);
+    b0 = _mm512_fmadd_ps(y0, y0, b0);
+    b1 = _mm512_fmadd_ps(y1, y1, b1);
+  }
+  for(; i < length; i += 16) {
+    __mmask16 mask = (length - i >= 16) ? 0xFFFF : (__mmask16) ((1 << (length - i)) - 1);
+    x0 = _mm512_maskz_loadu_ps(mask, a + i);
+    y0 = _mm512_maskz_loadu_ps(mask, b + i);
+    d0 = _mm512_fmadd_ps(x0, y0, d0);
+    a0 = _mm512_fmadd_ps(x0, x0, a0);
+    b0 = _mm512_fmadd_ps(y0, y0, b0);
+  }
+  *dot       = _mm512_reduce_add_ps(_mm512_add_ps(d0, d1));
+  *squares_a = _mm512_reduce_add_ps(_mm512_add_ps(a0, a1));
+  *squares_b = _mm512_reduce_add_ps(_mm512_add_ps(b0, b1));
+}
+
+__attribute__((target("avx512f")))
+static void avx512_dot_product_x4(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots) {
+  float *r0 = rows, *r1 = rows + stride, *r2 = rows + (2 * stride), *r3 = rows + (3 * stride);
+  __m512 d0 = _mm512_setzero_ps(), d1 = _mm512_setzero_ps(), d2 = _mm512_setzero_ps(), d3 = _mm512_setzero_ps(), q;
+  for(u_int32_t i = 0; i < length; i += 16) {
+    q  = _mm512_load_ps(query + i);
+    d0 = _mm512_fmadd_ps(q, _mm512_load_ps(r0 + i), d0);
+    d1 = _mm512_fmadd_ps(q, _mm512_load_ps(r1 + i), d1);
+    d2 = _mm512_fmadd_ps(q, _mm512_load_ps(r2 + i), d2);
+    d3 = _mm512_fmadd_ps(q, _mm512_load_ps(r3 + i), d3);
+  }
+  dots[0] = _mm512_reduce_add_ps(d0); dots[1] = _mm512_reduce_add_ps(d1); dots[2] = _mm512_reduce_add_ps(d2); dots[3] = _mm512_reduce_add_ps(d3);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_dot_and_squares_x4(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots, float *squares) {
+  float *r0 = rows, *r1 = rows + stride, *r2 = rows + (2 * stride), *r3 = rows + (3 * stride);
+  __m512 d0 = _mm512_setzero_ps(), d1 = _mm512_setzero_ps(), d2 = _mm512_setzero_ps(), d3 = _mm512_setzero_ps();
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+  __m512 q, x0, x1, x2, x3;
+  for(u_int32_t i = 0; i < length; i += 16) {
+    q  = _mm512_load_ps(query + i);
+    x0 = _mm512_load_ps(r0 + i);
+    x1 = _mm512_load_ps(r1 + i);
+    x2 = _mm512_load_ps(r2 + i);
+    x3 = _mm512_load_ps(r3 + i);
+    d0 = _mm512_fmadd_ps(q, x0, d0);
+    d1 = _mm512_fmadd_ps(q, x1, d1);
+    d2 = _mm512_fmadd_ps(q, x2, d2);
+    d3 = _mm512_fmadd_ps(q, x3, d3);
+    s0 = _mm512_fmadd_ps(x0, x0, s0);
+    s1 = _mm512_fmadd_ps(x1, x1, s1);
+    s2 = _mm512_fmadd_ps(x2, x2, s2);
+    s3 = _mm512_fmadd_ps(x3, x3, s3);
+  }
+  dots[0] = _mm512_reduce_add_ps(d0); dots[1] = _mm512_reduce_add_ps(d1); dots[2] = _mm512_reduce_add_ps(d2); dots[3] = _mm512_reduce_add_ps(d3);
+  squares[0] = _mm512_reduce_add_ps(s0); squares[1] = _mm512_reduce_add_ps(s1); squares[2] = _mm512_reduce_add_ps(s2); squares[3] = _mm512_reduce_add_ps(s3);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_axpy(float alpha, float *x, float *y, u_int32_t length) {
+  __m512 a = _mm512_set1_ps(alpha);
+  u_int32_t i = 0;
+  for(; i + 16 <= length; i += 16)
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(a, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+  if(i < length) {
+    __mmask16 mask = (__mmask16) ((1 << (length - i)) - 1);
+    _mm512_mask_storeu_ps(y + i, mask, _mm512_fmadd_ps(a, _mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i)));
+  }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int32_t avx512_dot_product_int8(int8_t *a, int8_t *b, u_int32_t length) {
+  __m512i s0 = _mm512_setzero_si512(), s1 = _mm512_setzero_si512();
+  u_int32_t i = 0;
+  for(; i + 64 <= length; i += 64) {
+    s0 = _mm512_add_epi32(s0, _mm512_madd_epi16(_mm512_cvtepi8_epi16(_mm256_loadu_si256((__m256i *) (a + i))),      _mm512_cvtepi8_epi16(_mm256_loadu_si256((__m256i *) (b + i)))));
+    s1 = _mm512_add_epi32(s1, _mm512_madd_epi16(_mm512_cvtepi8_epi16(_mm256_loadu_si256((__m256i *) (a + i + 32))), _mm512_cvtepi8_epi16(_mm256_loadu_si256((__m256i *) (b + i + 32)))));
+  }
+  if(i < length) {
+    // the masked loads zero the bytes past the end of the vectors
+    __mmask64 mask = (length - i >= 64) ? ~((__mmask64) 0) : (((__mmask64) 1) << (length - i)) - 1;
+    __m512i x = _mm512_maskz_loadu_epi8(mask, a + i), y = _mm512_maskz_loadu_epi8(mask, b + i);
+    s0 = _mm512_add_epi32(s0, _mm512_madd_epi16(_mm512_cvtepi8_epi16(_mm512_castsi512_si256(x)), _mm512_cvtepi8_epi16(_mm512_castsi512_si256(y))));
+    s1 = _mm512_add_epi32(s1, _mm512_madd_epi16(_mm512_cvtepi8_epi16(_mm512_extracti64x4_epi64(x, 1)), _mm512_cvtepi8_epi16(_mm512_extracti64x4_epi64(y, 1))));
+  }
+  return _mm512_reduce_add_epi32(_mm512_add_epi32(s0, s1));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void avx512_float16_to_float(u_int16_t *in, float *out, u_int32_t length) {
+  u_int32_t i = 0;
+  for(; i + 16 <= length; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (in + i))));
+  for(; i < length; i++)
+    out[i] = half_to_float(in[i]);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static float avx512_dot_product_float16(u_int16_t *a, u_int16_t *b, u_int32_t length) {
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  u_int32_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    s0 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (a + i))),      _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (b + i))),      s0);
+    s1 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (a + i + 16))), _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (b + i + 16))), s1);
+  }
+  for(; i + 16 <= length; i += 16)
+    s0 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (a + i))), _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (b + i))), s0);
+  float result = _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+  for(; i < length; i++)
+    result += half_to_float(a[i]) * half_to_float(b[i]);
+  return result;
+}
+
+// pairs are split with two source permutes. indexes are unique, so
+// the scatter in axpy never writes a lane twice.
+__attribute__((target("avx512f")))
+static inline void avx512_load_sparse(u_int32_t *indexes, float *values, u_int32_t stride, u_int32_t i, __m512i *index, __m512 *v) {
+  if(stride == 1) {
+    *index = _mm512_loadu_si512(indexes + i);
+    *v = _mm512_loadu_ps(values + i);
+  } else {
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd  = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    __m512i lo = _mm512_loadu_si512(indexes + (i * 2)), hi = _mm512_loadu_si512(indexes + (i * 2) + 16);
+    *index = _mm512_permutex2var_epi32(lo, even, hi);
+    *v = _mm512_castsi512_ps(_mm512_permutex2var_epi32(lo, odd, hi));
+  }
+}
+
+__attribute__((target("avx512f")))
+static float avx512_gather_dot_product(u_int32_t *indexes, float *values, u_int32_t stride, u_int32_t count, float *dense) {
+  __m512 sum = _mm512_setzero_ps(), v;
+  __m512i index;
+  u_int32_t i = 0;
+  for(; i + 16 <= count; i += 16) {
+    avx512_load_sparse(indexes, values, stride, i, &index, &v);
+    sum = _mm512_fmadd_ps(v, _mm512_i32gather_ps(index, dense, 4), sum);
+  }
+  return _mm512_reduce_add_ps(sum) + scalar_gather_dot_product(indexes + (i * stride), values + (i * stride), stride, count - i, dense);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_scatter_axpy(float alpha, u_int32_t *indexes, float *values, u_int32_t stride, u_int32_t count, float *dense) {
+  __m512 a = _mm512_set1_ps(alpha), v;
+  __m512i index;
+  u_int32_t i = 0;
+  for(; i + 16 <= count; i += 16) {
+    avx512_load_sparse(indexes, values, stride, i, &index, &v);
+    _mm512_i32scatter_ps(dense, index, _mm512_fmadd_ps(a, v, _mm512_i32gather_ps(index, dense, 4)), 4);
+  }
+  scalar_scatter_axpy(alpha, indexes + (i * stride), values + (i * stride), stride, count - i, dense);
+}
+#endif
+
+
+// ------------------------------------------
+// dispatch
+// ------------------------------------------
+vector_kernel_table vector_kernels = {
+  CPU_SCALAR,
+  scalar_dot_product,
+  scalar_sum_of_squares,
+  scalar_squared_distance,
+  scalar_dot_and_squares,
+  scalar_dot_product_x4,
+  scalar_dot_and_squares_x4,
+  scalar_axpy,
+  scalar_dot_product_int8,
+  scalar_dot_product_float16,
+  scalar_float16_to_float,
+  scalar_sparse_dot_product,
+  scalar_gather_dot_product,
+  scalar_scatter_axpy,
+  scalar_delta_decode
+};
+
+learner_error vector_kernels_select(learner_cpu_level level) {
+  if(level > learner_cpu_detect()) return UNSUPPORTED_CPU_LEVEL;
+
+  // each level starts from the level below it, so a level only
+  // needs to replace the kernels it actually accelerates
+  vector_kernels.level               = level;
+  vector_kernels.dot_product         = scalar_dot_product;
+  vector_kernels.sum_of_squares      = scalar_sum_of_squares;
+  vector_kernels.squared_distance    = scalar_squared_distance;
+  vector_kernels.dot_and_squares     = scalar_dot_and_squares;
+  vector_kernels.dot_product_x4      = scalar_dot_product_x4;
+  vector_kernels.dot_and_squares_x4  = scalar_dot_and_squares_x4;
+  vector_kernels.axpy                = scalar_axpy;
+  vector_kernels.dot_product_int8    = scalar_dot_product_int8;
+  vector_kernels.dot_product_float16 = scalar_dot_product_float16;
+  vector_kernels.float16_to_float    = scalar_float16_to_float;
+  vector_kernels.sparse_dot_product  = scalar_sparse_dot_product;
+  vector_kernels.gather_dot_product  = scalar_gather_dot_product;
+  vector_kernels.scatter_axpy        = scalar_scatter_axpy;
+  vector_kernels.delta_decode        = scalar_delta_decode;
+
+#ifdef LEARNER_X86_SIMD
+  build_delta_decode_tables();
+
+  if(level >= CPU_SSE2) {
+    vector_kernels.dot_product         = sse2_dot_product;
+    vector_kernels.sum_of_squares      = sse2_sum_of_squares;
+    vector_kernels.squared_distance    = sse2_squared_distance;
+    vector_kernels.dot_and_squares     = sse2_dot_and_squares;
+    vector_kernels.dot_product_x4      = sse2_dot_product_x4;
+    vector_kernels.dot_and_squares_x4  = sse2_dot_and_squares_x4;
+    vector_kernels.axpy                = sse2_axpy;
+    vector_kernels.dot_product_int8    = sse2_dot_product_int8;
+    vector_kernels.sparse_dot_product  = sse2_sparse_dot_product;
+  }
+
+  if(level >= CPU_AVX2) {
+    vector_kernels.dot_product         = avx2_dot_product;
+    vector_kernels.sum_of_squares      = avx2_sum_of_squares;
+    vector_kernels.squared_distance    = avx2_squared_distance;
+    vector_kernels.dot_and_squares     = avx2_dot_and_squares;
+    vector_kernels.dot_product_x4      = avx2_dot_product_x4;
+    vector_kernels.dot_and_squares_x4  = avx2_dot_and_squares_x4;
+    vector_kernels.axpy                = avx2_axpy;
+    vector_kernels.dot_product_int8    = avx2_dot_product_int8;
+    vector_kernels.dot_product_float16 = avx2_dot_product_float16;
+    vector_kernels.float16_to_float    = avx2_float16_to_float;
+    vector_kernels.sparse_dot_product  = avx2_sparse_dot_product;
+    vector_kernels.gather_dot_product  = avx2_gather_dot_product;
+    vector_kernels.delta_decode        = avx2_delta_decode;
+  }
+
+  if(level >= CPU_AVX512) {
+    vector_kernels.dot_product         = avx512_dot_product;
+    vector_kernels.sum_of_squares      = avx512_sum_of_squares;
+    vector_kernels.squared_distance    = avx512_squared_distance;
+    vector_kernels.dot_and_squares     = avx512_dot_and_squares;
+    vector_kernels.dot_product_x4      = avx512_dot_product_x4;
+    vector_kernels.dot_and_squares_x4  = avx512_dot_and_squares_x4;
+    vector_kernels.axpy                = avx512_axpy;
+    vector_kernels.dot_product_int8    = avx512_dot_product_int8;
+    vector_kernels.dot_product_float16 = avx512_dot_product_float16;
+    vector_kernels.float16_to_float    = avx512_float16_to_float;
+    vector_kernels.gather_dot_product  = avx512_gather_dot_product;
+    vector_kernels.scatter_axpy        = avx512_scatter_axpy;
+  }
+#endif
+
+  return NO_ERROR;
+}
+
+learner_error vector_kernels_initialize() {
+  learner_cpu = learner_cpu_detect();
+  learner_error error = vector_kernels_select(learner_cpu);
+  if(error) return error;
+  debug_with_format("Using %s vector kernels", learner_cpu_level_names[learner_cpu]);
+  return NO_ERROR;
+}
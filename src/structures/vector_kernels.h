@@ -0,0 +1,80 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include "core/errors.h"
+#include "core/cpu.h"
+
+#ifndef __learner_vector_kernels__
+#define __learner_vector_kernels__
+
+// the simd kernels split each sum across several accumulators,
+// so results are reassociated relative to the scalar kernels.
+// for vectors of up to 4096 values the difference is within
+// this fraction of the sum of absolute terms (i.e sum |a[i] * b[i]|
+// for dot products, sum a[i]^2 for magnitudes).
+#define VECTOR_KERNEL_TOLERANCE 1e-5
+
+// 127 * 127 * 65536 fits in an int32 accumulator
+#define VECTOR_KERNEL_INT8_CHUNK 65536
+
+// kernels operate on raw float arrays; the Vector functions do
+// the precondition checks before calling through this table
+typedef struct {
+  learner_cpu_level level;
+  float (*dot_product)(float *a, float *b, u_int32_t length);
+  float (*sum_of_squares)(float *a, u_int32_t length);
+  float (*squared_distance)(float *a, float *b, u_int32_t length);
+  
+  // single pass over a and b producing a.b, a.a and b.b
+  void  (*dot_and_squares)(float *a, float *b, u_int32_t length, float *dot, float *squares_a, float *squares_b);
+  
+  // register blocked kernels over four consecutive rows of a vector
+  // block. each step loads the query once and reuses it against all
+  // four rows. query and rows must be 64 byte aligned, and length a
+  // multiple of 16 (see vector_block_stride).
+  void  (*dot_product_x4)(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots);
+  void  (*dot_and_squares_x4)(float *query, float *rows, u_int32_t stride, u_int32_t length, float *dots, float *squares);
+  
+  // y += alpha * x
+  void  (*axpy)(float alpha, float *x, float *y, u_int32_t length);
+  
+  // quantized kernels (see quantize.h). the int8 kernel widens to
+  // 16 bit products and 32 bit sums, so callers must split vectors
+  // longer than VECTOR_KERNEL_INT8_CHUNK values in to chunks.
+  int32_t (*dot_product_int8)(int8_t *a, int8_t *b, u_int32_t length);
+  float   (*dot_product_float16)(u_int16_t *a, u_int16_t *b, u_int32_t length);
+  void    (*float16_to_float)(u_int16_t *in, float *out, u_int32_t length);
+  
+  // dot product of two sparse vectors in structure of arrays form
+  // (see sparse_vector_to_soa). indexes must be sorted and unique.
+  // the simd kernels compare blocks of indexes against each other,
+  // rather than stepping through one index at a time.
+  float   (*sparse_dot_product)(u_int32_t *a_indexes, float *a_values, u_int32_t a_count, u_int32_t *b_indexes, float *b_values, u_int32_t b_count);
+  
+  // sparse . dense kernels, reading the dense values directly at the
+  // sparse indexes (with gather instructions where available). the
+  // sparse values are count index and value pairs, stride floats
+  // apart: 1 for structure of arrays vectors, or 2 for packed pairs,
+  // in which case values must be indexes + 1. indexes must be unique
+  // and within the dense array (and below 2^31, as gather offsets
+  // are signed).
+  float   (*gather_dot_product)(u_int32_t *indexes, float *values, u_int32_t stride, u_int32_t count, float *dense);
+  
+  // dense[indexes[i]] += alpha * values[i]
+  void    (*scatter_axpy)(float alpha, u_int32_t *indexes, float *values, u_int32_t stride, u_int32_t count, float *dense);
+  
+  // stream vbyte decoding (see sparse_vector_codec.h). decodes count
+  // deltas from data, summing them on to previous to give indexes.
+  // each control byte holds the byte lengths of four deltas, so the
+  // controls must start on a four value boundary. returns the end of
+  // the data consumed, or NULL if it would pass data_end.
+  u_int8_t *(*delta_decode)(u_int8_t *controls, u_int8_t *data, u_int8_t *data_end, u_int32_t count, u_int32_t previous, u_int32_t *indexes);
+} vector_kernel_table;
+
+// the active kernels. defaults to the scalar implementations
+// until learner_initialize selects the best supported level.
+extern vector_kernel_table vector_kernels;
+
+learner_error vector_kernels_initialize();
+learner_error vector_kernels_select(learner_cpu_level level);
+
+#endif
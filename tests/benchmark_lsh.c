@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tests.h"
+
+// measures recall against latency for a range of lsh parameters.
+// rows are drawn around cluster centres (a random subset of the
+// centre's columns, plus some noise) so neighbours are meaningful.
+// recall is the fraction of the exact top k (knn_search_sparse, by
+// cosine similarity) found by the lsh query.
+#define BENCHMARK_ROWS        20000
+#define BENCHMARK_COLUMNS     200000
+#define BENCHMARK_CLUSTERS    400
+#define BENCHMARK_CENTRE      80
+#define BENCHMARK_QUERIES     200
+#define BENCHMARK_K           10
+
+typedef struct {
+  lsh_family  family;
+  u_int32_t   bands;
+  u_int32_t   rows_per_band;
+  u_int32_t   max_hamming;
+} benchmark_config;
+
+static benchmark_config configs[] = {
+  {LSH_SIMHASH, 8,  16, 1024},
+  {LSH_SIMHASH, 16, 12, 1024},
+  {LSH_SIMHASH, 32, 8,  1024},
+  {LSH_SIMHASH, 32, 8,  100},
+  {LSH_SIMHASH, 64, 8,  1024},
+  {LSH_MINHASH, 16, 4,  0},
+  {LSH_MINHASH, 32, 3,  0},
+  {LSH_MINHASH, 64, 2,  0}
+};
+
+static u_int32_t centres[BENCHMARK_CLUSTERS * BENCHMARK_CENTRE];
+
+static double elapsed(struct timespec *start, struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+int main(void) {
+  Matrix *matrix;
+  sparse_vector_builder *builder;
+  column_accumulator *accumulator;
+  SparseVector *queries[BENCHMARK_QUERIES];
+  knn_result exact[BENCHMARK_QUERIES][BENCHMARK_K], results[BENCHMARK_K];
+  u_int32_t exact_found[BENCHMARK_QUERIES], found;
+  struct timespec start, end;
+  
+  learner_initialize();
+  matrix_new(&matrix);
+  sparse_vector_builder_new(&builder);
+  column_accumulator_new(&accumulator);
+  srand(15);
+  
+  random_centres(centres, BENCHMARK_CLUSTERS, BENCHMARK_CENTRE, BENCHMARK_COLUMNS);
+  for(u_int64_t r = 0; r < BENCHMARK_ROWS; r++)
+    matrix_set_row(matrix, r, clustered_row(matrix, builder, centres, BENCHMARK_CLUSTERS, BENCHMARK_CENTRE, BENCHMARK_COLUMNS));
+  for(int q = 0; q < BENCHMARK_QUERIES; q++)
+    queries[q] = clustered_row(matrix, builder, centres, BENCHMARK_CLUSTERS, BENCHMARK_CENTRE, BENCHMARK_COLUMNS);
+  
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int q = 0; q < BENCHMARK_QUERIES; q++)
+    knn_search_sparse(matrix, queries[q], BENCHMARK_K, COSINE_SIMILARITY, exact[q], &exact_found[q]);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("exact search: %.0fus per query\n\n", elapsed(&start, &end) / BENCHMARK_QUERIES);
+  
+  printf("family\tbands\trows\thamming\tbuild (ms)\tquery (us)\tcandidates\trecall@%u\n", BENCHMARK_K);
+  for(u_int32_t c = 0; c < sizeof(configs) / sizeof(benchmark_config); c++) {
+    lsh_parameters parameters = {configs[c].family, configs[c].bands, configs[c].rows_per_band, configs[c].max_hamming, 15, 0};
+    lsh_index *index;
+    if(lsh_new(matrix, &parameters, &index) != NO_ERROR) continue;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    lsh_insert_all(index);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double build = elapsed(&start, &end) / 1e3;
+    
+    u_int64_t candidates = 0, hits = 0, relevant = 0;
+    double query = 0.0;
+    for(int q = 0; q < BENCHMARK_QUERIES; q++) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      lsh_query(index, accumulator, queries[q], BENCHMARK_K, results, &found);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      query += elapsed(&start, &end);
+      candidates += accumulator->count;
+      
+      for(u_int32_t i = 0; i < exact_found[q]; i++)
+        for(u_int32_t j = 0; j < found; j++)
+          hits += (results[j].row == exact[q][i].row);
+      relevant += exact_found[q];
+    }
+    
+    printf("%s\t%u\t%u\t%u\t%.1f\t\t%.1f\t\t%.0f\t\t%.3f\n", lsh_family_names[configs[c].family], configs[c].bands,
+           configs[c].rows_per_band, configs[c].max_hamming, build, query / BENCHMARK_QUERIES,
+           (double) candidates / BENCHMARK_QUERIES, relevant ? (double) hits / relevant : 0.0);
+    lsh_free(index);
+  }
+  
+  for(int q = 0; q < BENCHMARK_QUERIES; q++)
+    sparse_vector_free(queries[q]);
+  column_accumulator_free(accumulator);
+  sparse_vector_builder_free(builder);
+  matrix_free(matrix);
+  return 0;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "learner.h"
+
+// measures the size ratio at which galloping through the larger of
+// two sparse vectors beats merging them, to set the default for
+// SPARSE_VECTOR_GALLOP_RATIO. the smaller vector has a fixed number
+// of values; both draw their indexes from the same range.
+#define BENCHMARK_SMALL_COUNT   256
+#define BENCHMARK_MAX_RATIO     256
+#define BENCHMARK_REPEATS       2000
+
+static SparseVector *random_vector(Matrix *matrix, sparse_vector_builder *builder, int count, u_int32_t range) {
+  SparseVector *vector;
+  for(int i = 0; i < count; i++)
+    sparse_vector_builder_append(builder, rand() % range, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, matrix, &vector);
+  return vector;
+}
+
+static double time_dot_products(SparseVector *small, SparseVector *large, u_int32_t ratio, float *result) {
+  struct timespec start, end;
+  float dot;
+  *result = 0.0;
+  sparse_vector_gallop_ratio = ratio;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int i = 0; i < BENCHMARK_REPEATS; i++) {
+    sparse_vector_dot_product(small, large, &dot);
+    *result += dot;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / BENCHMARK_REPEATS;
+}
+
+int main(void) {
+  Matrix *matrix;
+  sparse_vector_builder *builder;
+  u_int32_t crossover = 0;
+  float merged_dot, galloped_dot;
+  
+  learner_initialize();
+  matrix_new(&matrix);
+  sparse_vector_builder_new(&builder);
+  srand(8);
+  
+  printf("ratio\tmerge (ns)\tgallop (ns)\n");
+  for(u_int32_t ratio = 1; ratio <= BENCHMARK_MAX_RATIO; ratio *= 2) {
+    u_int32_t range = BENCHMARK_SMALL_COUNT * ratio * 4;
+    SparseVector *small = random_vector(matrix, builder, BENCHMARK_SMALL_COUNT, range);
+    SparseVector *large = random_vector(matrix, builder, BENCHMARK_SMALL_COUNT * ratio, range);
+    
+    // a ratio of 1 always gallops, and one past the largest count never does
+    double merge  = time_dot_products(small, large, (u_int32_t) -1, &merged_dot);
+    double gallop = time_dot_products(small, large, 1, &galloped_dot);
+    printf("%u\t%.0f\t\t%.0f\n", ratio, merge, gallop);
+    if(gallop < merge && !crossover)
+      crossover = ratio;
+    else if(gallop >= merge)
+      crossover = 0;
+    
+    sparse_vector_free(small);
+    sparse_vector_free(large);
+  }
+  
+  if(crossover)
+    printf("galloping is faster from a ratio of %u\n", crossover);
+  else
+    printf("galloping was never consistently faster\n");
+  
+  sparse_vector_builder_free(builder);
+  matrix_free(matrix);
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include "tests.h"
+
+#define ALS_TEST_USERS    300
+#define ALS_TEST_ITEMS    120
+#define ALS_TEST_RANK     4
+#define ALS_TEST_UNRATED  7
+
+// ratings are the products of hidden rank 4 user and item factors;
+// a quarter of them are observed
+static float truth(float users[][ALS_TEST_RANK], float items[][ALS_TEST_RANK], int u, int i) {
+  float rating = 0.0;
+  for(int a = 0; a < ALS_TEST_RANK; a++)
+    rating += users[u][a] * items[i][a];
+  return rating;
+}
+
+int test_als() {
+  starting_tests();
+  learner_error error;
+  static float users[ALS_TEST_USERS][ALS_TEST_RANK], items[ALS_TEST_ITEMS][ALS_TEST_RANK];
+  static char observed[ALS_TEST_USERS][ALS_TEST_ITEMS];
+  Matrix *ratings, *empty, *dense;
+  als_result *result, *single;
+  als_parameters parameters;
+  
+  // every 29th user has no ratings, and one item is never rated
+  sparse_vector_builder *builder;
+  SparseVector *vector;
+  srand(41);
+  for(int u = 0; u < ALS_TEST_USERS; u++)
+    for(int a = 0; a < ALS_TEST_RANK; a++)
+      users[u][a] = 0.5 + ((float) rand() / RAND_MAX);
+  for(int i = 0; i < ALS_TEST_ITEMS; i++)
+    for(int a = 0; a < ALS_TEST_RANK; a++)
+      items[i][a] = 0.5 + ((float) rand() / RAND_MAX);
+  matrix_new(&ratings);
+  sparse_vector_builder_new(&builder);
+  for(int u = 0; u < ALS_TEST_USERS; u++) {
+    if(u % 29 == 11) continue;
+    for(int i = 0; i < ALS_TEST_ITEMS; i++) {
+      observed[u][i] = (i != ALS_TEST_UNRATED) && (rand() % 4 == 0);
+      if(observed[u][i])
+        sparse_vector_builder_append(builder, i, truth(users, items, u, i));
+    }
+    sparse_vector_builder_finalize(builder, ratings, &vector);
+    matrix_set_row(ratings, u, vector);
+  }
+  
+  // the factors reproduce the ratings seen, and predict those unseen
+  parameters = (als_parameters) {ALS_TEST_RANK, 30, 1e-3, 0.0, 3, 4};
+  error = matrix_als(ratings, &parameters, &result);
+  test_error(error);
+  test(result->iterations == 30 && result->rmse < 0.05);
+  double squares = 0.0;
+  u_int64_t unseen = 0;
+  float rating;
+  for(int u = 0; u < ALS_TEST_USERS; u++) {
+    if(u % 29 == 11) continue;
+    for(int i = 0; i < ALS_TEST_ITEMS; i++) {
+      if(observed[u][i] || i == ALS_TEST_UNRATED) continue;
+      als_predict(result, u, i, &rating);
+      squares += (rating - truth(users, items, u, i)) * (rating - truth(users, items, u, i));
+      unseen++;
+    }
+  }
+  test(sqrt(squares / unseen) < 0.2);
+  
+  // factors are aligned dense rows; unrated users and items are 0
+  test(result->users->rows == ALS_TEST_USERS && result->items->rows == ALS_TEST_ITEMS);
+  test(result->users->columns == ALS_TEST_RANK && result->items->stride == vector_block_stride(ALS_TEST_RANK));
+  test(((uintptr_t) result->users->values % VECTOR_BLOCK_ALIGNMENT) == 0 && ((uintptr_t) result->items->values % VECTOR_BLOCK_ALIGNMENT) == 0);
+  int zero = 1;
+  for(int a = 0; a < ALS_TEST_RANK; a++)
+    zero &= (result->users->values[(11 * result->users->stride) + a] == 0.0) &&
+            (result->items->values[(ALS_TEST_UNRATED * result->items->stride) + a] == 0.0);
+  test(zero);
+  
+  // a user's factors score every item with the vector block kernels
+  Vector view;
+  float scores[ALS_TEST_ITEMS];
+  matrix_dense_row(result->users, 5, &view);
+  error = vector_similarity_batch(&view, result->items->values, ALS_TEST_ITEMS, DOT_PRODUCT, scores);
+  test_error(error);
+  int matches = 1;
+  for(int i = 0; i < ALS_TEST_ITEMS; i++) {
+    als_predict(result, 5, i, &rating);
+    matches &= fabs(scores[i] - rating) < 1e-4;
+  }
+  test(matches);
+  
+  // each user and item is solved alone, so threads don't change them
+  parameters.threads = 1;
+  error = matrix_als(ratings, &parameters, &single);
+  test_error(error);
+  test(memcmp(single->users->values, result->users->values, ALS_TEST_USERS * result->users->stride * sizeof(float)) == 0);
+  test(memcmp(single->items->values, result->items->values, ALS_TEST_ITEMS * result->items->stride * sizeof(float)) == 0);
+  als_result_free(single);
+  als_result_free(result);
+  
+  // iterations stop once the rmse stops improving
+  parameters = (als_parameters) {ALS_TEST_RANK, 100, 1e-3, 1e-3, 3, 2};
+  error = matrix_als(ratings, &parameters, &result);
+  test_error(error);
+  test(result->iterations < 100);
+  test(als_predict(result, ALS_TEST_USERS, 0, &rating) == INDEX_OUT_OF_RANGE);
+  als_result_free(result);
+  
+  // errors
+  parameters.lambda = 0.0;
+  test(matrix_als(ratings, &parameters, &result) == INVALID_PARAMETERS);
+  parameters.lambda = 1e-3;
+  parameters.factors = 0;
+  test(matrix_als(ratings, &parameters, &result) == INVALID_PARAMETERS);
+  parameters.factors = ALS_TEST_RANK;
+  matrix_new(&empty);
+  test(matrix_als(empty, &parameters, &result) == INVALID_PARAMETERS);
+  matrix_new_dense(10, 10, &dense);
+  test(matrix_als(dense, &parameters, &result) == INVALID_MATRIX_STORAGE);
+  
+  sparse_vector_builder_free(builder);
+  matrix_free(dense);
+  matrix_free(empty);
+  matrix_free(ratings);
+  finished_tests();
+}
@@ -0,0 +1,211 @@
+#include "tests.h"
+
+#define COLUMN_TEST_ROWS     3000
+#define COLUMN_TEST_COLUMNS  50000
+
+// every row sharing a column with the query is listed with its dot
+// product, and every row not listed has no column in common with it
+static int matches_brute_force(Matrix *matrix, SparseVector *query, column_accumulator *accumulator) {
+  SparseVector *row;
+  float dot;
+  int mismatches = 0, listed = 0;
+  for(u_int64_t r = 0; r < matrix->rows; r++) {
+    if(matrix_get_row(matrix, r, &row) != NO_ERROR) continue;
+    sparse_vector_dot_product(query, row, &dot);
+    if(accumulator->stamps[r] == accumulator->stamp) {
+      mismatches += (fabs(dot - accumulator->dots[r]) > VECTOR_KERNEL_TOLERANCE * 10);
+      listed++;
+    } else {
+      mismatches += (dot != 0.0);
+    }
+  }
+  return (mismatches == 0) && (listed == accumulator->count);
+}
+
+int test_column_index() {
+  starting_tests();
+  learner_error error;
+  Matrix *matrix;
+  SparseVector *row, *query;
+  sparse_vector_builder *builder;
+  column_accumulator *accumulator;
+  u_int64_t postings = 0;
+  
+  matrix_new(&matrix);
+  sparse_vector_builder_new(&builder);
+  column_accumulator_new(&accumulator);
+  srand(14);
+  
+  // the first half of the rows are indexed in bulk, the rest as
+  // they're set. a few rows are left unset.
+  for(u_int64_t r = 0; r < COLUMN_TEST_ROWS; r++) {
+    if(r == COLUMN_TEST_ROWS / 2) {
+      error = matrix_index_columns(matrix, 4);
+      test_error(error);
+    }
+    if(r % 89 == 3) continue;
+    error = matrix_set_row(matrix, r, random_row(matrix, builder, rand() % 40, COLUMN_TEST_COLUMNS, -0.5));
+    test_error(error);
+  }
+  
+  // rows replaced, set out of order, and set again after changing
+  for(u_int64_t r = 0; r < COLUMN_TEST_ROWS; r += 7)
+    matrix_set_row(matrix, r, random_row(matrix, builder, rand() % 40, COLUMN_TEST_COLUMNS, -0.5));
+  matrix_set_row(matrix, 3, random_row(matrix, builder, rand() % 40, COLUMN_TEST_COLUMNS, -0.5));
+  matrix_get_row(matrix, 10, &row);
+  sparse_vector_set(row, 12345, 0.75);
+  matrix_set_row(matrix, 10, row);
+  
+  // rows changed in place by the sparse vector functions are
+  // re-indexed without being set again
+  SparseVector *added;
+  sparse_vector_builder_append(builder, 12344, 0.25);
+  sparse_vector_builder_append(builder, 12348, -0.5);
+  sparse_vector_builder_finalize(builder, matrix, &added);
+  matrix_get_row(matrix, 20, &row);
+  sparse_vector_add(row, added);
+  sparse_vector_add(row, added);
+  matrix_get_row(matrix, 21, &row);
+  sparse_vector_set(row, 12346, 0.5);
+  sparse_vector_scale(row, 2.0);
+  matrix_get_row(matrix, 22, &row);
+  sparse_vector_set(row, 12347, 0.5);
+  sparse_vector_freeze_normalized(row);
+  sparse_vector_free(added);
+  
+  for(u_int64_t r = 0; r < COLUMN_TEST_ROWS; r++)
+    if(matrix_get_row(matrix, r, &row) == NO_ERROR)
+      postings += row->header.count;
+  test(matrix->column_index->postings == postings);
+  
+  // queries in every representation
+  int matched = 1;
+  for(int q = 0; q < 30; q++) {
+    for(int i = 0; i < 200; i++)
+      sparse_vector_builder_append(builder, rand() % COLUMN_TEST_COLUMNS, ((float) rand() / RAND_MAX) - 0.5);
+    sparse_vector_builder_append(builder, 12345, 1.0);
+    sparse_vector_builder_finalize(builder, matrix, &query);
+    if(q % 3 == 1) sparse_vector_to_soa(query);
+    if(q % 3 == 2) sparse_vector_quantize(query, QUANTIZE_FLOAT16, NULL);
+    error = matrix_column_dot_products(matrix, query, accumulator);
+    test_error(error);
+    matched &= matches_brute_force(matrix, query, accumulator);
+    matched &= (accumulator->stamps[10] == accumulator->stamp);
+    sparse_vector_free(query);
+  }
+  test(matched);
+  
+  // columns hold the values of every row in that column, in row order
+  column_postings *column;
+  SparseVector *vector, *other;
+  int transposed = 1;
+  float value, similarity, expected;
+  for(u_int64_t c = 12340; c < 12350; c++) {
+    if(matrix_get_column(matrix, c, &column) != NO_ERROR) continue;
+    for(u_int32_t p = 0; p < column->count; p++) {
+      matrix_get_row(matrix, column->postings[p].row, &row);
+      transposed &= (sparse_vector_get(row, c, &value) == NO_ERROR && value == column->postings[p].weight);
+      transposed &= (p == 0 || column->postings[p - 1].row < column->postings[p].row);
+    }
+  }
+  test(transposed);
+  test(matrix_get_column(matrix, COLUMN_TEST_COLUMNS * 2, &column) == INDEX_NOT_FOUND);
+  
+  // column similarities match those of the columns copied to vectors
+  error = matrix_get_column_vector(matrix, 12345, &vector);
+  test_error(error);
+  matrix_get_column(matrix, 12345, &column);
+  test(vector->header.count == column->count && vector->header.min_index == column->postings[0].row);
+  int similar = 1;
+  for(u_int64_t c = 100; c < 200; c++) {
+    if(matrix_get_column_vector(matrix, c, &other) != NO_ERROR) continue;
+    matrix_column_similarity(matrix, 12345, c, COSINE_SIMILARITY, &similarity);
+    sparse_vector_cosine_similarity(vector, other, &expected);
+    similar &= fabs(similarity - expected) < 1e-5;
+    matrix_column_similarity(matrix, 12345, c, EUCLIDEAN_DISTANCE, &similarity);
+    sparse_vector_euclidean_distance(vector, other, &expected);
+    similar &= fabs(similarity - expected) < 1e-4;
+    matrix_column_similarity(matrix, c, 12345, DOT_PRODUCT, &similarity);
+    sparse_vector_dot_product(vector, other, &expected);
+    similar &= fabs(similarity - expected) < 1e-5;
+    sparse_vector_free(other);
+  }
+  test(similar);
+  matrix_column_similarity(matrix, 12345, COLUMN_TEST_COLUMNS * 2, COSINE_SIMILARITY, &similarity);
+  test(similarity == 0.0);
+  sparse_vector_free(vector);
+  
+  // the index costs at least the size of its postings
+  u_int64_t bytes;
+  error = matrix_column_index_memory(matrix, &bytes);
+  test_error(error);
+  test(bytes >= matrix->column_index->postings * sizeof(column_posting) + COLUMN_TEST_COLUMNS * sizeof(column_postings));
+  
+  // indexes built on one thread or many are the same
+  Matrix *copy;
+  matrix_new(&copy);
+  for(u_int64_t r = 0; r < COLUMN_TEST_ROWS; r++) {
+    if(matrix_get_row(matrix, r, &row) != NO_ERROR) continue;
+    sparse_vector_sum(&row, 1, copy, &vector);
+    matrix_set_row(copy, r, vector);
+  }
+  error = matrix_index_columns(copy, 1);
+  test_error(error);
+  matrix_drop_column_index(matrix);
+  error = matrix_index_columns(matrix, 7);
+  test_error(error);
+  int same = (copy->column_index->postings == matrix->column_index->postings);
+  for(u_int64_t c = 0; c < COLUMN_TEST_COLUMNS && same; c++) {
+    column_postings *a = &matrix->column_index->columns[c], *b = &copy->column_index->columns[c];
+    same = (a->count == b->count);
+    for(u_int32_t p = 0; p < a->count && same; p++)
+      same = (a->postings[p].row == b->postings[p].row && a->postings[p].weight == b->postings[p].weight);
+  }
+  test(same);
+  matrix_free(copy);
+  
+  // compaction packs the posting lists without changing them
+  for(int i = 0; i < 200; i++)
+    sparse_vector_builder_append(builder, rand() % COLUMN_TEST_COLUMNS, 1.0);
+  sparse_vector_builder_finalize(builder, matrix, &query);
+  error = matrix_compact(matrix);
+  test_error(error);
+  error = matrix_column_dot_products(matrix, query, accumulator);
+  test_error(error);
+  test(matches_brute_force(matrix, query, accumulator));
+  
+  error = matrix_drop_column_index(matrix);
+  test_error(error);
+  test(matrix_column_dot_products(matrix, query, accumulator) == INVALID_MATRIX_STORAGE);
+  
+  // rows adopted by an indexed matrix are indexed
+  Matrix *adopted;
+  u_int64_t *offsets = (u_int64_t *) malloc(3 * sizeof(u_int64_t));
+  u_int32_t *indexes;
+  float *values;
+  matrix_csr_alloc(3, &indexes, &values);
+  offsets[0] = 0; offsets[1] = 2; offsets[2] = 3;
+  indexes[0] = 1; indexes[1] = 4; indexes[2] = 4;
+  values[0] = 1.0; values[1] = 2.0; values[2] = 3.0;
+  matrix_new(&adopted);
+  matrix_index_columns(adopted, 1);
+  error = matrix_csr_adopt(adopted, 2, offsets, indexes, values, 1);
+  test_error(error);
+  error = matrix_get_column(adopted, 4, &column);
+  test_error(error);
+  test(column->count == 2 && column->postings[1].row == 1 && column->postings[1].weight == 3.0);
+  matrix_free(adopted);
+  
+  // dense matrices can't be indexed
+  Matrix *dense;
+  matrix_new_dense(2, 2, &dense);
+  test(matrix_index_columns(dense, 1) == INVALID_MATRIX_STORAGE);
+  matrix_free(dense);
+  
+  sparse_vector_free(query);
+  column_accumulator_free(accumulator);
+  sparse_vector_builder_free(builder);
+  error = matrix_free(matrix);
+  test_error(error);
+  finished_tests();
+}
@@ -0,0 +1,99 @@
+#include "tests.h"
+#include <limits.h>
+#include "structures/dense_matrix.h"
+
+int test_dense_matrix() {
+  starting_tests();
+  learner_error error;
+  Matrix *a, *b, *c;
+  Vector row, *x, *y, *z;
+  float value;
+  
+  // creating
+  error = matrix_new_dense(3, 2, &a);
+  test_error(error);
+  test(((size_t) a->values % VECTOR_BLOCK_ALIGNMENT) == 0);
+  error = matrix_new_dense(2, 4, &b);
+  test_error(error);
+  
+  // rows are views in to the matrix
+  for(int r = 0; r < 3; r++) {
+    error = matrix_dense_row(a, r, &row);
+    test_error(error);
+    vector_set(&row, 0, r + 1);
+    vector_set(&row, 1, r + 2);
+  }
+  test(a->values[a->stride + 1] == 3.0);
+  test(vector_free(&row) == VECTOR_IS_VIEW);
+  error = matrix_dense_row(a, 3, &row);
+  test(error == INDEX_OUT_OF_RANGE);
+  
+  for(int r = 0; r < 2; r++)
+    for(int col = 0; col < 4; col++)
+      b->values[(r * b->stride) + col] = (r * 4) + col;
+  
+  // matrix vector product
+  error = vector_new(2, &x);
+  test_error(error);
+  vector_set(x, 0, 1.0);
+  vector_set(x, 1, -1.0);
+  error = matrix_vector_product(a, x, &y);
+  test_error(error);
+  test(y->header.length == 3);
+  vector_get(y, 2, &value);
+  test_float(value, -1.0);
+  
+  // products longer than a vector can hold are refused before the
+  // values are read
+  a->rows = (u_int64_t) INT_MAX + 1;
+  test(matrix_vector_product(a, x, &z) == INVALID_PARAMETERS);
+  a->rows = 3;
+  
+  // matrix product; row 1 of a is (2, 3), column 2 of b is (2, 6)
+  error = matrix_matrix_product(a, b, &c);
+  test_error(error);
+  test(c->rows == 3 && c->columns == 4);
+  error = matrix_dense_row(c, 1, &row);
+  test_error(error);
+  vector_get(&row, 2, &value);
+  test_float(value, 22.0);
+  test(matrix_matrix_product(a, a, &c) == INCOMPATIBLE_DIMENSIONS);
+  
+  error = matrix_free(c);
+  test_error(error);
+  error = matrix_free(a);
+  test_error(error);
+  error = matrix_free(b);
+  test_error(error);
+  
+  // a product large enough to span several tiles in each dimension
+  int n = 70, k = 300, m = 600, mismatches = 0;
+  matrix_new_dense(n, k, &a);
+  matrix_new_dense(k, m, &b);
+  srand(2);
+  for(int r = 0; r < n; r++)
+    for(int col = 0; col < k; col++)
+      a->values[(r * a->stride) + col] = ((float) rand() / RAND_MAX) - 0.5;
+  for(int r = 0; r < k; r++)
+    for(int col = 0; col < m; col++)
+      b->values[(r * b->stride) + col] = ((float) rand() / RAND_MAX) - 0.5;
+  
+  error = matrix_matrix_product(a, b, &c);
+  test_error(error);
+  for(int r = 0; r < n; r += 7) {
+    for(int col = 0; col < m; col += 13) {
+      float expected = 0.0;
+      for(int i = 0; i < k; i++)
+        expected += a->values[(r * a->stride) + i] * b->values[(i * b->stride) + col];
+      mismatches += (fabs(c->values[(r * c->stride) + col] - expected) > VECTOR_KERNEL_TOLERANCE * k);
+    }
+  }
+  test(mismatches == 0);
+  
+  matrix_free(a);
+  matrix_free(b);
+  matrix_free(c);
+  vector_free(x);
+  vector_free(y);
+  finished_tests();
+}
@@ -0,0 +1,126 @@
+#include <unistd.h>
+#include "tests.h"
+
+#define DICTIONARY_TEST_NAMES     20000
+#define DICTIONARY_TEST_THREADS   8
+#define DICTIONARY_TEST_PATH      "test_dictionary.db"
+
+// every thread creates every name, starting at a different point, so
+// most creates race with another thread creating the same name
+typedef struct {
+  dictionary  *names;
+  u_int32_t   *indexes;
+  int         failed;
+} create_context;
+
+static void create_names(void *param, u_int64_t start, u_int64_t end, u_int32_t thread) {
+  create_context *context = (create_context *) param;
+  (void) thread;
+  char name[32];
+  u_int32_t index, found;
+  for(u_int64_t t = start; t < end; t++) {
+    for(u_int32_t i = 0; i < DICTIONARY_TEST_NAMES; i++) {
+      u_int32_t n = (i + (t * DICTIONARY_TEST_NAMES / DICTIONARY_TEST_THREADS)) % DICTIONARY_TEST_NAMES;
+      int length = sprintf(name, "name %u", n);
+      if(dictionary_find_or_create(context->names, name, length, &index) ||
+         dictionary_find(context->names, name, length, &found) || found != index) {
+        context->failed = 1;
+        continue;
+      }
+      if(t == 0) context->indexes[n] = index;
+    }
+  }
+}
+
+int test_dictionary() {
+  starting_tests();
+  learner_error error;
+  dictionary *names;
+  u_int32_t index, length;
+  char *name;
+  
+  // names map to indexes in the order they're created, and back
+  error = dictionary_new(NULL, &names);
+  test_error(error);
+  test(dictionary_find_or_create(names, "alpha", 5, &index) == NO_ERROR && index == 0);
+  test(dictionary_find_or_create(names, "beta", 4, &index) == NO_ERROR && index == 1);
+  test(dictionary_find_or_create(names, "alpha", 5, &index) == NO_ERROR && index == 0);
+  test(dictionary_find(names, "beta", 4, &index) == NO_ERROR && index == 1);
+  test(dictionary_find(names, "gamma", 5, &index) == UNKNOWN_KEY);
+  test(dictionary_name(names, 1, &name, &length) == NO_ERROR && length == 4 && strcmp(name, "beta") == 0);
+  test(dictionary_name(names, 2, &name, &length) == INDEX_OUT_OF_RANGE);
+  
+  // names are bytes, so may hold zeros or be empty
+  test(dictionary_find_or_create(names, "a\0b", 3, &index) == NO_ERROR && index == 2);
+  test(dictionary_find_or_create(names, "a\0c", 3, &index) == NO_ERROR && index == 3);
+  test(dictionary_find_or_create(names, "", 0, &index) == NO_ERROR && index == 4);
+  test(dictionary_find(names, "a", 1, &index) == UNKNOWN_KEY);
+  dictionary_free(names);
+  
+  // threads creating the same names at once agree on one index per
+  // name, with no index skipped, as the table doubles several times
+  u_int32_t *indexes = (u_int32_t *) malloc(DICTIONARY_TEST_NAMES * sizeof(u_int32_t));
+  unlink(DICTIONARY_TEST_PATH);
+  error = dictionary_new(DICTIONARY_TEST_PATH, &names);
+  test_error(error);
+  create_context context = {names, indexes, 0};
+  error = learner_parallel_for(DICTIONARY_TEST_THREADS, DICTIONARY_TEST_THREADS, 1, create_names, &context);
+  test_error(error);
+  test(!context.failed && names->count == DICTIONARY_TEST_NAMES && names->table->capacity > DICTIONARY_MIN_CAPACITY);
+  int matched = 1;
+  char expected[32];
+  for(u_int32_t n = 0; n < DICTIONARY_TEST_NAMES; n++) {
+    sprintf(expected, "name %u", n);
+    matched &= (dictionary_name(names, indexes[n], &name, &length) == NO_ERROR && strcmp(name, expected) == 0);
+  }
+  test(matched);
+  
+  // names are read back from the log with the same indexes
+  test(dictionary_free(names) == NO_ERROR);
+  error = dictionary_new(DICTIONARY_TEST_PATH, &names);
+  test_error(error);
+  test(names->count == DICTIONARY_TEST_NAMES);
+  matched = 1;
+  for(u_int32_t n = 0; n < DICTIONARY_TEST_NAMES; n++) {
+    sprintf(expected, "name %u", n);
+    matched &= (dictionary_find(names, expected, strlen(expected), &index) == NO_ERROR && index == indexes[n]);
+  }
+  test(matched);
+  test(dictionary_find_or_create(names, "last", 4, &index) == NO_ERROR && index == DICTIONARY_TEST_NAMES);
+  test(dictionary_flush(names) == NO_ERROR);
+  dictionary_free(names);
+  
+  // a partly written record is dropped, and later records follow the
+  // last complete one
+  FILE *log = fopen(DICTIONARY_TEST_PATH, "ab");
+  fwrite("\x01\x02\x03\x04\x05\x06", 1, 6, log);
+  fclose(log);
+  error = dictionary_new(DICTIONARY_TEST_PATH, &names);
+  test_error(error);
+  test(dictionary_find(names, "last", 4, &index) == NO_ERROR && index == DICTIONARY_TEST_NAMES);
+  test(dictionary_find_or_create(names, "later", 5, &index) == NO_ERROR && index == DICTIONARY_TEST_NAMES + 1);
+  dictionary_free(names);
+  error = dictionary_new(DICTIONARY_TEST_PATH, &names);
+  test_error(error);
+  test(dictionary_find(names, "later", 5, &index) == NO_ERROR && index == DICTIONARY_TEST_NAMES + 1);
+  dictionary_free(names);
+  
+  // records with an index no create gives out are damaged. the last
+  // record is "later": an index and length, a hash, then the name.
+  u_int32_t last = (u_int32_t) -1;
+  log = fopen(DICTIONARY_TEST_PATH, "r+b");
+  fseek(log, -(2 * sizeof(u_int32_t) + sizeof(u_int64_t) + 5), SEEK_END);
+  fwrite(&last, sizeof(u_int32_t), 1, log);
+  fclose(log);
+  test(dictionary_new(DICTIONARY_TEST_PATH, &names) == PARSE_ERROR);
+  
+  // logs of another format aren't read
+  log = fopen(DICTIONARY_TEST_PATH, "r+b");
+  fwrite("xxxx", 1, 4, log);
+  fclose(log);
+  test(dictionary_new(DICTIONARY_TEST_PATH, &names) == PARSE_ERROR);
+  
+  unlink(DICTIONARY_TEST_PATH);
+  free(indexes);
+  finished_tests();
+}
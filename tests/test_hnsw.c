@@ -0,0 +1,189 @@
+#include <unistd.h>
+#include "tests.h"
+
+#define HNSW_TEST_ROWS        3000
+#define HNSW_TEST_DIMENSIONS  24
+#define HNSW_TEST_QUERIES     50
+#define HNSW_TEST_K           10
+
+static void random_values(Vector *vector) {
+  for(u_int32_t i = 0; i < vector->header.length; i++)
+    vector->values[i] = ((float) rand() / RAND_MAX) - 0.5;
+}
+
+// the fraction of the exact k nearest rows (from knn_search) found
+static float recall(hnsw_index *index, column_accumulator *accumulator, Matrix *matrix, learner_metric metric, Vector **queries) {
+  knn_result exact[HNSW_TEST_K], approximate[HNSW_TEST_K];
+  u_int32_t exact_found, found, hits = 0, relevant = 0;
+  for(int q = 0; q < HNSW_TEST_QUERIES; q++) {
+    knn_search(matrix, queries[q], HNSW_TEST_K, metric, exact, &exact_found);
+    hnsw_search(index, accumulator, queries[q], HNSW_TEST_K, 64, approximate, &found);
+    for(u_int32_t i = 0; i < exact_found; i++)
+      for(u_int32_t j = 0; j < found; j++)
+        hits += (exact[i].row == approximate[j].row);
+    relevant += exact_found;
+  }
+  return (float) hits / relevant;
+}
+
+static int test_metric(learner_metric metric, Matrix *matrix, Vector **queries, column_accumulator *accumulator) {
+  starting_tests();
+  printf("%s\n", learner_metric_names[metric]);
+  hnsw_parameters parameters = {12, 100, metric, 16};
+  knn_result results[HNSW_TEST_K], reloaded[HNSW_TEST_K];
+  u_int32_t found, reloaded_found;
+  u_int64_t first;
+  learner_error error;
+  hnsw_index *index, *loaded;
+  
+  // rows are inserted by several threads at once
+  error = hnsw_new(HNSW_TEST_DIMENSIONS, HNSW_TEST_ROWS, &parameters, &index);
+  test_error(error);
+  error = hnsw_insert_matrix(index, matrix, 4, &first);
+  test_error(error);
+  test(first == 0 && index->count == HNSW_TEST_ROWS);
+  test(recall(index, accumulator, matrix, metric, queries) > 0.9);
+  
+  // results are best first, and scored as knn_search scores them
+  Vector row;
+  float score;
+  int ordered = 1, scored = 1;
+  error = hnsw_search(index, accumulator, queries[0], HNSW_TEST_K, 64, results, &found);
+  test_error(error);
+  test(found == HNSW_TEST_K);
+  for(u_int32_t i = 0; i < found; i++) {
+    if(i > 0) ordered &= (metric == EUCLIDEAN_DISTANCE) ? (results[i].score >= results[i - 1].score) : (results[i].score <= results[i - 1].score);
+    matrix_dense_row(matrix, results[i].row, &row);
+    if(metric == EUCLIDEAN_DISTANCE)
+      vector_euclidean_distance(queries[0], &row, &score);
+    else if(metric == COSINE_SIMILARITY)
+      vector_cosine_similarity(queries[0], &row, &score);
+    else
+      vector_dot_product(queries[0], &row, &score);
+    scored &= fabs(score - results[i].score) < 1e-4;
+  }
+  test(ordered && scored);
+  
+  // an index saved and loaded finds the same results
+  error = hnsw_save(index, "test_hnsw.db");
+  test_error(error);
+  error = hnsw_load("test_hnsw.db", &loaded);
+  test_error(error);
+  test(loaded->count == HNSW_TEST_ROWS && loaded->file != NULL);
+  error = hnsw_search(loaded, accumulator, queries[0], HNSW_TEST_K, 64, reloaded, &reloaded_found);
+  test_error(error);
+  int same = (reloaded_found == found);
+  for(u_int32_t i = 0; i < found && same; i++)
+    same = (results[i].row == reloaded[i].row && results[i].score == reloaded[i].score);
+  test(same);
+  
+  // loaded indexes are full, as is the original
+  u_int64_t id;
+  test(hnsw_insert(loaded, accumulator, queries[0], &id) == INDEX_OUT_OF_RANGE);
+  test(hnsw_insert(index, accumulator, queries[0], &id) == INDEX_OUT_OF_RANGE);
+  
+  hnsw_free(loaded);
+  hnsw_free(index);
+  remove("test_hnsw.db");
+  finished_tests();
+}
+
+// rewrites the header of a saved index, keeping its sections
+static void damage_header(char *path, hnsw_file_header *damaged) {
+  paged_file *file;
+  paged_file_open(path, 0, &file);
+  paged_file_write(file, paged_file_get_attribute(file, HNSW_ATTRIBUTE_HEADER), damaged, sizeof(hnsw_file_header));
+  paged_file_close(file);
+}
+
+int test_hnsw() {
+  starting_tests();
+  learner_error error;
+  Matrix *matrix;
+  Vector row, *queries[HNSW_TEST_QUERIES];
+  column_accumulator *accumulator;
+  hnsw_index *index;
+  
+  srand(16);
+  matrix_new_dense(HNSW_TEST_ROWS, HNSW_TEST_DIMENSIONS, &matrix);
+  for(u_int64_t r = 0; r < HNSW_TEST_ROWS; r++) {
+    matrix_dense_row(matrix, r, &row);
+    random_values(&row);
+  }
+  for(int q = 0; q < HNSW_TEST_QUERIES; q++) {
+    vector_new(HNSW_TEST_DIMENSIONS, &queries[q]);
+    random_values(queries[q]);
+  }
+  column_accumulator_new(&accumulator);
+  
+  failed += test_metric(EUCLIDEAN_DISTANCE, matrix, queries, accumulator);
+  failed += test_metric(COSINE_SIMILARITY, matrix, queries, accumulator);
+  failed += test_metric(DOT_PRODUCT, matrix, queries, accumulator);
+  
+  // single inserts are given ids in order, and a vector searched for
+  // straight after being inserted is its own nearest neighbour
+  hnsw_parameters parameters = {0, 0, EUCLIDEAN_DISTANCE, 1};
+  knn_result results[1];
+  u_int32_t found;
+  u_int64_t id;
+  int nearest = 1;
+  error = hnsw_new(HNSW_TEST_DIMENSIONS, 100, &parameters, &index);
+  test_error(error);
+  test(index->parameters.m == HNSW_DEFAULT_M);
+  error = hnsw_search(index, accumulator, queries[0], 1, 10, results, &found);
+  test_error(error);
+  test(found == 0);
+  for(u_int64_t r = 0; r < 100; r++) {
+    matrix_dense_row(matrix, r, &row);
+    error = hnsw_insert(index, accumulator, &row, &id);
+    nearest &= (error == NO_ERROR && id == r);
+    hnsw_search(index, accumulator, &row, 1, 10, results, &found);
+    nearest &= (found == 1 && results[0].row == r);
+  }
+  test(nearest);
+  
+  // loading checks sections and links against the file, rejecting
+  // headers pointing past its end
+  hnsw_index *loaded;
+  hnsw_file_header *header, damaged;
+  paged_file *file;
+  hnsw_save(index, "test_hnsw.db");
+  paged_file_open("test_hnsw.db", 0, &file);
+  paged_file_read(file, paged_file_get_attribute(file, HNSW_ATTRIBUTE_HEADER), (void **) &header, sizeof(hnsw_file_header));
+  paged_file_close(file);
+  damaged = *header;
+  damaged.vectors = 1000000;
+  damage_header("test_hnsw.db", &damaged);
+  test(hnsw_load("test_hnsw.db", &loaded) == PARSE_ERROR);
+  damaged = *header;
+  damaged.count = 1000000;
+  damage_header("test_hnsw.db", &damaged);
+  test(hnsw_load("test_hnsw.db", &loaded) == PARSE_ERROR);
+  damaged = *header;
+  damaged.entry = 100;
+  damage_header("test_hnsw.db", &damaged);
+  test(hnsw_load("test_hnsw.db", &loaded) == PARSE_ERROR);
+  damage_header("test_hnsw.db", header);
+  error = hnsw_load("test_hnsw.db", &loaded);
+  test_error(error);
+  test(loaded->count == 100);
+  hnsw_free(loaded);
+  free(header);
+  remove("test_hnsw.db");
+  
+  // mismatched dimensions and invalid parameters are rejected
+  Vector *wrong;
+  vector_new(HNSW_TEST_DIMENSIONS + 1, &wrong);
+  test(hnsw_search(index, accumulator, wrong, 1, 10, results, &found) == VECTORS_NOT_OF_EQUAL_LENGTH);
+  vector_free(wrong);
+  hnsw_free(index);
+  parameters.m = 1;
+  test(hnsw_new(HNSW_TEST_DIMENSIONS, 100, &parameters, &index) == INVALID_PARAMETERS);
+  test(hnsw_load("test_hnsw_missing.db", &index) == FILE_NOT_FOUND);
+  
+  for(int q = 0; q < HNSW_TEST_QUERIES; q++)
+    vector_free(queries[q]);
+  column_accumulator_free(accumulator);
+  matrix_free(matrix);
+  finished_tests();
+}
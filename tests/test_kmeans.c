@@ -0,0 +1,150 @@
+#include "tests.h"
+
+#define KMEANS_TEST_ROWS        3000
+#define KMEANS_TEST_CLUSTERS    6
+#define KMEANS_TEST_DIMENSIONS  20
+#define KMEANS_TEST_COLUMNS     50
+
+// rows are scattered tightly around well separated points, so every
+// clustering should recover the points' clusters
+static float noise() {
+  return (((float) rand() / RAND_MAX) - 0.5) * 0.4;
+}
+
+// each cluster is assigned to a single centre, and each centre to a
+// single cluster
+static int recovered(kmeans_result *result, u_int32_t *clusters, u_int64_t rows, u_int32_t k) {
+  u_int32_t centre_of[KMEANS_TEST_CLUSTERS], cluster_of[KMEANS_TEST_CLUSTERS];
+  for(u_int32_t c = 0; c < k; c++)
+    centre_of[c] = cluster_of[c] = KMEANS_UNASSIGNED;
+  for(u_int64_t r = 0; r < rows; r++) {
+    u_int32_t cluster = clusters[r], centre = result->assignments[r];
+    if(cluster == KMEANS_UNASSIGNED) {
+      if(centre != KMEANS_UNASSIGNED) return 0;
+      continue;
+    }
+    if(centre >= k) return 0;
+    if(centre_of[cluster] == KMEANS_UNASSIGNED) centre_of[cluster] = centre;
+    if(cluster_of[centre] == KMEANS_UNASSIGNED) cluster_of[centre] = cluster;
+    if(centre_of[cluster] != centre || cluster_of[centre] != cluster) return 0;
+  }
+  return 1;
+}
+
+// every row is assigned to its nearest centre, and the inertia is the
+// sum of squared distances
+static int nearest_centres(Matrix *matrix, kmeans_result *result) {
+  u_int32_t stride = result->centres->stride;
+  double inertia = 0.0;
+  for(u_int64_t r = 0; r < matrix->rows; r++) {
+    float *row = matrix->values + (r * matrix->stride), best = INFINITY;
+    u_int32_t nearest = 0;
+    for(u_int32_t c = 0; c < result->centres->rows; c++) {
+      float distance = 0.0, *centre = result->centres->values + (c * stride);
+      for(u_int32_t i = 0; i < matrix->columns; i++)
+        distance += (row[i] - centre[i]) * (row[i] - centre[i]);
+      if(distance < best) {
+        best = distance;
+        nearest = c;
+      }
+    }
+    inertia += best;
+    if(nearest != result->assignments[r]) return 0;
+  }
+  return fabs(inertia - result->inertia) < 1e-3 * inertia;
+}
+
+int test_kmeans() {
+  starting_tests();
+  learner_error error;
+  kmeans_result *result;
+  Matrix *dense, *sparse;
+  Vector row;
+  float points[KMEANS_TEST_CLUSTERS][KMEANS_TEST_DIMENSIONS];
+  u_int32_t clusters[KMEANS_TEST_ROWS];
+  
+  srand(23);
+  for(int c = 0; c < KMEANS_TEST_CLUSTERS; c++)
+    for(int i = 0; i < KMEANS_TEST_DIMENSIONS; i++)
+      points[c][i] = (float) (rand() % 20) - 10.0;
+  matrix_new_dense(KMEANS_TEST_ROWS, KMEANS_TEST_DIMENSIONS, &dense);
+  for(u_int64_t r = 0; r < KMEANS_TEST_ROWS; r++) {
+    clusters[r] = rand() % KMEANS_TEST_CLUSTERS;
+    matrix_dense_row(dense, r, &row);
+    for(int i = 0; i < KMEANS_TEST_DIMENSIONS; i++)
+      row.values[i] = points[clusters[r]][i] + noise();
+  }
+  
+  // full k-means (0 for the default iterations) recovers the clusters,
+  // with rows at their nearest centre. once clusters settle the
+  // bounds skip most distances.
+  kmeans_parameters parameters = {KMEANS_TEST_CLUSTERS, EUCLIDEAN_DISTANCE, 0, 0.0, 0, 1, 4};
+  error = matrix_kmeans(dense, &parameters, &result);
+  test_error(error);
+  test(recovered(result, clusters, KMEANS_TEST_ROWS, KMEANS_TEST_CLUSTERS));
+  test(nearest_centres(dense, result));
+  test(result->iterations > 0 && result->pruned > result->distances / 2);
+  test(result->distances + result->pruned == (u_int64_t) KMEANS_TEST_ROWS * KMEANS_TEST_CLUSTERS * (result->iterations + 1));
+  u_int64_t total = 0;
+  for(int c = 0; c < KMEANS_TEST_CLUSTERS; c++)
+    total += result->sizes[c];
+  test(total == KMEANS_TEST_ROWS);
+  double inertia = result->inertia;
+  kmeans_result_free(result);
+  
+  // mini-batches converge close to the full solution
+  parameters.batch = 200;
+  parameters.iterations = 40;
+  parameters.threads = 3;
+  error = matrix_kmeans(dense, &parameters, &result);
+  test_error(error);
+  test(recovered(result, clusters, KMEANS_TEST_ROWS, KMEANS_TEST_CLUSTERS));
+  test(nearest_centres(dense, result));
+  test(result->iterations == 40 && result->inertia < inertia * 1.1);
+  kmeans_result_free(result);
+  
+  // sparse rows cluster by angle: each cluster has its own columns,
+  // scaled arbitrarily. half the rows are frozen; some aren't set.
+  sparse_vector_builder *builder;
+  SparseVector *vector;
+  matrix_new(&sparse);
+  sparse_vector_builder_new(&builder);
+  for(u_int64_t r = 0; r < KMEANS_TEST_ROWS; r++) {
+    if(r % 17 == 3) {
+      clusters[r] = KMEANS_UNASSIGNED;
+      continue;
+    }
+    float scale = 1.0 + (rand() % 10);
+    for(int i = 0; i < KMEANS_TEST_COLUMNS; i++)
+      if(rand() % 4)
+        sparse_vector_builder_append(builder, (clusters[r] * KMEANS_TEST_COLUMNS) + i, scale * (1.0 + noise()));
+    sparse_vector_builder_append(builder, (clusters[r] * KMEANS_TEST_COLUMNS) + KMEANS_TEST_COLUMNS - 1, scale);
+    sparse_vector_builder_finalize(builder, sparse, &vector);
+    if(r % 2) sparse_vector_freeze(vector);
+    matrix_set_row(sparse, r, vector);
+  }
+  
+  parameters = (kmeans_parameters) {KMEANS_TEST_CLUSTERS, COSINE_SIMILARITY, 0, 0.0, 0, 7, 4};
+  error = matrix_kmeans(sparse, &parameters, &result);
+  test_error(error);
+  test(recovered(result, clusters, KMEANS_TEST_ROWS, KMEANS_TEST_CLUSTERS));
+  test(result->centres->columns == KMEANS_TEST_CLUSTERS * KMEANS_TEST_COLUMNS);
+  int normalized = 1;
+  for(int c = 0; c < KMEANS_TEST_CLUSTERS; c++)
+    normalized &= fabs(vector_kernels.sum_of_squares(result->centres->values + (c * result->centres->stride), result->centres->stride) - 1.0) < 1e-4;
+  test(normalized && result->inertia > 0.0 && result->inertia < KMEANS_TEST_ROWS * 0.5);
+  kmeans_result_free(result);
+  
+  // the dot product isn't a distance, and there must be k rows
+  parameters.metric = DOT_PRODUCT;
+  test(matrix_kmeans(sparse, &parameters, &result) == INVALID_PARAMETERS);
+  parameters = (kmeans_parameters) {KMEANS_TEST_ROWS, EUCLIDEAN_DISTANCE, 10, 0.0, 0, 7, 2};
+  test(matrix_kmeans(sparse, &parameters, &result) == INVALID_PARAMETERS);
+  parameters.k = 0;
+  test(matrix_kmeans(dense, &parameters, &result) == INVALID_PARAMETERS);
+  
+  sparse_vector_builder_free(builder);
+  matrix_free(sparse);
+  matrix_free(dense);
+  finished_tests();
+}
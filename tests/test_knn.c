@@ -0,0 +1,174 @@
+#include "tests.h"
+#include "algorithms/knn.h"
+
+#define KNN_TEST_K  10
+
+// brute force reference: the row with the best score not already in
+// found, using the same ordering as knn_search
+static u_int64_t best_remaining(float *scores, u_int64_t rows, learner_metric metric, knn_result *found, int count) {
+  u_int64_t best = -1;
+  for(u_int64_t row = 0; row < rows; row++) {
+    int used = 0;
+    for(int i = 0; i < count; i++)
+      used |= (found[i].row == row);
+    if(used || isnan(scores[row])) continue;
+    if(best == (u_int64_t) -1 || (metric == EUCLIDEAN_DISTANCE ? scores[row] < scores[best] : scores[row] > scores[best]))
+      best = row;
+  }
+  return best;
+}
+
+// results match the reference when each result is the best of the
+// rows not yet returned, allowing for rounding between near ties
+static int matches_reference(float *scores, u_int64_t rows, learner_metric metric, knn_result *results, u_int32_t found) {
+  for(u_int32_t i = 0; i < found; i++) {
+    u_int64_t best = best_remaining(scores, rows, metric, results, i);
+    if(fabs(scores[best] - results[i].score) > VECTOR_KERNEL_TOLERANCE * 100 * (1 + fabs(scores[best])))
+      return 0;
+  }
+  return 1;
+}
+
+int test_knn() {
+  starting_tests();
+  learner_error error;
+  knn_result results[KNN_TEST_K];
+  u_int32_t found;
+  
+  // dense rows; large enough to be split across threads
+  u_int64_t rows = 8000;
+  u_int32_t columns = 40;
+  Matrix *dense;
+  Vector row, *query;
+  float *scores = (float *) malloc(rows * sizeof(float));
+  
+  error = matrix_new_dense(rows, columns, &dense);
+  test_error(error);
+  vector_new(columns, &query);
+  srand(6);
+  for(u_int64_t r = 0; r < rows; r++) {
+    float scale = ((float) rand() / RAND_MAX) * 4;
+    for(u_int32_t c = 0; c < columns; c++)
+      dense->values[(r * dense->stride) + c] = (((float) rand() / RAND_MAX) - 0.4) * scale;
+  }
+  for(u_int32_t c = 0; c < columns; c++)
+    vector_set(query, c, ((float) rand() / RAND_MAX) - 0.4);
+  
+  for(int frozen = 0; frozen < 2; frozen++) {
+    if(frozen) {
+      error = matrix_dense_freeze(dense);
+      test_error(error);
+    }
+    for(learner_metric metric = DOT_PRODUCT; metric <= EUCLIDEAN_DISTANCE; metric++) {
+      for(u_int64_t r = 0; r < rows; r++) {
+        matrix_dense_row(dense, r, &row);
+        if(metric == DOT_PRODUCT) vector_dot_product(query, &row, &scores[r]);
+        else if(metric == COSINE_SIMILARITY) vector_cosine_similarity(query, &row, &scores[r]);
+        else vector_euclidean_distance(query, &row, &scores[r]);
+      }
+      error = knn_search(dense, query, KNN_TEST_K, metric, results, &found);
+      test_error(error);
+      test(found == KNN_TEST_K);
+      test(matches_reference(scores, rows, metric, results, found));
+    }
+  }
+  
+  // a k larger than the first chunk of candidates ordered makes
+  // pruned searches order more, and still match a full scan
+  u_int32_t many = 2000, pruned_found, scanned_found;
+  knn_result *pruned = (knn_result *) malloc(many * sizeof(knn_result));
+  knn_result *scanned = (knn_result *) malloc(many * sizeof(knn_result));
+  for(learner_metric metric = DOT_PRODUCT; metric <= EUCLIDEAN_DISTANCE; metric += 2) {
+    matrix_dense_freeze(dense);
+    error = knn_search(dense, query, many, metric, pruned, &pruned_found);
+    test_error(error);
+    matrix_dense_unfreeze(dense);
+    error = knn_search(dense, query, many, metric, scanned, &scanned_found);
+    test_error(error);
+    int same = (pruned_found == many && scanned_found == many);
+    for(u_int32_t i = 0; same && i < many; i++)
+      same &= fabs(pruned[i].score - scanned[i].score) <= VECTOR_KERNEL_TOLERANCE * 100 * (1 + fabs(scanned[i].score));
+    test(same);
+  }
+  matrix_dense_freeze(dense);
+  free(pruned);
+  free(scanned);
+  
+  // asking for more rows than the matrix has
+  Matrix *small;
+  knn_result all[8];
+  matrix_new_dense(3, columns, &small);
+  error = knn_search(small, query, 8, EUCLIDEAN_DISTANCE, all, &found);
+  test_error(error);
+  test(found == 3);
+  test(all[0].score <= all[1].score && all[1].score <= all[2].score);
+  error = knn_search(small, query, 0, DOT_PRODUCT, all, &found);
+  test(error == NO_ERROR && found == 0);
+  matrix_free(small);
+  
+  // sparse rows
+  Matrix *sparse;
+  SparseVector *sparse_row, *sparse_query;
+  rows = 3000;
+  matrix_new(&sparse);
+  sparse_vector_new(&sparse_query, sparse);
+  for(int i = 0; i < 120; i++)
+    sparse_vector_set(sparse_query, rand() % 2000, ((float) rand() / RAND_MAX) - 0.3);
+  
+  error = knn_search(sparse, query, 1, DOT_PRODUCT, results, &found);
+  test(error == INVALID_MATRIX_STORAGE);
+  test(knn_search_sparse(dense, sparse_query, 1, DOT_PRODUCT, results, &found) == INVALID_MATRIX_STORAGE);
+  
+  for(u_int64_t r = 0; r < rows; r++) {
+    // leave a few rows unset
+    if(r % 97 == 5) continue;
+    sparse_vector_new(&sparse_row, sparse);
+    int count = rand() % 200;
+    for(int i = 0; i < count; i++)
+      sparse_vector_set(sparse_row, rand() % 2000, ((float) rand() / RAND_MAX) - 0.3);
+    error = matrix_set_row(sparse, r, sparse_row);
+    test_error(error);
+  }
+  test(sparse->rows == rows);
+  test(matrix_get_row(sparse, 5, &sparse_row) == INDEX_NOT_FOUND);
+  error = matrix_get_row(sparse, 7, &sparse_row);
+  test_error(error);
+  test(sparse_row->header.matrix_index == 7);
+  
+  for(int frozen = 0; frozen < 2; frozen++) {
+    if(frozen) {
+      for(u_int64_t r = 0; r < rows; r++)
+        if(matrix_get_row(sparse, r, &sparse_row) == NO_ERROR)
+          sparse_vector_freeze(sparse_row);
+      sparse_vector_freeze(sparse_query);
+    }
+    for(learner_metric metric = DOT_PRODUCT; metric <= EUCLIDEAN_DISTANCE; metric++) {
+      for(u_int64_t r = 0; r < rows; r++) {
+        scores[r] = NAN;
+        if(matrix_get_row(sparse, r, &sparse_row) != NO_ERROR) continue;
+        if(metric == DOT_PRODUCT) sparse_vector_dot_product(sparse_query, sparse_row, &scores[r]);
+        else if(metric == COSINE_SIMILARITY) sparse_vector_cosine_similarity(sparse_query, sparse_row, &scores[r]);
+        else sparse_vector_euclidean_distance(sparse_query, sparse_row, &scores[r]);
+      }
+      error = knn_search_sparse(sparse, sparse_query, KNN_TEST_K, metric, results, &found);
+      test_error(error);
+      test(found == KNN_TEST_K);
+      test(matches_reference(scores, rows, metric, results, found));
+    }
+  }
+  
+  // the row's own vector is its nearest neighbour
+  matrix_get_row(sparse, 42, &sparse_row);
+  error = knn_search_sparse(sparse, sparse_row, 1, EUCLIDEAN_DISTANCE, results, &found);
+  test_error(error);
+  test(found == 1 && results[0].row == 42);
+  
+  free(scores);
+  vector_free(query);
+  sparse_vector_free(sparse_query);
+  error = matrix_free(sparse);
+  test_error(error);
+  error = matrix_free(dense);
+  test_error(error);
+  finished_tests();
+}
@@ -6,6 +6,19 @@ int main(void) {
   run_test(test_vector);
   run_test(test_sparse_vector);
   run_test(test_paged_file);
+  run_test(test_dense_matrix);
+  run_test(test_knn);
+  run_test(test_column_index);
+  run_test(test_lsh);
+  run_test(test_hnsw);
+  run_test(test_matrix_csr);
+  run_test(test_sparse_matrix);
+  run_test(test_similarity);
+  run_test(test_matrix_file);
+  run_test(test_dictionary);
+  run_test(test_kmeans);
+  run_test(test_sgd);
+  run_test(test_als);
   
   print_separator();
   if(failed > 0) {
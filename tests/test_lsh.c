@@ -0,0 +1,150 @@
+#include "tests.h"
+
+#define LSH_TEST_ROWS     2000
+#define LSH_TEST_COLUMNS  100000
+
+// rows come in pairs: a random row, then a copy with a few values
+// changed, so each row's nearest neighbour is its partner
+static SparseVector *near_duplicate(Matrix *matrix, sparse_vector_builder *builder, SparseVector *original) {
+  SparseVector *row;
+  for(int i = 0, count = original->header.count; i < count; i++)
+    if(i % 10 != 0)
+      sparse_vector_builder_append(builder, sparse_vector_index_at(original, i), sparse_vector_value_at(original, i));
+  for(int i = 0; i < 3; i++)
+    sparse_vector_builder_append(builder, rand() % LSH_TEST_COLUMNS, (float) rand() / RAND_MAX);
+  sparse_vector_builder_finalize(builder, matrix, &row);
+  return row;
+}
+
+// the fraction of rows whose partner is the best match, excluding
+// the row itself
+static float partner_recall(lsh_index *index, column_accumulator *accumulator, Matrix *matrix) {
+  knn_result results[2];
+  SparseVector *row;
+  u_int32_t found, matched = 0, queries = 0;
+  for(u_int64_t r = 0; r < LSH_TEST_ROWS; r += 11) {
+    if(matrix_get_row(matrix, r, &row) != NO_ERROR) continue;
+    lsh_query(index, accumulator, row, 2, results, &found);
+    matched += (found == 2 && results[0].row == r && results[1].row == (r ^ 1));
+    queries++;
+  }
+  return (float) matched / queries;
+}
+
+static int test_family(lsh_family family, Matrix *matrix, sparse_vector_builder *builder, column_accumulator *accumulator) {
+  starting_tests();
+  printf("%s\n", lsh_family_names[family]);
+  learner_error error;
+  lsh_index *index;
+  lsh_parameters parameters = {family, 16, 8, 64, 15, 4};
+  
+  // minhash values only agree with probability equal to the jaccard
+  // similarity (about 0.75 between partners), so bands are narrower
+  if(family == LSH_MINHASH)
+    parameters.rows_per_band = 4;
+  SparseVector *row;
+  knn_result results[10];
+  u_int32_t found;
+  
+  error = lsh_new(matrix, &parameters, &index);
+  test_error(error);
+  error = lsh_insert_all(index);
+  test_error(error);
+  test(index->rows == LSH_TEST_ROWS);
+  test(partner_recall(index, accumulator, matrix) > 0.95);
+  
+  // results are sorted, and scored exactly
+  float score;
+  int sorted = 1, exact = 1;
+  matrix_get_row(matrix, 100, &row);
+  error = lsh_query(index, accumulator, row, 10, results, &found);
+  test_error(error);
+  test(found >= 2 && accumulator->count >= found);
+  for(u_int32_t i = 0; i < found; i++) {
+    if(i > 0) sorted &= (results[i - 1].score >= results[i].score);
+    if(family == LSH_SIMHASH) {
+      SparseVector *other;
+      matrix_get_row(matrix, results[i].row, &other);
+      sparse_vector_cosine_similarity(row, other, &score);
+      exact &= (score == results[i].score);
+    }
+  }
+  test(sorted && exact);
+  
+  // deleted rows are no longer found; reinserting them restores them
+  lsh_delete(index, 100);
+  lsh_delete(index, 100);
+  lsh_query(index, accumulator, row, 10, results, &found);
+  test(index->rows == LSH_TEST_ROWS - 1);
+  test(found >= 1 && results[0].row == 101);
+  error = lsh_insert(index, 100);
+  test_error(error);
+  lsh_query(index, accumulator, row, 1, results, &found);
+  test(found == 1 && results[0].row == 100);
+  
+  // a row inserted again rehashes its new values
+  SparseVector *replacement = random_row(matrix, builder, 40, LSH_TEST_COLUMNS, 0.0);
+  matrix_set_row(matrix, 200, replacement);
+  error = lsh_insert(index, 200);
+  test_error(error);
+  test(index->rows == LSH_TEST_ROWS);
+  lsh_query(index, accumulator, replacement, 1, results, &found);
+  test(found == 1 && results[0].row == 200);
+  
+  error = lsh_free(index);
+  test_error(error);
+  finished_tests();
+}
+
+int test_lsh() {
+  starting_tests();
+  learner_error error;
+  Matrix *matrix;
+  SparseVector *row;
+  sparse_vector_builder *builder;
+  column_accumulator *accumulator;
+  lsh_index *index;
+  
+  matrix_new(&matrix);
+  sparse_vector_builder_new(&builder);
+  column_accumulator_new(&accumulator);
+  srand(15);
+  for(u_int64_t r = 0; r < LSH_TEST_ROWS; r += 2) {
+    row = random_row(matrix, builder, 40, LSH_TEST_COLUMNS, 0.0);
+    matrix_set_row(matrix, r, row);
+    matrix_set_row(matrix, r + 1, near_duplicate(matrix, builder, row));
+  }
+  
+  failed += test_family(LSH_SIMHASH, matrix, builder, accumulator);
+  failed += test_family(LSH_MINHASH, matrix, builder, accumulator);
+  
+  // signatures too wide, or bands of nothing, are rejected
+  lsh_parameters parameters = {LSH_SIMHASH, 4, 65, 0, 1, 0};
+  test(lsh_new(matrix, &parameters, &index) == INVALID_PARAMETERS);
+  parameters.rows_per_band = 64;
+  parameters.bands = 17;
+  test(lsh_new(matrix, &parameters, &index) == INVALID_PARAMETERS);
+  parameters.family = LSH_MINHASH;
+  parameters.bands = 0;
+  test(lsh_new(matrix, &parameters, &index) == INVALID_PARAMETERS);
+  parameters.bands = 64;
+  parameters.rows_per_band = 5;
+  test(lsh_new(matrix, &parameters, &index) == INVALID_PARAMETERS);
+  
+  // hamming filtering drops every candidate but exact matches
+  parameters = (lsh_parameters) {LSH_SIMHASH, 8, 8, 0, 3, 0};
+  knn_result results[4];
+  u_int32_t found;
+  lsh_new(matrix, &parameters, &index);
+  lsh_insert_all(index);
+  matrix_get_row(matrix, 6, &row);
+  error = lsh_query(index, accumulator, row, 4, results, &found);
+  test_error(error);
+  test(found == 1 && results[0].row == 6);
+  lsh_free(index);
+  
+  column_accumulator_free(accumulator);
+  sparse_vector_builder_free(builder);
+  matrix_free(matrix);
+  finished_tests();
+}
@@ -0,0 +1,116 @@
+#include "tests.h"
+
+#define CSR_TEST_ROWS     3000
+#define CSR_TEST_COLUMNS  5000
+
+int test_matrix_csr() {
+  starting_tests();
+  learner_error error;
+  Matrix *matrix, *reference;
+  sparse_vector_builder *builder;
+  SparseVector *row, *other;
+  
+  matrix_new(&matrix);
+  matrix_new(&reference);
+  sparse_vector_builder_new(&builder);
+  srand(17);
+  random_rows(matrix, builder, CSR_TEST_ROWS, CSR_TEST_COLUMNS, 60);
+  srand(17);
+  random_rows(reference, builder, CSR_TEST_ROWS, CSR_TEST_COLUMNS, 60);
+  matrix_index_columns(matrix, 4);
+  
+  // packing keeps every row, missing rows included
+  error = matrix_csr_merge(matrix, 4);
+  test_error(error);
+  test(matrix->csr != NULL && matrix->csr->rows == CSR_TEST_ROWS && matrix->csr->staged == 0);
+  test(same_rows(matrix, reference));
+  test(matrix_get_row(matrix, 7, &row) == INDEX_NOT_FOUND);
+  
+  // rows are views of consecutive ranges of the packed arrays
+  int packed = 1;
+  u_int64_t nonzeros = 0;
+  matrix_csr *csr = matrix->csr;
+  for(u_int64_t r = 0; r < CSR_TEST_ROWS; r++) {
+    nonzeros += csr->views[r].header.count;
+    packed &= (csr->views[r].indexes == csr->indexes + csr->offsets[r]);
+    packed &= (csr->offsets[r + 1] - csr->offsets[r] == csr->views[r].header.count);
+    packed &= (r % 7 == 0) || (matrix->row_vectors[r] == &csr->views[r]);
+  }
+  test(packed && nonzeros == csr->nonzeros);
+  test(((u_int64_t) csr->indexes % SPARSE_VECTOR_ALIGNMENT) == 0 && ((u_int64_t) csr->values % SPARSE_VECTOR_ALIGNMENT) == 0);
+  
+  // views are read only
+  int frozen;
+  matrix_get_row(matrix, 1, &row);
+  matrix_get_row(matrix, 2, &other);
+  sparse_vector_frozen(row, &frozen);
+  test(frozen);
+  test(sparse_vector_set(row, 1, 1.0) == VECTOR_IS_VIEW);
+  test(sparse_vector_scale(row, 2.0) == VECTOR_IS_VIEW);
+  test(sparse_vector_axpy(1.0, other, row) == VECTOR_IS_VIEW);
+  test(sparse_vector_quantize(row, QUANTIZE_INT8, NULL) == VECTOR_IS_VIEW);
+  test(sparse_vector_to_aos(row) == VECTOR_IS_VIEW);
+  test(sparse_vector_unfreeze(row) == VECTOR_IS_VIEW);
+  test(sparse_vector_free(row) == VECTOR_IS_VIEW);
+  test(matrix_set_row(matrix, 2, row) == VECTOR_IS_VIEW);
+  
+  // searches over views match searches over the reference rows
+  knn_result results[10], expected[10];
+  u_int32_t found, expected_found;
+  matrix_get_row(reference, 5, &other);
+  error = knn_search_sparse(matrix, other, 10, COSINE_SIMILARITY, results, &found);
+  test_error(error);
+  knn_search_sparse(reference, other, 10, COSINE_SIMILARITY, expected, &expected_found);
+  int same = (found == expected_found);
+  for(u_int32_t i = 0; i < found && same; i++)
+    same = (results[i].row == expected[i].row && fabs(results[i].score - expected[i].score) < 1e-5);
+  test(same);
+  
+  // rows set after packing are staged, and kept in the column index
+  column_accumulator *accumulator;
+  column_accumulator_new(&accumulator);
+  sparse_vector_builder_append(builder, 4, 2.0);
+  sparse_vector_builder_append(builder, CSR_TEST_COLUMNS + 10, 3.0);
+  sparse_vector_builder_finalize(builder, matrix, &row);
+  error = matrix_set_row(matrix, 1, row);
+  test_error(error);
+  sparse_vector_builder_append(builder, CSR_TEST_COLUMNS + 10, 1.0);
+  sparse_vector_builder_finalize(builder, matrix, &other);
+  error = matrix_set_row(matrix, CSR_TEST_ROWS, other);
+  test_error(error);
+  test(matrix->csr->staged == 2 && matrix->rows == CSR_TEST_ROWS + 1);
+  test(matrix_csr_should_merge(matrix) == 0);
+  matrix_get_row(matrix, 1, &row);
+  test(row->header._view == 0 && sparse_vector_set(row, 8, 1.0) == NO_ERROR);
+  matrix_column_dot_products(matrix, other, accumulator);
+  test(accumulator->count == 2 && accumulator->dots[1] == 3.0 && accumulator->dots[CSR_TEST_ROWS] == 1.0);
+  
+  // compaction moves the staged rows, leaving packed rows in place
+  error = matrix_compact(matrix);
+  test_error(error);
+  matrix_get_row(matrix, 3, &row);
+  test(row == &csr->views[3]);
+  
+  // merging packs the staged rows
+  error = matrix_csr_merge(matrix, 0);
+  test_error(error);
+  test(matrix->csr->staged == 0 && matrix->csr->rows == CSR_TEST_ROWS + 1);
+  matrix_get_row(matrix, 1, &row);
+  test(row->header._view && row->header.count == 3 && row->indexes[1] == 8 && row->weights[2] == 3.0);
+  matrix_get_row(matrix, CSR_TEST_ROWS, &row);
+  test(row == &matrix->csr->views[CSR_TEST_ROWS] && row->header.magnitude == 1.0);
+  matrix_column_dot_products(matrix, row, accumulator);
+  test(accumulator->count == 2 && accumulator->dots[1] == 3.0);
+  
+  // dense matrices have no sparse rows to pack
+  Matrix *dense;
+  matrix_new_dense(2, 2, &dense);
+  test(matrix_csr_merge(dense, 1) == INVALID_MATRIX_STORAGE);
+  
+  matrix_free(dense);
+  column_accumulator_free(accumulator);
+  sparse_vector_builder_free(builder);
+  matrix_free(reference);
+  matrix_free(matrix);
+  finished_tests();
+}
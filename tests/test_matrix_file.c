@@ -0,0 +1,131 @@
+#include <unistd.h>
+#include <stddef.h>
+#include "tests.h"
+
+#define FILE_TEST_ROWS      5000
+#define FILE_TEST_COLUMNS   2000
+#define FILE_TEST_PATH      "test_matrix_file.db"
+
+// rows of the loaded matrix are views of the mapping, holding the
+// same values as the saved rows
+static int mapped_rows(Matrix *loaded, Matrix *saved) {
+  SparseVector *row;
+  char *mapping = (char *) loaded->csr->mapping;
+  for(u_int64_t r = 0; r < loaded->rows; r++) {
+    if(matrix_get_row(loaded, r, &row) != NO_ERROR) continue;
+    if(!row->header._view) return 0;
+    if((char *) row->indexes < mapping || (char *) (row->weights + row->header.count) > mapping + loaded->csr->mapping_length) return 0;
+  }
+  return same_rows(loaded, saved);
+}
+
+// overwrites bytes of the saved file, returning its header
+static matrix_file_header damage_file(long offset, void *data, size_t length) {
+  matrix_file_header header;
+  FILE *file = fopen(FILE_TEST_PATH, "r+b");
+  fread(&header, sizeof(matrix_file_header), 1, file);
+  if(data) {
+    fseek(file, offset, SEEK_SET);
+    fwrite(data, 1, length, file);
+  }
+  fclose(file);
+  return header;
+}
+
+int test_matrix_file() {
+  starting_tests();
+  learner_error error;
+  Matrix *matrix, *loaded, *reloaded;
+  sparse_vector_builder *builder;
+  SparseVector *row, *other;
+  float expected, score;
+  
+  matrix_new(&matrix);
+  sparse_vector_builder_new(&builder);
+  srand(21);
+  random_rows(matrix, builder, FILE_TEST_ROWS, FILE_TEST_COLUMNS, 40);
+  unlink(FILE_TEST_PATH);
+  
+  // rows are saved in any form and loaded as views of the file
+  error = matrix_file_save(matrix, FILE_TEST_PATH);
+  test_error(error);
+  error = matrix_file_load(FILE_TEST_PATH, 4, &loaded);
+  test_error(error);
+  test(loaded->rows == matrix->rows && loaded->csr && loaded->csr->mapping && loaded->csr->staged == 0);
+  test(((u_int64_t) loaded->csr->indexes % MATRIX_FILE_ALIGNMENT) == 0 && ((u_int64_t) loaded->csr->values % MATRIX_FILE_ALIGNMENT) == 0);
+  test(mapped_rows(loaded, matrix));
+  
+  // views are read only, and score like the rows they were saved from
+  matrix_get_row(loaded, 2, &row);
+  matrix_get_row(loaded, 3, &other);
+  test(sparse_vector_set(row, 1, 1.0) == VECTOR_IS_VIEW);
+  sparse_vector_cosine_similarity(row, other, &score);
+  matrix_get_row(matrix, 2, &row);
+  matrix_get_row(matrix, 3, &other);
+  sparse_vector_cosine_similarity(row, other, &expected);
+  test(fabs(score - expected) < 1e-5);
+  
+  // a loaded matrix can itself be saved, replacing the file it's
+  // mapped from without disturbing the mapping
+  error = matrix_file_save(loaded, FILE_TEST_PATH);
+  test_error(error);
+  test(mapped_rows(loaded, matrix));
+  error = matrix_file_load(FILE_TEST_PATH, 1, &reloaded);
+  test_error(error);
+  test(mapped_rows(reloaded, matrix));
+  test(reloaded->csr->mapping != loaded->csr->mapping);
+  matrix_free(reloaded);
+  
+  // rows set on a loaded matrix are staged, and merging copies the
+  // mapped rows out before the file is unmapped
+  sparse_vector_builder_append(builder, 5, 2.0);
+  sparse_vector_builder_finalize(builder, loaded, &row);
+  test(matrix_set_row(loaded, 4, row) == NO_ERROR && loaded->csr->staged == 1);
+  error = matrix_csr_merge(loaded, 2);
+  test_error(error);
+  test(loaded->csr->mapping == NULL);
+  matrix_get_row(loaded, 4, &row);
+  test(row->header.count == 1 && row->indexes[0] == 5 && row->weights[0] == 2.0);
+  matrix_get_row(loaded, FILE_TEST_ROWS - 3, &row);
+  matrix_get_row(matrix, FILE_TEST_ROWS - 3, &other);
+  test(row->header.count == other->header.count && sparse_vector_value_at(row, 0) == sparse_vector_value_at(other, 0));
+  matrix_free(loaded);
+  
+  // dense matrices can't be saved; missing and damaged files can't be loaded
+  Matrix *dense;
+  matrix_new_dense(2, 2, &dense);
+  test(matrix_file_save(dense, FILE_TEST_PATH) == INVALID_MATRIX_STORAGE);
+  matrix_free(dense);
+  test(matrix_file_load("missing_matrix_file.db", 1, &loaded) == FILE_NOT_FOUND);
+  
+  u_int32_t version = MATRIX_FILE_VERSION + 1;
+  damage_file(offsetof(matrix_file_header, version), &version, sizeof(u_int32_t));
+  test(matrix_file_load(FILE_TEST_PATH, 1, &loaded) == PARSE_ERROR);
+  matrix_file_save(matrix, FILE_TEST_PATH);
+  u_int64_t offset = -1;
+  matrix_file_header header = damage_file(0, NULL, 0);
+  damage_file(header.offsets + (100 * sizeof(u_int64_t)), &offset, sizeof(u_int64_t));
+  test(matrix_file_load(FILE_TEST_PATH, 2, &loaded) == PARSE_ERROR);
+  
+  // records must match the indexes they describe, which must ascend
+  u_int32_t bound = FILE_TEST_COLUMNS * 100;
+  matrix_file_save(matrix, FILE_TEST_PATH);
+  damage_file(header.row_records + (2 * sizeof(matrix_file_row)) + offsetof(matrix_file_row, max_index), &bound, sizeof(u_int32_t));
+  test(matrix_file_load(FILE_TEST_PATH, 2, &loaded) == PARSE_ERROR);
+  u_int64_t position = 0, r = 0;
+  for(; matrix_get_row(matrix, r, &row) != NO_ERROR || row->header.count < 3; r++)
+    position += (matrix_get_row(matrix, r, &row) == NO_ERROR) ? row->header.count : 0;
+  u_int32_t first = sparse_vector_index_at(row, 0);
+  matrix_file_save(matrix, FILE_TEST_PATH);
+  damage_file(header.indexes + ((position + 1) * sizeof(u_int32_t)), &first, sizeof(u_int32_t));
+  test(matrix_file_load(FILE_TEST_PATH, 2, &loaded) == PARSE_ERROR);
+  
+  matrix_file_save(matrix, FILE_TEST_PATH);
+  truncate(FILE_TEST_PATH, MATRIX_FILE_ALIGNMENT * 3);
+  test(matrix_file_load(FILE_TEST_PATH, 2, &loaded) == PARSE_ERROR);
+  
+  unlink(FILE_TEST_PATH);
+  sparse_vector_builder_free(builder);
+  matrix_free(matrix);
+  finished_tests();
+}
@@ -12,19 +12,47 @@ int test_paged_file() {
   paged_file_set_attribute(file, 0, 10);
   test(paged_file_get_attribute(file, 0) == 10);
   
+  // new pages are appended after the first sector start page, and
+  // runs are padded to whole pages
+  char small[100], large[3000], *read;
+  uint64_t first, second;
+  memset(small, 's', sizeof(small));
+  memset(large, 'l', sizeof(large));
+  error = paged_file_write_new(file, &first, small, sizeof(small));
+  test(error == PF_NO_ERROR && first == 1);
+  error = paged_file_write_new(file, &second, large, sizeof(large));
+  test(error == PF_NO_ERROR && second == 2);
+  test(file->header.pages == 5);
+  
+  error = paged_file_read(file, second, (void **) &read, sizeof(large));
+  test(error == PF_NO_ERROR && memcmp(read, large, sizeof(large)) == 0);
+  free(read);
+  
   error = paged_file_flush(file);
   test(error == PF_NO_ERROR);
   
   error = paged_file_close(file);
   test(error == PF_NO_ERROR);
   
+  // reopened files keep their header, and can be mapped
+  error = paged_file_open("test_file.db", 0, &file);
+  test(error == PF_NO_ERROR);
+  test(file->header.page_size == 1024 && file->header.pages == 5);
+  test(paged_file_get_attribute(file, 0) == 10);
+  error = paged_file_map(file, first, (void **) &read);
+  test(error == PF_NO_ERROR && memcmp(read, small, sizeof(small)) == 0);
+  error = paged_file_map(file, second, (void **) &read);
+  test(error == PF_NO_ERROR && memcmp(read, large, sizeof(large)) == 0 && read[sizeof(large)] == 0);
+  error = paged_file_close(file);
+  test(error == PF_NO_ERROR);
+
 /*
   // writing
   pf_error paged_file_write_offset(paged_file *file, uint64_t index, uint64_t offset, void *data, uint64_t length);
   pf_error paged_file_write_new(paged_file *file, uint64_t *index, void *data, uint64_t length);
   pf_error paged_file_free(paged_file *file, uint64_t index, uint64_t count);
   #define  paged_file_write(file, index, data, length)  paged_file_write_offset(file, index, 0, data, length)
-
+  
   // reading
   pf_error paged_file_read_offset(paged_file *file, uint64_t index, uint64_t offset, void **data, uint64_t length);
   #define  paged_file_read(file, index, data, length) paged_file_read_offset(file, index, 0, data, length)
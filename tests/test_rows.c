@@ -0,0 +1,68 @@
+#include "tests.h"
+
+// ------------------------------------------
+// fixtures shared by the suites
+// ------------------------------------------
+SparseVector *random_row(Matrix *matrix, sparse_vector_builder *builder, u_int32_t count, u_int32_t columns, float low) {
+  SparseVector *row;
+  for(u_int32_t i = 0; i < count; i++)
+    sparse_vector_builder_append(builder, rand() % columns, low + ((float) rand() / RAND_MAX));
+  sparse_vector_builder_finalize(builder, matrix, &row);
+  return row;
+}
+
+
+void random_rows(Matrix *matrix, sparse_vector_builder *builder, u_int64_t rows, u_int32_t columns, u_int32_t values) {
+  SparseVector *row;
+  for(u_int64_t r = 0; r < rows; r++) {
+    if(r % 7 == 0) continue;
+    row = random_row(matrix, builder, (r % 11 == 0) ? 0 : 1 + rand() % values, columns, -0.5);
+    if(r % 2)
+      sparse_vector_to_soa(row);
+    if(r % 3 == 0)
+      sparse_vector_freeze(row);
+    if(r % 10 == 7)
+      sparse_vector_quantize(row, QUANTIZE_FLOAT16, NULL);
+    matrix_set_row(matrix, r, row);
+  }
+}
+
+
+int same_rows(Matrix *matrix, Matrix *expected) {
+  SparseVector *row, *other;
+  float magnitude;
+  if(matrix->rows != expected->rows) return 0;
+  for(u_int64_t r = 0; r < matrix->rows; r++) {
+    learner_error error = matrix_get_row(matrix, r, &row);
+    if(error != matrix_get_row(expected, r, &other)) return 0;
+    if(error) continue;
+    if(row->header.count != other->header.count || row->header.matrix_index != r) return 0;
+    for(u_int32_t i = 0; i < row->header.count; i++)
+      if(sparse_vector_index_at(row, i) != sparse_vector_index_at(other, i) ||
+         sparse_vector_value_at(row, i) != sparse_vector_value_at(other, i))
+        return 0;
+    if(row->header.count && (row->header.min_index != other->header.min_index || row->header.max_index != other->header.max_index)) return 0;
+    sparse_vector_magnitude(other, &magnitude);
+    if(fabs(row->header.magnitude - magnitude) > 1e-5) return 0;
+  }
+  return 1;
+}
+
+
+void random_centres(u_int32_t *centres, u_int32_t clusters, u_int32_t width, u_int32_t columns) {
+  for(u_int32_t i = 0; i < clusters * width; i++)
+    centres[i] = rand() % columns;
+}
+
+
+SparseVector *clustered_row(Matrix *matrix, sparse_vector_builder *builder, u_int32_t *centres, u_int32_t clusters, u_int32_t width, u_int32_t columns) {
+  SparseVector *row;
+  u_int32_t *centre = centres + (rand() % clusters) * width;
+  for(u_int32_t i = 0; i < width; i++)
+    if(rand() % 2)
+      sparse_vector_builder_append(builder, centre[i], 0.5 + ((float) rand() / RAND_MAX));
+  for(u_int32_t i = 0; i < 10; i++)
+    sparse_vector_builder_append(builder, rand() % columns, (float) rand() / RAND_MAX);
+  sparse_vector_builder_finalize(builder, matrix, &row);
+  return row;
+}
@@ -0,0 +1,133 @@
+#include "tests.h"
+
+#define SGD_TEST_ROWS       4000
+#define SGD_TEST_COLUMNS    200
+#define SGD_TEST_FEATURES   12
+
+// the fraction of rows whose label the trained weights predict
+static double accuracy(Matrix *matrix, float *labels, Vector *weights, sgd_loss loss) {
+  u_int64_t correct = 0, rows = 0;
+  SparseVector *row;
+  float score, threshold = (loss == SGD_LOGISTIC) ? 0.5 : 0.0;
+  for(u_int64_t r = 0; r < matrix->rows; r++) {
+    if(matrix_get_row(matrix, r, &row)) continue;
+    sgd_predict(weights, loss, row, &score);
+    correct += ((score > threshold) == (labels[r] > 0.0));
+    rows++;
+  }
+  return (double) correct / rows;
+}
+
+int test_sgd() {
+  starting_tests();
+  learner_error error;
+  float truth[SGD_TEST_COLUMNS], labels[SGD_TEST_ROWS];
+  Matrix *matrix, *dense;
+  Vector *weights;
+  sgd_result result;
+  sgd_parameters parameters;
+  
+  // rows are a few random columns of a linear model's features, plus
+  // a constant intercept column, labelled by the model. every 13th
+  // row isn't set.
+  sparse_vector_builder *builder;
+  SparseVector *vector;
+  srand(31);
+  for(int j = 0; j < SGD_TEST_COLUMNS; j++)
+    truth[j] = ((float) rand() / RAND_MAX) * 2.0 - 1.0;
+  matrix_new(&matrix);
+  sparse_vector_builder_new(&builder);
+  for(u_int64_t r = 0; r < SGD_TEST_ROWS; r++) {
+    labels[r] = 0.0;
+    if(r % 13 == 5) continue;
+    float margin = truth[SGD_TEST_COLUMNS - 1];
+    int columns[SGD_TEST_FEATURES];
+    for(int i = 0; i < SGD_TEST_FEATURES; i++) {
+      int column = rand() % (SGD_TEST_COLUMNS - 1), seen = 0;
+      for(int j = 0; j < i; j++)
+        seen |= (columns[j] == column);
+      columns[i] = seen ? -1 : column;
+    }
+    for(int column = 0; column < SGD_TEST_COLUMNS - 1; column++) {
+      for(int i = 0; i < SGD_TEST_FEATURES; i++) {
+        if(columns[i] != column) continue;
+        sparse_vector_builder_append(builder, column, 1.0);
+        margin += truth[column];
+      }
+    }
+    sparse_vector_builder_append(builder, SGD_TEST_COLUMNS - 1, 1.0);
+    sparse_vector_builder_finalize(builder, matrix, &vector);
+    if(r % 2) sparse_vector_freeze(vector);
+    matrix_set_row(matrix, r, vector);
+    labels[r] = (margin > 0.0) ? 1.0 : -1.0;
+  }
+  
+  // logistic regression across threads learns the model's labels
+  u_int64_t rows = SGD_TEST_ROWS - ((SGD_TEST_ROWS + 7) / 13);
+  vector_new(SGD_TEST_COLUMNS, &weights);
+  parameters = (sgd_parameters) {SGD_LOGISTIC, 20, 16, 0.5, 1e-4, 3, 4};
+  error = matrix_sgd_train(matrix, labels, weights, &parameters, &result);
+  test_error(error);
+  test(accuracy(matrix, labels, weights, SGD_LOGISTIC) > 0.95);
+  test(result.loss < 0.25);
+  test(result.epochs == 20 && result.examples == rows * 20);
+  test(result.seconds > 0.0 && result.examples_per_second > 0.0);
+  vector_free(weights);
+  
+  // as does a linear svm, in a single thread
+  vector_new(SGD_TEST_COLUMNS, &weights);
+  parameters = (sgd_parameters) {SGD_HINGE, 20, 1, 0.1, 1e-4, 5, 1};
+  error = matrix_sgd_train(matrix, labels, weights, &parameters, &result);
+  test_error(error);
+  test(accuracy(matrix, labels, weights, SGD_HINGE) > 0.95);
+  
+  // more epochs (at a finer rate) continue from the weights given
+  float loss = result.loss;
+  parameters.epochs = 5;
+  parameters.learning_rate = 0.01;
+  error = matrix_sgd_train(matrix, labels, weights, &parameters, &result);
+  test_error(error);
+  test(result.loss < loss && accuracy(matrix, labels, weights, SGD_HINGE) > 0.95);
+  vector_free(weights);
+  
+  // with every margin already past 1, svm gradients are 0 and only
+  // regularisation changes the weights: each shrinks once per batch,
+  // whether rows read it (lazily) or not (at the end of each epoch)
+  vector_new(SGD_TEST_COLUMNS, &weights);
+  for(int j = 0; j < SGD_TEST_COLUMNS; j++)
+    weights->values[j] = 1000.0;
+  for(u_int64_t r = 0; r < SGD_TEST_ROWS; r++) {
+    if(matrix_get_row(matrix, r, &vector) == NO_ERROR) {
+      float margin;
+      sparse_vector_dense_dot_product(vector, weights, &margin);
+      labels[r] = margin;
+    }
+  }
+  parameters = (sgd_parameters) {SGD_HINGE, 3, 10, 0.1, 1e-3, 9, 4};
+  error = matrix_sgd_train(matrix, labels, weights, &parameters, &result);
+  test_error(error);
+  double shrink = 1.0;
+  u_int64_t batches = (rows + 9) / 10;
+  for(int epoch = 0; epoch < 3; epoch++)
+    shrink *= pow(1.0 - (1e-3 * 0.1 / sqrt(1.0 + epoch)), batches);
+  int shrunk = 1;
+  for(int j = 0; j < SGD_TEST_COLUMNS; j++)
+    shrunk &= fabs(weights->values[j] - 1000.0 * shrink) < 1e-2;
+  test(shrunk);
+  vector_free(weights);
+  
+  // errors
+  vector_new(SGD_TEST_COLUMNS - 1, &weights);
+  test(matrix_sgd_train(matrix, labels, weights, &parameters, &result) == INDEX_OUT_OF_RANGE);
+  parameters.lambda = 20.0;
+  test(matrix_sgd_train(matrix, labels, weights, &parameters, &result) == INVALID_PARAMETERS);
+  matrix_new_dense(10, SGD_TEST_COLUMNS, &dense);
+  parameters.lambda = 0.0;
+  test(matrix_sgd_train(dense, labels, weights, &parameters, &result) == INVALID_MATRIX_STORAGE);
+  vector_free(weights);
+  
+  sparse_vector_builder_free(builder);
+  matrix_free(dense);
+  matrix_free(matrix);
+  finished_tests();
+}
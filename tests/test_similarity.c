@@ -0,0 +1,184 @@
+#include "tests.h"
+
+#define SIMILARITY_TEST_ROWS      600
+#define SIMILARITY_TEST_COLUMNS   400
+#define SIMILARITY_TEST_K         5
+
+// rows share columns with a few cluster centres so that many pairs are
+// similar, and enough rows are set that they span several tiles
+static u_int32_t centres[8 * 30];
+
+// callbacks record each pair reported in a rows x rows table
+typedef struct {
+  float     *scores;
+  u_int32_t *reported;
+  int       ordered;
+  int       calls;
+} pairs;
+
+static learner_error record_pairs(void *context, u_int64_t row, knn_result *results, u_int32_t count) {
+  pairs *recorded = (pairs *) context;
+  recorded->calls++;
+  for(u_int32_t i = 0; i < count; i++) {
+    recorded->scores[row * SIMILARITY_TEST_ROWS + results[i].row] = results[i].score;
+    recorded->reported[row * SIMILARITY_TEST_ROWS + results[i].row]++;
+    if(i > 0) recorded->ordered &= (results[i - 1].score >= results[i].score);
+  }
+  return NO_ERROR;
+}
+
+static learner_error stop_pairs(void *context, u_int64_t row, knn_result *results, u_int32_t count) {
+  (void) row;
+  (void) results;
+  (void) count;
+  (*(int *) context)++;
+  return UNKNOWN_OPERATION;
+}
+
+static void reset_pairs(pairs *recorded) {
+  memset(recorded->scores, 0, SIMILARITY_TEST_ROWS * SIMILARITY_TEST_ROWS * sizeof(float));
+  memset(recorded->reported, 0, SIMILARITY_TEST_ROWS * SIMILARITY_TEST_ROWS * sizeof(u_int32_t));
+  recorded->ordered = 1;
+  recorded->calls = 0;
+}
+
+// the best k rows of every row are the k + 1 best knn results, bar
+// the row itself. scores are compared rather than rows, as rows with
+// equal scores may be ordered either way.
+static int matches_knn(Matrix *matrix, pairs *recorded, learner_metric metric) {
+  knn_result results[SIMILARITY_TEST_K + 1];
+  u_int32_t found;
+  SparseVector *row;
+  Vector dense;
+  int matched = 1;
+  for(u_int64_t r = 0; r < SIMILARITY_TEST_ROWS; r += 3) {
+    if(matrix->values) {
+      matrix_dense_row(matrix, r, &dense);
+      knn_search(matrix, &dense, SIMILARITY_TEST_K + 1, metric, results, &found);
+    } else {
+      matrix_get_row(matrix, r, &row);
+      knn_search_sparse(matrix, row, SIMILARITY_TEST_K + 1, metric, results, &found);
+    }
+    u_int32_t listed = 0;
+    float worst = INFINITY;
+    for(u_int64_t other = 0; other < SIMILARITY_TEST_ROWS; other++)
+      if(recorded->reported[r * SIMILARITY_TEST_ROWS + other]) {
+        listed++;
+        worst = fminf(worst, recorded->scores[r * SIMILARITY_TEST_ROWS + other]);
+      }
+    u_int32_t expected = 0;
+    for(u_int32_t i = 0; i < found && expected < SIMILARITY_TEST_K; i++) {
+      if(results[i].row == r) continue;
+      matched &= fabs(recorded->scores[r * SIMILARITY_TEST_ROWS + results[i].row] - results[i].score) < 1e-4 || fabs(results[i].score - worst) < 1e-4;
+      expected++;
+    }
+    matched &= (listed == expected);
+  }
+  return matched;
+}
+
+int test_similarity() {
+  starting_tests();
+  learner_error error;
+  Matrix *matrix;
+  SparseVector *a, *b;
+  sparse_vector_builder *builder;
+  pairs recorded = {NULL, NULL, 1, 0};
+  recorded.scores = (float *) malloc(SIMILARITY_TEST_ROWS * SIMILARITY_TEST_ROWS * sizeof(float));
+  recorded.reported = (u_int32_t *) malloc(SIMILARITY_TEST_ROWS * SIMILARITY_TEST_ROWS * sizeof(u_int32_t));
+  
+  srand(20);
+  matrix_new(&matrix);
+  sparse_vector_builder_new(&builder);
+  random_centres(centres, 8, 30, SIMILARITY_TEST_COLUMNS);
+  for(u_int64_t r = 0; r < SIMILARITY_TEST_ROWS; r++) {
+    SparseVector *row = clustered_row(matrix, builder, centres, 8, 30, SIMILARITY_TEST_COLUMNS);
+    if(r % 2) sparse_vector_freeze(row);
+    matrix_set_row(matrix, r, row);
+  }
+  
+  // every pair above the threshold is reported once, under its lower
+  // row, with the score sparse_vector_cosine_similarity gives it
+  similarity_parameters parameters = {COSINE_SIMILARITY, 0.3, 0, 4};
+  reset_pairs(&recorded);
+  error = matrix_all_pairs_similarity(matrix, &parameters, record_pairs, &recorded);
+  test_error(error);
+  int matched = 1, above = 0, pairs = 0;
+  float score;
+  for(u_int64_t r = 0; r < SIMILARITY_TEST_ROWS; r++) {
+    matrix_get_row(matrix, r, &a);
+    for(u_int64_t other = 0; other < SIMILARITY_TEST_ROWS; other++) {
+      u_int32_t reported = recorded.reported[r * SIMILARITY_TEST_ROWS + other];
+      pairs += reported;
+      if(other <= r) {
+        matched &= (reported == 0);
+        continue;
+      }
+      matrix_get_row(matrix, other, &b);
+      sparse_vector_cosine_similarity(a, b, &score);
+      if(fabs(score - parameters.threshold) < 1e-4) continue;
+      above += (score > parameters.threshold);
+      matched &= (reported == (score > parameters.threshold));
+      if(reported) matched &= fabs(recorded.scores[r * SIMILARITY_TEST_ROWS + other] - score) < 1e-4;
+    }
+  }
+  test(matched && recorded.ordered && above > SIMILARITY_TEST_ROWS);
+  
+  // the best k of every row match knn searches, by either metric
+  parameters = (similarity_parameters) {COSINE_SIMILARITY, 0.0, SIMILARITY_TEST_K, 3};
+  reset_pairs(&recorded);
+  error = matrix_all_pairs_similarity(matrix, &parameters, record_pairs, &recorded);
+  test_error(error);
+  test(recorded.calls == SIMILARITY_TEST_ROWS && recorded.ordered);
+  test(matches_knn(matrix, &recorded, COSINE_SIMILARITY));
+  parameters.metric = DOT_PRODUCT;
+  parameters.threads = 1;
+  reset_pairs(&recorded);
+  error = matrix_all_pairs_similarity(matrix, &parameters, record_pairs, &recorded);
+  test_error(error);
+  test(matches_knn(matrix, &recorded, DOT_PRODUCT));
+  
+  // dense rows are compared in blocks
+  Matrix *dense;
+  Vector row;
+  matrix_new_dense(SIMILARITY_TEST_ROWS, 50, &dense);
+  for(u_int64_t r = 0; r < SIMILARITY_TEST_ROWS; r++) {
+    matrix_dense_row(dense, r, &row);
+    for(int c = 0; c < 50; c++)
+      row.values[c] = ((float) rand() / RAND_MAX) - 0.5;
+  }
+  parameters = (similarity_parameters) {COSINE_SIMILARITY, -1.0, SIMILARITY_TEST_K, 4};
+  reset_pairs(&recorded);
+  error = matrix_all_pairs_similarity(dense, &parameters, record_pairs, &recorded);
+  test_error(error);
+  test(matches_knn(dense, &recorded, COSINE_SIMILARITY));
+  
+  // pairs can be written to a file
+  FILE *file = tmpfile();
+  parameters = (similarity_parameters) {COSINE_SIMILARITY, 0.3, 0, 2};
+  error = matrix_all_pairs_similarity(matrix, &parameters, similarity_write_pairs, file);
+  test_error(error);
+  rewind(file);
+  unsigned long long first, second;
+  int lines = 0, valid = 1;
+  while(fscanf(file, "%llu\t%llu\t%f\n", &first, &second, &score) == 3) {
+    lines++;
+    valid &= (first < second && score >= 0.3);
+  }
+  fclose(file);
+  test(lines == pairs && valid);
+  
+  // callback errors stop the job; euclidean distances aren't supported
+  int calls = 0;
+  test(matrix_all_pairs_similarity(matrix, &parameters, stop_pairs, &calls) == UNKNOWN_OPERATION);
+  test(calls == 1);
+  parameters.metric = EUCLIDEAN_DISTANCE;
+  test(matrix_all_pairs_similarity(matrix, &parameters, record_pairs, &recorded) == INVALID_PARAMETERS);
+  
+  free(recorded.scores);
+  free(recorded.reported);
+  matrix_free(dense);
+  sparse_vector_builder_free(builder);
+  matrix_free(matrix);
+  finished_tests();
+}
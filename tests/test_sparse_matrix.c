@@ -0,0 +1,135 @@
+#include "tests.h"
+
+#define SPARSE_TEST_ROWS      2000
+#define SPARSE_TEST_COLUMNS   300
+#define SPARSE_TEST_WIDTH     20
+
+// most rows are short, but every 500th row is full, so dividing the
+// rows evenly by count would leave threads with very uneven work.
+// every 13th row is unset.
+static Matrix *random_matrix(sparse_vector_builder *builder, u_int64_t rows, u_int32_t columns) {
+  Matrix *matrix;
+  SparseVector *row;
+  matrix_new(&matrix);
+  for(u_int64_t r = 0; r < rows; r++) {
+    if(r % 13 == 5) continue;
+    if(r % 500 == 0) {
+      for(u_int32_t c = 0; c < columns; c++)
+        sparse_vector_builder_append(builder, c, ((float) rand() / RAND_MAX) - 0.5);
+      sparse_vector_builder_finalize(builder, matrix, &row);
+    } else {
+      row = random_row(matrix, builder, columns / 30, columns, -0.5);
+    }
+    if(r % 3 == 1)
+      sparse_vector_to_soa(row);
+    matrix_set_row(matrix, r, row);
+  }
+  return matrix;
+}
+
+// the value at (row, column) of a sparse matrix, or 0
+static float value_at(Matrix *matrix, u_int64_t row, u_int32_t column) {
+  SparseVector *vector;
+  float value = 0.0;
+  if(matrix_get_row(matrix, row, &vector) == NO_ERROR)
+    sparse_vector_get(vector, column, &value);
+  return value;
+}
+
+static int test_products(Matrix *a, Matrix *b, u_int32_t threads) {
+  starting_tests();
+  printf("%u threads%s\n", threads, a->csr ? ", csr" : "");
+  learner_error error;
+  Vector *vector, *result;
+  Matrix *dense, *product;
+  SparseVector *row;
+  float expected;
+  
+  // matrix * vector matches a dot product per row
+  vector_new(SPARSE_TEST_COLUMNS, &vector);
+  for(u_int32_t c = 0; c < SPARSE_TEST_COLUMNS; c++)
+    vector->values[c] = ((float) rand() / RAND_MAX) - 0.5;
+  error = matrix_sparse_vector_product(a, vector, threads, &result);
+  test_error(error);
+  int matched = (result->header.length == SPARSE_TEST_ROWS);
+  for(u_int64_t r = 0; r < SPARSE_TEST_ROWS && matched; r++) {
+    expected = 0.0;
+    if(matrix_get_row(a, r, &row) == NO_ERROR)
+      sparse_vector_dense_dot_product(row, vector, &expected);
+    matched = fabs(result->values[r] - expected) < 1e-5;
+  }
+  test(matched);
+  vector_free(result);
+  vector_free(vector);
+  
+  // sparse * dense matches the product summed value by value
+  matrix_new_dense(SPARSE_TEST_COLUMNS, SPARSE_TEST_WIDTH, &dense);
+  for(u_int64_t r = 0; r < dense->rows; r++)
+    for(u_int32_t c = 0; c < SPARSE_TEST_WIDTH; c++)
+      dense->values[r * dense->stride + c] = ((float) rand() / RAND_MAX) - 0.5;
+  error = matrix_sparse_dense_product(a, dense, threads, &product);
+  test_error(error);
+  matched = (product->rows == SPARSE_TEST_ROWS && product->columns == SPARSE_TEST_WIDTH);
+  for(u_int64_t r = 0; r < SPARSE_TEST_ROWS && matched; r += 7) {
+    for(u_int32_t c = 0; c < SPARSE_TEST_WIDTH; c++) {
+      expected = 0.0;
+      for(u_int32_t k = 0; k < SPARSE_TEST_COLUMNS; k++)
+        expected += value_at(a, r, k) * dense->values[k * dense->stride + c];
+      matched &= fabs(product->values[r * product->stride + c] - expected) < 1e-4;
+    }
+  }
+  test(matched);
+  matrix_free(product);
+  matrix_free(dense);
+  
+  // sparse * sparse matches too, with every row present and packed
+  error = matrix_sparse_product(a, b, threads, &product);
+  test_error(error);
+  matched = (product->rows == SPARSE_TEST_ROWS && product->csr != NULL);
+  for(u_int64_t r = 0; r < SPARSE_TEST_ROWS && matched; r += 11) {
+    matched &= (matrix_get_row(product, r, &row) == NO_ERROR);
+    for(u_int32_t i = 1; i < row->header.count; i++)
+      matched &= (row->indexes[i - 1] < row->indexes[i]);
+    for(u_int32_t c = 0; c < SPARSE_TEST_COLUMNS; c++) {
+      expected = 0.0;
+      for(u_int32_t k = 0; k < SPARSE_TEST_COLUMNS; k++)
+        expected += value_at(a, r, k) * value_at(b, k, c);
+      matched &= fabs(value_at(product, r, c) - expected) < 1e-4;
+    }
+  }
+  test(matched);
+  matrix_free(product);
+  finished_tests();
+}
+
+int test_sparse_matrix() {
+  starting_tests();
+  sparse_vector_builder *builder;
+  Matrix *a, *b;
+  Vector *vector, *result;
+  
+  srand(19);
+  sparse_vector_builder_new(&builder);
+  a = random_matrix(builder, SPARSE_TEST_ROWS, SPARSE_TEST_COLUMNS);
+  b = random_matrix(builder, SPARSE_TEST_COLUMNS, SPARSE_TEST_COLUMNS);
+  
+  failed += test_products(a, b, 1);
+  failed += test_products(a, b, 4);
+  matrix_csr_merge(a, 4);
+  failed += test_products(a, b, 3);
+  
+  // vectors must cover every column, and dense matrices every row
+  vector_new(SPARSE_TEST_COLUMNS - 1, &vector);
+  test(matrix_sparse_vector_product(a, vector, 2, &result) == INDEX_OUT_OF_RANGE);
+  vector_free(vector);
+  Matrix *dense, *product;
+  matrix_new_dense(SPARSE_TEST_COLUMNS - 1, 2, &dense);
+  test(matrix_sparse_dense_product(a, dense, 2, &product) == INDEX_OUT_OF_RANGE);
+  test(matrix_sparse_product(a, dense, 2, &product) == INVALID_MATRIX_STORAGE);
+  matrix_free(dense);
+  
+  sparse_vector_builder_free(builder);
+  matrix_free(a);
+  matrix_free(b);
+  finished_tests();
+}
@@ -12,6 +12,13 @@
   test_error(error);\
 }
 
+// expands a sparse vector in to a dense one of length at least max_index
+static void expand(SparseVector *sparse, Vector *dense) {
+  memset(dense->values, 0, dense->header.length * sizeof(float));
+  for(int i = 0; i < sparse->header.count; i++)
+    dense->values[sparse_vector_index_at(sparse, i)] = sparse_vector_value_at(sparse, i);
+}
+
 
 int test_sparse_vector() {
   starting_tests();
@@ -79,6 +86,38 @@ int test_sparse_vector() {
   test_error(error);
   test_float(value, ((3.0) / (sqrtf(5.0) * sqrtf(50.0))));
   
+  // single pass (unfrozen) cosine similarity and distance
+  error = sparse_vector_unfreeze(v1);
+  test_error(error);
+  error = sparse_vector_unfreeze(v2);
+  test_error(error);
+  error = sparse_vector_cosine_similarity(v1, v2, &value);
+  test_error(error);
+  test_float(value, ((3.0) / (sqrtf(5.0) * sqrtf(50.0))));
+  error = sparse_vector_euclidean_distance(v1, v2, &value);
+  test_error(error);
+  test_float(value, sqrtf(4.0 + 4.0 + 25.0 + 16.0));
+  
+  // normalized vectors
+  int normalized;
+  error = sparse_vector_freeze_normalized(v1);
+  test_error(error);
+  error = sparse_vector_freeze_normalized(v2);
+  test_error(error);
+  error = sparse_vector_normalized(v1, &normalized);
+  test_error(error);
+  test(normalized);
+  error = sparse_vector_magnitude(v1, &value);
+  test_error(error);
+  test_float(value, 1.0);
+  error = sparse_vector_cosine_similarity(v1, v2, &value);
+  test_error(error);
+  test_float(value, ((3.0) / (sqrtf(5.0) * sqrtf(50.0))));
+  error = sparse_vector_unfreeze(v1);
+  test_error(error);
+  error = sparse_vector_unfreeze(v2);
+  test_error(error);
+  
   // setting existing values
   test_set_value(v1, 1, 12.0);
   test_set_value(v1, 0, 11.0);
@@ -93,6 +132,449 @@ int test_sparse_vector() {
   test_get_value(v2, 2, 15.0);
   test_get_value(v2, 3, 14.0);
   
+  // quantized vectors are read only, and dot products are computed
+  // directly on the quantized values
+  float float_dot, float_distance;
+  error = sparse_vector_unfreeze(v1);
+  test_error(error);
+  error = sparse_vector_unfreeze(v2);
+  test_error(error);
+  error = sparse_vector_dot_product(v1, v2, &float_dot);
+  test_error(error);
+  error = sparse_vector_euclidean_distance(v1, v2, &float_distance);
+  test_error(error);
+  quantization_error quantization_error;
+  error = sparse_vector_quantize(v1, QUANTIZE_INT8, &quantization_error);
+  test_error(error);
+  test(quantization_error.max_error <= (1.0 / 254) * 1.0);
+  test(sparse_vector_set(v1, 5, 1.0) == QUANTIZED_VECTOR);
+  test_get_value(v1, 1, 12.0);
+  
+  // quantized . float
+  error = sparse_vector_dot_product(v1, v2, &value);
+  test_error(error);
+  test(fabs(value - float_dot) <= 0.01);
+  error = sparse_vector_euclidean_distance(v1, v2, &value);
+  test_error(error);
+  test(fabs(value - float_distance) <= 0.01);
+  
+  // quantized . quantized
+  error = sparse_vector_quantize(v2, QUANTIZE_INT8, NULL);
+  test_error(error);
+  error = sparse_vector_dot_product(v1, v2, &value);
+  test_error(error);
+  test(fabs(value - float_dot) <= 0.1);
+  error = sparse_vector_dequantize(v1);
+  test_error(error);
+  test_set_value(v1, 5, 1.0);
+  
+  // building from unsorted values with duplicates matches setting
+  // each value in turn, with the last duplicate winning
+  sparse_vector_builder *builder;
+  SparseVector *built, *reference;
+  error = sparse_vector_builder_new(&builder);
+  test_error(error);
+  for(int size = 10; size <= 10000; size *= 1000) {
+    sparse_vector_new(&reference, m);
+    srand(size);
+    for(int i = 0; i < size; i++) {
+      u_int32_t index = (i % 3 == 0) ? rand() % 50 : rand() * 2654435761u;
+      error = sparse_vector_builder_append(builder, index, i);
+      test_error(error);
+      sparse_vector_set(reference, index, i);
+    }
+    error = sparse_vector_builder_finalize(builder, m, &built);
+    test_error(error);
+    test(builder->count == 0);
+    test(built->header.count == reference->header.count);
+    test(built->header.min_index == reference->header.min_index);
+    test(built->header.max_index == reference->header.max_index);
+    test(memcmp(built->values, reference->values, built->header.count * sizeof(sparse_vector_value)) == 0);
+    sparse_vector_free(built);
+    sparse_vector_free(reference);
+  }
+  
+  error = sparse_vector_builder_finalize(builder, m, &built);
+  test_error(error);
+  test(built->header.count == 0);
+  sparse_vector_free(built);
+  
+  // galloping through a larger vector gives the same results as
+  // merging, for every calculation sharing the intersection engine
+  float merged[3], galloped[3];
+  SparseVector *small, *large;
+  srand(8);
+  for(int i = 0; i < 20; i++)
+    sparse_vector_builder_append(builder, rand() % 5000, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, m, &small);
+  for(int i = 0; i < 2000; i++)
+    sparse_vector_builder_append(builder, (rand() % 4000) + 500, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, m, &large);
+  
+  for(int gallop = 0; gallop < 2; gallop++) {
+    float *results = gallop ? galloped : merged;
+    sparse_vector_gallop_ratio = gallop ? 1 : (u_int32_t) -1;
+    sparse_vector_dot_product(small, large, &results[0]);
+    sparse_vector_cosine_similarity(large, small, &results[1]);
+    sparse_vector_euclidean_distance(small, large, &results[2]);
+  }
+  sparse_vector_gallop_ratio = SPARSE_VECTOR_GALLOP_RATIO;
+  test(merged[0] != 0.0);
+  for(int i = 0; i < 3; i++)
+    test(fabs(merged[i] - galloped[i]) <= VECTOR_KERNEL_TOLERANCE * 10);
+  
+  // vectors with disjoint index ranges
+  sparse_vector_free(small);
+  sparse_vector_new(&small, m);
+  sparse_vector_set(small, 4600, 3.0);
+  sparse_vector_set(small, 4700, 4.0);
+  error = sparse_vector_dot_product(small, large, &value);
+  test_error(error);
+  test_float(value, 0.0);
+  float large_magnitude;
+  sparse_vector_magnitude(large, &large_magnitude);
+  error = sparse_vector_euclidean_distance(small, large, &value);
+  test_error(error);
+  test(fabs(value - sqrtf(25.0 + (large_magnitude * large_magnitude))) <= VECTOR_KERNEL_TOLERANCE * 10);
+  sparse_vector_free(small);
+  sparse_vector_free(large);
+  
+  // structure of arrays vectors give the same results as pairs, at
+  // every simd level, and setting a new index converts back to pairs
+  int soa;
+  float pairs[3], arrays[3];
+  for(int i = 0; i < 3000; i++)
+    sparse_vector_builder_append(builder, rand() % 6000, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, m, &small);
+  for(int i = 0; i < 2000; i++)
+    sparse_vector_builder_append(builder, rand() % 6000, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, m, &large);
+  sparse_vector_dot_product(small, large, &pairs[0]);
+  sparse_vector_cosine_similarity(small, large, &pairs[1]);
+  sparse_vector_euclidean_distance(small, large, &pairs[2]);
+  
+  error = sparse_vector_to_soa(small);
+  test_error(error);
+  error = sparse_vector_to_soa(large);
+  test_error(error);
+  sparse_vector_soa(small, &soa);
+  test(soa && small->values == NULL);
+  test(((size_t) small->indexes % SPARSE_VECTOR_ALIGNMENT) == 0);
+  
+  int mismatches = 0;
+  for(learner_cpu_level level = CPU_SCALAR; level <= learner_cpu; level++) {
+    vector_kernels_select(level);
+    sparse_vector_dot_product(small, large, &arrays[0]);
+    sparse_vector_cosine_similarity(small, large, &arrays[1]);
+    sparse_vector_euclidean_distance(large, small, &arrays[2]);
+    for(int i = 0; i < 3; i++)
+      mismatches += (fabs(pairs[i] - arrays[i]) > VECTOR_KERNEL_TOLERANCE * 10);
+  }
+  vector_kernels_select(learner_cpu);
+  test(mismatches == 0);
+  
+  value = small->weights[0];
+  test_get_value(small, small->indexes[0], value);
+  test_set_value(small, small->indexes[0], 7.0);
+  test_get_value(small, small->indexes[0], 7.0);
+  sparse_vector_soa(small, &soa);
+  test(soa);
+  test_set_value(small, 6001, 1.0);
+  sparse_vector_soa(small, &soa);
+  test(!soa);
+  test_get_value(small, 6001, 1.0);
+  sparse_vector_free(small);
+  sparse_vector_free(large);
+  
+  // sparse . dense kernels match converting the sparse vector to a
+  // dense one, for both layouts and every simd level
+  Vector *dense, *expanded, *updated;
+  float expected[3];
+  vector_new(5000, &dense);
+  vector_new(5000, &expanded);
+  vector_new(5000, &updated);
+  for(int i = 0; i < 5000; i++)
+    vector_set(dense, i, ((float) rand() / RAND_MAX) - 0.5);
+  for(int i = 0; i < 1001; i++)
+    sparse_vector_builder_append(builder, rand() % 5000, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, m, &small);
+  for(int i = 0; i < small->header.count; i++)
+    vector_set(expanded, small->values[i].index, small->values[i].value);
+  vector_dot_product(expanded, dense, &expected[0]);
+  vector_euclidean_distance(expanded, dense, &expected[1]);
+  
+  mismatches = 0;
+  for(int layout = 0; layout < 2; layout++) {
+    if(layout) sparse_vector_to_soa(small);
+    for(learner_cpu_level level = CPU_SCALAR; level <= learner_cpu; level++) {
+      vector_kernels_select(level);
+      error = sparse_vector_dense_dot_product(small, dense, &value);
+      test_error(error);
+      mismatches += (fabs(value - expected[0]) > VECTOR_KERNEL_TOLERANCE * 10);
+      error = sparse_vector_dense_euclidean_distance(small, dense, &value);
+      test_error(error);
+      mismatches += (fabs(value - expected[1]) > VECTOR_KERNEL_TOLERANCE * 10);
+      
+      memcpy(updated->values, dense->values, 5000 * sizeof(float));
+      error = sparse_vector_dense_axpy(-2.0, small, updated);
+      test_error(error);
+      for(int i = 0; i < 5000; i++)
+        mismatches += (fabs(updated->values[i] - (dense->values[i] - (2 * expanded->values[i]))) > FLT_EPSILON * 4);
+    }
+  }
+  vector_kernels_select(learner_cpu);
+  test(mismatches == 0);
+  
+  Vector *short_dense;
+  vector_new(10, &short_dense);
+  test(sparse_vector_dense_dot_product(small, short_dense, &value) == INDEX_OUT_OF_RANGE);
+  test(sparse_vector_dense_axpy(1.0, small, short_dense) == INDEX_OUT_OF_RANGE);
+  vector_free(short_dense);
+  vector_free(dense);
+  vector_free(expanded);
+  vector_free(updated);
+  sparse_vector_free(small);
+  
+  // encoding round trips, with deltas from one to four bytes and
+  // enough values to span several decode chunks
+  SparseVector *decoded;
+  void *encoded;
+  u_int64_t encoded_size;
+  u_int32_t index = 0;
+  for(int i = 0; i < 700; i++) {
+    index += 1 + (rand() % ((i % 4 == 3) ? 20000000 : (i % 4 == 2) ? 60000 : 200));
+    sparse_vector_builder_append(builder, index, ((float) rand() / RAND_MAX) - 0.5);
+  }
+  sparse_vector_builder_finalize(builder, m, &small);
+  for(int i = 0; i < small->header.count; i += 2)
+    sparse_vector_builder_append(builder, small->values[i].index, ((float) rand() / RAND_MAX) - 0.5);
+  for(int i = 0; i < 300; i++)
+    sparse_vector_builder_append(builder, rand() % index, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, m, &large);
+  
+  mismatches = 0;
+  for(int half = 0; half < 2; half++) {
+    for(learner_cpu_level level = CPU_SCALAR; level <= learner_cpu; level++) {
+      vector_kernels_select(level);
+      error = sparse_vector_encode(small, half ? QUANTIZE_FLOAT16 : QUANTIZE_NONE, &encoded, &encoded_size);
+      test_error(error);
+      error = sparse_vector_decode(encoded, encoded_size, m, &decoded);
+      test_error(error);
+      mismatches += (decoded->header.count != small->header.count);
+      mismatches += (decoded->header.max_index != small->header.max_index);
+      for(int i = 0; i < small->header.count && i < decoded->header.count; i++) {
+        mismatches += (decoded->indexes[i] != small->values[i].index);
+        mismatches += (fabs(decoded->weights[i] - small->values[i].value) > (half ? 1e-3 : 0));
+      }
+      
+      // dot products straight from the encoding match the decoded vector
+      sparse_vector_dot_product(decoded, large, &expected[0]);
+      error = sparse_vector_encoded_dot_product(encoded, encoded_size, large, &value);
+      test_error(error);
+      mismatches += (fabs(value - expected[0]) > VECTOR_KERNEL_TOLERANCE * 10);
+      
+      // the truncated buffer is rejected rather than read past
+      mismatches += (sparse_vector_decode(encoded, encoded_size - 1, m, &decoded) != INVALID_ENCODING);
+      sparse_vector_free(decoded);
+      free(encoded);
+    }
+  }
+  vector_kernels_select(learner_cpu);
+  test(mismatches == 0);
+  sparse_vector_free(large);
+  
+  // encoded . dense, with indexes inside the dense vector
+  vector_new(5000, &dense);
+  for(int i = 0; i < 5000; i++)
+    vector_set(dense, i, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_free(small);
+  for(int i = 0; i < 600; i++)
+    sparse_vector_builder_append(builder, rand() % 5000, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, m, &small);
+  sparse_vector_dense_dot_product(small, dense, &expected[0]);
+  sparse_vector_encode(small, QUANTIZE_NONE, &encoded, &encoded_size);
+  mismatches = 0;
+  for(learner_cpu_level level = CPU_SCALAR; level <= learner_cpu; level++) {
+    vector_kernels_select(level);
+    error = sparse_vector_encoded_dense_dot_product(encoded, encoded_size, dense, &value);
+    test_error(error);
+    mismatches += (fabs(value - expected[0]) > VECTOR_KERNEL_TOLERANCE * 10);
+  }
+  vector_kernels_select(learner_cpu);
+  test(mismatches == 0);
+  
+  // a corrupted control byte no longer adds up to the data section
+  ((u_int8_t *) encoded)[sizeof(sparse_vector_encoding_header)] ^= 0xFF;
+  test(sparse_vector_decode(encoded, encoded_size, m, &decoded) == INVALID_ENCODING);
+  free(encoded);
+  vector_free(dense);
+  sparse_vector_free(small);
+  
+  // rows are carved from the matrix's arena, so many short rows take
+  // a handful of slabs. replacing most rows with smaller ones leaves
+  // the slabs sparsely used until the matrix is compacted.
+  Matrix *rows;
+  SparseVector *row;
+  matrix_arena_usage before, after;
+  double *sums = (double *) malloc(20000 * sizeof(double));
+  matrix_new(&rows);
+  for(u_int64_t r = 0; r < 20000; r++) {
+    sparse_vector_new(&row, rows);
+    for(int i = 0; i < 30; i++)
+      sparse_vector_set(row, (i * 31) + (rand() % 31), ((float) rand() / RAND_MAX) - 0.5);
+    if(r % 3 == 1) sparse_vector_to_soa(row);
+    if(r % 3 == 2) sparse_vector_quantize(row, QUANTIZE_INT8, NULL);
+    matrix_set_row(rows, r, row);
+  }
+  sparse_vector_new(&row, m);
+  test(matrix_set_row(rows, 0, row) == VECTOR_NOT_IN_MATRIX);
+  sparse_vector_free(row);
+  
+  error = matrix_memory(rows, &before);
+  test_error(error);
+  test(before.slabs < 20);
+  test(before.reserved >= before.allocated && before.allocated >= before.requested);
+  
+  for(u_int64_t r = 0; r < 20000; r++) {
+    if(r % 4) {
+      sparse_vector_builder_append(builder, r, 1.0);
+      sparse_vector_builder_finalize(builder, rows, &row);
+      matrix_set_row(rows, r, row);
+    }
+    matrix_get_row(rows, r, &row);
+    sums[r] = 0.0;
+    for(int i = 0; i < row->header.count; i++)
+      sums[r] += sparse_vector_index_at(row, i) * sparse_vector_value_at(row, i);
+  }
+  
+  matrix_memory(rows, &before);
+  error = matrix_compact(rows);
+  test_error(error);
+  matrix_memory(rows, &after);
+  test(after.requested < before.requested);
+  test(after.reserved < before.reserved);
+  
+  mismatches = 0;
+  for(u_int64_t r = 0; r < 20000; r++) {
+    matrix_get_row(rows, r, &row);
+    mismatches += (row->header.buffer_remaining != 0);
+    if(row->weights)
+      mismatches += (((uintptr_t) row->indexes % SPARSE_VECTOR_ALIGNMENT) != 0) + (((uintptr_t) row->weights % SPARSE_VECTOR_ALIGNMENT) != 0);
+    double sum = 0.0;
+    for(int i = 0; i < row->header.count; i++)
+      sum += sparse_vector_index_at(row, i) * sparse_vector_value_at(row, i);
+    mismatches += (sum != sums[r]);
+  }
+  test(mismatches == 0);
+  free(sums);
+  
+  // rows are freed with the matrix, not one at a time
+  error = matrix_free(rows);
+  test_error(error);
+  
+  // arithmetic, with y in either layout and x in any representation.
+  // x is either a subset of y (updated in place) or not (merged).
+  Vector *dense_y, *dense_x;
+  SparseVector *x, *y;
+  float *original;
+  vector_new(2000, &dense_y);
+  vector_new(2000, &dense_x);
+  mismatches = 0;
+  for(int layout = 0; layout < 2; layout++) {
+    for(int form = 0; form < 3; form++) {
+      for(int subset = 0; subset < 2; subset++) {
+        for(int i = 0; i < 300; i++)
+          sparse_vector_builder_append(builder, rand() % 2000, ((float) rand() / RAND_MAX) - 0.5);
+        sparse_vector_builder_finalize(builder, m, &y);
+        for(int i = 0; i < (subset ? y->header.count : 200); i += (subset ? 3 : 1))
+          sparse_vector_builder_append(builder, subset ? y->values[i].index : rand() % 2000, ((float) rand() / RAND_MAX) - 0.5);
+        sparse_vector_builder_finalize(builder, m, &x);
+        if(layout) sparse_vector_to_soa(y);
+        if(form == 1) sparse_vector_to_soa(x);
+        if(form == 2) sparse_vector_quantize(x, QUANTIZE_FLOAT16, NULL);
+        sparse_vector_freeze(y);
+        expand(y, dense_y);
+        sparse_vector_dense_axpy(-0.5, x, dense_y);
+        original = y->weights ? y->weights : &y->values[0].value;
+        
+        error = sparse_vector_axpy(-0.5, x, y);
+        test_error(error);
+        mismatches += (subset != ((y->weights ? y->weights : &y->values[0].value) == original));
+        mismatches += (layout != (y->weights != NULL));
+        expand(y, dense_x);
+        for(int i = 0; i < 2000; i++)
+          mismatches += (fabs(dense_x->values[i] - dense_y->values[i]) > FLT_EPSILON * 4);
+        for(int i = 1; i < y->header.count; i++)
+          mismatches += (sparse_vector_index_at(y, i) <= sparse_vector_index_at(y, i - 1));
+        
+        // the cached magnitude matches the merged values
+        float cached = y->header.magnitude, recomputed;
+        mismatches += (y->header.frozen != SPARSE_VECTOR_FROZEN);
+        sparse_vector_unfreeze(y);
+        sparse_vector_magnitude(y, &recomputed);
+        mismatches += (fabs(cached - recomputed) > VECTOR_KERNEL_TOLERANCE * recomputed);
+        sparse_vector_free(x);
+        sparse_vector_free(y);
+      }
+    }
+  }
+  test(mismatches == 0);
+  test(sparse_vector_axpy(1.0, v1, NULL) == MISSING_VECTOR);
+  
+  // scaling keeps the freeze state
+  for(int i = 0; i < 50; i++)
+    sparse_vector_builder_append(builder, rand() % 2000, ((float) rand() / RAND_MAX) - 0.5);
+  sparse_vector_builder_finalize(builder, m, &y);
+  sparse_vector_freeze_normalized(y);
+  error = sparse_vector_scale(y, -1.0);
+  test_error(error);
+  test(y->header.frozen == SPARSE_VECTOR_NORMALIZED);
+  sparse_vector_scale(y, 3.0);
+  test(y->header.frozen == SPARSE_VECTOR_FROZEN);
+  test(fabs(y->header.magnitude - 3.0) < FLT_EPSILON * 4);
+  error = sparse_vector_add(y, y);
+  test_error(error);
+  test(fabs(y->header.magnitude - 6.0) < FLT_EPSILON * 8);
+  sparse_vector_free(y);
+  
+  // sums of many vectors, through the dense scratch array (a narrow
+  // range of indexes) and the heap (a wide one)
+  SparseVector *parts[40], *sum;
+  for(int wide = 0; wide < 2; wide++) {
+    Vector *expected_sum;
+    u_int32_t range = wide ? 1000000 : 2000;
+    vector_new(range, &expected_sum);
+    for(int p = 0; p < 40; p++) {
+      for(int i = 0; i < 50; i++)
+        sparse_vector_builder_append(builder, rand() % range, ((float) rand() / RAND_MAX) - 0.5);
+      sparse_vector_builder_finalize(builder, m, &parts[p]);
+      if(p % 2) sparse_vector_to_soa(parts[p]);
+      sparse_vector_dense_axpy(1.0, parts[p], expected_sum);
+    }
+    error = sparse_vector_sum(parts, 40, m, &sum);
+    test_error(error);
+    
+    mismatches = 0;
+    for(int i = 0; i < sum->header.count; i++)
+      mismatches += (fabs(sum->values[i].value - expected_sum->values[sum->values[i].index]) > FLT_EPSILON * 16);
+    for(int i = 1; i < sum->header.count; i++)
+      mismatches += (sum->values[i].index <= sum->values[i - 1].index);
+    test(mismatches == 0);
+    
+    sparse_vector_free(sum);
+    for(int p = 0; p < 40; p++)
+      sparse_vector_free(parts[p]);
+    vector_free(expected_sum);
+  }
+  error = sparse_vector_sum(parts, 0, m, &sum);
+  test(error == NO_ERROR && sum->header.count == 0);
+  sparse_vector_free(sum);
+  vector_free(dense_x);
+  vector_free(dense_y);
+  
+  error = sparse_vector_builder_free(builder);
+  test_error(error);
+  
   // cleanup
   error = sparse_vector_free(v1);
   test_error(error);
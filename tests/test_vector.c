@@ -71,11 +71,198 @@ int test_vector() {
   test_error(error);
   test_float(value, ((3.0 + 8.0) / (sqrtf(5.0) * sqrtf(25.0))));
   
+  // single pass (unfrozen) cosine similarity and distance
+  error = vector_unfreeze(v1);
+  test_error(error);
+  error = vector_unfreeze(v2);
+  test_error(error);
+  error = vector_cosine_similarity(v1, v2, &value);
+  test_error(error);
+  test_float(value, ((3.0 + 8.0) / (sqrtf(5.0) * sqrtf(25.0))));
+  error = vector_euclidean_distance(v1, v2, &value);
+  test_error(error);
+  test_float(value, sqrtf(4.0 + 4.0));
+  
+  // normalized vectors
+  int normalized;
+  error = vector_freeze_normalized(v1);
+  test_error(error);
+  error = vector_freeze_normalized(v2);
+  test_error(error);
+  error = vector_normalized(v1, &normalized);
+  test_error(error);
+  test(normalized);
+  error = vector_magnitude(v1, &value);
+  test_error(error);
+  test_float(value, 1.0);
+  error = vector_cosine_similarity(v1, v2, &value);
+  test_error(error);
+  test_float(value, ((3.0 + 8.0) / (sqrtf(5.0) * sqrtf(25.0))));
+  error = vector_unfreeze(v1);
+  test_error(error);
+  error = vector_unfreeze(v2);
+  test_error(error);
+  
   // cleanup
   error = vector_free(v1);
   test_error(error);
   error = vector_free(v2);
   test_error(error);
   
+  // simd kernels should agree with the scalar kernels to within
+  // the documented tolerance. an odd length exercises the tails.
+  int length = 4099;
+  float *a = (float *) malloc(sizeof(float) * length);
+  float *b = (float *) malloc(sizeof(float) * length);
+  float abs_dot = 0.0, squares_a = 0.0, squares_d = 0.0;
+  srand(1);
+  for(int i = 0; i < length; i++) {
+    a[i] = ((float) rand() / RAND_MAX) - 0.5;
+    b[i] = ((float) rand() / RAND_MAX) - 0.5;
+    abs_dot   += fabs(a[i] * b[i]);
+    squares_a += a[i] * a[i];
+    squares_d += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  
+  error = vector_kernels_select(CPU_SCALAR);
+  test_error(error);
+  float dot = vector_kernels.dot_product(a, b, length);
+  float sum = vector_kernels.sum_of_squares(a, length);
+  float distance = vector_kernels.squared_distance(a, b, length);
+  float fused_dot, fused_a, fused_b;
+  
+  // quantized kernels: int8 sums must be exact
+  int8_t bytes_a[4099], bytes_b[4099];
+  u_int16_t halfs_a[4099], halfs_b[4099];
+  for(int i = 0; i < length; i++) {
+    bytes_a[i] = (int8_t) (a[i] * 254);
+    bytes_b[i] = (int8_t) (b[i] * 254);
+    halfs_a[i] = float_to_half(a[i]);
+    halfs_b[i] = float_to_half(b[i]);
+  }
+  int32_t int8_dot = vector_kernels.dot_product_int8(bytes_a, bytes_b, length);
+  float half_dot = vector_kernels.dot_product_float16(halfs_a, halfs_b, length);
+  
+  for(learner_cpu_level level = CPU_SSE2; level <= learner_cpu; level++) {
+    error = vector_kernels_select(level);
+    test_error(error);
+    test(fabs(vector_kernels.dot_product(a, b, length) - dot) <= VECTOR_KERNEL_TOLERANCE * abs_dot);
+    test(fabs(vector_kernels.sum_of_squares(a, length) - sum) <= VECTOR_KERNEL_TOLERANCE * squares_a);
+    test(fabs(vector_kernels.squared_distance(a, b, length) - distance) <= VECTOR_KERNEL_TOLERANCE * squares_d);
+    vector_kernels.dot_and_squares(a, b, length, &fused_dot, &fused_a, &fused_b);
+    test(fabs(fused_dot - dot) <= VECTOR_KERNEL_TOLERANCE * abs_dot);
+    test(fabs(fused_a - sum) <= VECTOR_KERNEL_TOLERANCE * squares_a);
+    test(vector_kernels.dot_product_int8(bytes_a, bytes_b, length) == int8_dot);
+    test(fabs(vector_kernels.dot_product_float16(halfs_a, halfs_b, length) - half_dot) <= VECTOR_KERNEL_TOLERANCE * abs_dot);
+  }
+  
+  error = vector_kernels_select(learner_cpu);
+  test_error(error);
+  free(a);
+  free(b);
+  
+  // batch scoring against a block should match scoring each row
+  // individually. 7 rows covers a blocked group and a remainder.
+  int rows = 7;
+  float *block, scores[7], expected;
+  error = vector_new(37, &v1);
+  test_error(error);
+  error = vector_new(37, &v2);
+  test_error(error);
+  error = vector_block_new(37, rows, &block);
+  test_error(error);
+  test(((size_t) block % VECTOR_BLOCK_ALIGNMENT) == 0);
+  
+  for(int i = 0; i < 37; i++)
+    v1->values[i] = ((float) rand() / RAND_MAX) - 0.5;
+  for(int row = 0; row < rows; row++) {
+    for(int i = 0; i < 37; i++)
+      v2->values[i] = ((float) rand() / RAND_MAX) - 0.5;
+    error = vector_block_set(block, row, v2);
+    test_error(error);
+  }
+  
+  for(learner_metric metric = DOT_PRODUCT; metric <= EUCLIDEAN_DISTANCE; metric++) {
+    error = vector_similarity_batch(v1, block, rows, metric, scores);
+    test_error(error);
+    int matches = 0;
+    for(int row = 0; row < rows; row++) {
+      memcpy(v2->values, vector_block_row(block, 37, row), 37 * sizeof(float));
+      if(metric == DOT_PRODUCT)
+        error = vector_dot_product(v1, v2, &expected);
+      else if(metric == COSINE_SIMILARITY)
+        error = vector_cosine_similarity(v1, v2, &expected);
+      else
+        error = vector_euclidean_distance(v1, v2, &expected);
+      test_error(error);
+      matches += (fabs(scores[row] - expected) <= VECTOR_KERNEL_TOLERANCE * 37);
+    }
+    test(matches == rows);
+  }
+  
+  error = vector_block_free(block);
+  test_error(error);
+  error = vector_free(v1);
+  test_error(error);
+  error = vector_free(v2);
+  test_error(error);
+  
+  // quantized vectors should stay within their reported error of
+  // the float results, and be read only until dequantized
+  quantization_error quantization_error;
+  float float_dot, float_cosine, float_distance, quantized_dot;
+  error = vector_new(1000, &v1);
+  test_error(error);
+  error = vector_new(1000, &v2);
+  test_error(error);
+  for(int i = 0; i < 1000; i++) {
+    v1->values[i] = ((float) rand() / RAND_MAX) - 0.5;
+    v2->values[i] = ((float) rand() / RAND_MAX) - 0.5;
+  }
+  vector_dot_product(v1, v2, &float_dot);
+  vector_cosine_similarity(v1, v2, &float_cosine);
+  vector_euclidean_distance(v1, v2, &float_distance);
+  
+  for(quantization_type type = QUANTIZE_FLOAT16; type <= QUANTIZE_INT8; type++) {
+    Vector *q1, *q2;
+    vector_new(1000, &q1);
+    vector_new(1000, &q2);
+    memcpy(q1->values, v1->values, 1000 * sizeof(float));
+    memcpy(q2->values, v2->values, 1000 * sizeof(float));
+    
+    error = vector_quantize(q1, type, &quantization_error);
+    test_error(error);
+    test(quantization_error.max_error <= ((type == QUANTIZE_INT8) ? (1.0 / 254) : 0.001));
+    test(quantization_error.rms_error <= quantization_error.max_error);
+    error = vector_quantize(q2, type, NULL);
+    test_error(error);
+    test(vector_set(q1, 0, 1.0) == QUANTIZED_VECTOR);
+    
+    // quantized . quantized, quantized . float
+    error = vector_dot_product(q1, q2, &quantized_dot);
+    test_error(error);
+    test(fabs(quantized_dot - float_dot) <= 1000 * quantization_error.max_error);
+    error = vector_dot_product(q1, v2, &value);
+    test_error(error);
+    test(fabs(value - float_dot) <= 1000 * quantization_error.max_error);
+    error = vector_cosine_similarity(q1, q2, &value);
+    test_error(error);
+    test(fabs(value - float_cosine) <= 0.01);
+    error = vector_euclidean_distance(q1, q2, &value);
+    test_error(error);
+    test(fabs(value - float_distance) <= 0.01 * float_distance);
+    
+    error = vector_dequantize(q1);
+    test_error(error);
+    vector_get(q1, 10, &value);
+    test(fabs(value - v1->values[10]) <= quantization_error.max_error);
+    test_error(vector_set(q1, 0, 1.0));
+    vector_free(q1);
+    vector_free(q2);
+  }
+  
+  vector_free(v1);
+  vector_free(v2);
+  
   finished_tests();
 }
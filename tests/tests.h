@@ -6,12 +6,42 @@
 #include <stdio.h>
 #include <float.h>
 #include <math.h>
+#include <string.h>
 #include "learner.h"
 
 
 int test_vector();
 int test_sparse_vector();
 int test_paged_file();
+int test_dense_matrix();
+int test_knn();
+int test_column_index();
+int test_lsh();
+int test_hnsw();
+int test_matrix_csr();
+int test_sparse_matrix();
+int test_similarity();
+int test_matrix_file();
+int test_dictionary();
+int test_kmeans();
+int test_sgd();
+int test_als();
+
+// fixtures shared by the suites (test_rows.c), drawing from rand(), so
+// callers seed with srand. random rows have count random columns
+// (fewer if any repeat) below columns, valued in [low, low + 1).
+// random_rows sets rows of up to values values (valued in [-0.5, 0.5))
+// in every form: every 7th is left unset, every 11th is empty, and the
+// rest are pairs or structure of arrays, some frozen and some
+// quantized. same_rows compares every row's values and magnitude.
+// clustered rows take about half the columns of one of clusters
+// centres (each width columns below columns, from random_centres),
+// valued in [0.5, 1.5), plus 10 noise columns valued in [0, 1).
+SparseVector *random_row(Matrix *matrix, sparse_vector_builder *builder, u_int32_t count, u_int32_t columns, float low);
+void random_rows(Matrix *matrix, sparse_vector_builder *builder, u_int64_t rows, u_int32_t columns, u_int32_t values);
+int same_rows(Matrix *matrix, Matrix *expected);
+void random_centres(u_int32_t *centres, u_int32_t clusters, u_int32_t width, u_int32_t columns);
+SparseVector *clustered_row(Matrix *matrix, sparse_vector_builder *builder, u_int32_t *centres, u_int32_t clusters, u_int32_t width, u_int32_t columns);
 
 #define print_separator()       printf("\n=================================================\n");
 #define test(expr)              if(expr){printf("+\t%s\n", #expr); passed++;} else {printf("-\t%s\n\t(%s:%u)\n", #expr, __FILE__, __LINE__); failed++;}